@@ -0,0 +1,99 @@
+// NOTE(DH): What the allocation tracking shows for a frame loop that warms up and then should stop touching the
+// heap: containers are created once, grown in the first frames, cleared and refilled after that. Frame 40 adds a
+// list that is created and freed every frame, the kind of thing the per frame counter is there to catch.
+// A list on the frame arena goes through a tracking_allocator with its own tracker.
+// Prints the per frame numbers, the reports, and the cost of an untracked vs tracked malloc/free.
+//
+// clang++ ./junk/alloc_benchmarks/alloc_tracking.cpp -o ./bin/alloc_tracking -std=c++20 -O2 -I . -D ALLOC_TRACKING
+// ./bin/alloc_tracking [frames]
+
+#include "src/util/list.h"
+#include "src/util/buffer.h"
+#include "src/util/slab_array.h"
+#include "src/util/free_list_alloc.h"
+
+#include <chrono>
+#include <cstdio>
+
+void* allocate_memory(void*, size_t size) { return malloc(size);}
+
+struct quad { f32 x, y, w, h; u32 colour; };
+
+static alloc_tracker arena_tracker;
+
+int main(int argc, char** argv) {
+    u32 frames = argc > 1 ? atoi(argv[1]) : 60;
+
+#ifndef ALLOC_TRACKING
+    printf("built without ALLOC_TRACKING, nothing gets recorded\n");
+#endif
+
+    memory_arena arena = initialize_arena(Megabytes(4));
+    var quads = list<quad>::create(default_allocator, 0);
+    var cmds = buffer_create(default_allocator, 64);
+    var nodes = slab_array<quad>::create(4);
+    var components = free_list_buffer::create(256);
+    // NOTE(DH): The per frame arena traffic of one list, on its own tracker
+    var arena_alc = tracking_allocator::create(arena_allocator(&arena), &arena_tracker);
+
+    for (u32 frame = 0; frame < frames; ++frame) {
+        u32 count = frame < 10 ? 64 << (frame / 2) : 1024;
+
+        quads.size = 0;
+        cmds.size = 0;
+        temporary_memory_scope temp(&arena);
+        for (u32 i = 0; i < count; ++i) {
+            quads.push(quad {.x = (f32)i, .y = 0, .w = 0, .h = 0, .colour = frame});
+            cmds = buffer_write(cmds, i);
+        }
+        [[maybe_unused]] var scratch = arena.alloc_array<f32>(count);
+        var visible = list<u32>::create(arena_alc.as_allocator(), 8);
+        for (u32 i = 0; i < count / 4; ++i) visible.push(i);
+
+        // NOTE(DH): Nodes come and go but the live count stays flat after the warm up
+        if (nodes.count < 256) nodes.push(quad {});
+        else nodes.remove(nodes.handle_of(nodes.z_bottom)), nodes.push(quad {});
+
+        let c = components.alloc_s(96);
+        components.free(c);
+
+        if (frame >= 40) {
+            var per_frame = list<u32>::create(default_allocator, 16);
+            per_frame.push(frame);
+            per_frame.deinit();
+        }
+
+#ifdef ALLOC_TRACKING
+        global_alloc_tracker.next_frame();
+        alloc_totals t = global_alloc_tracker.get_totals();
+        if (frame < 12 || frame % 10 == 0 || frame == 40) {
+            printf("frame %3u: %4llu heap allocs, %8llu bytes, %3llu clean frames\n", frame,
+                (unsigned long long)t.last_frame_allocs, (unsigned long long)t.last_frame_bytes, (unsigned long long)t.clean_frames);
+        }
+#endif
+    }
+
+    printf("\n");
+#ifdef ALLOC_TRACKING
+    global_alloc_tracker.report(stdout, 12);
+#endif
+    printf("\narena list through tracking_allocator:\n");
+    arena_tracker.report(stdout, 4);
+
+    quads.deinit();
+    default_allocator.free(cmds.data);
+    nodes.dealloc();
+    components.destroy();
+
+    u32 n = 1000000;
+    void* volatile keep[64];
+    auto t0 = std::chrono::high_resolution_clock::now();
+    for (u32 i = 0; i < n; ++i) { keep[i & 63] = malloc(64 + (i & 255)); free(keep[i & 63]); }
+    auto t1 = std::chrono::high_resolution_clock::now();
+    for (u32 i = 0; i < n; ++i) { keep[i & 63] = tracked_malloc(64 + (i & 255)); tracked_free(keep[i & 63]); }
+    auto t2 = std::chrono::high_resolution_clock::now();
+    printf("\nmalloc+free %.1f ns, tracked %.1f ns\n", std::chrono::duration<f64, std::nano>(t1 - t0).count() / n,
+        std::chrono::duration<f64, std::nano>(t2 - t1).count() / n);
+    free(arena.base);
+    return 0;
+}
@@ -0,0 +1,69 @@
+// NOTE(DH): Same per frame container traffic (a few lists grown from empty, a command buffer, freed at frame end)
+// on malloc, on an arena that is rolled back every frame and on a block pool. Also reports how much of the arena
+// a frame used at its peak: the list growing at the top of the arena is extended in place, the interleaved ones
+// leave their old blocks behind until the frame ends.
+//
+// clang++ ./junk/alloc_benchmarks/allocators.cpp -o ./bin/allocators -std=c++20 -O2 -I .
+// ./bin/allocators [frames] [items per list]
+
+#include "src/util/list.h"
+#include "src/util/buffer.h"
+
+#include <chrono>
+#include <cstdio>
+
+void* allocate_memory(void* base, size_t size) { return malloc(size);}
+
+struct vertex { f32 x, y; u32 colour; };
+
+static usize arena_peak = 0;
+
+static func frame(allocator alc, u32 items, memory_arena* arena) -> u64 {
+    // NOTE(DH): One list grows alone at the top, the other two interleave with it
+    var quads = list<vertex>::create(alc, 0);
+    for (u32 i = 0; i < items; ++i) quads.push(vertex {.x = (f32)i, .y = (f32)i, .colour = i});
+
+    var indices = list<u32>::create(alc, 16);
+    var ids = list<u64>::create(alc, 16);
+    for (u32 i = 0; i < items; ++i) { indices.push(i); ids.push(i * 31); }
+
+    var cmds = buffer_create(alc, 64);
+    for (u32 i = 0; i < items; ++i) cmds = buffer_write(cmds, i);
+
+    if (arena) arena_peak = std::max(arena_peak, arena->used);
+    u64 checksum = quads.items[items - 1].colour + indices.items[items / 2] + ids.items[items - 1] + cmds.size;
+    alc.free(cmds.data);
+    ids.deinit();
+    indices.deinit();
+    quads.deinit();
+    return checksum;
+}
+
+int main(int argc, char** argv) {
+    u32 frames = argc > 1 ? atoi(argv[1]) : 2000;
+    u32 items  = argc > 2 ? atoi(argv[2]) : 2048;
+
+    u64 checksum = 0;
+    let time = [&](const char* name, allocator alc, memory_arena* arena, auto frame_end) {
+        auto t0 = std::chrono::high_resolution_clock::now();
+        for (u32 f = 0; f < frames; ++f) { checksum += frame(alc, items, arena); frame_end(); }
+        auto t1 = std::chrono::high_resolution_clock::now();
+        printf("%-10s %8.3f us/frame\n", name, std::chrono::duration<f64, std::micro>(t1 - t0).count() / frames);
+    };
+
+    time("malloc", default_allocator, nullptr, [](){});
+
+    memory_arena arena = initialize_arena(Megabytes(16));
+    time("arena", arena_allocator(&arena), &arena, [&](){ arena.used = 0; });
+    printf("arena peak %llu bytes for %llu bytes of final data\n", (unsigned long long)arena_peak,
+        (unsigned long long)(items * (sizeof(vertex) + sizeof(u32) + sizeof(u64) + sizeof(u32))));
+
+    // NOTE(DH): Pool blocks have to hold the largest list, so it trades memory for never moving anything
+    block_pool pool = block_pool::create(default_allocator, items * sizeof(u64) * 2, 8);
+    time("pool", pool.as_allocator(), nullptr, [&](){ if (pool.used != 0) panic("pool leaked a block"); });
+
+    printf("checksum %llu\n", (unsigned long long)checksum);
+    pool.destroy();
+    free(arena.base);
+    return 0;
+}
@@ -0,0 +1,177 @@
+// NOTE(DH): The churn ui_back_state::replace produces: a live set of components, each replace frees one and
+// writes its successor, mostly the same size, sometimes a different one (a block that gained or lost children).
+// Runs the TLSF free_list_buffer against the first fit free list it replaced (kept here with its free_s fixed,
+// the original could delete a live node and never left some of its branches) and against malloc/free.
+// Every live block carries a stamp that is checked at the end, so a broken split or merge shows up.
+//
+// clang++ ./junk/alloc_benchmarks/free_list_churn.cpp -o ./bin/free_list_churn -std=c++20 -O2 -I .
+// ./bin/free_list_churn [live components] [replaces]
+
+#include "src/util/free_list_alloc.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+// NOTE(DH): The previous free_list_buffer, first fit over a sorted list of heap allocated nodes
+struct first_fit_buffer {
+    struct node { u32 start; u32 end; node* next; };
+
+    u32 capacity;
+    u8* data;
+    node* free_list;
+
+    static inline func create(u32 capacity) -> first_fit_buffer {
+        return {.capacity = capacity, .data = (u8*)malloc(capacity), .free_list = new node {.start = 0, .end = capacity, .next = nullptr}};
+    }
+
+    inline func alloc_s(u32 size) -> u32 {
+        let block_size_needed = size + 8;
+        for (node* fl = this->free_list, *fl_prev = nullptr;; fl_prev = fl, fl = fl->next) {
+            if (fl->end - fl->start >= block_size_needed || fl->next == nullptr) {
+                while (fl->end - fl->start < block_size_needed) {
+                    fl->end += this->capacity;
+                    this->capacity *= 2;
+                    this->data = (u8*)realloc(this->data, this->capacity);
+                }
+                let offset = fl->start;
+                fl->start += block_size_needed;
+                if (fl->start == fl->end && fl->next != nullptr) {
+                    if (fl_prev) fl_prev->next = fl->next; else this->free_list = fl->next;
+                    delete fl;
+                }
+                *(u32*)(this->data + offset) = size;
+                return offset;
+            }
+        }
+    }
+
+    inline func free(u32 start) -> void {
+        let end = start + *(u32*)(this->data + start) + 8;
+        node* fl_prev = nullptr;
+        node* fl = this->free_list;
+        while (fl != nullptr && fl->end < start) { fl_prev = fl; fl = fl->next; }
+
+        if (fl_prev == nullptr && fl != nullptr && end < fl->start) {
+            this->free_list = new node {.start = start, .end = end, .next = fl};
+        } else if (fl != nullptr && fl->end == start) {
+            fl->end = end;
+            if (fl->next != nullptr && fl->next->start == end) { node* merged = fl->next; fl->end = merged->end; fl->next = merged->next; delete merged; }
+        } else if (fl != nullptr && fl->start == end) {
+            fl->start = start;
+        } else {
+            node* n = new node {.start = start, .end = end, .next = fl};
+            if (fl_prev) fl_prev->next = n; else this->free_list = n;
+        }
+    }
+};
+
+static u64 random_state = 0x9E3779B97F4A7C15ull;
+static func random_u32() -> u32 {
+    random_state ^= random_state << 13; random_state ^= random_state >> 7; random_state ^= random_state << 17;
+    return (u32)random_state;
+}
+
+// NOTE(DH): Mostly component sized, a tail of bigger child arrays
+static func component_size() -> u32 {
+    u32 r = random_u32() % 100;
+    if (r < 70) return 96 + (random_u32() % 4) * 8;
+    if (r < 95) return 16 + random_u32() % 240;
+    return 256 + random_u32() % 3840;
+}
+
+struct churn_result {
+    f64 ns_per_replace;
+    f64 worst_ns;
+    u64 capacity;
+    bool stamps_ok;
+};
+
+template<typename alloc_fn, typename free_fn, typename ptr_fn>
+static func churn(u32 live, u32 replaces, alloc_fn alloc, free_fn release, ptr_fn ptr_of, auto capacity) -> churn_result {
+    random_state = 0x9E3779B97F4A7C15ull;
+    u32* offsets = (u32*)malloc(sizeof(u32) * live);
+    u32* sizes = (u32*)malloc(sizeof(u32) * live);
+    u32* stamps = (u32*)malloc(sizeof(u32) * live);
+
+    let stamp = [&](u32 i) {
+        u8* p = ptr_of(offsets[i]);
+        stamps[i] = random_u32();
+        memcpy(p, &stamps[i], 4);
+        memcpy(p + sizes[i] - 4, &stamps[i], 4);
+    };
+
+    for (u32 i = 0; i < live; ++i) { sizes[i] = component_size(); offsets[i] = alloc(sizes[i]); stamp(i); }
+
+    churn_result result = {};
+    auto start = std::chrono::high_resolution_clock::now();
+    for (u32 r = 0; r < replaces; ++r) {
+        u32 i = random_u32() % live;
+        auto t0 = std::chrono::high_resolution_clock::now();
+        release(offsets[i]);
+        sizes[i] = random_u32() % 4 == 0 ? component_size() : sizes[i];
+        offsets[i] = alloc(sizes[i]);
+        auto t1 = std::chrono::high_resolution_clock::now();
+        result.worst_ns = std::max(result.worst_ns, std::chrono::duration<f64, std::nano>(t1 - t0).count());
+        stamp(i);
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    result.ns_per_replace = std::chrono::duration<f64, std::nano>(end - start).count() / replaces;
+    result.capacity = capacity();
+
+    result.stamps_ok = true;
+    for (u32 i = 0; i < live; ++i) {
+        u8* p = ptr_of(offsets[i]);
+        result.stamps_ok = result.stamps_ok && memcmp(p, &stamps[i], 4) == 0 && memcmp(p + sizes[i] - 4, &stamps[i], 4) == 0;
+    }
+
+    free(offsets); free(sizes); free(stamps);
+    return result;
+}
+
+static func print(const char* name, churn_result r) -> void {
+    printf("%-12s %12.1f %12.0f %14llu %8s\n", name, r.ns_per_replace, r.worst_ns, (unsigned long long)r.capacity, r.stamps_ok ? "ok" : "BROKEN");
+}
+
+int main(int argc, char** argv) {
+    u32 live     = argc > 1 ? atoi(argv[1]) : 4096;
+    u32 replaces = argc > 2 ? atoi(argv[2]) : 1000000;
+
+    printf("%u live components, %u replaces\n", live, replaces);
+    printf("%-12s %12s %12s %14s %8s\n", "allocator", "ns/replace", "worst ns", "capacity", "stamps");
+
+    {
+        var buf = free_list_buffer::create(1000);
+        print("tlsf", churn(live, replaces,
+            [&](u32 size) { return buf.alloc_s(size).offset; },
+            [&](u32 offset) { buf.free(free_list_buffer::fl_ptr {.offset = offset}); },
+            [&](u32 offset) { return buf.get_ptr<u8>(free_list_buffer::fl_ptr {.offset = offset}); },
+            [&]() { return (u64)buf.capacity; }));
+        printf("%-12s %u bytes used, largest free block %u\n", "", buf.size, buf.largest_free_block());
+        buf.destroy();
+    }
+
+    {
+        var buf = first_fit_buffer::create(1000);
+        print("first fit", churn(live, replaces,
+            [&](u32 size) { return buf.alloc_s(size); },
+            [&](u32 offset) { buf.free(offset); },
+            [&](u32 offset) { return buf.data + offset + 8; },
+            [&]() { return (u64)buf.capacity; }));
+    }
+
+    {
+        // NOTE(DH): Offsets into a table of pointers, so the harness stays the same
+        u8** table = (u8**)calloc(live * 2 + 1, sizeof(u8*));
+        u32* free_slots = (u32*)malloc(sizeof(u32) * (live * 2 + 1));
+        u32 free_count = 0;
+        for (u32 i = live * 2 + 1; i-- > 1;) free_slots[free_count++] = i;
+        print("malloc", churn(live, replaces,
+            [&](u32 size) { u32 slot = free_slots[--free_count]; table[slot] = (u8*)malloc(size); return slot; },
+            [&](u32 slot) { free(table[slot]); free_slots[free_count++] = slot; },
+            [&](u32 slot) { return table[slot]; },
+            [&]() { return (u64)0; }));
+        free(table); free(free_slots);
+    }
+    return 0;
+}
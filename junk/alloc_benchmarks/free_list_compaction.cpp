@@ -0,0 +1,121 @@
+// NOTE(DH): A long UI session on free_list_buffer: the component set grows with replace churn, then most of it
+// goes away (a closed panel) while churn goes on. Every "frame" runs compact() with a time budget. Prints capacity,
+// usage and fragmentation over time next to a run without compaction, and checks every live element through its
+// handle at the end (stamps at both ends of the data), so a block that moved wrong shows up.
+//
+// clang++ ./junk/alloc_benchmarks/free_list_compaction.cpp -o ./bin/free_list_compaction -std=c++20 -O2 -I .
+// ./bin/free_list_compaction [peak live] [frames] [budget ms]
+
+#include "src/util/free_list_alloc.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+
+static u64 random_state;
+static func random_u32() -> u32 {
+    random_state ^= random_state << 13; random_state ^= random_state >> 7; random_state ^= random_state << 17;
+    return (u32)random_state;
+}
+
+static func component_size() -> u32 {
+    u32 r = random_u32() % 100;
+    if (r < 70) return 96 + (random_u32() % 4) * 8;
+    if (r < 95) return 16 + random_u32() % 240;
+    return 256 + random_u32() % 3840;
+}
+
+struct element {
+    free_list_buffer::fl_ptr ptr;
+    u32 size;
+    u32 stamp;
+};
+
+static func stamp(free_list_buffer* buf, element* el) -> void {
+    u8* p = buf->get_ptr<u8>(el->ptr);
+    el->stamp = random_u32();
+    memcpy(p, &el->stamp, 4);
+    memcpy(p + el->size - 4, &el->stamp, 4);
+}
+
+static func run(u32 peak_live, u32 frames, f64 budget_ms, bool print_timeline) -> free_list_stats {
+    random_state = 0x9E3779B97F4A7C15ull;
+    var buf = free_list_buffer::create(4096);
+    element* elements = (element*)malloc(sizeof(element) * peak_live);
+    u32 live = 0;
+    f64 worst_compact_ms = 0;
+    f64 worst_compact_cpu_ms = 0;   // NOTE(DH): Process CPU time, what's left when the frame wasn't preempted
+    u32 frames_over_budget = 0;     // NOTE(DH): Wall time over by more than 10%, on a shared machine preempted frames count too
+
+    if (print_timeline) printf("%6s %8s %12s %12s %8s %10s\n", "frame", "live", "capacity", "used", "frag", "ms");
+
+    for (u32 frame = 0; frame < frames; ++frame) {
+        // NOTE(DH): First third grows to the peak, at the second third 90% is closed, churn all the way
+        u32 target = frame < frames / 3 ? peak_live * (frame + 1) / (frames / 3) : frame < frames * 2 / 3 ? peak_live : peak_live / 10;
+        while (live > target) {
+            u32 i = random_u32() % live;
+            buf.free(elements[i].ptr);
+            elements[i] = elements[--live];
+        }
+        while (live < target) {
+            element* el = &elements[live++];
+            el->size = component_size();
+            el->ptr = buf.alloc_s(el->size);
+            stamp(&buf, el);
+        }
+        for (u32 r = 0; r < live / 8; ++r) {
+            element* el = &elements[random_u32() % live];
+            buf.free(el->ptr);
+            el->size = random_u32() % 4 == 0 ? component_size() : el->size;
+            el->ptr = buf.alloc_s(el->size);
+            stamp(&buf, el);
+        }
+
+        if (budget_ms > 0) {
+            std::clock_t cpu_start = std::clock();
+            buf.compact(budget_ms);
+            f64 cpu_ms = (std::clock() - cpu_start) * 1000.0 / CLOCKS_PER_SEC;
+            worst_compact_ms = std::max(worst_compact_ms, buf.stats.last_compact_ms);
+            worst_compact_cpu_ms = std::max(worst_compact_cpu_ms, cpu_ms);
+            frames_over_budget += buf.stats.last_compact_ms > budget_ms * 1.1 ? 1 : 0;
+        }
+
+        if (print_timeline && (frame + 1) % (frames / 12) == 0) {
+            free_list_stats s = buf.get_stats();
+            printf("%6u %8u %12u %12u %8.3f %10.4f\n", frame + 1, live, s.capacity, s.used, s.fragmentation, s.last_compact_ms);
+        }
+    }
+
+    bool ok = true;
+    for (u32 i = 0; i < live; ++i) {
+        u8* p = buf.get_ptr<u8>(elements[i].ptr);
+        ok = ok && memcmp(p, &elements[i].stamp, 4) == 0 && memcmp(p + elements[i].size - 4, &elements[i].stamp, 4) == 0;
+        ok = ok && buf.ptr_of(p).offset == elements[i].ptr.offset;
+    }
+
+    free_list_stats result = buf.get_stats();
+    if (print_timeline) {
+        printf("elements %s, %llu blocks / %llu bytes moved, %u passes, %u shrinks, %.2f ms compacting in total, worst frame %.4f ms (%.4f ms cpu), %u frames over budget\n",
+            ok ? "ok" : "BROKEN", (unsigned long long)result.blocks_moved, (unsigned long long)result.bytes_moved,
+            result.passes, result.shrinks, result.total_compact_ms, worst_compact_ms, worst_compact_cpu_ms, frames_over_budget);
+    }
+
+    free(elements);
+    buf.destroy();
+    return result;
+}
+
+int main(int argc, char** argv) {
+    u32 peak_live  = argc > 1 ? atoi(argv[1]) : 20000;
+    u32 frames     = argc > 2 ? atoi(argv[2]) : 1200;
+    f64 budget_ms  = argc > 3 ? atof(argv[3]) : 0.25;
+
+    printf("peak %u live, %u frames, compaction budget %.2f ms/frame\n\n", peak_live, frames, budget_ms);
+    free_list_stats plain = run(peak_live, frames, 0, false);
+    free_list_stats compacted = run(peak_live, frames, budget_ms, true);
+
+    printf("\n%-14s %12s %12s %8s\n", "", "capacity", "used", "frag");
+    printf("%-14s %12u %12u %8.3f\n", "no compaction", plain.capacity, plain.used, plain.fragmentation);
+    printf("%-14s %12u %12u %8.3f\n", "compaction", compacted.capacity, compacted.used, compacted.fragmentation);
+    return 0;
+}
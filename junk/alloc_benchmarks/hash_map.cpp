@@ -0,0 +1,192 @@
+// NOTE(DH): hash_map against std::unordered_map. First a random insert/overwrite/erase/find run checked op by op
+// against std::unordered_map, plus the iteration order (has to be insertion order after erases and rebuilds).
+// Then timings for u64 keys (insert, hit, miss, erase + reinsert churn, iterate), v2i style cell keys the way
+// spatial hashing uses them, and string keys looked up with a plain const char* (the std map has to build a
+// std::string for that). The map is run on default_allocator and on an arena.
+//
+// clang++ ./junk/alloc_benchmarks/hash_map.cpp -o ./bin/hash_map -std=c++20 -O2 -I .
+// ./bin/hash_map [keys]
+
+#include "src/util/hash_map.h"
+#include "src/util/memory_management.h"
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+void* allocate_memory(void*, size_t size) { return malloc(size);}
+
+struct cell { i32 x, y; };
+inline func operator==(cell a, cell b) -> bool { return a.x == b.x && a.y == b.y; }
+struct cell_std_hash { inline func operator()(cell c) const -> usize { return std::hash<u64>{}(((u64)(u32)c.x << 32) | (u32)c.y); } };
+
+static u64 random_state = 0x9E3779B97F4A7C15ull;
+static func random_u64() -> u64 {
+    random_state ^= random_state << 13; random_state ^= random_state >> 7; random_state ^= random_state << 17;
+    return random_state;
+}
+
+static func fail(const char* what, u64 at) -> void {
+    printf("FAILED: %s (at %llu)\n", what, (unsigned long long)at);
+    exit(1);
+}
+
+template <typename F>
+static func time_ms(F f) -> f64 {
+    auto t0 = std::chrono::high_resolution_clock::now();
+    f();
+    return std::chrono::duration<f64, std::milli>(std::chrono::high_resolution_clock::now() - t0).count();
+}
+
+static u64 sink = 0;
+
+static func check_against_std(u32 ops) -> void {
+    var map = hash_map<u64, u64>::create(default_allocator);
+    std::unordered_map<u64, u64> reference;
+    std::vector<u64> order;         // NOTE(DH): Expected iteration order, keys in the order they were first inserted
+
+    for (u32 i = 0; i < ops; ++i) {
+        u64 r = random_u64();
+        u64 key = r % 4096;         // NOTE(DH): Small key space, lots of hits, erases of present keys and tombstones
+        switch ((r >> 32) % 4) {
+            case 0: case 1: {
+                if (reference.find(key) == reference.end()) order.push_back(key);
+                map.insert(key, i);
+                reference[key] = i;
+            } break;
+            case 2: {
+                bool erased = map.erase(key);
+                if (erased != (reference.erase(key) == 1)) fail("erase", i);
+                if (erased) std::erase(order, key);
+            } break;
+            case 3: {
+                u64* found = map.find(key);
+                auto it = reference.find(key);
+                if ((found != nullptr) != (it != reference.end()) || (found && *found != it->second)) fail("find", i);
+            } break;
+        }
+        if (map.count != reference.size()) fail("count", i);
+    }
+
+    u32 at = 0;
+    map.iter([&](u64* key, u64* value) {
+        if (at >= order.size() || *key != order[at] || *value != reference[*key]) fail("iteration order", at);
+        at += 1;
+    });
+    if (at != order.size()) fail("iteration count", at);
+    printf("checked %u random ops against std::unordered_map, %u keys left, iteration in insertion order\n", ops, at);
+    map.destroy();
+}
+
+template <typename MAP>
+static func bench_u64(const char* name, MAP* map, const std::vector<u64>& keys, const std::vector<u64>& misses) -> void {
+    u32 n = (u32)keys.size();
+    f64 insert = time_ms([&]() { for (u32 i = 0; i < n; ++i) map->insert(keys[i], i); });
+    f64 hit = time_ms([&]() { for (u32 i = 0; i < n; ++i) sink += *map->find(keys[i]); });
+    f64 miss = time_ms([&]() { for (u32 i = 0; i < n; ++i) sink += map->find(misses[i]) != nullptr; });
+    f64 churn = time_ms([&]() {
+        for (u32 i = 0; i < n; ++i) { map->erase(keys[i]); map->insert(misses[i], i); }
+    });
+    f64 iter = time_ms([&]() { map->iter([](u64*, u64* value) { sink += *value; }); });
+    printf("  %-24s %8.1f %8.1f %8.1f %8.1f %8.2f\n", name, insert * 1e6 / n, hit * 1e6 / n, miss * 1e6 / n, churn * 1e6 / n, iter * 1e6 / n);
+}
+
+// NOTE(DH): Same calls over std::unordered_map
+struct std_u64_map {
+    std::unordered_map<u64, u64> map;
+    inline func insert(u64 key, u64 value) -> void { map[key] = value; }
+    inline func find(u64 key) -> u64* { auto it = map.find(key); return it == map.end() ? nullptr : &it->second; }
+    inline func erase(u64 key) -> void { map.erase(key); }
+    template <typename F> inline func iter(F f) -> void { for (auto& [k, v] : map) { u64 key = k; f(&key, &v); } }
+};
+
+int main(int argc, char** argv) {
+    u32 n = argc > 1 ? atoi(argv[1]) : 1000000;
+
+    check_against_std(2000000);
+
+    std::vector<u64> keys(n), misses(n);
+    for (u32 i = 0; i < n; ++i) { keys[i] = random_u64(); misses[i] = random_u64(); }
+
+    printf("\n%u u64 keys, ns per op\n", n);
+    printf("  %-24s %8s %8s %8s %8s %8s\n", "", "insert", "hit", "miss", "churn", "iterate");
+    {
+        std_u64_map m;
+        bench_u64("std::unordered_map", &m, keys, misses);
+    }
+    {
+        var m = hash_map<u64, u64>::create(default_allocator);
+        bench_u64("hash_map", &m, keys, misses);
+        m.destroy();
+    }
+    {
+        var m = hash_map<u64, u64>::create(default_allocator, n);
+        bench_u64("hash_map, reserved", &m, keys, misses);
+        m.destroy();
+    }
+    {
+        memory_arena arena = {};
+        arena.size = (usize)n * 256;
+        arena.base = (u8*)malloc(arena.size);
+        var m = hash_map<u64, u64>::create(arena_allocator(&arena));
+        bench_u64("hash_map, arena", &m, keys, misses);
+        free(arena.base);
+    }
+
+    // NOTE(DH): Cells of a 1024 x 1024 grid, looked up with their neighbourhood like a particle query does
+    std::vector<cell> cells(n);
+    for (u32 i = 0; i < n; ++i) { u64 r = random_u64(); cells[i] = {(i32)(r % 1024), (i32)((r >> 32) % 1024)}; }
+    {
+        std::unordered_map<cell, u32, cell_std_hash> std_map;
+        var map = hash_map<cell, u32>::create(default_allocator);
+        f64 std_insert = time_ms([&]() { for (u32 i = 0; i < n; ++i) std_map[cells[i]] = i; });
+        f64 map_insert = time_ms([&]() { for (u32 i = 0; i < n; ++i) map.insert(cells[i], i); });
+        if (std_map.size() != map.count) fail("cell count", map.count);
+        f64 std_query = time_ms([&]() {
+            for (u32 i = 0; i < n; ++i) for (i32 dy = -1; dy <= 1; ++dy) for (i32 dx = -1; dx <= 1; ++dx) {
+                auto it = std_map.find({cells[i].x + dx, cells[i].y + dy}); sink += it != std_map.end() ? it->second : 0;
+            }
+        });
+        f64 map_query = time_ms([&]() {
+            for (u32 i = 0; i < n; ++i) for (i32 dy = -1; dy <= 1; ++dy) for (i32 dx = -1; dx <= 1; ++dx) {
+                u32* v = map.find(cell {cells[i].x + dx, cells[i].y + dy}); sink += v ? *v : 0;
+            }
+        });
+        printf("\ncell keys (%u distinct), ns per op\n", map.count);
+        printf("  %-24s %8s %8s\n", "", "insert", "3x3 query");
+        printf("  %-24s %8.1f %8.1f\n", "std::unordered_map", std_insert * 1e6 / n, std_query * 1e6 / n);
+        printf("  %-24s %8.1f %8.1f\n", "hash_map", map_insert * 1e6 / n, map_query * 1e6 / n);
+        map.destroy();
+    }
+
+    // NOTE(DH): Interned names, looked up with const char* coming from somewhere else
+    {
+        u32 count = n / 8;
+        std::vector<std::string> names(count), lookups(count);
+        for (u32 i = 0; i < count; ++i) { names[i] = "node_" + std::to_string(random_u64() % 100000000); lookups[i] = names[i]; }
+
+        std::unordered_map<std::string, u32> std_map;
+        var map = hash_map<str_key, u32>::create(default_allocator);
+        f64 std_insert = time_ms([&]() { for (u32 i = 0; i < count; ++i) std_map[names[i]] = i; });
+        f64 map_insert = time_ms([&]() { for (u32 i = 0; i < count; ++i) map.insert(str_key {names[i].data(), (u32)names[i].size()}, i); });
+        if (std_map.size() != map.count) fail("string count", map.count);
+        f64 std_find = time_ms([&]() { for (u32 i = 0; i < count; ++i) sink += std_map.find(lookups[i].c_str())->second; });
+        f64 map_find = time_ms([&]() {
+            for (u32 i = 0; i < count; ++i) {
+                u32* v = map.find(lookups[i].c_str());
+                if (v == nullptr || names[*v] != lookups[i]) fail("string lookup", i);
+                sink += *v;
+            }
+        });
+        printf("\nstring keys (%u), ns per op\n", map.count);
+        printf("  %-24s %8s %8s\n", "", "insert", "find(const char*)");
+        printf("  %-24s %8.1f %8.1f\n", "std::unordered_map", std_insert * 1e6 / count, std_find * 1e6 / count);
+        printf("  %-24s %8.1f %8.1f\n", "hash_map", map_insert * 1e6 / count, map_find * 1e6 / count);
+        map.destroy();
+    }
+
+    printf("\n(sink %llu)\n", (unsigned long long)sink);
+    return 0;
+}
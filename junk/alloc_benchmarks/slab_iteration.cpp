@@ -0,0 +1,85 @@
+// NOTE(DH): Iterating a slab_array the way the node editor does every frame, after most of what was ever pushed
+// has been removed again. Compares the old walk (test an in_use flag in every slot up to the high water mark) with
+// the occupancy bitset and with the dense layout, at a few fill levels. All three sum the same values.
+//
+// clang++ ./junk/alloc_benchmarks/slab_iteration.cpp -o ./bin/slab_iteration -std=c++20 -O2 -I .
+// ./bin/slab_iteration [high water slots] [iterations]
+
+#include "src/util/slab_array.h"
+
+#include <chrono>
+#include <cstdio>
+
+struct item { f32 x, y, w, h; };
+
+// NOTE(DH): The previous slot layout, a flag next to every value
+struct flagged_slot { item val; bool in_use; };
+
+static u64 random_state = 0x9E3779B97F4A7C15ull;
+static func random_u32() -> u32 {
+    random_state ^= random_state << 13; random_state ^= random_state >> 7; random_state ^= random_state << 17;
+    return (u32)random_state;
+}
+
+template <typename F>
+static func time_ns(u32 iterations, F f) -> f64 {
+    auto t0 = std::chrono::high_resolution_clock::now();
+    for (u32 i = 0; i < iterations; ++i) f();
+    auto t1 = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<f64, std::nano>(t1 - t0).count() / iterations;
+}
+
+int main(int argc, char** argv) {
+    u32 high_water = argc > 1 ? atoi(argv[1]) : 65536;
+    u32 iterations = argc > 2 ? atoi(argv[2]) : 2000;
+
+    printf("%u slots high water, %u iterations\n", high_water, iterations);
+    printf("%8s %8s %14s %14s %14s %8s\n", "live %", "live", "flag ns", "bitset ns", "dense ns", "sums");
+
+    for (u32 percent : {100u, 50u, 10u, 1u}) {
+        var sparse = slab_array<item>::create(16);
+        var dense = slab_array<item, slab_dense>::create(16);
+        flagged_slot* flagged = (flagged_slot*)calloc(high_water, sizeof(flagged_slot));
+        slab_array<item>::ptr* sparse_handles = (slab_array<item>::ptr*)malloc(sizeof(slab_array<item>::ptr) * high_water);
+        slab_array<item, slab_dense>::ptr* dense_handles = (slab_array<item, slab_dense>::ptr*)malloc(sizeof(slab_array<item, slab_dense>::ptr) * high_water);
+
+        for (u32 i = 0; i < high_water; ++i) {
+            item it = {.x = (f32)(i % 97), .y = 1, .w = 2, .h = 3};
+            sparse_handles[i] = sparse.push(it);
+            dense_handles[i] = dense.push(it);
+            flagged[i] = {.val = it, .in_use = true};
+        }
+        for (u32 i = 0; i < high_water; ++i) {
+            if (random_u32() % 100 < percent) continue;
+            sparse.remove(sparse_handles[i]);
+            dense.remove(dense_handles[i]);
+            flagged[i].in_use = false;
+        }
+
+        f32 sums[3] = {};
+        f64 flag_ns = time_ns(iterations, [&]() {
+            f32 sum = 0;
+            for (u32 i = 0; i < high_water; ++i) if (flagged[i].in_use) sum += flagged[i].val.x;
+            sums[0] = sum;
+        });
+        f64 bitset_ns = time_ns(iterations, [&]() {
+            sums[1] = sparse.fold(0.0f, [](const item& it, f32 acc) { return acc + it.x; });
+        });
+        f64 dense_ns = time_ns(iterations, [&]() {
+            f32 sum = 0;
+            item* values = dense.values();
+            for (u32 i = 0; i < dense.count; ++i) sum += values[i].x;
+            sums[2] = sum;
+        });
+
+        printf("%8u %8u %14.0f %14.0f %14.0f %8s\n", percent, sparse.count, flag_ns, bitset_ns, dense_ns,
+            sums[0] == sums[1] && sums[1] == sums[2] ? "ok" : "DIFFER");
+
+        free(flagged);
+        free(sparse_handles);
+        free(dense_handles);
+        sparse.dealloc();
+        dense.dealloc();
+    }
+    return 0;
+}
@@ -0,0 +1,98 @@
+// NOTE(DH): The node editor raises the clicked definition to the top of the draw order and draws everything in
+// that order every frame. Runs that on slab_array's linked z-order next to the shifting iter_order array it
+// replaced, with definitions being removed and added in between, and checks after every frame that both draw
+// the same slots in the same order. Also checks that handles kept past a remove are rejected.
+//
+// clang++ ./junk/alloc_benchmarks/slab_z_order.cpp -o ./bin/slab_z_order -std=c++20 -O2 -I .
+// ./bin/slab_z_order [definitions] [frames]
+
+#include "src/util/slab_array.h"
+
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+struct definition_stub { f32 x, y; u32 id; };
+
+// NOTE(DH): The previous scheme, positions in an array, bring to front shifts everything above down by one
+struct shifting_order {
+    std::vector<u32> order;
+
+    func raise(u32 slot) -> void {
+        u32 pos = 0;
+        while (order[pos] != slot) ++pos;
+        for (; pos + 1 < order.size(); ++pos) order[pos] = order[pos + 1];
+        order.back() = slot;
+    }
+
+    func remove(u32 slot) -> void {
+        u32 pos = 0;
+        while (order[pos] != slot) ++pos;
+        order.erase(order.begin() + pos);
+    }
+};
+
+static u64 random_state = 0x9E3779B97F4A7C15ull;
+static func random_u32() -> u32 {
+    random_state ^= random_state << 13; random_state ^= random_state >> 7; random_state ^= random_state << 17;
+    return (u32)random_state;
+}
+
+int main(int argc, char** argv) {
+    u32 definitions = argc > 1 ? atoi(argv[1]) : 20000;
+    u32 frames      = argc > 2 ? atoi(argv[2]) : 2000;
+
+    var defs = slab_array<definition_stub>::create(64);
+    std::vector<slab_array<definition_stub>::ptr> handles;
+    shifting_order reference = {};
+
+    for (u32 i = 0; i < definitions; ++i) {
+        let h = defs.push({.x = (f32)i, .y = 0, .id = i});
+        handles.push_back(h);
+        reference.order.push_back(h.idx);
+    }
+
+    f64 linked_ns = 0, shifting_ns = 0;
+    u64 checksum = 0;
+    bool same_order = true;
+    u32 stale_accepted = 0;
+    std::vector<u32> drawn;
+
+    for (u32 frame = 0; frame < frames; ++frame) {
+        // NOTE(DH): A click raises one definition, every 8th frame one is deleted and a new one created
+        u32 pick = random_u32() % handles.size();
+        auto t0 = std::chrono::high_resolution_clock::now();
+        defs.raise(handles[pick]);
+        auto t1 = std::chrono::high_resolution_clock::now();
+        reference.raise(handles[pick].idx);
+        auto t2 = std::chrono::high_resolution_clock::now();
+        linked_ns += std::chrono::duration<f64, std::nano>(t1 - t0).count();
+        shifting_ns += std::chrono::duration<f64, std::nano>(t2 - t1).count();
+
+        if (frame % 8 == 0) {
+            u32 victim = random_u32() % handles.size();
+            let stale = handles[victim];
+            defs.remove(stale);
+            reference.remove(stale.idx);
+            let fresh = defs.push({.x = 0, .y = 0, .id = definitions + frame});
+            reference.order.push_back(fresh.idx);
+            handles[victim] = fresh;
+            // NOTE(DH): The new definition reuses the slot, the old handle must not reach it
+            if (defs.try_get_ptr(stale) != nullptr) ++stale_accepted;
+            defs.raise(stale);
+        }
+
+        drawn.clear();
+        defs.iter_in_order([&](definition_stub* def, u32 order, slab_array<definition_stub>::ptr h) {
+            checksum += def->id * (order + 1);
+            drawn.push_back(h.idx);
+        });
+        same_order = same_order && drawn == reference.order;
+    }
+
+    printf("%u definitions, %u frames\n", definitions, frames);
+    printf("raise: linked %.1f ns, shifting %.1f ns\n", linked_ns / frames, shifting_ns / frames);
+    printf("order %s, stale handles accepted %u, checksum %llu\n", same_order ? "same" : "DIFFERENT", stale_accepted, (unsigned long long)checksum);
+    defs.dealloc();
+    return 0;
+}
@@ -0,0 +1,72 @@
+// NOTE(DH): Integration step (p += v * dt, v += g * dt) over the same particles kept three ways: interleaved v2
+// arrays with the old 4 byte alignment, the same with 32 byte alignment, and an aligned SoA (x, y, vx, vy) that
+// runs in whole AVX registers with aligned loads and no scalar tail. Checks every SoA component really is aligned.
+//
+// clang++ ./junk/alloc_benchmarks/soa_arrays.cpp -o ./bin/soa_arrays -std=c++20 -O2 -mavx -I .
+// ./bin/soa_arrays [particles] [iterations]
+
+#include <climits>
+#include "src/util/memory_management.h"
+#include "src/dmath.h"
+
+#include <chrono>
+#include <cstdio>
+#include <immintrin.h>
+
+void* allocate_memory(void* base, size_t size) { return malloc(size);}
+
+static func integrate_aos(v2 *positions, v2 *velocities, u32 count, f32 dt) -> void {
+	for(u32 i = 0; i < count; ++i) {
+		velocities[i].y -= 9.81f * dt;
+		positions[i] = positions[i] + velocities[i] * dt;
+	}
+}
+
+static func integrate_soa(f32 *x, f32 *y, f32 *vx, f32 *vy, u32 capacity, f32 dt) -> void {
+	__m256 dts = _mm256_set1_ps(dt);
+	__m256 gravity = _mm256_set1_ps(-9.81f * dt);
+	for(u32 i = 0; i < capacity; i += 8) {
+		__m256 v_y = _mm256_add_ps(_mm256_load_ps(vy + i), gravity);
+		_mm256_store_ps(vy + i, v_y);
+		_mm256_store_ps(x + i, _mm256_add_ps(_mm256_load_ps(x + i), _mm256_mul_ps(_mm256_load_ps(vx + i), dts)));
+		_mm256_store_ps(y + i, _mm256_add_ps(_mm256_load_ps(y + i), _mm256_mul_ps(v_y, dts)));
+	}
+}
+
+int main(int argc, char** argv) {
+	u32 count		= argc > 1 ? atoi(argv[1]) : 100003;
+	u32 iterations	= argc > 2 ? atoi(argv[2]) : 2000;
+	f32 dt = 1.0f / 120.0f;
+
+	memory_arena arena = initialize_arena(Megabytes(64));
+	arena.alloc_array<u8>(3); // NOTE(DH): Knock the arena off alignment like real use would
+
+	auto time = [&](const char *name, auto body) {
+		auto t0 = std::chrono::high_resolution_clock::now();
+		for(u32 it = 0; it < iterations; ++it) body();
+		auto t1 = std::chrono::high_resolution_clock::now();
+		printf("%-22s %8.3f us/step\n", name, std::chrono::duration<f64, std::micro>(t1 - t0).count() / iterations);
+	};
+
+	for(usize alignment : {default_arena_alignment(), arena_simd_alignment}) {
+		arena_array<v2> positions = arena.alloc_array<v2>(count, alignment);
+		arena_array<v2> velocities = arena.alloc_array<v2>(count, alignment);
+		v2 *p = arena.get_array(positions), *v = arena.get_array(velocities);
+		for(u32 i = 0; i < count; ++i) { p[i] = V2(i * 0.001f, 0); v[i] = V2(1, 0); }
+
+		char name[64];
+		snprintf(name, sizeof(name), "aos, %llu byte aligned", (unsigned long long)alignment);
+		time(name, [&]() { integrate_aos(p, v, count, dt); });
+		printf("%-22s data at %% 32 = %llu, last y %f\n", "", (unsigned long long)((usize)p % 32), arena.load_by_idx(positions.ptr, count - 1).y);
+	}
+
+	arena_soa<f32, f32, f32, f32> soa = arena.alloc_soa<f32, f32, f32, f32>(count);
+	f32 *x = arena.get_soa<0>(soa), *y = arena.get_soa<1>(soa), *vx = arena.get_soa<2>(soa), *vy = arena.get_soa<3>(soa);
+	bool aligned = ((usize)x | (usize)y | (usize)vx | (usize)vy) % arena_simd_alignment == 0;
+	for(u32 i = 0; i < soa.capacity; ++i) { x[i] = i * 0.001f; y[i] = 0; vx[i] = 1; vy[i] = 0; }
+	time("soa, 32 byte aligned", [&]() { integrate_soa(x, y, vx, vy, soa.capacity, dt); });
+	printf("%-22s capacity %u for %u, components %s, last y %f\n", "", soa.capacity, count, aligned ? "aligned" : "NOT ALIGNED", y[count - 1]);
+
+	free(arena.base);
+	return 0;
+}
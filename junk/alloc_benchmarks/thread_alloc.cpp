@@ -0,0 +1,116 @@
+// NOTE(DH): Worker threads doing small allocation churn (16..512 bytes, a window of live blocks each) on malloc,
+// on one memory_arena behind a mutex (the only way to share one safely) and on thread_allocator. Then the
+// cross thread case: every thread frees blocks the next thread allocated, through the deferred lists, with the
+// contents checked on the way. After the threads are gone the orphan list has to be empty.
+//
+// clang++ ./junk/alloc_benchmarks/thread_alloc.cpp -o ./bin/thread_alloc -std=c++20 -O2 -I . -lpthread
+// ./bin/thread_alloc [threads] [allocations per thread]
+
+#include "src/util/thread_alloc.h"
+
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+void* allocate_memory(void*, size_t size) { return malloc(size);}
+
+static constexpr u32 window = 256;
+
+template <typename F>
+static func run_threads(u32 thread_count, F fn) -> f64 {
+    std::thread threads[64];
+    auto t0 = std::chrono::high_resolution_clock::now();
+    for (u32 i = 0; i < thread_count; ++i) threads[i] = std::thread(fn, i);
+    for (u32 i = 0; i < thread_count; ++i) threads[i].join();
+    auto t1 = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<f64, std::milli>(t1 - t0).count();
+}
+
+static func churn(allocator alc, u32 seed, u32 count) -> u64 {
+    void* live[window] = {};
+    u64 state = seed * 0x9E3779B97F4A7C15ull + 1, sum = 0;
+    for (u32 i = 0; i < count; ++i) {
+        state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+        u32 slot = state % window;
+        alc.free(live[slot]);
+        u32 size = 16 + (state >> 32) % 496;
+        live[slot] = alc.alloc(size);
+        ((u8*)live[slot])[size - 1] = (u8)i;
+        sum += ((u8*)live[slot])[0];
+    }
+    for (u32 i = 0; i < window; ++i) alc.free(live[i]);
+    return sum;
+}
+
+// NOTE(DH): Shared arena, every call takes the lock; frees are no-ops, it is reset when the round is over
+static std::mutex shared_lock;
+static memory_arena shared_arena;
+static const allocator locked_arena_allocator = {
+    .ctx        = &shared_arena,
+    .alloc_fn   = [](void* ctx, usize size) -> void* { std::lock_guard<std::mutex> g(shared_lock); return arena_allocator_alloc(ctx, size); },
+    .realloc_fn = [](void* ctx, void* ptr, usize size) -> void* { std::lock_guard<std::mutex> g(shared_lock); return arena_allocator_realloc(ctx, ptr, size); },
+    .free_fn    = [](void* ctx, void* ptr) -> void { std::lock_guard<std::mutex> g(shared_lock); arena_allocator_free(ctx, ptr); },
+};
+
+// NOTE(DH): Thread i allocates into its mailbox, thread i + 1 frees what it finds there
+struct mailbox {
+    std::atomic<u32*> slots[window];
+};
+static mailbox mailboxes[64];
+
+int main(int argc, char** argv) {
+    u32 thread_count = argc > 1 ? atoi(argv[1]) : std::max(2u, std::min(8u, std::thread::hardware_concurrency()));
+    u32 count        = argc > 2 ? atoi(argv[2]) : 2000000;
+    thread_count = std::min(thread_count, 64u);
+
+    shared_arena = initialize_arena((usize)thread_count * count * 512 + Megabytes(1));
+
+    std::atomic<u64> sink = 0;
+    printf("%u threads, %u allocations each\n", thread_count, count);
+    f64 malloc_ms = run_threads(thread_count, [&](u32 t) { sink += churn(default_allocator, t, count); });
+    printf("%-16s %8.1f ns/alloc\n", "malloc", malloc_ms * 1e6 / count);
+    f64 arena_ms = run_threads(thread_count, [&](u32 t) { sink += churn(locked_arena_allocator, t, count); });
+    printf("%-16s %8.1f ns/alloc\n", "locked arena", arena_ms * 1e6 / count);
+    f64 thread_ms = run_threads(thread_count, [&](u32 t) {
+        sink += churn(thread_allocator(), t, count);
+        // NOTE(DH): Scratch temporaries on the same thread, gone at the end of the scope
+        temporary_memory_scope temp(thread_scratch());
+        sink += thread_scratch()->alloc_array<u64>(1024).capacity;
+    });
+    printf("%-16s %8.1f ns/alloc\n", "thread heap", thread_ms * 1e6 / count);
+
+    // NOTE(DH): Cross thread frees
+    std::atomic<u64> bad = 0, remote_frees = 0;
+    f64 cross_ms = run_threads(thread_count, [&](u32 t) {
+        allocator alc = thread_allocator();
+        mailbox* mine = &mailboxes[t];
+        mailbox* theirs = &mailboxes[(t + thread_count - 1) % thread_count];
+        for (u32 i = 0; i < count / 4; ++i) {
+            u32 slot = i % window;
+            u32* block = (u32*)alc.alloc(64);
+            block[0] = t; block[15] = i;
+            u32* old = mine->slots[slot].exchange(block);
+            if (old != nullptr) alc.free(old);
+
+            u32* taken = theirs->slots[(i * 7) % window].exchange(nullptr);
+            if (taken != nullptr) {
+                if (taken[0] != (t + thread_count - 1) % thread_count) bad += 1;
+                alc.free(taken);
+            }
+        }
+        remote_frees += thread_heap_get_stats().remote_frees;
+    });
+    // NOTE(DH): What is still in the mailboxes belongs to heaps whose threads are gone
+    for (u32 t = 0; t < thread_count; ++t) {
+        for (u32 s = 0; s < window; ++s) thread_heap_free(mailboxes[t].slots[s].exchange(nullptr));
+    }
+    thread_heap_collect();
+
+    u32 orphans = 0;
+    for (thread_heap* o = thread_heap_orphans; o != nullptr; o = o->next_orphan) ++orphans;
+    printf("%-16s %8.1f ns/alloc, %llu blocks came back through deferred lists, %llu bad, %u orphaned heaps left\n",
+        "cross thread", cross_ms * 1e6 / (count / 4), (unsigned long long)remote_frees.load(), (unsigned long long)bad.load(), orphans);
+    printf("sink %llu\n", (unsigned long long)sink.load());
+    free(shared_arena.base);
+    return 0;
+}
@@ -0,0 +1,149 @@
+// NOTE(DH): job_system: spawn overhead of an empty job (one thread creating them all, and parallel_for spreading
+// the spawning), against a std::thread per piece of work the way fluid_surface_parallel does it. Then
+// parallel_for scaling over worker counts and grain sizes on a compute loop, and a dependency graph (a chain and
+// a fan out / fan in per step, like sim phases) checked for order.
+//
+// clang++ ./junk/job_benchmarks/job_system.cpp -o ./bin/job_system -std=c++20 -O2 -I . -lpthread
+// ./bin/job_system [max workers]
+
+#include "src/util/job_system.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+using bench_clock = std::chrono::high_resolution_clock;
+
+static func ms_since(bench_clock::time_point t0) -> f64 {
+    return std::chrono::duration<f64, std::milli>(bench_clock::now() - t0).count();
+}
+
+static func work(u32 i) -> f32 {
+    f32 x = (f32)i;
+    for (u32 k = 0; k < 32; ++k) x = sqrtf(x * x + 1.0f) * 0.999f;
+    return x;
+}
+
+static func spawn_overhead(job_system* js) -> void {
+    const u32 count = 1 << 20;
+    std::atomic<u32> ran = 0;
+
+    auto t0 = bench_clock::now();
+    for (u32 done = 0; done < count; done += 2048) {
+        // NOTE(DH): Batches below the pool size, the handles have to stay good until the wait
+        job* root = js->create_job([](job_system*, job*, void*) {});
+        for (u32 i = 0; i < 2048; ++i) {
+            std::atomic<u32>* counter = &ran;
+            js->run(js->create_lambda_job([counter]() { counter->fetch_add(1, std::memory_order_relaxed); }, root));
+        }
+        js->run(root);
+        js->wait(root);
+    }
+    f64 single = ms_since(t0);
+    if (ran.load() != count) { printf("spawn: ran %u of %u\n", ran.load(), count); exit(1); }
+
+    ran = 0;
+    t0 = bench_clock::now();
+    parallel_for(js, 0, count, 1, [&](u32 begin, u32 end) { ran.fetch_add(end - begin, std::memory_order_relaxed); });
+    f64 spread = ms_since(t0);
+    if (ran.load() != count) { printf("parallel_for: ran %u of %u\n", ran.load(), count); exit(1); }
+
+    const u32 thread_count = 2048;
+    t0 = bench_clock::now();
+    for (u32 done = 0; done < thread_count; done += 16) {
+        std::thread threads[16];
+        for (u32 i = 0; i < 16; ++i) threads[i] = std::thread([&ran]() { ran.fetch_add(1, std::memory_order_relaxed); });
+        for (u32 i = 0; i < 16; ++i) threads[i].join();
+    }
+    f64 threads = ms_since(t0);
+
+    printf("spawn overhead (%u workers)\n", js->worker_count);
+    printf("  job, one spawner       %8.1f ns/job\n", single * 1e6 / count);
+    printf("  parallel_for grain 1   %8.1f ns/job\n", spread * 1e6 / count);
+    printf("  std::thread + join     %8.1f ns/thread\n", threads * 1e6 / thread_count);
+}
+
+static func scaling(u32 max_workers) -> void {
+    const u32 count = 1 << (getenv("SMALL") ? 16 : 22);
+    std::vector<f32> out(count);
+
+    auto t0 = bench_clock::now();
+    for (u32 i = 0; i < count; ++i) out[i] = work(i);
+    f64 serial = ms_since(t0);
+    f64 expected = 0; for (f32 v : out) expected += v;
+
+    printf("\nparallel_for over %u items, serial %.2f ms\n", count, serial);
+    printf("  workers  grain    ms      speedup\n");
+    for (u32 workers = 1; workers <= max_workers; workers *= 2) {
+        job_system* js = job_system::create(workers);
+        for (u32 grain : {64u, 1024u, 16384u}) {
+            std::fill(out.begin(), out.end(), 0.0f);
+            t0 = bench_clock::now();
+            parallel_for(js, 0, count, grain, [&](u32 begin, u32 end) { for (u32 i = begin; i < end; ++i) out[i] = work(i); });
+            f64 ms = ms_since(t0);
+            f64 sum = 0; for (f32 v : out) sum += v;
+            if (sum != expected) { printf("parallel_for result differs\n"); exit(1); }
+            printf("  %7u  %6u  %7.2f  %6.2fx\n", workers, grain, ms, serial / ms);
+        }
+        job_system_stats stats = js->get_stats();
+        printf("           executed %llu, stolen %llu, inline %llu\n",
+               (unsigned long long)stats.executed, (unsigned long long)stats.stolen, (unsigned long long)stats.inline_runs);
+        js->destroy();
+    }
+}
+
+// NOTE(DH): Per step: a phase job, fanning out to 4 jobs, fanning in to the next step's phase job
+static func dependencies(job_system* js) -> void {
+    const u32 steps = 200;
+    std::atomic<u32> clock = 0;
+    std::vector<u32> stamps(steps * 6);
+
+    auto t0 = bench_clock::now();
+    job* root = js->create_job([](job_system*, job*, void*) {});
+    job* previous = nullptr;
+    std::vector<job*> all;
+    for (u32 s = 0; s < steps; ++s) {
+        u32* stamp = &stamps[s * 6];
+        std::atomic<u32>* c = &clock;
+        job* phase = js->create_lambda_job([c, stamp]() { stamp[0] = c->fetch_add(1); }, root);
+        job* join  = js->create_lambda_job([c, stamp]() { stamp[5] = c->fetch_add(1); }, root);
+        if (previous != nullptr) js->add_dependency(previous, phase);
+        all.push_back(phase);
+        for (u32 k = 0; k < 4; ++k) {
+            job* part = js->create_lambda_job([c, stamp, k]() { stamp[1 + k] = c->fetch_add(1); }, root);
+            js->add_dependency(phase, part);
+            js->add_dependency(part, join);
+            all.push_back(part);
+        }
+        all.push_back(join);
+        previous = join;
+    }
+    for (job* j : all) js->run(j);
+    js->run(root);
+    js->wait(root);
+    f64 ms = ms_since(t0);
+
+    for (u32 s = 0; s < steps; ++s) {
+        u32* stamp = &stamps[s * 6];
+        for (u32 k = 1; k < 5; ++k) {
+            if (!(stamp[0] < stamp[k] && stamp[k] < stamp[5])) { printf("dependency order broken at step %u\n", s); exit(1); }
+        }
+        if (s > 0 && !(stamps[(s - 1) * 6 + 5] < stamp[0])) { printf("step %u started early\n", s); exit(1); }
+    }
+    printf("\ndependency graph, %u steps x 6 jobs: %.2f ms (%.1f us/step), order ok\n", steps, ms, ms * 1e3 / steps);
+}
+
+int main(int argc, char** argv) {
+    u32 max_workers = argc > 1 ? (u32)atoi(argv[1]) : std::thread::hardware_concurrency();
+
+    job_system* js = job_system::create(max_workers);
+    spawn_overhead(js);
+    dependencies(js);
+    js->destroy();
+
+    scaling(max_workers);
+    return 0;
+}
@@ -0,0 +1,172 @@
+// NOTE(DH): spsc_queue / mpsc_queue stress and throughput. Every run checks what the consumer got: the SPSC
+// stream has to come out as 0, 1, 2, ... and in the MPSC one every producer's items have to come out in its own
+// order with none lost. Runs with single items, batches, the blocking *_wait calls (with a consumer that is
+// slower than the producers and then the other way around, so both sides actually sleep), and a std::mutex +
+// ring baseline.
+//
+// clang++ ./junk/job_benchmarks/queues.cpp -o ./bin/queues -std=c++20 -O2 -I . -lpthread
+// ./bin/queues [millions of items] [producers]
+
+#include "src/util/queue.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+
+void* allocate_memory(void*, size_t size) { return malloc(size);}
+
+using bench_clock = std::chrono::high_resolution_clock;
+
+static func ms_since(bench_clock::time_point t0) -> f64 {
+    return std::chrono::duration<f64, std::milli>(bench_clock::now() - t0).count();
+}
+
+static func fail(const char* what, u64 at) -> void {
+    printf("FAILED: %s (at %llu)\n", what, (unsigned long long)at);
+    exit(1);
+}
+
+static func report(const char* name, u64 items, f64 ms) -> void {
+    printf("  %-34s %8.2f ms  %7.1f M items/s\n", name, ms, items / ms * 1e-3);
+}
+
+// NOTE(DH): Slows one side down for the blocking runs. The signal fence is a compiler-only barrier, it keeps the
+// loop from being dropped without a volatile counter or any instruction of its own
+static func busy(u32 iterations) -> void {
+    for (u32 i = 0; i < iterations; ++i) std::atomic_signal_fence(std::memory_order_seq_cst);
+}
+
+static func spsc_run(const char* name, u32 count, u32 batch, bool blocking, u32 producer_delay, u32 consumer_delay) -> void {
+    spsc_queue<u32>* q = spsc_queue<u32>::create(default_allocator, 1024, blocking);
+
+    auto t0 = bench_clock::now();
+    std::thread producer([&]() {
+        u32 items[64];
+        for (u32 next = 0; next < count;) {
+            if (blocking) { busy(producer_delay); q->push_wait(next++); continue; }
+            u32 n = std::min(batch, count - next);
+            for (u32 i = 0; i < n; ++i) items[i] = next + i;
+            u32 pushed = q->push_n(items, n);
+            next += pushed;
+            if (pushed == 0) std::this_thread::yield();
+        }
+    });
+
+    u32 items[64];
+    for (u32 expected = 0; expected < count;) {
+        u32 n = 0;
+        if (blocking) { q->pop_wait(&items[0]); n = 1; busy(consumer_delay); }
+        else if ((n = q->pop_n(items, batch)) == 0) std::this_thread::yield();
+        for (u32 i = 0; i < n; ++i) if (items[i] != expected++) fail("spsc order", expected - 1);
+    }
+    producer.join();
+    if (q->size() != 0) fail("spsc queue not empty", q->size());
+    report(name, count, ms_since(t0));
+    q->destroy();
+}
+
+static func mpsc_run(const char* name, u32 count, u32 producer_count, u32 batch, bool blocking, u32 producer_delay, u32 consumer_delay) -> void {
+    mpsc_queue<u32>* q = mpsc_queue<u32>::create(default_allocator, 1024, blocking);
+    u32 per_producer = count / producer_count;
+
+    auto t0 = bench_clock::now();
+    std::thread producers[64];
+    for (u32 p = 0; p < producer_count; ++p) {
+        producers[p] = std::thread([&, p]() {
+            // NOTE(DH): Producer index in the top byte, sequence in the rest
+            u32 items[64];
+            for (u32 next = 0; next < per_producer;) {
+                if (blocking) { busy(producer_delay); q->push_wait((p << 24) | next++); continue; }
+                u32 n = std::min(batch, per_producer - next);
+                for (u32 i = 0; i < n; ++i) items[i] = (p << 24) | (next + i);
+                u32 pushed = q->push_n(items, n);
+                next += pushed;
+                if (pushed == 0) std::this_thread::yield();
+            }
+        });
+    }
+
+    u32 expected[64] = {};
+    u32 items[64];
+    for (u64 received = 0; received < (u64)per_producer * producer_count;) {
+        u32 n = 0;
+        if (blocking) { q->pop_wait(&items[0]); n = 1; busy(consumer_delay); }
+        else if ((n = q->pop_n(items, batch)) == 0) std::this_thread::yield();
+        for (u32 i = 0; i < n; ++i) {
+            u32 p = items[i] >> 24;
+            if (p >= producer_count || (items[i] & 0xFFFFFF) != expected[p]++) fail("mpsc per producer order", received + i);
+        }
+        received += n;
+    }
+    for (u32 p = 0; p < producer_count; ++p) producers[p].join();
+    if (q->size() != 0) fail("mpsc queue not empty", q->size());
+    report(name, (u64)per_producer * producer_count, ms_since(t0));
+    q->destroy();
+}
+
+// NOTE(DH): What a queue would be without the lock-free part
+static func mutex_run(const char* name, u32 count, u32 producer_count) -> void {
+    std::mutex lock;
+    u32 ring[1024];
+    u32 head = 0, tail = 0;
+    u32 per_producer = count / producer_count;
+
+    auto t0 = bench_clock::now();
+    std::thread producers[64];
+    for (u32 p = 0; p < producer_count; ++p) {
+        producers[p] = std::thread([&, p]() {
+            for (u32 next = 0; next < per_producer;) {
+                bool full;
+                {
+                    std::lock_guard<std::mutex> guard(lock);
+                    full = head - tail == 1024;
+                    if (!full) ring[head++ & 1023] = (p << 24) | next++;
+                }
+                if (full) std::this_thread::yield();
+            }
+        });
+    }
+    u32 expected[64] = {};
+    for (u64 received = 0; received < (u64)per_producer * producer_count;) {
+        bool empty;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            empty = tail == head;
+            while (tail != head) {
+                u32 item = ring[tail++ & 1023];
+                if ((item & 0xFFFFFF) != expected[item >> 24]++) fail("mutex order", received);
+                received += 1;
+            }
+        }
+        if (empty) std::this_thread::yield();
+    }
+    for (u32 p = 0; p < producer_count; ++p) producers[p].join();
+    report(name, (u64)per_producer * producer_count, ms_since(t0));
+}
+
+int main(int argc, char** argv) {
+    setvbuf(stdout, nullptr, _IONBF, 0);
+    u32 count = (argc > 1 ? (u32)atoi(argv[1]) : 16) * 1000000;
+    u32 producer_count = std::min(argc > 2 ? (u32)atoi(argv[2]) : 4u, 64u);
+    u32 blocking_count = count / 64;
+
+    printf("spsc, %u items\n", count);
+    spsc_run("single", count, 1, false, 0, 0);
+    spsc_run("batch 16", count, 16, false, 0, 0);
+    spsc_run("batch 64", count, 64, false, 0, 0);
+    spsc_run("push_wait/pop_wait, slow consumer", blocking_count, 1, true, 0, 400);
+    spsc_run("push_wait/pop_wait, slow producer", blocking_count, 1, true, 400, 0);
+    mutex_run("mutex ring", count, 1);
+
+    printf("mpsc, %u items from %u producers\n", count, producer_count);
+    mpsc_run("single", count, producer_count, 1, false, 0, 0);
+    mpsc_run("batch 16", count, producer_count, 16, false, 0, 0);
+    mpsc_run("batch 64", count, producer_count, 64, false, 0, 0);
+    mpsc_run("push_wait/pop_wait, slow consumer", blocking_count, producer_count, 1, true, 0, 400);
+    mpsc_run("push_wait/pop_wait, slow producers", blocking_count, producer_count, 1, true, 1600, 0);
+    mutex_run("mutex ring", count, producer_count);
+    printf("all checks passed\n");
+    return 0;
+}
@@ -0,0 +1,133 @@
+// NOTE(DH): Full f32 storage against the compact layout (i16 fixed-point positions, fp16 velocities and
+// densities). Both runs start from the same grid and take the same steps, the full run is the reference.
+// Reports how far compact positions drift from the reference, how the density error compares, step time, how
+// many bytes of particle state the neighbour loops stream and how large that state is. The flow is chaotic, so
+// per particle deviation keeps growing once rounding differences get amplified; density error is what says
+// whether the fluid still behaves the same. The tank grows with the particle count, so the density stays the same.
+//
+// clang++ ./junk/sim_benchmarks/compact_storage.cpp -o ./bin/compact_storage -std=c++20 -O2 -mavx -mf16c -I ./src
+// ./bin/compact_storage [particles] [steps] [wcsph|pbf] [3d]
+
+#include "../../src/simulation_of_particles_core.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+void* allocate_memory(void*, size_t size) { return malloc(size);}
+
+template<u32 dim>
+static func setup_fluid(solver_mode mode, u32 particle_count) -> sph_params<dim> {
+	sph_params<dim> params = sph_default_params<dim>();
+	params.mode							= mode;
+	params.gravity						= -12.0f;
+	params.smoothing_radius 			= 0.35f;
+	params.target_density 				= dim == 2 ? 55.0f : 150.0f;
+	params.pressure_multiplier 			= 500.0f;
+	params.near_pressure_multiplier 	= 18.0f;
+	params.viscosity_strength 			= 0.06f;
+	params.bounds_size.x				= 17.0f;
+	params.bounds_size.y				= 9.0f;
+	if constexpr (dim == 3) params.bounds_size.z = 6.0f;
+	f32 scale = powf(std::max(1.0f, particle_count / 4096.0f), 1.0f / dim);
+	for(u32 k = 0; k < dim; ++k) params.bounds_size.E[k] *= scale;
+	return params;
+}
+
+struct compact_sample {
+	u32 step;
+	f32 mean_deviation;
+	f32 max_deviation;
+	f32 mean_speed_deviation;
+};
+
+template<u32 dim>
+static func run(u32 particle_count, u32 steps, solver_mode mode) -> void {
+	using vec = typename sph_dim<dim>::vec;
+
+	sph_params<dim> params = setup_fluid<dim>(mode, particle_count);
+	f32 dt = mode == solver_mode_pbf ? 1.0f / 120.0f : 1.0f / 480.0f;
+
+	memory_arena full_arena = initialize_arena(Megabytes(64) + (usize)particle_count * 256);
+	memory_arena compact_arena = initialize_arena(Megabytes(64) + (usize)particle_count * 256);
+	sph_state<dim> full = sph_create<dim>(&full_arena, particle_count, params);
+	sph_state<dim, sph_layout_compact> compact = sph_create<dim, sph_layout_compact>(&compact_arena, particle_count, params);
+	sph_spawn_grid(&full_arena, &full, params.particle_size * 2 + 0.03f);
+	sph_spawn_grid(&compact_arena, &compact, params.particle_size * 2 + 0.03f);
+
+	f64 full_seconds = 0, compact_seconds = 0;
+	compact_sample samples[16];
+	u32 sample_count = 0;
+	u32 sample_every = std::max(1u, steps / 8);
+
+	for(u32 step = 0; step < steps; ++step) {
+		auto t0 = std::chrono::high_resolution_clock::now();
+		sph_step(&full_arena, &full, dt);
+		auto t1 = std::chrono::high_resolution_clock::now();
+		sph_step(&compact_arena, &compact, dt);
+		auto t2 = std::chrono::high_resolution_clock::now();
+		full_seconds += std::chrono::duration<f64>(t1 - t0).count();
+		compact_seconds += std::chrono::duration<f64>(t2 - t1).count();
+
+		if((step + 1) % sample_every != 0 && step + 1 != steps) continue;
+		if(sample_count == 16) continue;
+
+		// NOTE(DH): Particle i is the same particle in both runs, only the storage differs
+		auto full_positions = sph_positions(&full_arena, &full, full.positions);
+		auto full_velocities = sph_velocities(&full_arena, &full);
+		auto compact_positions = sph_positions(&compact_arena, &compact, compact.positions);
+		auto compact_velocities = sph_velocities(&compact_arena, &compact);
+
+		compact_sample sample = {};
+		sample.step = step + 1;
+		for(u32 i = 0; i < particle_count; ++i) {
+			vec offset = full_positions[i] - (vec)compact_positions[i];
+			f32 deviation = SquareRoot(Inner(offset, offset));
+			f32 speed_a = SquareRoot(Inner(full_velocities[i], full_velocities[i]));
+			vec compact_velocity = compact_velocities[i];
+			f32 speed_b = SquareRoot(Inner(compact_velocity, compact_velocity));
+			sample.mean_deviation += deviation;
+			sample.max_deviation = std::max(sample.max_deviation, deviation);
+			sample.mean_speed_deviation += fabsf(speed_a - speed_b);
+		}
+		sample.mean_deviation /= particle_count;
+		sample.mean_speed_deviation /= particle_count;
+		samples[sample_count++] = sample;
+	}
+
+	printf("%uD %s, %u particles, %u steps of %.5f s, smoothing radius %.3f\n", dim, mode == solver_mode_pbf ? "pbf" : "wcsph",
+		particle_count, steps, dt, params.smoothing_radius);
+	printf("%8s %16s %16s %18s\n", "step", "mean pos dev", "max pos dev", "mean speed dev");
+	for(u32 i = 0; i < sample_count; ++i) {
+		printf("%8u %16.6f %16.6f %18.6f\n", samples[i].step, samples[i].mean_deviation, samples[i].max_deviation, samples[i].mean_speed_deviation);
+	}
+
+	f32 full_error = sph_density_error(&full_arena, &full);
+	f32 compact_error = sph_density_error(&compact_arena, &compact);
+	u32 full_bytes = sph_streamed_bytes_per_particle<dim, sph_layout_full>();
+	u32 compact_bytes = sph_streamed_bytes_per_particle<dim, sph_layout_compact>();
+
+	vec resolution;
+	auto view = sph_layout_compact::position_view<dim>(nullptr, &params);
+	for(u32 k = 0; k < dim; ++k) resolution.E[k] = view.to_world.E[k];
+
+	printf("position resolution: %.6f (%.4f of smoothing radius)\n", resolution.E[0], resolution.E[0] / params.smoothing_radius);
+	printf("%-10s %18s %14s %16s %14s\n", "layout", "density error", "ms / step", "bytes / particle", "state MB");
+	printf("%-10s %18.5f %14.3f %16u %14.2f\n", "full", full_error, full_seconds * 1000.0 / steps, full_bytes, (f64)full_bytes * particle_count / (1 << 20));
+	printf("%-10s %18.5f %14.3f %16u %14.2f\n", "compact", compact_error, compact_seconds * 1000.0 / steps, compact_bytes, (f64)compact_bytes * particle_count / (1 << 20));
+	printf("streamed particle state reduced by %.1f%%\n", 100.0 * (1.0 - (f64)compact_bytes / full_bytes));
+
+	free(full_arena.base);
+	free(compact_arena.base);
+}
+
+int main(int argc, char** argv) {
+	u32 particle_count	= argc > 1 ? atoi(argv[1]) : 4096;
+	u32 steps			= argc > 2 ? atoi(argv[2]) : 480;
+	solver_mode mode	= (argc > 3 && strcmp(argv[3], "pbf") == 0) ? solver_mode_pbf : solver_mode_wcsph;
+	bool three_d		= argc > 4 && strcmp(argv[4], "3d") == 0;
+
+	if(three_d) run<3>(particle_count, steps, mode);
+	else		run<2>(particle_count, steps, mode);
+	return 0;
+}
@@ -0,0 +1,164 @@
+// NOTE(DH): Marching squares surface of a running simulation. Each frame the surface is meshed three times on the
+// job system: incrementally (only dirty tiles), fully re-meshed, and incrementally with move_threshold = 0, which
+// has to match the full re-mesh exactly. A fourth surface runs on the calling thread alone and has to match too.
+// Reports time per update for the incremental and full paths, over the whole run and its second half, how many
+// tiles were re-meshed and how far the thresholded vertex count is from the full one, then draws the last frame's
+// contour over the particles into a PPM. Scenes:
+//  - moving:   PBF dam break, measured from the start, the block collapses and sloshes for the whole run,
+//  - settling: the same block with WCSPH, stepped `warmup` frames unmeasured first so it is coming to rest,
+//  - sparse:   WCSPH drops over a large box, most tiles never see a particle, warmed up until they have spread.
+// Settling and sparse are where the incremental path wins, on moving fluid nearly every fluid tile is dirty anyway
+// and the marking pass is overhead, that is what `full_remesh` is for.
+//
+// clang++ ./junk/sim_benchmarks/fluid_surface.cpp -o ./bin/fluid_surface -std=c++20 -O2 -mavx -I ./src -lpthread
+// ./bin/fluid_surface [moving|settling|sparse] [particles] [frames] [warmup] [lines|triangles] [out.ppm]
+
+#include "../../src/fluid_surface.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+void* allocate_memory(void*, size_t size) { return malloc(size);}
+
+static func plot(u8 *pixels, u32 width, u32 height, i32 x, i32 y, u8 r, u8 g, u8 b) -> void {
+	if(x < 0 || y < 0 || x >= (i32)width || y >= (i32)height) return;
+	u8 *p = pixels + (y * width + x) * 3;
+	p[0] = r; p[1] = g; p[2] = b;
+}
+
+static func same_output(fluid_surface *a, fluid_surface *b) -> bool {
+	return a->vertex_count == b->vertex_count && memcmp(a->vertices, b->vertices, sizeof(v2) * a->vertex_count) == 0;
+}
+
+int main(int argc, char** argv) {
+	const char *scene	= argc > 1 ? argv[1] : "moving";
+	u32 particle_count	= argc > 2 ? atoi(argv[2]) : 4096;
+	bool settling		= strcmp(scene, "settling") == 0;
+	bool sparse			= strcmp(scene, "sparse") == 0;
+	u32 frame_count		= argc > 3 ? atoi(argv[3]) : 480;
+	u32 warmup_count	= argc > 4 ? atoi(argv[4]) : settling ? 1800 : sparse ? 1200 : 0;
+	bool triangles		= argc > 5 && strcmp(argv[5], "triangles") == 0;
+	const char *out		= argc > 6 ? argv[6] : "surface.ppm";
+
+	sph_params<2> params = sph_default_params<2>();
+	params.mode							= solver_mode_pbf;
+	params.gravity						= -12.0f;
+	params.smoothing_radius 			= 0.35f;
+	params.target_density 				= 55.0f;
+	params.bounds_size					= V2(17.0f, 9.0f);
+	if(settling || sparse) {
+		params.mode						= solver_mode_wcsph;
+		params.pressure_multiplier 		= 500.0f;
+		params.near_pressure_multiplier = 18.0f;
+		params.viscosity_strength		= 0.06f;
+	}
+	if(sparse) params.bounds_size		= V2(48.0f, 27.0f);
+
+	memory_arena arena = initialize_arena(Megabytes(64) + (usize)particle_count * 256);
+	sph_state<2> s = sph_create<2>(&arena, particle_count, params);
+	sph_spawn_grid(&arena, &s, params.particle_size * 2 + 0.03f);
+	if(sparse) {
+		// NOTE(DH): Drops of 256 particles spread over the box, each a small block around its own centre
+		auto positions = arena.get_array(s.positions);
+		u32 drop_size = 256, drops = (particle_count + drop_size - 1) / drop_size;
+		for(u32 i = 0; i < particle_count; ++i) {
+			u32 drop = i / drop_size;
+			v2 centre = V2(params.bounds_size.x * ((drop + 0.5f) / drops - 0.5f), params.bounds_size.y * (drop % 2 ? 0.25f : -0.1f));
+			positions[i] = centre + sph_grid_position<2>(i % drop_size, drop_size, params.particle_size * 2 + 0.03f);
+		}
+	}
+
+	fluid_surface_settings settings = fluid_surface_default_settings(params.target_density);
+	settings.output = triangles ? fluid_surface_triangles : fluid_surface_lines;
+	fluid_surface_settings full_settings = settings;
+	full_settings.full_remesh = true;
+	fluid_surface_settings exact_settings = settings;
+	exact_settings.move_threshold = 0.0f;
+
+	job_system *jobs = job_system::create();
+	fluid_surface incremental = fluid_surface::create(default_allocator, params.bounds_size, settings, jobs);
+	fluid_surface full = fluid_surface::create(default_allocator, params.bounds_size, full_settings, jobs);
+	fluid_surface exact = fluid_surface::create(default_allocator, params.bounds_size, exact_settings, jobs);
+	fluid_surface serial = fluid_surface::create(default_allocator, params.bounds_size, full_settings, nullptr);
+
+	f64 incremental_ms[2] = {}, full_ms[2] = {};
+	u64 remeshed[2] = {};
+	f64 vertex_difference = 0;
+	u32 mismatches = 0;
+
+	for(u32 frame = 0; frame < warmup_count; ++frame) sph_step(&arena, &s, 1.0f / 120.0f);
+
+	for(u32 frame = 0; frame < frame_count; ++frame) {
+		sph_step(&arena, &s, 1.0f / 120.0f);
+		u32 half = frame * 2 >= frame_count;
+
+		auto t0 = std::chrono::high_resolution_clock::now();
+		incremental.update(&arena, &s);
+		auto t1 = std::chrono::high_resolution_clock::now();
+		full.update(&arena, &s);
+		auto t2 = std::chrono::high_resolution_clock::now();
+		exact.update(&arena, &s);
+		serial.update(&arena, &s);
+
+		incremental_ms[half] += std::chrono::duration<f64, std::milli>(t1 - t0).count();
+		full_ms[half] += std::chrono::duration<f64, std::milli>(t2 - t1).count();
+		remeshed[half] += incremental.stats.tiles_remeshed;
+		vertex_difference += fabs((f64)incremental.vertex_count - full.vertex_count) / std::max(1u, full.vertex_count);
+		mismatches += same_output(&exact, &full) && same_output(&serial, &full) ? 0 : 1;
+	}
+
+	u32 second = frame_count / 2;
+	printf("%s: particles: %u, frames: %u after %u warmup, %s, grid %ux%u cells, %u tiles, %u workers\n", scene, particle_count,
+		frame_count, warmup_count, triangles ? "triangles" : "lines", incremental.cells_x, incremental.cells_y, incremental.stats.tiles, jobs->worker_count);
+	printf("                 whole run          second half\n");
+	printf("incremental:  %8.3f ms/update  %8.3f ms/update\n", (incremental_ms[0] + incremental_ms[1]) / frame_count, incremental_ms[1] / std::max(second, 1u));
+	printf("full re-mesh: %8.3f ms/update  %8.3f ms/update\n", (full_ms[0] + full_ms[1]) / frame_count, full_ms[1] / std::max(second, 1u));
+	printf("tiles re-meshed:  %6.1f/update  %11.1f/update\n", (f64)(remeshed[0] + remeshed[1]) / frame_count, (f64)remeshed[1] / std::max(second, 1u));
+	printf("incremental vertex count off by %.2f%% from full\n", vertex_difference * 100.0 / frame_count);
+	printf("frames where threshold 0 or the calling thread differ from full: %u\n", mismatches);
+	printf("last frame: %u vertices\n", incremental.vertex_count);
+
+	// NOTE(DH): Particles grey, surface white, world y up
+	u32 width = 1280, height = 720;
+	u8 *pixels = (u8*)calloc(width * height, 3);
+	f32 scale = std::min(width / params.bounds_size.x, height / params.bounds_size.y);
+	auto to_screen = [&](v2 p) { return V2(width * 0.5f + p.x * scale, height * 0.5f - p.y * scale); };
+
+	auto positions = arena.get_array(s.positions);
+	for(u32 i = 0; i < particle_count; ++i) {
+		v2 p = to_screen(positions[i]);
+		plot(pixels, width, height, (i32)p.x, (i32)p.y, 60, 90, 140);
+	}
+
+	u32 stride = triangles ? 3 : 2;
+	for(u32 v = 0; v + stride <= incremental.vertex_count; v += stride) {
+		for(u32 e = 0; e < stride; ++e) {
+			v2 a = to_screen(incremental.vertices[v + e]);
+			v2 b = to_screen(incremental.vertices[v + (e + 1) % stride]);
+			u32 steps = (u32)std::max(fabsf(b.x - a.x), fabsf(b.y - a.y)) + 1;
+			for(u32 i = 0; i <= steps; ++i) {
+				v2 p = a + (b - a) * ((f32)i / steps);
+				plot(pixels, width, height, (i32)p.x, (i32)p.y, 255, 255, 255);
+			}
+			if(stride == 2) break;
+		}
+	}
+
+	FILE *file = fopen(out, "wb");
+	if(file) {
+		fprintf(file, "P6\n%u %u\n255\n", width, height);
+		fwrite(pixels, 1, width * height * 3, file);
+		fclose(file);
+		printf("written to %s\n", out);
+	}
+
+	free(pixels);
+	incremental.destroy();
+	full.destroy();
+	exact.destroy();
+	serial.destroy();
+	jobs->destroy();
+	free(arena.base);
+	return 0;
+}
@@ -0,0 +1,124 @@
+// NOTE(DH): Row span neighbour search against the hashed 9-cell (3D: 27-cell) loop. The fluid is settled once,
+// then both searches run on the very same particles: spatial lookup rebuild, one density pass and a whole solver
+// step are timed separately. Neighbour counts and density sums have to match, otherwise a search lost particles.
+//
+// clang++ ./junk/sim_benchmarks/neighbour_search.cpp -o ./bin/neighbour_search -std=c++20 -O2 -mavx -I ./src
+// ./bin/neighbour_search [particles] [repeats] [3d]
+
+#include "../../src/simulation_of_particles_core.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+void* allocate_memory(void* base, size_t size) { return malloc(size);}
+
+static const char *search_names[] = {"row spans", "hashed cells"};
+
+struct search_result {
+	f64 lookup_ms;
+	f64 density_ms;
+	f64 step_ms;
+	u64 neighbours;
+	f64 density_sum;
+};
+
+template<u32 dim>
+static func measure(memory_arena *arena, sph_state<dim> *settled, sph_neighbour_search search, u32 repeats) -> search_result {
+	using clock = std::chrono::high_resolution_clock;
+
+	search_result result = {};
+	sph_state<dim> s = *settled;
+	s.params.neighbour_search = search;
+	u32 count = s.positions.count;
+	sph_kernel_factors k = sph_dim<dim>::kernel_factors(s.params.smoothing_radius);
+	auto positions = arena->get_array(s.positions);
+	auto predicted = arena->get_array(s.predicted_positions);
+
+	for(u32 r = 0; r < repeats; ++r) {
+		for(u32 i = 0; i < count; ++i) predicted[i] = positions[i];
+
+		auto t0 = clock::now();
+		sph_update_spatial_lookup(arena, &s);
+		auto t1 = clock::now();
+
+		f64 density_sum = 0;
+		for(u32 i = 0; i < count; ++i) density_sum += sph_calculate_density(arena, &s, k, predicted[i]).x;
+		auto t2 = clock::now();
+
+		result.lookup_ms += std::chrono::duration<f64, std::milli>(t1 - t0).count();
+		result.density_ms += std::chrono::duration<f64, std::milli>(t2 - t1).count();
+		result.density_sum = density_sum;
+	}
+
+	result.neighbours = 0;
+	for(u32 i = 0; i < count; ++i) {
+		sph_foreach_neighbour(arena, &s, predicted, predicted[i], [&](u32, auto, f32) { ++result.neighbours; });
+	}
+
+	result.lookup_ms /= repeats;
+	result.density_ms /= repeats;
+	return result;
+}
+
+template<u32 dim>
+static func run(u32 particle_count, u32 repeats) -> void {
+	sph_params<dim> params = sph_default_params<dim>();
+	params.mode							= solver_mode_pbf;
+	params.gravity						= -12.0f;
+	params.smoothing_radius 			= 0.35f;
+	params.target_density 				= dim == 2 ? 55.0f : 150.0f;
+	params.bounds_size.x				= 17.0f;
+	params.bounds_size.y				= 9.0f;
+	if constexpr (dim == 3) params.bounds_size.z = 6.0f;
+
+	memory_arena arena = initialize_arena(Megabytes(128) + (usize)particle_count * 256);
+	sph_state<dim> s = sph_create<dim>(&arena, particle_count, params);
+	sph_spawn_grid(&arena, &s, params.particle_size * 2 + 0.03f);
+
+	// NOTE(DH): Let the block collapse so particles are spread like in a running simulation
+	for(u32 i = 0; i < 120; ++i) sph_step(&arena, &s, 1.0f / 120.0f);
+
+	printf("%uD, %u particles, %u repeats, grid %u cells\n", dim, particle_count, repeats, sph_grid_for_capacity(&s.params, s.cell_starts.capacity).cell_count);
+	printf("%-14s %12s %12s %12s %14s %16s\n", "search", "lookup ms", "density ms", "step ms", "neighbours", "density sum");
+
+	search_result results[2];
+	for(u32 m = 0; m < 2; ++m) {
+		results[m] = measure(&arena, &s, (sph_neighbour_search)m, repeats);
+	}
+
+	// NOTE(DH): Whole steps last, they move the particles; each search steps its own copy of the settled state
+	usize snapshot_used = arena.used;
+	for(u32 m = 0; m < 2; ++m) {
+		sph_state<dim> copy = sph_create<dim>(&arena, particle_count, params);
+		copy.params.neighbour_search = (sph_neighbour_search)m;
+		memcpy(arena.get_array(copy.positions), arena.get_array(s.positions), sizeof(typename sph_dim<dim>::vec) * particle_count);
+		memcpy(arena.get_array(copy.velocities), arena.get_array(s.velocities), sizeof(typename sph_dim<dim>::vec) * particle_count);
+
+		auto start = std::chrono::high_resolution_clock::now();
+		for(u32 r = 0; r < repeats; ++r) sph_step(&arena, &copy, 1.0f / 120.0f);
+		auto end = std::chrono::high_resolution_clock::now();
+		results[m].step_ms = std::chrono::duration<f64, std::milli>(end - start).count() / repeats;
+		arena.used = snapshot_used;
+	}
+
+	for(u32 m = 0; m < 2; ++m) {
+		search_result r = results[m];
+		printf("%-14s %12.3f %12.3f %12.3f %14llu %16.3f\n", search_names[m], r.lookup_ms, r.density_ms, r.step_ms, (unsigned long long)r.neighbours, r.density_sum);
+	}
+	printf("row spans speedup: lookup x%.2f, density x%.2f, step x%.2f\n", results[1].lookup_ms / results[0].lookup_ms,
+		results[1].density_ms / results[0].density_ms, results[1].step_ms / results[0].step_ms);
+	if(results[0].neighbours != results[1].neighbours) printf("neighbour counts differ!\n");
+
+	free(arena.base);
+}
+
+int main(int argc, char** argv) {
+	u32 particle_count	= argc > 1 ? atoi(argv[1]) : 4096;
+	u32 repeats			= argc > 2 ? atoi(argv[2]) : 20;
+	bool three_d		= argc > 3 && strcmp(argv[3], "3d") == 0;
+
+	if(three_d) run<3>(particle_count, repeats);
+	else		run<2>(particle_count, repeats);
+	return 0;
+}
@@ -0,0 +1,98 @@
+// NOTE(DH): Fountain and drain on the dynamic particle pool. An emitter shoots particles in from the top left,
+// a sink drains the bottom right corner, so the live count settles where inflow matches outflow. Runs the same
+// scene without and with periodic compaction (cell order reordering) and checks the id <-> slot tables at the end.
+//
+// clang++ ./junk/sim_benchmarks/particle_pool.cpp -o ./bin/particle_pool -std=c++20 -O2 -mavx -I ./src
+// ./bin/particle_pool [capacity] [start alive] [seconds] [emit rate]
+
+#include "../../src/simulation_of_particles_pool.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+void* allocate_memory(void*, size_t size) { return malloc(size);}
+
+struct pool_run {
+	f64 step_ms;
+	f64 update_ms;
+	u32 alive_min;
+	u32 alive_max;
+	u32 alive_final;
+	bool tables_ok;
+};
+
+static func run(u32 capacity, u32 start_alive, f32 seconds, f32 rate, u32 compact_interval, bool print_timeline) -> pool_run {
+	sph_params<2> params = sph_default_params<2>();
+	params.mode							= solver_mode_pbf;
+	params.gravity						= -12.0f;
+	params.smoothing_radius 			= 0.35f;
+	params.target_density 				= 55.0f;
+	params.bounds_size					= V2(17.0f, 9.0f);
+
+	memory_arena arena = initialize_arena(Megabytes(16) + (usize)capacity * 256);
+	sph_state<2> s = sph_create<2>(&arena, capacity, params);
+	sph_pool pool = sph_pool_create(&arena, &s, start_alive, compact_interval);
+	sph_spawn_grid(&arena, &s, params.particle_size * 2 + 0.03f);
+
+	sph_emitter<2> emitter = {.position = V2(-7.5f, 3.5f), .velocity = V2(9.0f, 0.0f), .rate = rate, .spread = 0.2f, .accumulator = 0};
+	sph_sink<2> sink = {.lo = V2(6.0f, -5.0f), .hi = V2(9.0f, -3.0f)};
+
+	f32 dt = 1.0f / 120.0f;
+	u32 steps = (u32)(seconds / dt);
+	pool_run result = {};
+	result.alive_min = UINT_MAX;
+
+	if(print_timeline) printf("%8s %10s %12s %12s\n", "time s", "alive", "spawned", "despawned");
+
+	for(u32 step = 0; step < steps; ++step) {
+		auto t0 = std::chrono::high_resolution_clock::now();
+		sph_step(&arena, &s, dt);
+		auto t1 = std::chrono::high_resolution_clock::now();
+		sph_pool_update(&arena, &s, &pool, &emitter, 1, &sink, 1, dt);
+		auto t2 = std::chrono::high_resolution_clock::now();
+
+		result.step_ms += std::chrono::duration<f64, std::milli>(t1 - t0).count();
+		result.update_ms += std::chrono::duration<f64, std::milli>(t2 - t1).count();
+		result.alive_min = std::min(result.alive_min, pool.alive);
+		result.alive_max = std::max(result.alive_max, pool.alive);
+
+		if(print_timeline && (step + 1) % 120 == 0) {
+			printf("%8.1f %10u %12u %12u\n", (step + 1) * dt, pool.alive, pool.spawned, pool.despawned);
+		}
+	}
+
+	result.step_ms /= steps;
+	result.update_ms /= steps;
+	result.alive_final = pool.alive;
+
+	// NOTE(DH): Every live slot maps back to its id, every free id is dead and nothing is counted twice
+	auto ids = arena.get_array(pool.ids);
+	auto slots = arena.get_array(pool.slots);
+	result.tables_ok = pool.alive + pool.free_ids.count == capacity && s.positions.count == pool.alive;
+	for(u32 i = 0; i < pool.alive; ++i) result.tables_ok = result.tables_ok && slots[ids[i]] == i;
+	auto free_ids = arena.get_array(pool.free_ids);
+	for(u32 i = 0; i < pool.free_ids.count; ++i) result.tables_ok = result.tables_ok && slots[free_ids[i]] == sph_pool_invalid;
+
+	if(print_timeline) printf("compactions: %u\n", pool.compactions);
+
+	free(arena.base);
+	return result;
+}
+
+int main(int argc, char** argv) {
+	u32 capacity	= argc > 1 ? atoi(argv[1]) : 8192;
+	u32 start_alive	= argc > 2 ? atoi(argv[2]) : 2048;
+	f32 seconds		= argc > 3 ? atof(argv[3]) : 10.0f;
+	f32 rate		= argc > 4 ? atof(argv[4]) : 600.0f;
+
+	printf("capacity %u, starting with %u, emitting %.0f/s for %.1f s\n", capacity, start_alive, rate, seconds);
+
+	pool_run plain = run(capacity, start_alive, seconds, rate, 0, false);
+	pool_run compacted = run(capacity, start_alive, seconds, rate, 30, true);
+
+	printf("%-18s %10s %12s %10s %10s %10s %8s\n", "compaction", "step ms", "update ms", "alive min", "alive max", "final", "tables");
+	printf("%-18s %10.3f %12.4f %10u %10u %10u %8s\n", "never", plain.step_ms, plain.update_ms, plain.alive_min, plain.alive_max, plain.alive_final, plain.tables_ok ? "ok" : "BROKEN");
+	printf("%-18s %10.3f %12.4f %10u %10u %10u %8s\n", "every 30 updates", compacted.step_ms, compacted.update_ms, compacted.alive_min, compacted.alive_max, compacted.alive_final, compacted.tables_ok ? "ok" : "BROKEN");
+	return 0;
+}
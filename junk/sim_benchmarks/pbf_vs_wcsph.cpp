@@ -0,0 +1,127 @@
+// NOTE(DH): Throughput of the CPU particle solvers measured in simulated seconds per wall second, and the dt
+// each one survives. On this scene (2D, 4096 particles) WCSPH holds up to dt x4 and blows up at x8, PBF still
+// holds at x8 (and goes at x12). A PBF step costs several WCSPH steps though, so WCSPH at its largest stable dt
+// still simulates faster; what PBF buys is the lower density error (less compression) and the bigger dt.
+// Only the solver core is used, so this builds without the device layer:
+//
+// clang .\junk\sim_benchmarks\pbf_vs_wcsph.cpp -o .\bin\pbf_vs_wcsph.exe -std=c++20 -O2 -mavx -I .\src
+// Pass "3d" as the third argument to run the same comparison on the 27-cell 3D solver.
+
+#include "../../src/simulation_of_particles_core.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+void* allocate_memory(void* base, size_t size) { return malloc(size);}
+
+struct bench_config {
+	const char* name;
+	solver_mode mode;
+	f32 delta_time;
+	u32 pbf_iterations;
+};
+
+struct bench_result {
+	f32 wall_seconds;
+	f32 simulated_seconds;
+	f32 max_speed;
+	f32 mean_density_error;
+	bool exploded;
+};
+
+template<u32 dim>
+static func setup_fluid(solver_mode mode, u32 pbf_iterations) -> sph_params<dim> {
+	sph_params<dim> params = sph_default_params<dim>();
+	params.mode							= mode;
+	params.pbf.iterations				= pbf_iterations;
+	params.gravity						= -12.0f;
+	params.collision_damping			= 0.95f;
+	params.smoothing_radius 			= 0.35f;
+	params.target_density 				= dim == 2 ? 55.0f : 150.0f;
+	params.pressure_multiplier 			= 500.0f;
+	params.near_pressure_multiplier 	= 18.0f;
+	params.viscosity_strength 			= 0.06f;
+	params.bounds_size.x				= 17.0f;
+	params.bounds_size.y				= 9.0f;
+	if constexpr (dim == 3) params.bounds_size.z = 6.0f;
+	return params;
+}
+
+template<u32 dim>
+static func run(bench_config cfg, u32 particle_count, f32 simulated_seconds) -> bench_result {
+	memory_arena arena = initialize_arena(Megabytes(64));
+	sph_state<dim> s = sph_create<dim>(&arena, particle_count, setup_fluid<dim>(cfg.mode, cfg.pbf_iterations));
+	sph_spawn_grid(&arena, &s, s.params.particle_size * 2 + 0.03f);
+
+	u32 steps = (u32)(simulated_seconds / cfg.delta_time);
+
+	auto start = std::chrono::high_resolution_clock::now();
+	for(u32 i = 0; i < steps; ++i) {
+		sph_step(&arena, &s, cfg.delta_time);
+	}
+	auto end = std::chrono::high_resolution_clock::now();
+	std::chrono::duration<f32> duration = end - start;
+
+	bench_result result = {};
+	result.wall_seconds = duration.count();
+	result.simulated_seconds = steps * cfg.delta_time;
+
+	auto velocities = arena.get_array(s.velocities);
+	auto positions = arena.get_array(s.positions);
+	for(u32 i = 0; i < particle_count; ++i) {
+		for(u32 k = 0; k < dim; ++k) if(!std::isfinite(positions[i].E[k])) result.exploded = true;
+		if(result.exploded) break;
+		result.max_speed = fmax(result.max_speed, SquareRoot(LengthSq(velocities[i])));
+	}
+
+	// NOTE(DH): The walls keep positions finite, so a blow up mostly shows as speed: nothing in a box of height H
+	// can go faster than free fall over H, twice that means the solver is pumping energy in
+	f32 free_fall_speed = SquareRoot(2.0f * fabsf(s.params.gravity) * s.params.bounds_size.y);
+	if(result.max_speed > 2.0f * free_fall_speed) result.exploded = true;
+
+	result.mean_density_error = sph_density_error(&arena, &s);
+
+	free(arena.base);
+	return result;
+}
+
+template<u32 dim>
+static func run_all(u32 particle_count, f32 simulated_seconds) -> void {
+	f32 base_dt = 1.0f / 480.0f;
+
+	bench_config configs[] = {
+		{"wcsph  dt x1", solver_mode_wcsph, base_dt,         0},
+		{"wcsph  dt x4", solver_mode_wcsph, base_dt * 4.0f,  0},
+		{"wcsph  dt x8", solver_mode_wcsph, base_dt * 8.0f,  0},
+		{"pbf    dt x4", solver_mode_pbf,   base_dt * 4.0f,  3},
+		{"pbf    dt x8", solver_mode_pbf,   base_dt * 8.0f,  4},
+		{"pbf    dt x12", solver_mode_pbf,  base_dt * 12.0f, 4},
+	};
+
+	printf("%uD, particles: %u, simulated: %.2f s\n", dim, particle_count, simulated_seconds);
+	printf("%-14s %10s %14s %12s %14s %10s\n", "solver", "wall s", "sim s/wall s", "max speed", "density err %", "stable");
+
+	f32 reference_throughput = 0;
+	for(u32 i = 0; i < sizeof(configs) / sizeof(configs[0]); ++i) {
+		bench_result r = run<dim>(configs[i], particle_count, simulated_seconds);
+		f32 throughput = r.simulated_seconds / r.wall_seconds;
+		if(i == 0) reference_throughput = throughput;
+
+		printf("%-14s %10.3f %14.3f %12.3f %14.2f %10s  (x%.2f)\n",
+			configs[i].name, r.wall_seconds, throughput, r.max_speed, r.mean_density_error * 100.0f,
+			r.exploded ? "no" : "yes", throughput / reference_throughput);
+	}
+}
+
+int main(int argc, char** argv) {
+	u32 particle_count = argc > 1 ? atoi(argv[1]) : 4096;
+	f32 simulated_seconds = argc > 2 ? atof(argv[2]) : 2.0f;
+	bool is_3d = argc > 3 && strcmp(argv[3], "3d") == 0;
+
+	if(is_3d) 	run_all<3>(particle_count, simulated_seconds);
+	else 		run_all<2>(particle_count, simulated_seconds);
+
+	return 0;
+}
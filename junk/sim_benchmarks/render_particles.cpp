@@ -0,0 +1,91 @@
+// NOTE(DH): Headless simulation + CPU particle renderer. Reports render time per frame for several thread
+// counts and writes the last frame as a PPM, which is what regression images are compared against.
+//
+// clang++ ./junk/sim_benchmarks/render_particles.cpp -o ./bin/render_particles -std=c++20 -O2 -mavx -I ./src -lpthread
+// ./bin/render_particles [particles] [frames] [width] [height] [out.ppm]
+
+#include "../../src/simulation_of_particles_core.h"
+#include "../../src/particle_renderer.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+void* allocate_memory(void* base, size_t size) { return malloc(size);}
+
+static func write_ppm(const char *path, image_buffer *img) -> bool {
+	FILE *file = fopen(path, "wb");
+	if(!file) return false;
+	fprintf(file, "P6\n%u %u\n255\n", img->width, img->height);
+	for(u32 i = 0; i < img->width * img->height; ++i) {
+		u8 pixel[3] = {img->render_img[i].r, img->render_img[i].g, img->render_img[i].b};
+		fwrite(pixel, 1, 3, file);
+	}
+	fclose(file);
+	return true;
+}
+
+int main(int argc, char** argv) {
+	u32 particle_count	= argc > 1 ? atoi(argv[1]) : 16384;
+	u32 frame_count		= argc > 2 ? atoi(argv[2]) : 120;
+	u32 width			= argc > 3 ? atoi(argv[3]) : 1280;
+	u32 height			= argc > 4 ? atoi(argv[4]) : 720;
+	const char *out		= argc > 5 ? argv[5] : "particles.ppm";
+
+	sph_params<2> params = sph_default_params<2>();
+	params.mode							= solver_mode_pbf;
+	params.gravity						= -12.0f;
+	params.smoothing_radius 			= 0.35f;
+	params.target_density 				= 55.0f;
+	params.bounds_size					= V2(17.0f, 9.0f);
+
+	image_buffer img = {};
+	img.width = width;
+	img.height = height;
+	img.render_img = (rgba*)malloc(sizeof(rgba) * width * height);
+
+	particle_render_settings settings = particle_render_default_settings(params.bounds_size, params.particle_size);
+	settings.max_velocity = 6.0f;
+
+	u32 thread_counts[] = {1, 2, 4, 0};
+	f64 render_ms[4] = {};
+
+	printf("particles: %u, frames: %u, image: %ux%u, hardware threads: %u\n", particle_count, frame_count, width, height, std::thread::hardware_concurrency());
+
+	// NOTE(DH): One job system per configuration for the whole run, like an app would keep it. The simulation is
+	// replayed from the same start for each one, so every configuration renders the same frames
+	for(u32 c = 0; c < 4; ++c) {
+		memory_arena arena = initialize_arena(Megabytes(64));
+		sph_state<2> s = sph_create<2>(&arena, particle_count, params);
+		sph_spawn_grid(&arena, &s, params.particle_size * 2 + 0.03f);
+
+		job_system *jobs = job_system::create(thread_counts[c]);
+		particle_renderer renderer = particle_renderer::create(default_allocator, jobs);
+
+		for(u32 frame = 0; frame < frame_count; ++frame) {
+			sph_step(&arena, &s, 1.0f / 120.0f);
+
+			auto start = std::chrono::high_resolution_clock::now();
+			renderer.render(&img, arena.get_array(s.positions), arena.get_array(s.velocities), particle_count, settings);
+			auto end = std::chrono::high_resolution_clock::now();
+			if(frame > 0) render_ms[c] += std::chrono::duration<f64, std::milli>(end - start).count();	// NOTE(DH): First frame sizes the bins
+		}
+
+		renderer.destroy();
+		jobs->destroy();
+		free(arena.base);
+	}
+
+	printf("%-10s %14s %10s\n", "threads", "ms / frame", "fps");
+	for(u32 c = 0; c < 4; ++c) {
+		f64 ms = render_ms[c] / (frame_count > 1 ? frame_count - 1 : 1);
+		u32 threads = thread_counts[c] ? thread_counts[c] : std::max(1u, std::thread::hardware_concurrency());
+		printf("%-10u %14.3f %10.1f\n", threads, ms, 1000.0 / ms);
+	}
+
+	if(!write_ppm(out, &img)) printf("can't write %s\n", out);
+	else printf("last frame written to %s\n", out);
+
+	free(img.render_img);
+	return 0;
+}
@@ -0,0 +1,150 @@
+// NOTE(DH): Spatial query API against brute force over all particles. Every query type runs at random places in a
+// settled fluid, results must match the brute force answer exactly; timings show how much the grid saves.
+//
+// clang++ ./junk/sim_benchmarks/spatial_queries.cpp -o ./bin/spatial_queries -std=c++20 -O2 -mavx -I ./src
+// ./bin/spatial_queries [particles] [queries] [3d]
+
+#include "../../src/simulation_of_particles_core.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+void* allocate_memory(void* base, size_t size) { return malloc(size);}
+
+using bench_clock = std::chrono::high_resolution_clock;
+
+static func elapsed_ms(bench_clock::time_point start) -> f64 {
+	return std::chrono::duration<f64, std::milli>(bench_clock::now() - start).count();
+}
+
+template<u32 dim>
+static func run(u32 particle_count, u32 query_count) -> void {
+	using vec = typename sph_dim<dim>::vec;
+
+	sph_params<dim> params = sph_default_params<dim>();
+	params.mode							= solver_mode_pbf;
+	params.gravity						= -12.0f;
+	params.smoothing_radius 			= 0.35f;
+	params.target_density 				= dim == 2 ? 55.0f : 150.0f;
+	params.bounds_size.x				= 17.0f;
+	params.bounds_size.y				= 9.0f;
+	if constexpr (dim == 3) params.bounds_size.z = 6.0f;
+
+	memory_arena arena = initialize_arena(Megabytes(64) + (usize)particle_count * 256);
+	sph_state<dim> s = sph_create<dim>(&arena, particle_count, params);
+	sph_spawn_grid(&arena, &s, params.particle_size * 2 + 0.03f);
+	for(u32 i = 0; i < 120; ++i) sph_step(&arena, &s, 1.0f / 120.0f);
+
+	// NOTE(DH): Queries run on current positions against the lookup of predicted ones, like the app does
+	auto positions = arena.get_array(s.positions);
+	auto query = sph_make_query(&arena, &s, positions, params.smoothing_radius);
+
+	std::mt19937 rng(7);
+	auto random_point = [&]() {
+		vec p;
+		for(u32 k = 0; k < dim; ++k) p.E[k] = std::uniform_real_distribution<f32>(-0.5f, 0.5f)(rng) * params.bounds_size.E[k];
+		return p;
+	};
+
+	u32 mismatches = 0;
+	f64 grid_ms[4] = {}, brute_ms[4] = {};
+	u64 grid_hits[4] = {}, brute_hits[4] = {};
+
+	for(u32 q = 0; q < query_count; ++q) {
+		vec centre = random_point();
+		vec other = random_point();
+		f32 radius = 0.2f + (q % 8) * 0.15f;
+
+		// NOTE(DH): Radius, hits are summed as index sums so a different set of particles shows up
+		u64 grid_sum = 0, brute_sum = 0;
+		auto t = bench_clock::now();
+		query.radius(centre, radius, [&](u32 idx, vec, f32) { grid_sum += idx + 1; ++grid_hits[0]; });
+		grid_ms[0] += elapsed_ms(t);
+		t = bench_clock::now();
+		for(u32 i = 0; i < particle_count; ++i) {
+			vec offset = positions[i] - centre;
+			if(Inner(offset, offset) <= radius * radius) { brute_sum += i + 1; ++brute_hits[0]; }
+		}
+		brute_ms[0] += elapsed_ms(t);
+		mismatches += grid_sum != brute_sum;
+
+		// NOTE(DH): AABB
+		vec lo, hi;
+		for(u32 k = 0; k < dim; ++k) { lo.E[k] = std::min(centre.E[k], centre.E[k] + radius); hi.E[k] = lo.E[k] + radius * 2.0f; }
+		grid_sum = brute_sum = 0;
+		t = bench_clock::now();
+		query.aabb(lo, hi, [&](u32 idx, vec) { grid_sum += idx + 1; ++grid_hits[1]; });
+		grid_ms[1] += elapsed_ms(t);
+		t = bench_clock::now();
+		for(u32 i = 0; i < particle_count; ++i) {
+			bool inside = true;
+			for(u32 k = 0; k < dim; ++k) inside = inside && positions[i].E[k] >= lo.E[k] && positions[i].E[k] <= hi.E[k];
+			if(inside) { brute_sum += i + 1; ++brute_hits[1]; }
+		}
+		brute_ms[1] += elapsed_ms(t);
+		mismatches += grid_sum != brute_sum;
+
+		// NOTE(DH): k nearest, compared by distance (ties may pick different particles)
+		constexpr u32 k_count = 16;
+		u32 indices[k_count]; f32 sqr_dsts[k_count];
+		f32 brute_dsts[k_count];
+		t = bench_clock::now();
+		u32 found = query.knn(centre, k_count, indices, sqr_dsts);
+		grid_ms[2] += elapsed_ms(t);
+		grid_hits[2] += found;
+		t = bench_clock::now();
+		u32 brute_found = 0;
+		for(u32 i = 0; i < particle_count; ++i) {
+			vec offset = positions[i] - centre;
+			f32 d = Inner(offset, offset);
+			if(brute_found == k_count && d >= brute_dsts[k_count - 1]) continue;
+			u32 at = brute_found < k_count ? brute_found++ : k_count - 1;
+			while(at > 0 && brute_dsts[at - 1] > d) { brute_dsts[at] = brute_dsts[at - 1]; --at; }
+			brute_dsts[at] = d;
+		}
+		brute_ms[2] += elapsed_ms(t);
+		brute_hits[2] += brute_found;
+		mismatches += found != brute_found;
+		for(u32 i = 0; i < std::min(found, brute_found); ++i) mismatches += sqr_dsts[i] != brute_dsts[i];
+
+		// NOTE(DH): Segment
+		f32 thickness = 0.1f + (q % 4) * 0.1f;
+		grid_sum = brute_sum = 0;
+		t = bench_clock::now();
+		query.segment(centre, other, thickness, [&](u32 idx, f32, f32) { grid_sum += idx + 1; ++grid_hits[3]; });
+		grid_ms[3] += elapsed_ms(t);
+		t = bench_clock::now();
+		vec ab = other - centre;
+		f32 ab_sqr = Inner(ab, ab);
+		for(u32 i = 0; i < particle_count; ++i) {
+			f32 along = ab_sqr > 0.0f ? Clamp01(Inner(positions[i] - centre, ab) / ab_sqr) : 0.0f;
+			vec offset = positions[i] - (centre + ab * along);
+			if(Inner(offset, offset) <= thickness * thickness) { brute_sum += i + 1; ++brute_hits[3]; }
+		}
+		brute_ms[3] += elapsed_ms(t);
+		mismatches += grid_sum != brute_sum;
+	}
+
+	const char *names[4] = {"radius", "aabb", "knn (16)", "segment"};
+	printf("%uD, %u particles, %u queries of each kind\n", dim, particle_count, query_count);
+	printf("%-10s %14s %14s %10s %12s\n", "query", "grid us/q", "brute us/q", "speedup", "hits/q");
+	for(u32 i = 0; i < 4; ++i) {
+		printf("%-10s %14.3f %14.3f %10.1f %12.1f\n", names[i], grid_ms[i] * 1000.0 / query_count, brute_ms[i] * 1000.0 / query_count,
+			brute_ms[i] / grid_ms[i], (f64)grid_hits[i] / query_count);
+	}
+	printf("mismatches against brute force: %u\n", mismatches);
+
+	free(arena.base);
+}
+
+int main(int argc, char** argv) {
+	u32 particle_count	= argc > 1 ? atoi(argv[1]) : 4096;
+	u32 query_count		= argc > 2 ? atoi(argv[2]) : 2000;
+	bool three_d		= argc > 3 && strcmp(argv[3], "3d") == 0;
+
+	if(three_d) run<3>(particle_count, query_count);
+	else		run<2>(particle_count, query_count);
+	return 0;
+}
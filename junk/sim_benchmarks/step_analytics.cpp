@@ -0,0 +1,101 @@
+// NOTE(DH): Overhead of per step analytics. Steps the solver, records stats after every step and measures how
+// long recording takes against the step itself. A reader thread follows the ring the whole time (like a monitor
+// UI would) and checks it only ever sees whole, in order entries. At the end the fused reduction is compared
+// against straightforward separate passes.
+//
+// clang++ ./junk/sim_benchmarks/step_analytics.cpp -o ./bin/step_analytics -std=c++20 -O2 -mavx -I ./src -lpthread
+// ./bin/step_analytics [particles] [steps] [wcsph|pbf]
+
+#include "../../src/simulation_of_particles_analytics.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+void* allocate_memory(void* base, size_t size) { return malloc(size);}
+
+int main(int argc, char** argv) {
+	u32 particle_count	= argc > 1 ? atoi(argv[1]) : 4096;
+	u32 steps			= argc > 2 ? atoi(argv[2]) : 600;
+	bool pbf			= argc > 3 && strcmp(argv[3], "pbf") == 0;
+
+	sph_params<2> params = sph_default_params<2>();
+	params.mode							= pbf ? solver_mode_pbf : solver_mode_wcsph;
+	params.gravity						= -12.0f;
+	params.smoothing_radius 			= 0.35f;
+	params.target_density 				= 55.0f;
+	params.pressure_multiplier 			= 500.0f;
+	params.near_pressure_multiplier 	= 18.0f;
+	params.viscosity_strength 			= 0.06f;
+	params.bounds_size					= V2(17.0f, 9.0f);
+	f32 dt = pbf ? 1.0f / 120.0f : 1.0f / 480.0f;
+
+	memory_arena arena = initialize_arena(Megabytes(16) + (usize)particle_count * 256);
+	sph_state<2> s = sph_create<2>(&arena, particle_count, params);
+	sph_spawn_grid(&arena, &s, params.particle_size * 2 + 0.03f);
+
+	static sph_stats_ring<2> ring = {};
+	std::atomic<bool> done = false;
+	u64 reader_entries = 0, reader_misses = 0, reader_out_of_order = 0, reader_latest = 0;
+
+	// NOTE(DH): Follows the ring entry by entry, falls behind on purpose now and then
+	std::thread reader([&]() {
+		u64 next = 0;
+		sph_step_stats<2> stats;
+		while(!done.load(std::memory_order_acquire) || next < ring.published.load()) {
+			if(ring.latest(&stats)) ++reader_latest;
+			u64 published = ring.published.load(std::memory_order_acquire);
+			if(published > next + 256) { reader_misses += published - 256 - next; next = published - 256; }
+			for(; next < published; ++next) {
+				if(!ring.read(next, &stats)) { ++reader_misses; continue; }
+				if(stats.step != next) ++reader_out_of_order;
+				++reader_entries;
+			}
+			std::this_thread::yield();
+		}
+	});
+
+	f64 step_seconds = 0, record_seconds = 0;
+	for(u32 step = 0; step < steps; ++step) {
+		auto t0 = std::chrono::high_resolution_clock::now();
+		sph_step(&arena, &s, dt);
+		auto t1 = std::chrono::high_resolution_clock::now();
+		sph_record_step(&arena, &s, &ring, step, (step + 1) * dt);
+		auto t2 = std::chrono::high_resolution_clock::now();
+		step_seconds += std::chrono::duration<f64>(t1 - t0).count();
+		record_seconds += std::chrono::duration<f64>(t2 - t1).count();
+	}
+	done.store(true, std::memory_order_release);
+	reader.join();
+
+	sph_step_stats<2> last;
+	ring.latest(&last);
+	printf("%s, %u particles, %u steps\n", pbf ? "pbf" : "wcsph", particle_count, steps);
+	printf("step %.3f ms, record %.4f ms, overhead %.3f%%\n", step_seconds * 1000.0 / steps, record_seconds * 1000.0 / steps, record_seconds * 100.0 / step_seconds);
+	printf("reader: %llu entries, %llu missed, %llu out of order, %llu latest reads\n", (unsigned long long)reader_entries,
+		(unsigned long long)reader_misses, (unsigned long long)reader_out_of_order, (unsigned long long)reader_latest);
+	printf("last: kinetic %.3f, max speed %.3f, density error mean %.4f max %.4f, bounds (%.3f %.3f) - (%.3f %.3f)\n",
+		last.kinetic_energy, last.max_speed, last.mean_density_error, last.max_density_error,
+		last.bounds_min.x, last.bounds_min.y, last.bounds_max.x, last.bounds_max.y);
+
+	// NOTE(DH): Reference, one pass per statistic
+	auto positions = arena.get_array(s.positions);
+	auto velocities = arena.get_array(s.velocities);
+	auto densities = arena.get_array(s.densities);
+	f64 kinetic = 0, max_speed = 0, error_sum = 0, error_max = 0;
+	v2 lo = V2(FLT_MAX, FLT_MAX), hi = V2(-FLT_MAX, -FLT_MAX);
+	for(u32 i = 0; i < particle_count; ++i) kinetic += 0.5 * Inner(velocities[i], velocities[i]);
+	for(u32 i = 0; i < particle_count; ++i) max_speed = std::max(max_speed, (f64)sqrtf(Inner(velocities[i], velocities[i])));
+	for(u32 i = 0; i < particle_count; ++i) error_sum += fabs((f64)densities[i].x - params.target_density) / params.target_density;
+	for(u32 i = 0; i < particle_count; ++i) error_max = std::max(error_max, fabs((f64)densities[i].x - params.target_density) / params.target_density);
+	for(u32 i = 0; i < particle_count; ++i) {
+		lo.x = std::min(lo.x, positions[i].x); lo.y = std::min(lo.y, positions[i].y);
+		hi.x = std::max(hi.x, positions[i].x); hi.y = std::max(hi.y, positions[i].y);
+	}
+	printf("reference: kinetic %.3f, max speed %.3f, density error mean %.4f max %.4f, bounds (%.3f %.3f) - (%.3f %.3f)\n",
+		kinetic, max_speed, error_sum / particle_count, error_max, lo.x, lo.y, hi.x, hi.y);
+
+	free(arena.base);
+	return 0;
+}
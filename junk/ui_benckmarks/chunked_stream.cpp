@@ -0,0 +1,141 @@
+// NOTE(DH): Building a big UI command stream (blocks with rects inside, commands of different sizes) with buffer,
+// which doubles and reallocs as it goes, and with chunked_buffer, then reading it back command by command.
+// "cold" starts every stream from an empty 256 byte buffer, "warm" reuses the one from the round before
+// (buffer keeps its capacity, chunked_buffer reset() keeps its chunks). Both read loops have to see the same
+// commands.
+//
+// clang++ ./junk/ui_benckmarks/chunked_stream.cpp -o ./bin/chunked_stream -std=c++20 -O2 -I .
+// ./bin/chunked_stream [commands] [rounds]
+
+#include "src/util/buffer.h"
+#include "src/util/chunked_buffer.h"
+
+#include <chrono>
+#include <cstdio>
+
+enum ui_draw_op : u8 {
+    udo_rect = 0,
+    udo_margin,
+    udo_block,
+    udo_block_end,
+};
+
+struct ui_rect_cmd   { ui_draw_op op; u16 width; u16 height; u32 color; };
+struct ui_margin_cmd { ui_draw_op op; u16 margin; };
+struct ui_block_cmd  { ui_draw_op op; };
+
+static func command_size(ui_draw_op op) -> u32 {
+    switch (op) {
+        case udo_rect:   return sizeof(ui_rect_cmd);
+        case udo_margin: return sizeof(ui_margin_cmd);
+        default:         return sizeof(ui_block_cmd);
+    }
+}
+
+// NOTE(DH): Same sequence for both, i decides what comes next
+static func command_at(u32 i, u8* out) -> u32 {
+    switch (i % 8) {
+        case 0: { ui_block_cmd c = {udo_block}; memcpy(out, &c, sizeof(c)); return sizeof(c); }
+        case 7: { ui_block_cmd c = {udo_block_end}; memcpy(out, &c, sizeof(c)); return sizeof(c); }
+        case 3: { ui_margin_cmd c = {udo_margin, (u16)i}; memcpy(out, &c, sizeof(c)); return sizeof(c); }
+        default: { ui_rect_cmd c = {udo_rect, (u16)i, (u16)(i >> 3), i * 2654435761u}; memcpy(out, &c, sizeof(c)); return sizeof(c); }
+    }
+}
+
+static func checksum_command(u8* cmd) -> u64 {
+    switch ((ui_draw_op)*cmd) {
+        case udo_rect:   { ui_rect_cmd c; memcpy(&c, cmd, sizeof(c)); return c.width + c.height * 3 + c.color; }
+        case udo_margin: { ui_margin_cmd c; memcpy(&c, cmd, sizeof(c)); return c.margin * 7; }
+        default:         return *cmd + 1;
+    }
+}
+
+static u64 realloc_copied = 0;
+
+static func build_buffer(buffer buf, u32 commands) -> buffer {
+    u8 cmd[16];
+    for (u32 i = 0; i < commands; ++i) {
+        u32 size = command_at(i, cmd);
+        if (buf.size + size > buf.capacity) realloc_copied += buf.size;
+        buf = buffer_write_bytes(buf, size, cmd);
+    }
+    return buf;
+}
+
+static func read_buffer(buffer buf) -> u64 {
+    u64 sum = 0;
+    for (u32 offset = 0; offset < buf.size;) {
+        u8* cmd = (u8*)buf.data + offset;
+        sum += checksum_command(cmd);
+        offset += command_size((ui_draw_op)*cmd);
+    }
+    return sum;
+}
+
+static func build_chunked(chunked_buffer* buf, u32 commands) -> void {
+    for (u32 i = 0; i < commands; ++i) {
+        // NOTE(DH): Reserve the biggest command, commit what was written
+        u8* dst = buf->reserve(sizeof(ui_rect_cmd));
+        buf->commit(command_at(i, dst));
+    }
+}
+
+static func read_chunked(chunked_buffer* buf) -> u64 {
+    u64 sum = 0;
+    chunked_buffer_cursor cursor = buf->begin_read();
+    while (!cursor.at_end()) {
+        u8* cmd = cursor.peek(1);
+        sum += checksum_command(cursor.read_bytes(command_size((ui_draw_op)*cmd)));
+    }
+    return sum;
+}
+
+template <typename F>
+static func time_ms(F f) -> f64 {
+    auto t0 = std::chrono::high_resolution_clock::now();
+    f();
+    auto t1 = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<f64, std::milli>(t1 - t0).count();
+}
+
+int main(int argc, char** argv) {
+    u32 commands = argc > 1 ? atoi(argv[1]) : 2000000;
+    u32 rounds   = argc > 2 ? atoi(argv[2]) : 20;
+
+    u64 sums[2] = {};
+    f64 cold[2] = {}, warm[2] = {}, read[2] = {};
+
+    for (u32 r = 0; r < rounds; ++r) {
+        cold[0] += time_ms([&]() {
+            buffer buf = buffer_create(default_allocator, 256);
+            buf = build_buffer(buf, commands);
+            default_allocator.free(buf.data);
+        });
+        cold[1] += time_ms([&]() {
+            chunked_buffer buf = chunked_buffer::create(default_allocator, 64 * 1024);
+            build_chunked(&buf, commands);
+            buf.destroy();
+        });
+    }
+    u64 copied_per_round = realloc_copied / rounds;
+
+    buffer flat = buffer_create(default_allocator, 256);
+    chunked_buffer chunked = chunked_buffer::create(default_allocator, 64 * 1024);
+    for (u32 r = 0; r < rounds; ++r) {
+        warm[0] += time_ms([&]() { flat.size = 0; flat = build_buffer(flat, commands); });
+        warm[1] += time_ms([&]() { chunked.reset(); build_chunked(&chunked, commands); });
+        read[0] += time_ms([&]() { sums[0] = read_buffer(flat); });
+        read[1] += time_ms([&]() { sums[1] = read_chunked(&chunked); });
+    }
+
+    printf("%u commands, %u bytes, %u chunks of 64 KB\n", commands, flat.size, chunked.chunk_count);
+    printf("%-10s %10s %10s %10s\n", "", "cold ms", "warm ms", "read ms");
+    printf("%-10s %10.2f %10.2f %10.2f\n", "buffer", cold[0] / rounds, warm[0] / rounds, read[0] / rounds);
+    printf("%-10s %10.2f %10.2f %10.2f\n", "chunked", cold[1] / rounds, warm[1] / rounds, read[1] / rounds);
+    printf("buffer copied %llu bytes per cold build growing, chunked 0; streams %s\n",
+        (unsigned long long)copied_per_round, sums[0] == sums[1] && chunked.size == flat.size ? "match" : "DIFFER");
+
+    default_allocator.free(flat.data);
+    chunked.destroy();
+    return 0;
+}
@@ -43,6 +43,15 @@ union v2
 		i32 E[2];
 	};
 	
+	union v3i
+	{
+		struct
+		{
+			i32 x,y,z;
+		};
+		i32 E[3];
+	};
+	
 	union v3
 	{
 		struct
@@ -352,6 +361,14 @@ V2(f32 value)
 	return(Result);
 }
 
+inline v3i
+V3i(i32 x, i32 y, i32 z)
+{
+	v3i Result = { x, y, z};
+	
+	return(Result);
+}
+
 inline v3
 V3(f32 x, f32 y, f32 z)
 {
@@ -728,6 +745,14 @@ operator*=(v3 &B, f32 A)
 	return(B);
 }
 
+inline v3 
+operator/(v3 A, f32 B)
+{
+	v3 Result = V3(A.x / B, A.y / B, A.z / B);
+	
+	return(Result);
+}
+
 inline v3 
 operator-(v3 A)
 {
@@ -183,6 +183,12 @@ void move_to_next_frame(dx_context *context)
 	}
 
 	context->g_frame_fence_values[context->g_frame_index] = current_fence_value + 1;
+
+	// NOTE(DH): Whatever was built in scratch for this frame was already recorded into the command lists
+	context->scratch.next_frame();
+#ifdef ALLOC_TRACKING
+	global_alloc_tracker.next_frame();
+#endif
 }
 
 void present(dx_context *context)
@@ -636,6 +642,7 @@ dx_context init_dx(HWND hwnd)
 
 	printf("Initialize memory...\n");
 	result.mem_arena = initialize_arena(Megabytes(128));
+	result.scratch = frame_arena::create(Megabytes(8));
 
 	printf("Allocate resources from mem arena...\n");
 	// TODO(DH): When nodes will be ready to use, rework this to be dynamic
@@ -461,6 +461,7 @@ struct dx_context
 	f32					dt_for_frame;
 
 	memory_arena mem_arena;
+	frame_arena scratch; // NOTE(DH): Per frame temporaries, reset in move_to_next_frame
 
 	arena_array<resource_and_view> 	resources_and_views;
 	
@@ -0,0 +1,347 @@
+#pragma once
+#include <cmath>
+#include <cstring>
+#include "simulation_of_particles_core.h"
+#include "util/alloc.h"
+#include "util/job_system.h"
+
+// NOTE(DH): Fluid surface for the 2D solver. Density is evaluated on a regular node grid over the bounds and
+// iso-contours are extracted with marching squares, either as line segments (pairs of vertices) or as filled
+// triangles (triples). The grid is split into tiles that are meshed in parallel, each one:
+//  - gathers the particles that can reach its nodes with one AABB query over the particle lookup,
+//  - scatters every such particle into the nodes within h of it, with the solver's density kernel,
+//  - writes its segments/triangles into its own slot, so tiles never touch each other.
+// Tiles run as parallel_for on the caller's job_system, without one on the calling thread. Updates are incremental:
+// a particle that moved more than `move_threshold` since its tiles were last meshed marks the tiles around its old
+// and new position dirty, only dirty tiles are re-meshed and a tile whose query finds no particles is just cleared.
+// Despawned or swapped particles show up as moved, so this works with the dynamic pool too. Sloshing fluid marks
+// nearly every fluid tile anyway, `full_remesh` skips the marking pass for that case.
+
+static constexpr u32 fluid_surface_tile_cells = 16;
+
+enum fluid_surface_output : u32 {
+	fluid_surface_lines = 0,
+	fluid_surface_triangles,
+};
+
+struct fluid_surface_settings {
+	f32 cell_size;				// NOTE(DH): Node spacing
+	f32 iso_density;			// NOTE(DH): Inside where density >= iso_density
+	f32 move_threshold;			// NOTE(DH): Movement a particle may accumulate before its tiles are re-meshed
+	bool full_remesh;			// NOTE(DH): Re-mesh every tile every update, no movement tracking
+	fluid_surface_output output;
+};
+
+inline func fluid_surface_default_settings(f32 target_density) -> fluid_surface_settings {
+	return {
+		.cell_size		= 0.08f,
+		.iso_density	= target_density * 0.5f,
+		.move_threshold	= 0.02f,
+		.full_remesh	= false,
+		.output			= fluid_surface_lines,
+	};
+}
+
+struct fluid_surface_stats {
+	u32 tiles;
+	u32 tiles_remeshed;			// NOTE(DH): In the last update, cleared empty tiles included
+	u32 vertex_count;
+};
+
+// NOTE(DH): Edge pairs for every marching squares case, corners c0 (x, y), c1 (x + 1, y), c2 (x + 1, y + 1),
+// c3 (x, y + 1), edge k runs from corner k to corner k + 1. Saddles (5, 10) are picked by the cell centre.
+static constexpr i8 fluid_surface_segments[16][4] = {
+	{-1, -1, -1, -1}, {3, 0, -1, -1}, {0, 1, -1, -1}, {3, 1, -1, -1},
+	{1, 2, -1, -1},   {3, 0, 1, 2},   {0, 2, -1, -1}, {3, 2, -1, -1},
+	{2, 3, -1, -1},   {0, 2, -1, -1}, {0, 1, 2, 3},   {1, 2, -1, -1},
+	{1, 3, -1, -1},   {0, 1, -1, -1}, {3, 0, -1, -1}, {-1, -1, -1, -1},
+};
+static constexpr i8 fluid_surface_saddle_connected[16][4] = {
+	{}, {}, {}, {}, {}, {0, 1, 2, 3}, {}, {}, {}, {}, {3, 0, 1, 2}, {}, {}, {}, {}, {},
+};
+
+struct fluid_surface {
+	allocator alc;
+	job_system *jobs;		// NOTE(DH): May be null, update() then runs on the calling thread
+	u32 thread_count;		// NOTE(DH): Scratch sets, one per job system worker
+	fluid_surface_settings settings;
+
+	v2 origin;
+	u32 cells_x;
+	u32 cells_y;
+	u32 tiles_x;
+	u32 tiles_y;
+
+	// NOTE(DH): Per tile output slots, tile_capacity vertices each
+	u32 tile_capacity;
+	v2 *tile_vertices;
+	u32 *tile_counts;
+	u8 *tile_dirty;
+	u32 *dirty_list;
+
+	// NOTE(DH): Per thread scratch, candidates of the tile and its node densities
+	u32 candidate_capacity;
+	v2 *candidates;
+	f32 *node_density;
+
+	// NOTE(DH): Where every particle was when its tiles were last meshed
+	u32 meshed_capacity;
+	u32 meshed_count;
+	v2 *meshed_positions;
+	f32 meshed_radius;
+
+	// NOTE(DH): Compact output, all tiles back to back
+	u32 vertex_capacity;
+	u32 vertex_count;
+	v2 *vertices;
+
+	fluid_surface_stats stats;
+
+	static inline func create(allocator alc, v2 bounds_size, fluid_surface_settings settings, job_system *jobs) -> fluid_surface {
+		fluid_surface result = {};
+		result.alc = alc;
+		result.settings = settings;
+		result.jobs = jobs;
+		result.thread_count = jobs ? jobs->worker_count : 1;
+
+		result.cells_x = (u32)ceilf(bounds_size.x / settings.cell_size);
+		result.cells_y = (u32)ceilf(bounds_size.y / settings.cell_size);
+		result.origin = V2(-0.5f * result.cells_x * settings.cell_size, -0.5f * result.cells_y * settings.cell_size);
+		result.tiles_x = (result.cells_x + fluid_surface_tile_cells - 1) / fluid_surface_tile_cells;
+		result.tiles_y = (result.cells_y + fluid_surface_tile_cells - 1) / fluid_surface_tile_cells;
+
+		// NOTE(DH): Worst case per cell is 2 segments (4 vertices) or a saddle hexagon (4 triangles)
+		u32 per_cell = settings.output == fluid_surface_lines ? 4 : 12;
+		u32 tile_count = result.tiles_x * result.tiles_y;
+		result.tile_capacity = fluid_surface_tile_cells * fluid_surface_tile_cells * per_cell;
+		result.tile_vertices = (v2*)alc.alloc(sizeof(v2) * result.tile_capacity * tile_count);
+		result.tile_counts = (u32*)alc.alloc(sizeof(u32) * tile_count);
+		result.tile_dirty = (u8*)alc.alloc(tile_count);
+		result.dirty_list = (u32*)alc.alloc(sizeof(u32) * tile_count);
+		memset(result.tile_counts, 0, sizeof(u32) * tile_count);
+		memset(result.tile_dirty, 1, tile_count);
+
+		u32 nodes = (fluid_surface_tile_cells + 1) * (fluid_surface_tile_cells + 1);
+		result.node_density = (f32*)alc.alloc(sizeof(f32) * nodes * result.thread_count);
+		result.stats.tiles = tile_count;
+		return result;
+	}
+
+	inline func destroy() -> void {
+		alc.free(tile_vertices);
+		alc.free(tile_counts);
+		alc.free(tile_dirty);
+		alc.free(dirty_list);
+		alc.free(node_density);
+		if(candidates) alc.free(candidates);
+		if(meshed_positions) alc.free(meshed_positions);
+		if(vertices) alc.free(vertices);
+		*this = {};
+	}
+
+	inline func invalidate() -> void {
+		memset(tile_dirty, 1, tiles_x * tiles_y);
+	}
+
+	// NOTE(DH): Marks every tile with a node within `reach` of `p`
+	inline func mark(v2 p, f32 reach) -> void {
+		f32 tile_size = fluid_surface_tile_cells * settings.cell_size;
+		i32 x0 = (i32)floorf((p.x - reach - origin.x) / tile_size);
+		i32 x1 = (i32)floorf((p.x + reach - origin.x) / tile_size);
+		i32 y0 = (i32)floorf((p.y - reach - origin.y) / tile_size);
+		i32 y1 = (i32)floorf((p.y + reach - origin.y) / tile_size);
+		x0 = std::max(x0, 0); y0 = std::max(y0, 0);
+		x1 = std::min(x1, (i32)tiles_x - 1); y1 = std::min(y1, (i32)tiles_y - 1);
+		for(i32 y = y0; y <= y1; ++y)
+			for(i32 x = x0; x <= x1; ++x) tile_dirty[y * tiles_x + x] = 1;
+	}
+
+	template<typename L>
+	inline func update(memory_arena *arena, sph_state<2, L> *s) -> void;
+
+	template<typename L>
+	inline func mesh_tile(memory_arena *arena, sph_state<2, L> *s, u32 tile, u32 thread_idx) -> void;
+};
+
+static inline func fluid_surface_edge_point(v2 *corners, f32 *values, u32 edge, f32 iso) -> v2 {
+	u32 a = edge, b = (edge + 1) & 3;
+	f32 t = Clamp01((iso - values[a]) / (values[b] - values[a]));
+	return corners[a] + (corners[b] - corners[a]) * t;
+}
+
+template<typename L>
+inline func fluid_surface::mesh_tile(memory_arena *arena, sph_state<2, L> *s, u32 tile, u32 thread_idx) -> void {
+	u32 tx = tile % tiles_x, ty = tile / tiles_x;
+	u32 cx0 = tx * fluid_surface_tile_cells, cy0 = ty * fluid_surface_tile_cells;
+	u32 cx1 = std::min(cx0 + fluid_surface_tile_cells, cells_x), cy1 = std::min(cy0 + fluid_surface_tile_cells, cells_y);
+	u32 nodes_x = cx1 - cx0 + 1, nodes_y = cy1 - cy0 + 1;
+
+	f32 h = s->params.smoothing_radius;
+	f32 sqr_h = h * h;
+	f32 density_factor = sph_dim<2>::kernel_factors(h).density;
+	f32 iso = settings.iso_density;
+	f32 cs = settings.cell_size;
+
+	// NOTE(DH): One query for the whole tile, the node loop then only sees particles that can reach it
+	v2 lo = origin + V2(cx0 * cs - h, cy0 * cs - h);
+	v2 hi = origin + V2(cx1 * cs + h, cy1 * cs + h);
+	v2 *tile_candidates = candidates + thread_idx * candidate_capacity;
+	u32 candidate_count = 0;
+	auto query = sph_make_query(arena, s, sph_positions(arena, s, s->positions), h);
+	query.aabb(lo, hi, [&](u32, v2 p) { tile_candidates[candidate_count++] = p; });
+	if(candidate_count == 0) {
+		tile_counts[tile] = 0;
+		return;
+	}
+
+	// NOTE(DH): Scatter, every candidate only visits the nodes within h of it
+	f32 *density = node_density + thread_idx * (fluid_surface_tile_cells + 1) * (fluid_surface_tile_cells + 1);
+	memset(density, 0, sizeof(f32) * nodes_x * nodes_y);
+	v2 tile_origin = origin + V2(cx0 * cs, cy0 * cs);
+	f32 inv_cs = 1.0f / cs;
+	for(u32 i = 0; i < candidate_count; ++i) {
+		v2 local = tile_candidates[i] - tile_origin;
+		i32 x0 = std::max(0, (i32)ceilf((local.x - h) * inv_cs)), x1 = std::min((i32)nodes_x - 1, (i32)floorf((local.x + h) * inv_cs));
+		i32 y0 = std::max(0, (i32)ceilf((local.y - h) * inv_cs)), y1 = std::min((i32)nodes_y - 1, (i32)floorf((local.y + h) * inv_cs));
+		for(i32 ny = y0; ny <= y1; ++ny) {
+			f32 dy = local.y - ny * cs;
+			for(i32 nx = x0; nx <= x1; ++nx) {
+				f32 dx = local.x - nx * cs;
+				f32 sqr_dst = dx * dx + dy * dy;
+				if(sqr_dst >= sqr_h) continue;
+				f32 v = h - sqrtf(sqr_dst);
+				density[ny * nodes_x + nx] += v * v * density_factor;
+			}
+		}
+	}
+
+	v2 *out = tile_vertices + tile * tile_capacity;
+	u32 count = 0;
+
+	for(u32 y = 0; y + 1 < nodes_y; ++y) {
+		for(u32 x = 0; x + 1 < nodes_x; ++x) {
+			f32 values[4] = {
+				density[y * nodes_x + x], density[y * nodes_x + x + 1],
+				density[(y + 1) * nodes_x + x + 1], density[(y + 1) * nodes_x + x],
+			};
+			u32 index = (values[0] >= iso) | (values[1] >= iso) << 1 | (values[2] >= iso) << 2 | (values[3] >= iso) << 3;
+			if(index == 0 || (index == 15 && settings.output == fluid_surface_lines)) continue;
+
+			v2 base = origin + V2((cx0 + x) * cs, (cy0 + y) * cs);
+			v2 corners[4] = {base, base + V2(cs, 0.0f), base + V2(cs, cs), base + V2(0.0f, cs)};
+			bool saddle = index == 5 || index == 10;
+			bool centre_inside = (values[0] + values[1] + values[2] + values[3]) * 0.25f >= iso;
+
+			if(settings.output == fluid_surface_lines) {
+				const i8 *edges = (saddle && centre_inside) ? fluid_surface_saddle_connected[index] : fluid_surface_segments[index];
+				for(u32 e = 0; e < 4 && edges[e] >= 0; ++e) {
+					out[count++] = fluid_surface_edge_point(corners, values, edges[e], iso);
+				}
+				continue;
+			}
+
+			// NOTE(DH): Separated saddle, two corner triangles
+			if(saddle && !centre_inside) {
+				for(u32 c = 0; c < 4; ++c) {
+					if(!((index >> c) & 1)) continue;
+					out[count++] = corners[c];
+					out[count++] = fluid_surface_edge_point(corners, values, c, iso);
+					out[count++] = fluid_surface_edge_point(corners, values, (c + 3) & 3, iso);
+				}
+				continue;
+			}
+
+			// NOTE(DH): Inside polygon, corners and crossings in order around the cell, fanned from the first vertex
+			v2 polygon[8];
+			u32 polygon_count = 0;
+			for(u32 c = 0; c < 4; ++c) {
+				bool inside = (index >> c) & 1;
+				bool next_inside = (index >> ((c + 1) & 3)) & 1;
+				if(inside) polygon[polygon_count++] = corners[c];
+				if(inside != next_inside) polygon[polygon_count++] = fluid_surface_edge_point(corners, values, c, iso);
+			}
+			for(u32 i = 1; i + 1 < polygon_count; ++i) {
+				out[count++] = polygon[0];
+				out[count++] = polygon[i];
+				out[count++] = polygon[i + 1];
+			}
+		}
+	}
+
+	tile_counts[tile] = count;
+}
+
+template<typename L>
+inline func fluid_surface::update(memory_arena *arena, sph_state<2, L> *s) -> void {
+	auto positions = sph_positions(arena, s, s->positions);
+	u32 count = s->positions.count;
+	f32 h = s->params.smoothing_radius;
+	f32 reach = h + settings.cell_size;
+
+	if(meshed_radius != h || settings.full_remesh) {
+		meshed_radius = h;
+		invalidate();
+	}
+
+	if(meshed_capacity < count) {
+		meshed_capacity = std::max(count, meshed_capacity * 2);
+		meshed_positions = (v2*)alc.realloc(meshed_positions, sizeof(v2) * meshed_capacity);
+	}
+	if(candidate_capacity < count) {
+		candidate_capacity = std::max(count, candidate_capacity * 2);
+		if(candidates) alc.free(candidates);
+		candidates = (v2*)alc.alloc(sizeof(v2) * candidate_capacity * thread_count);
+	}
+
+	// NOTE(DH): Dirty tiles, from particles that moved, appeared or disappeared since they were last meshed. With
+	// every tile dirty already there is nothing to mark, the positions are only remembered for the next update
+	if(settings.full_remesh) {
+		for(u32 i = 0; i < count; ++i) meshed_positions[i] = positions[i];
+	} else {
+		f32 sqr_threshold = settings.move_threshold * settings.move_threshold;
+		for(u32 i = 0; i < count; ++i) {
+			v2 p = positions[i];
+			if(i < meshed_count) {
+				v2 offset = p - meshed_positions[i];
+				if(Inner(offset, offset) <= sqr_threshold) continue;
+				mark(meshed_positions[i], reach);
+			}
+			mark(p, reach);
+			meshed_positions[i] = p;
+		}
+		for(u32 i = count; i < meshed_count; ++i) mark(meshed_positions[i], reach);
+	}
+	meshed_count = count;
+
+	u32 tile_count = tiles_x * tiles_y;
+	u32 dirty_count = 0;
+	for(u32 t = 0; t < tile_count; ++t) {
+		if(tile_dirty[t]) dirty_list[dirty_count++] = t;
+		tile_dirty[t] = 0;
+	}
+	stats.tiles_remeshed = dirty_count;
+	if(dirty_count == 0) return;
+
+	if(jobs) {
+		parallel_for(jobs, 0, dirty_count, 1, [&](u32 begin, u32 end) {
+			for(u32 i = begin; i < end; ++i) mesh_tile(arena, s, dirty_list[i], job_system::current_worker());
+		});
+	} else {
+		for(u32 i = 0; i < dirty_count; ++i) mesh_tile(arena, s, dirty_list[i], 0);
+	}
+
+	// NOTE(DH): Compact output, tiles in order
+	u32 total = 0;
+	for(u32 t = 0; t < tile_count; ++t) total += tile_counts[t];
+	if(vertex_capacity < total) {
+		vertex_capacity = std::max(total, vertex_capacity * 2);
+		vertices = (v2*)alc.realloc(vertices, sizeof(v2) * vertex_capacity);
+	}
+	vertex_count = 0;
+	for(u32 t = 0; t < tile_count; ++t) {
+		memcpy(vertices + vertex_count, tile_vertices + t * tile_capacity, sizeof(v2) * tile_counts[t]);
+		vertex_count += tile_counts[t];
+	}
+
+	stats.vertex_count = vertex_count;
+}
@@ -0,0 +1,309 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <thread>
+
+#include "util/alloc.h"
+#include "util/log.h"
+#include "util/queue.h"
+#include "util/types.h"
+
+// NOTE(DH): Asynchronous frame capture. The producer (simulation/render thread) never touches the disk:
+// frames go into a fixed pool of slots, filled slot indices travel through a bounded lock-free
+// single-producer single-consumer queue (spsc_queue) to a writer thread, which streams them into a Y4M file or numbered
+// PPMs and hands the slot back through a second queue.
+// When no slot is free the backpressure policy decides: drop the frame (simulation never waits) or block.
+
+enum capture_format : u32 {
+	capture_format_y4m = 0,	// NOTE(DH): One YUV4MPEG2 stream, 4:2:0 full range BT.601
+	capture_format_ppm,		// NOTE(DH): path is a printf pattern with one %u for the frame number
+};
+
+enum capture_policy : u32 {
+	capture_policy_drop = 0,
+	capture_policy_block,
+};
+
+struct capture_stats {
+	u64 submitted;
+	u64 written;
+	u64 dropped;
+	u64 bytes_written;
+	u64 write_errors;		// NOTE(DH): Frames that didn't make it to disk whole (short write, can't open the file)
+	u32 queue_depth;		// NOTE(DH): Frames waiting for the writer right now
+	u32 max_queue_depth;
+	f64 producer_wait_seconds;	// NOTE(DH): Time the producer spent blocked (block policy only)
+	f64 writer_busy_seconds;
+};
+
+struct frame_capture {
+	allocator alc;
+	capture_format format;
+	capture_policy policy;
+	char path[512];
+	FILE *file;
+
+	u32 width;
+	u32 height;
+	u32 fps;
+	u32 slot_count;
+	rgba *pixels;			// NOTE(DH): slot_count frames back to back
+	u8 *yuv;				// NOTE(DH): Writer side conversion buffer
+
+	spsc_queue<u32> *filled;	// NOTE(DH): producer -> writer
+	spsc_queue<u32> *free_slots;	// NOTE(DH): writer -> producer, blocking for the block policy
+
+	std::atomic<bool> stop;
+	std::atomic<u32> wake;	// NOTE(DH): Bumped on every submit and on destroy, the writer sleeps on it
+	std::thread writer;
+
+	// NOTE(DH): Written by one side each, read by stats()
+	std::atomic<u64> submitted;
+	std::atomic<u64> written;
+	std::atomic<u64> dropped;
+	std::atomic<u64> bytes_written;
+	std::atomic<u64> write_errors;
+	std::atomic<u32> max_queue_depth;
+	f64 producer_wait_seconds;
+	std::atomic<u64> writer_busy_ns;
+
+	u32 frame_number;		// NOTE(DH): Writer side
+
+	static inline func create(allocator alc, const char *path, capture_format format, capture_policy policy, u32 width, u32 height, u32 fps, u32 slot_count) -> frame_capture*;
+	inline func destroy() -> void;
+
+	inline func acquire() -> image_buffer;
+	inline func submit(image_buffer frame) -> void;
+	inline func capture(image_buffer *frame) -> bool;
+	inline func stats() -> capture_stats;
+};
+
+static inline func capture_next_pow_2(u32 value) -> u32 {
+	u32 result = 1;
+	while(result < value) result <<= 1;
+	return result;
+}
+
+// NOTE(DH): Y plane plus two chroma planes at half resolution, rounded up for odd sizes
+static inline func capture_y4m_frame_size(u32 w, u32 h) -> u64 {
+	return (u64)w * h + 2 * (u64)((w + 1) / 2) * ((h + 1) / 2);
+}
+
+// NOTE(DH): Counts the failure, only warns about the first one so a full disk doesn't flood the log
+static inline func capture_write_failed(frame_capture *c, const char *msg) -> void {
+	if(c->write_errors.fetch_add(1, std::memory_order_relaxed) == 0) warn(msg);
+}
+
+// NOTE(DH): BGRA -> planar 4:2:0 (chroma averaged over 2x2), full range BT.601 like the "420jpeg" tag says
+static inline func capture_write_y4m_frame(frame_capture *c, rgba *pixels) -> u64 {
+	u32 w = c->width;
+	u32 h = c->height;
+	u32 cw = (w + 1) / 2;
+	u32 ch = (h + 1) / 2;
+	u8 *plane_y = c->yuv;
+	u8 *plane_u = plane_y + w * h;
+	u8 *plane_v = plane_u + cw * ch;
+
+	for(u32 i = 0; i < w * h; ++i) {
+		rgba p = pixels[i];
+		f32 y = 0.299f * p.r + 0.587f * p.g + 0.114f * p.b;
+		plane_y[i] = (u8)(y + 0.5f);
+	}
+
+	for(u32 cy = 0; cy < ch; ++cy) {
+		for(u32 cx = 0; cx < cw; ++cx) {
+			f32 r = 0, g = 0, b = 0;
+			for(u32 k = 0; k < 4; ++k) {
+				u32 x = std::min(cx * 2 + (k & 1), w - 1);
+				u32 y = std::min(cy * 2 + (k >> 1), h - 1);
+				rgba p = pixels[y * w + x];
+				r += p.r; g += p.g; b += p.b;
+			}
+			r *= 0.25f; g *= 0.25f; b *= 0.25f;
+			f32 u = 128.0f - 0.168736f * r - 0.331264f * g + 0.5f * b;
+			f32 v = 128.0f + 0.5f * r - 0.418688f * g - 0.081312f * b;
+			plane_u[cy * cw + cx] = (u8)std::min(255.0f, std::max(0.0f, u + 0.5f));
+			plane_v[cy * cw + cx] = (u8)std::min(255.0f, std::max(0.0f, v + 0.5f));
+		}
+	}
+
+	static const char frame_tag[] = "FRAME\n";
+	u64 size = capture_y4m_frame_size(w, h);
+	u64 written = fwrite(frame_tag, 1, sizeof(frame_tag) - 1, c->file);
+	written += fwrite(c->yuv, 1, size, c->file);
+	if(written != size + sizeof(frame_tag) - 1) capture_write_failed(c, "Short write to the capture file!");
+	return written;
+}
+
+static inline func capture_write_ppm_frame(frame_capture *c, rgba *pixels) -> u64 {
+	char name[600];
+	snprintf(name, sizeof(name), c->path, c->frame_number);
+	FILE *file = fopen(name, "wb");
+	if(!file) { capture_write_failed(c, "Can't open capture frame for writing!"); return 0; }
+
+	i32 header = fprintf(file, "P6\n%u %u\n255\n", c->width, c->height);
+	u64 written = 0;
+	u8 *row = c->yuv;
+	for(u32 y = 0; y < c->height; ++y) {
+		for(u32 x = 0; x < c->width; ++x) {
+			rgba p = pixels[y * c->width + x];
+			row[x * 3 + 0] = p.r;
+			row[x * 3 + 1] = p.g;
+			row[x * 3 + 2] = p.b;
+		}
+		written += fwrite(row, 1, c->width * 3, file);
+	}
+	bool closed = fclose(file) == 0;
+	if(header < 0 || !closed || written != (u64)c->width * c->height * 3) capture_write_failed(c, "Short write to a capture frame!");
+	return (header > 0 ? header : 0) + written;
+}
+
+static inline func capture_writer_main(frame_capture *c) -> void {
+	while(true) {
+		// NOTE(DH): Read before the pop, a submit between the pop and the wait still wakes us
+		u32 seen = c->wake.load(std::memory_order_acquire);
+
+		u32 slot;
+		if(!c->filled->pop(&slot)) {
+			// NOTE(DH): Frames submitted right before destroy are visible once stop is, drain them first
+			if(c->stop.load(std::memory_order_acquire)) {
+				if(c->filled->size() == 0) break;
+				continue;
+			}
+			c->wake.wait(seen, std::memory_order_acquire);
+			continue;
+		}
+
+		auto start = std::chrono::high_resolution_clock::now();
+		rgba *pixels = c->pixels + (u64)slot * c->width * c->height;
+		u64 bytes = c->format == capture_format_y4m ? capture_write_y4m_frame(c, pixels) : capture_write_ppm_frame(c, pixels);
+		auto end = std::chrono::high_resolution_clock::now();
+
+		c->frame_number++;
+		c->bytes_written.fetch_add(bytes, std::memory_order_relaxed);
+		c->written.fetch_add(1, std::memory_order_relaxed);
+		c->writer_busy_ns.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count(), std::memory_order_relaxed);
+
+		c->free_slots->push(slot);
+	}
+
+	if(c->file && fflush(c->file) != 0) capture_write_failed(c, "Short write to the capture file!");
+}
+
+// NOTE(DH): slot_count frames are allocated up front, nothing is allocated per frame
+inline func frame_capture::create(allocator alc, const char *path, capture_format format, capture_policy policy, u32 width, u32 height, u32 fps, u32 slot_count) -> frame_capture* {
+	frame_capture *c = (frame_capture*)alc.alloc(sizeof(frame_capture));
+	new (c) frame_capture();
+	c->alc		= alc;
+	c->format	= format;
+	c->policy	= policy;
+	c->width	= width;
+	c->height	= height;
+	c->fps		= fps;
+	snprintf(c->path, sizeof(c->path), "%s", path);
+
+	c->slot_count = capture_next_pow_2(std::max(slot_count, 2u));
+	c->pixels = (rgba*)alc.alloc(sizeof(rgba) * width * height * c->slot_count);
+	c->yuv = (u8*)alc.alloc(std::max<u64>(capture_y4m_frame_size(width, height), (u64)width * 3));	// NOTE(DH): Y4M frame or one PPM row
+
+	c->filled = spsc_queue<u32>::create(alc, c->slot_count);
+	c->free_slots = spsc_queue<u32>::create(alc, c->slot_count, policy == capture_policy_block);
+	for(u32 i = 0; i < c->slot_count; ++i) c->free_slots->push(i);
+
+	if(format == capture_format_y4m) {
+		c->file = fopen(path, "wb");
+		if(!c->file) panic("Can't open capture file for writing!");
+		i32 header = fprintf(c->file, "YUV4MPEG2 W%u H%u F%u:1 Ip A1:1 C420jpeg\n", width, height, fps);
+		c->bytes_written.store(header);
+	}
+
+	c->writer = std::thread(capture_writer_main, c);
+	return c;
+}
+
+// NOTE(DH): Drains everything already submitted, then stops the writer
+inline func frame_capture::destroy() -> void {
+	stop.store(true, std::memory_order_release);
+	wake.fetch_add(1, std::memory_order_release);
+	wake.notify_one();
+	writer.join();
+
+	if(file) fclose(file);
+	filled->destroy();
+	free_slots->destroy();
+	alc.free(pixels);
+	alc.free(yuv);
+	allocator a = alc;
+	this->~frame_capture();
+	a.free(this);
+}
+
+// NOTE(DH): Zero copy path: render straight into a slot, then submit it. render_img is null when the
+// frame was dropped (drop policy and the writer is behind).
+inline func frame_capture::acquire() -> image_buffer {
+	image_buffer result = {};
+	result.width = width;
+	result.height = height;
+
+	u32 slot;
+	if(!free_slots->pop(&slot)) {
+		if(policy == capture_policy_drop) {
+			submitted.fetch_add(1, std::memory_order_relaxed);
+			dropped.fetch_add(1, std::memory_order_relaxed);
+			return result;
+		}
+
+		auto start = std::chrono::high_resolution_clock::now();
+		free_slots->pop_wait(&slot);
+		auto end = std::chrono::high_resolution_clock::now();
+		producer_wait_seconds += std::chrono::duration<f64>(end - start).count();
+	}
+
+	result.render_img = pixels + (u64)slot * width * height;
+	return result;
+}
+
+inline func frame_capture::submit(image_buffer frame) -> void {
+	if(!frame.render_img) return;
+
+	u32 slot = (u32)((frame.render_img - pixels) / ((u64)width * height));
+	assert(slot < slot_count);
+
+	// NOTE(DH): Can't fail, there are only slot_count slots in flight
+	filled->push(slot);
+	submitted.fetch_add(1, std::memory_order_relaxed);
+	wake.fetch_add(1, std::memory_order_release);
+	wake.notify_one();
+
+	u32 depth = filled->size();
+	if(depth > max_queue_depth.load(std::memory_order_relaxed)) max_queue_depth.store(depth, std::memory_order_relaxed);
+}
+
+// NOTE(DH): Copying path for frames that already live somewhere else (readbacks, ui image_buffer).
+// Returns false when the frame was dropped.
+inline func frame_capture::capture(image_buffer *frame) -> bool {
+	if(frame->width != width || frame->height != height) panic("Captured frame size does not match the capture!");
+
+	image_buffer slot = acquire();
+	if(!slot.render_img) return false;
+	memcpy(slot.render_img, frame->render_img, sizeof(rgba) * width * height);
+	submit(slot);
+	return true;
+}
+
+inline func frame_capture::stats() -> capture_stats {
+	capture_stats result = {};
+	result.submitted				= submitted.load(std::memory_order_relaxed);
+	result.written					= written.load(std::memory_order_relaxed);
+	result.dropped					= dropped.load(std::memory_order_relaxed);
+	result.bytes_written			= bytes_written.load(std::memory_order_relaxed);
+	result.write_errors				= write_errors.load(std::memory_order_relaxed);
+	result.queue_depth				= filled->size();
+	result.max_queue_depth			= max_queue_depth.load(std::memory_order_relaxed);
+	result.producer_wait_seconds	= producer_wait_seconds;
+	result.writer_busy_seconds		= writer_busy_ns.load(std::memory_order_relaxed) * 1e-9;
+	return result;
+}
@@ -0,0 +1,303 @@
+#pragma once
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <immintrin.h>
+
+#include "dmath.h"
+#include "util/alloc.h"
+#include "util/job_system.h"
+#include "util/types.h"
+
+// NOTE(DH): CPU particle renderer for headless runs. Splats anti-aliased circles coloured by the same
+// color_a/color_b/color_c speed gradient render_particles.hlsl uses into an image_buffer (the one ui.h renders into).
+//  1) particles are projected to pixels and binned into screen tiles (parallel over particle chunks),
+//  2) every tile is rasterised by one thread into a small planar float tile with 8-wide AVX span fills,
+//  3) the tile is packed into the BGRA render_img.
+// Particles land in a tile in index order, so the output does not depend on the thread count.
+// The parallel parts run as parallel_for on the caller's job_system (the workers live as long as it does),
+// without one everything runs on the calling thread.
+
+static constexpr u32 particle_render_tile_size = 32; // NOTE(DH): Multiple of 8, a tile row is a whole number of AVX lanes
+
+struct particle_render_settings {
+	v4 color_a;
+	v4 color_b;
+	v4 color_c;
+	v4 background;
+	f32 max_velocity;
+	f32 particle_radius;	// NOTE(DH): World units
+	v2 view_centre;			// NOTE(DH): World point in the middle of the image
+	v2 view_size;			// NOTE(DH): World extent that has to fit into the image
+};
+
+inline func particle_render_default_settings(v2 view_size, f32 particle_radius) -> particle_render_settings {
+	particle_render_settings result = {};
+	result.color_a			= V4(0.05f, 0.25f, 0.95f, 1.0f);
+	result.color_b			= V4(0.15f, 0.95f, 0.45f, 1.0f);
+	result.color_c			= V4(0.95f, 0.25f, 0.05f, 1.0f);
+	result.background		= V4(0.0f, 0.0f, 0.06f, 1.0f);
+	result.max_velocity		= 1.0f;
+	result.particle_radius	= particle_radius;
+	result.view_centre		= V2(0.0f, 0.0f);
+	result.view_size		= view_size;
+	return result;
+}
+
+// NOTE(DH): fn(i) for i in [0, count), grain items per job
+template<typename F>
+static inline func particle_render_parallel(job_system *jobs, u32 count, u32 grain, F fn) -> void {
+	if(!jobs) { for(u32 i = 0; i < count; ++i) fn(i); return; }
+	parallel_for(jobs, 0, count, grain, [&](u32 begin, u32 end) { for(u32 i = begin; i < end; ++i) fn(i); });
+}
+
+struct particle_renderer {
+	allocator alc;
+	job_system *jobs;	// NOTE(DH): May be null, render() then runs on the calling thread
+	u32 thread_count;	// NOTE(DH): Number of binning chunks, the job system's worker count
+
+	u32 tiles_x;
+	u32 tiles_y;
+
+	// NOTE(DH): Projected particles, planar so the colour fetch in the tile loop stays in cache
+	u32 particle_capacity;
+	f32 *screen_x;
+	f32 *screen_y;
+	f32 *colour_r;
+	f32 *colour_g;
+	f32 *colour_b;
+
+	// NOTE(DH): Per chunk tile counts, then per chunk write cursors after the prefix sum
+	u32 bin_capacity;
+	u32 *chunk_counts;
+	u32 *tile_start;	// NOTE(DH): tile_count + 1 entries
+
+	u32 ref_capacity;
+	u32 *tile_refs;		// NOTE(DH): Particle indices grouped by tile
+
+	static inline func create(allocator alc, job_system *jobs) -> particle_renderer {
+		particle_renderer result = {};
+		result.alc = alc;
+		result.jobs = jobs;
+		result.thread_count = jobs ? jobs->worker_count : 1;
+		return result;
+	}
+
+	inline func destroy() -> void {
+		if(screen_x) 		{ alc.free(screen_x); alc.free(screen_y); alc.free(colour_r); alc.free(colour_g); alc.free(colour_b); }
+		if(chunk_counts) 	{ alc.free(chunk_counts); alc.free(tile_start); }
+		if(tile_refs) 		{ alc.free(tile_refs); }
+		*this = {};
+	}
+
+	template<typename T>
+	inline func grow(T **ptr, u32 *capacity, u32 needed) -> bool {
+		if(*ptr && needed <= *capacity) return false;
+		u32 new_capacity = std::max(needed, *capacity * 2);
+		*ptr = (T*)alc.realloc(*ptr, sizeof(T) * new_capacity);
+		*capacity = new_capacity;
+		return true;
+	}
+
+	inline func ensure_particles(u32 count) -> void {
+		u32 capacity = particle_capacity;
+		if(!screen_x || count > capacity) {
+			u32 new_capacity = std::max(count, capacity * 2);
+			screen_x = (f32*)alc.realloc(screen_x, sizeof(f32) * new_capacity);
+			screen_y = (f32*)alc.realloc(screen_y, sizeof(f32) * new_capacity);
+			colour_r = (f32*)alc.realloc(colour_r, sizeof(f32) * new_capacity);
+			colour_g = (f32*)alc.realloc(colour_g, sizeof(f32) * new_capacity);
+			colour_b = (f32*)alc.realloc(colour_b, sizeof(f32) * new_capacity);
+			particle_capacity = new_capacity;
+		}
+	}
+
+	inline func ensure_bins(u32 tile_count) -> void {
+		u32 needed = tile_count * thread_count;
+		u32 capacity = bin_capacity;
+		if(grow(&chunk_counts, &capacity, needed)) {
+			tile_start = (u32*)alc.realloc(tile_start, sizeof(u32) * (capacity + 1));
+		}
+		bin_capacity = capacity;
+	}
+
+	inline func render(image_buffer *target, const v2 *positions, const v2 *velocities, u32 count, particle_render_settings settings) -> void;
+};
+
+// NOTE(DH): Same blend as render_particles.hlsl
+static inline func particle_speed_colour(particle_render_settings *settings, v2 velocity) -> v4 {
+	f32 speed_t = Clamp01(Length(velocity) / settings->max_velocity);
+	v4 inner = Lerp(settings->color_b, speed_t, settings->color_c);
+	return Lerp(settings->color_a, speed_t, inner);
+}
+
+static inline func particle_render_tile(particle_renderer *r, image_buffer *target, u32 tile_idx, f32 radius_px, v4 background) -> void {
+	constexpr u32 T = particle_render_tile_size;
+	alignas(32) f32 plane_r[T * T];
+	alignas(32) f32 plane_g[T * T];
+	alignas(32) f32 plane_b[T * T];
+
+	__m256 bg_r = _mm256_set1_ps(background.r * 255.0f);
+	__m256 bg_g = _mm256_set1_ps(background.g * 255.0f);
+	__m256 bg_b = _mm256_set1_ps(background.b * 255.0f);
+	for(u32 i = 0; i < T * T; i += 8) {
+		_mm256_store_ps(plane_r + i, bg_r);
+		_mm256_store_ps(plane_g + i, bg_g);
+		_mm256_store_ps(plane_b + i, bg_b);
+	}
+
+	u32 tile_x = (tile_idx % r->tiles_x) * T;
+	u32 tile_y = (tile_idx / r->tiles_x) * T;
+
+	__m256 lane_offsets = _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f);
+	__m256 zero = _mm256_setzero_ps();
+	__m256 one = _mm256_set1_ps(1.0f);
+	__m256 edge = _mm256_set1_ps(radius_px + 0.5f);
+
+	for(u32 ref = r->tile_start[tile_idx]; ref < r->tile_start[tile_idx + 1]; ++ref) {
+		u32 p = r->tile_refs[ref];
+		f32 cx = r->screen_x[p] - tile_x;
+		f32 cy = r->screen_y[p] - tile_y;
+
+		// NOTE(DH): Pixel rows/columns of the tile the circle (plus one pixel of AA fringe) touches
+		i32 y0 = std::max(0, (i32)floorf(cy - radius_px - 1.0f));
+		i32 y1 = std::min((i32)T, (i32)ceilf(cy + radius_px + 1.0f));
+		i32 x0 = std::max(0, (i32)floorf(cx - radius_px - 1.0f)) & ~7;
+		i32 x1 = std::min((i32)T, (i32)ceilf(cx + radius_px + 1.0f));
+
+		__m256 src_r = _mm256_set1_ps(r->colour_r[p]);
+		__m256 src_g = _mm256_set1_ps(r->colour_g[p]);
+		__m256 src_b = _mm256_set1_ps(r->colour_b[p]);
+		__m256 centre_x = _mm256_set1_ps(cx);
+
+		for(i32 y = y0; y < y1; ++y) {
+			f32 dy = (f32)y + 0.5f - cy;
+			__m256 dy2 = _mm256_set1_ps(dy * dy);
+			f32 *row_r = plane_r + y * T;
+			f32 *row_g = plane_g + y * T;
+			f32 *row_b = plane_b + y * T;
+
+			for(i32 x = x0; x < x1; x += 8) {
+				__m256 dx = _mm256_sub_ps(_mm256_add_ps(_mm256_set1_ps((f32)x), lane_offsets), centre_x);
+				__m256 dst = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), dy2));
+				__m256 coverage = _mm256_min_ps(one, _mm256_max_ps(zero, _mm256_sub_ps(edge, dst)));
+
+				__m256 r_ = _mm256_load_ps(row_r + x);
+				__m256 g_ = _mm256_load_ps(row_g + x);
+				__m256 b_ = _mm256_load_ps(row_b + x);
+				_mm256_store_ps(row_r + x, _mm256_add_ps(r_, _mm256_mul_ps(_mm256_sub_ps(src_r, r_), coverage)));
+				_mm256_store_ps(row_g + x, _mm256_add_ps(g_, _mm256_mul_ps(_mm256_sub_ps(src_g, g_), coverage)));
+				_mm256_store_ps(row_b + x, _mm256_add_ps(b_, _mm256_mul_ps(_mm256_sub_ps(src_b, b_), coverage)));
+			}
+		}
+	}
+
+	// NOTE(DH): Pack into BGRA, 4 pixels at a time
+	u32 width = std::min(T, target->width - tile_x);
+	u32 height = std::min(T, target->height - tile_y);
+	__m128i alpha = _mm_set1_epi32((i32)0xFF000000);
+	for(u32 y = 0; y < height; ++y) {
+		rgba *out = target->render_img + (tile_y + y) * target->width + tile_x;
+		u32 x = 0;
+		for(; x + 4 <= width; x += 4) {
+			__m128i r_ = _mm_cvtps_epi32(_mm_loadu_ps(plane_r + y * T + x));
+			__m128i g_ = _mm_cvtps_epi32(_mm_loadu_ps(plane_g + y * T + x));
+			__m128i b_ = _mm_cvtps_epi32(_mm_loadu_ps(plane_b + y * T + x));
+			__m128i packed = _mm_or_si128(_mm_or_si128(alpha, _mm_slli_epi32(r_, 16)), _mm_or_si128(_mm_slli_epi32(g_, 8), b_));
+			_mm_storeu_si128((__m128i*)(out + x), packed);
+		}
+		for(; x < width; ++x) {
+			out[x].r = (u8)(plane_r[y * T + x] + 0.5f);
+			out[x].g = (u8)(plane_g[y * T + x] + 0.5f);
+			out[x].b = (u8)(plane_b[y * T + x] + 0.5f);
+			out[x].a = 255;
+		}
+	}
+}
+
+inline func particle_renderer::render(image_buffer *target, const v2 *positions, const v2 *velocities, u32 count, particle_render_settings settings) -> void {
+	constexpr u32 T = particle_render_tile_size;
+
+	tiles_x = (target->width + T - 1) / T;
+	tiles_y = (target->height + T - 1) / T;
+	u32 tile_count = tiles_x * tiles_y;
+	u32 chunks = thread_count;
+
+	ensure_particles(count);
+	ensure_bins(tile_count);
+
+	// NOTE(DH): World -> pixels, y up in the world, down in the image. Whole view_size fits, aspect is kept.
+	f32 scale = std::min(target->width / settings.view_size.x, target->height / settings.view_size.y);
+	f32 offset_x = target->width * 0.5f - settings.view_centre.x * scale;
+	f32 offset_y = target->height * 0.5f + settings.view_centre.y * scale;
+	f32 radius_px = settings.particle_radius * scale;
+	f32 reach = radius_px + 1.0f;
+
+	u32 chunk_size = (count + chunks - 1) / chunks;
+	particle_renderer *r = this;
+
+	auto tile_range = [r, reach](f32 x, f32 y, i32 *tx0, i32 *ty0, i32 *tx1, i32 *ty1) {
+		*tx0 = std::max(0, (i32)floorf((x - reach) / T));
+		*ty0 = std::max(0, (i32)floorf((y - reach) / T));
+		*tx1 = std::min((i32)r->tiles_x - 1, (i32)floorf((x + reach) / T));
+		*ty1 = std::min((i32)r->tiles_y - 1, (i32)floorf((y + reach) / T));
+	};
+
+	// NOTE(DH): 1) Project, colour and count tile references per chunk
+	particle_render_parallel(jobs, chunks, 1, [&](u32 chunk) {
+		u32 *counts = r->chunk_counts + chunk * tile_count;
+		memset(counts, 0, sizeof(u32) * tile_count);
+
+		u32 begin = std::min(count, chunk * chunk_size);
+		u32 end = std::min(count, begin + chunk_size);
+		for(u32 i = begin; i < end; ++i) {
+			f32 x = positions[i].x * scale + offset_x;
+			f32 y = offset_y - positions[i].y * scale;
+			v4 colour = particle_speed_colour(&settings, velocities[i]) * 255.0f;
+			r->screen_x[i] = x;
+			r->screen_y[i] = y;
+			r->colour_r[i] = colour.r;
+			r->colour_g[i] = colour.g;
+			r->colour_b[i] = colour.b;
+
+			i32 tx0, ty0, tx1, ty1;
+			tile_range(x, y, &tx0, &ty0, &tx1, &ty1);
+			for(i32 ty = ty0; ty <= ty1; ++ty)
+				for(i32 tx = tx0; tx <= tx1; ++tx)
+					counts[ty * r->tiles_x + tx]++;
+		}
+	});
+
+	// NOTE(DH): 2) Prefix sum, tile major / chunk minor keeps particle order inside every tile
+	u32 total = 0;
+	for(u32 tile = 0; tile < tile_count; ++tile) {
+		tile_start[tile] = total;
+		for(u32 chunk = 0; chunk < chunks; ++chunk) {
+			u32 *slot = chunk_counts + chunk * tile_count + tile;
+			u32 c = *slot;
+			*slot = total;
+			total += c;
+		}
+	}
+	tile_start[tile_count] = total;
+	grow(&tile_refs, &ref_capacity, total);
+
+	// NOTE(DH): 3) Scatter references
+	particle_render_parallel(jobs, chunks, 1, [&](u32 chunk) {
+		u32 *cursors = r->chunk_counts + chunk * tile_count;
+		u32 begin = std::min(count, chunk * chunk_size);
+		u32 end = std::min(count, begin + chunk_size);
+		for(u32 i = begin; i < end; ++i) {
+			i32 tx0, ty0, tx1, ty1;
+			tile_range(r->screen_x[i], r->screen_y[i], &tx0, &ty0, &tx1, &ty1);
+			for(i32 ty = ty0; ty <= ty1; ++ty)
+				for(i32 tx = tx0; tx <= tx1; ++tx)
+					r->tile_refs[cursors[ty * r->tiles_x + tx]++] = i;
+		}
+	});
+
+	// NOTE(DH): 4) Rasterise, a few tiles per job, idle workers steal the rest
+	particle_render_parallel(jobs, tile_count, 4, [&](u32 tile) {
+		particle_render_tile(r, target, tile, radius_px, settings.background);
+	});
+}
@@ -0,0 +1,103 @@
+// NOTE(DH): Local launcher for the multi-process CPU solver. Creates the shared memory object, forks one
+// worker per slab, waits for them and prints per worker stats. Worker count 1 is the single process baseline.
+//
+// clang++ ./src/sim_domain.cpp -o ./bin/sim_domain -std=c++20 -O2 -mavx -I ./src
+// ./bin/sim_domain [workers] [particles] [steps] [wcsph|pbf] [pin]
+
+#include "simulation_of_particles_domain.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <sys/wait.h>
+
+void* allocate_memory(void*, size_t size) { return malloc(size);}
+
+// NOTE(DH): The box gets wider with the particle count, so the fluid at rest fills about half its height whatever
+// the count is (and every slab holds the same amount for a given particles per worker)
+static func setup_params(solver_mode mode, u32 particle_count) -> sph_params<2> {
+	sph_params<2> params = sph_default_params<2>();
+	params.mode							= mode;
+	params.gravity						= -12.0f;
+	params.collision_damping			= 0.95f;
+	params.smoothing_radius 			= 0.35f;
+	params.target_density 				= 55.0f;
+	params.pressure_multiplier 			= 500.0f;
+	params.near_pressure_multiplier 	= 18.0f;
+	params.viscosity_strength 			= 0.06f;
+	f32 height							= 9.0f;
+	f32 rest_area						= particle_count / params.target_density;
+	params.bounds_size					= V2(std::max(34.0f, rest_area / (height * 0.5f) / 0.9f), height);
+	return params;
+}
+
+int main(int argc, char** argv) {
+	u32 worker_count	= argc > 1 ? atoi(argv[1]) : 4;
+	u32 particle_count	= argc > 2 ? atoi(argv[2]) : 16384;
+	u32 step_count		= argc > 3 ? atoi(argv[3]) : 200;
+	bool is_pbf			= argc > 4 && strcmp(argv[4], "pbf") == 0;
+	bool pin			= argc > 5 && strcmp(argv[5], "pin") == 0;
+
+	solver_mode mode = is_pbf ? solver_mode_pbf : solver_mode_wcsph;
+	f32 delta_time = is_pbf ? 1.0f / 120.0f : 1.0f / 480.0f;
+
+	char shm_name[64];
+	snprintf(shm_name, sizeof(shm_name), "/sim_domain_%d", (i32)getpid());
+
+	domain_control *ctrl = domain_create_shared(shm_name, worker_count, particle_count, step_count, delta_time, setup_params(mode, particle_count));
+	ctrl->pin_workers = pin;
+
+	printf("workers: %u, particles: %u, steps: %u, solver: %s, box: %.1f x %.1f, shared: %.2f MB (rings of %.1f KB)\n",
+		worker_count, particle_count, step_count, is_pbf ? "pbf" : "wcsph", ctrl->params.bounds_size.x, ctrl->params.bounds_size.y,
+		ctrl->total_size / (1024.0 * 1024.0), ctrl->ring_capacity / 1024.0);
+
+	fflush(stdout);
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	pid_t workers[domain_max_workers] = {};
+	for(u32 i = 0; i < worker_count; ++i) {
+		pid_t pid = fork();
+		if(pid < 0) { ctrl->abort.store(1); panic("Can't fork worker!"); }
+		if(pid == 0) _exit(domain_run_worker(shm_name, i));
+		workers[i] = pid;
+	}
+
+	// NOTE(DH): A worker that dies takes its rings with it, tell the others to stop waiting
+	bool failed = false;
+	for(u32 done = 0; done < worker_count; ++done) {
+		i32 status = 0;
+		pid_t pid = wait(&status);
+		if(pid < 0) break;
+		if(!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			// NOTE(DH): Any order, whichever dies first has to stop the rest before they block on its rings
+			u32 index = 0;
+			while(index < worker_count && workers[index] != pid) ++index;
+			fprintf(stderr, "worker %u (pid %d) failed: %s %d\n", index, (i32)pid,
+				WIFEXITED(status) ? "exit code" : "signal", WIFEXITED(status) ? WEXITSTATUS(status) : WTERMSIG(status));
+			failed = true;
+			ctrl->abort.store(1);
+		}
+	}
+
+	auto end = std::chrono::high_resolution_clock::now();
+	f64 wall = std::chrono::duration<f64>(end - start).count();
+
+	printf("%-7s %10s %10s %10s %10s %10s %6s %10s %10s %12s %12s\n", "worker", "owned", "max owned", "mig out", "mig in", "capacity", "grows", "arena MB",
+		"max speed", "step ms", "exchange ms");
+	u32 total_owned = 0;
+	for(u32 i = 0; i < worker_count; ++i) {
+		domain_worker_stats s = ctrl->stats[i];
+		f64 steps = s.steps_done ? s.steps_done : 1;
+		printf("%-7u %10u %10u %10u %10u %10u %6u %10.2f %10.2f %12.3f %12.3f\n", i, s.owned_count, s.max_owned_count, s.migrated_out, s.migrated_in,
+			s.capacity, s.grow_count, s.arena_bytes / (1024.0 * 1024.0), s.max_speed, s.step_seconds * 1000.0 / steps, s.exchange_seconds * 1000.0 / steps);
+		total_owned += s.owned_count;
+	}
+
+	printf("wall: %.3f s, %.1f steps/s, particles %s (%u of %u)\n", wall, step_count / wall,
+		total_owned == particle_count ? "conserved" : "LOST", total_owned, particle_count);
+
+	domain_close_shared(ctrl);
+	shm_unlink(shm_name);
+
+	return (failed || total_owned != particle_count) ? 1 : 0;
+}
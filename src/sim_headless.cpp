@@ -0,0 +1,94 @@
+// NOTE(DH): Headless run of the CPU solver: steps the simulation, renders every frame with the CPU particle
+// renderer and records it through the asynchronous frame capture. Output ending in .y4m is one video stream,
+// anything else is a PPM pattern with one %u (e.g. frames/frame_%05u.ppm).
+//
+// clang++ ./src/sim_headless.cpp -o ./bin/sim_headless -std=c++20 -O2 -mavx -I ./src -lpthread
+// ./bin/sim_headless [particles] [seconds] [out] [drop|block] [width] [height] [fps] [pbf|wcsph]
+
+#include "simulation_of_particles_core.h"
+#include "particle_renderer.h"
+#include "frame_capture.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+void* allocate_memory(void* base, size_t size) { return malloc(size);}
+
+int main(int argc, char** argv) {
+	u32 particle_count	= argc > 1 ? atoi(argv[1]) : 16384;
+	f32 seconds			= argc > 2 ? atof(argv[2]) : 10.0f;
+	const char *out		= argc > 3 ? argv[3] : "particles.y4m";
+	bool block			= argc > 4 && strcmp(argv[4], "block") == 0;
+	u32 width			= argc > 5 ? atoi(argv[5]) : 1280;
+	u32 height			= argc > 6 ? atoi(argv[6]) : 720;
+	u32 fps				= argc > 7 ? atoi(argv[7]) : 30;
+	bool is_wcsph		= argc > 8 && strcmp(argv[8], "wcsph") == 0;
+
+	u32 out_length = strlen(out);
+	capture_format format = (out_length > 4 && strcmp(out + out_length - 4, ".y4m") == 0) ? capture_format_y4m : capture_format_ppm;
+
+	sph_params<2> params = sph_default_params<2>();
+	params.mode							= is_wcsph ? solver_mode_wcsph : solver_mode_pbf;
+	params.gravity						= -12.0f;
+	params.smoothing_radius 			= 0.35f;
+	params.target_density 				= 55.0f;
+	params.bounds_size					= V2(17.0f, 9.0f);
+
+	memory_arena arena = initialize_arena(Megabytes(64) + (usize)particle_count * 128);
+	sph_state<2> s = sph_create<2>(&arena, particle_count, params);
+	sph_spawn_grid(&arena, &s, params.particle_size * 2 + 0.03f);
+
+	job_system *jobs = job_system::create();
+	particle_renderer renderer = particle_renderer::create(default_allocator, jobs);
+	particle_render_settings settings = particle_render_default_settings(params.bounds_size, params.particle_size);
+	settings.max_velocity = 6.0f;
+
+	frame_capture *capture = frame_capture::create(default_allocator, out, format, block ? capture_policy_block : capture_policy_drop, width, height, fps, 8);
+
+	f32 frame_dt = 1.0f / fps;
+	u32 steps_per_frame = std::max(1u, (u32)ceilf(frame_dt * 120.0f));
+	f32 step_dt = frame_dt / steps_per_frame;
+	u32 frame_count = (u32)(seconds * fps);
+
+	f64 sim_seconds = 0, render_seconds = 0;
+	auto start = std::chrono::high_resolution_clock::now();
+
+	for(u32 frame = 0; frame < frame_count; ++frame) {
+		auto t0 = std::chrono::high_resolution_clock::now();
+		for(u32 i = 0; i < steps_per_frame; ++i) sph_step(&arena, &s, step_dt);
+		auto t1 = std::chrono::high_resolution_clock::now();
+
+		// NOTE(DH): Render straight into the capture slot, nothing is copied
+		image_buffer target = capture->acquire();
+		if(target.render_img) {
+			renderer.render(&target, arena.get_array(s.positions), arena.get_array(s.velocities), particle_count, settings);
+			capture->submit(target);
+		}
+		auto t2 = std::chrono::high_resolution_clock::now();
+
+		sim_seconds += std::chrono::duration<f64>(t1 - t0).count();
+		render_seconds += std::chrono::duration<f64>(t2 - t1).count();
+	}
+
+	auto loop_end = std::chrono::high_resolution_clock::now();
+	capture_stats before_drain = capture->stats();
+	capture->destroy();
+	auto end = std::chrono::high_resolution_clock::now();
+
+	f64 loop = std::chrono::duration<f64>(loop_end - start).count();
+	f64 drain = std::chrono::duration<f64>(end - loop_end).count();
+
+	printf("frames: %u (%ux%u @ %u fps, %u steps/frame), particles: %u\n", frame_count, width, height, fps, steps_per_frame, particle_count);
+	printf("loop: %.3f s (%.1f fps), sim %.2f ms/frame, render %.2f ms/frame, drain after loop %.3f s\n",
+		loop, frame_count / loop, sim_seconds * 1000.0 / frame_count, render_seconds * 1000.0 / frame_count, drain);
+	printf("capture: submitted %llu, dropped %llu, queue depth at end %u (max %u), producer blocked %.3f s, writer busy %.3f s, %.1f MB written\n",
+		(unsigned long long)before_drain.submitted, (unsigned long long)before_drain.dropped, before_drain.queue_depth, before_drain.max_queue_depth,
+		before_drain.producer_wait_seconds, before_drain.writer_busy_seconds, before_drain.bytes_written / (1024.0 * 1024.0));
+	if(before_drain.write_errors) printf("capture: %llu frames were not written completely\n", (unsigned long long)before_drain.write_errors);
+
+	renderer.destroy();
+	jobs->destroy();
+	free(arena.base);
+	return 0;
+}
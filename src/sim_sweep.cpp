@@ -0,0 +1,292 @@
+// NOTE(DH): Parameter sweep batch runner for the CPU solver. Expands a grid over the fluid parameters, runs
+// one independent simulation per hardware thread (each with its own arena) for a fixed simulated time and
+// appends one CSV row per configuration as soon as it finishes, so an overnight run can be read while going.
+//
+// clang++ ./src/sim_sweep.cpp -o ./bin/sim_sweep -std=c++20 -O2 -mavx -I ./src -lpthread
+// ./bin/sim_sweep grid.txt results.csv [threads]
+//
+// Grid file, one setting per line, '#' starts a comment. Parameter values are a list or start:end:count.
+//   smoothing_radius   0.3 0.35 0.4
+//   target_density     40:70:4
+//   pressure_multiplier 300 500
+//   viscosity_strength 0.02 0.06
+//   collision_damping  0.9 0.95
+//   particles 4096
+//   seconds   4
+//   dt        0.002083
+//   mode      wcsph            (or pbf)
+//   pbf_iterations 4
+
+#include "simulation_of_particles_core.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+
+void* allocate_memory(void* base, size_t size) { return malloc(size);}
+
+static constexpr u32 sweep_axis_count = 5;
+static constexpr u32 sweep_max_values = 64;
+
+static const char *sweep_axis_names[sweep_axis_count] = {
+	"smoothing_radius",
+	"target_density",
+	"pressure_multiplier",
+	"viscosity_strength",
+	"collision_damping",
+};
+
+struct sweep_axis {
+	u32 count;
+	f32 values[sweep_max_values];
+};
+
+struct sweep_grid {
+	sweep_axis axes[sweep_axis_count];
+	sph_params<2> base;
+	u32 particle_count;
+	f32 seconds;
+	f32 delta_time;
+	u32 samples;			// NOTE(DH): How many times kinetic energy is sampled over the run
+};
+
+struct sweep_result {
+	f32 values[sweep_axis_count];
+	f32 density_error;
+	f32 kinetic_energy_final;
+	f32 kinetic_energy_mean;
+	f64 step_ms_mean;
+	f64 step_ms_max;
+	f32 max_speed;
+	bool exploded;
+};
+
+static func parse_axis(sweep_axis *axis, char *rest) -> bool {
+	axis->count = 0;
+
+	f32 start, end; u32 count;
+	if(sscanf(rest, " %f:%f:%u", &start, &end, &count) == 3) {
+		if(count == 0 || count > sweep_max_values) return false;
+		for(u32 i = 0; i < count; ++i) {
+			axis->values[axis->count++] = count == 1 ? start : start + (end - start) * i / (count - 1);
+		}
+		return true;
+	}
+
+	char *cursor = rest;
+	while(axis->count < sweep_max_values) {
+		char *next = nullptr;
+		f32 value = strtof(cursor, &next);
+		if(next == cursor) break;
+		axis->values[axis->count++] = value;
+		cursor = next;
+	}
+	return axis->count > 0;
+}
+
+static func load_grid(const char *path, sweep_grid *grid) -> bool {
+	FILE *file = fopen(path, "rb");
+	if(!file) return false;
+
+	*grid = {};
+	grid->base						= sph_default_params<2>();
+	grid->base.gravity				= -12.0f;
+	grid->base.bounds_size			= V2(17.0f, 9.0f);
+	grid->base.smoothing_radius		= 0.35f;
+	grid->base.target_density		= 55.0f;
+	grid->base.pressure_multiplier	= 500.0f;
+	grid->base.near_pressure_multiplier = 18.0f;
+	grid->base.viscosity_strength	= 0.06f;
+	grid->particle_count			= 4096;
+	grid->seconds					= 2.0f;
+	grid->delta_time				= 1.0f / 480.0f;
+	grid->samples					= 32;
+
+	char line[1024];
+	u32 line_number = 0;
+	bool ok = true;
+	while(ok && fgets(line, sizeof(line), file)) {
+		++line_number;
+		if(char *comment = strchr(line, '#')) *comment = 0;
+
+		char name[64];
+		i32 consumed = 0;
+		if(sscanf(line, " %63s%n", name, &consumed) != 1) continue;
+		char *rest = line + consumed;
+
+		bool known = false;
+		for(u32 a = 0; a < sweep_axis_count; ++a) {
+			if(strcmp(name, sweep_axis_names[a]) == 0) { ok = parse_axis(&grid->axes[a], rest); known = true; }
+		}
+
+		if(known) 										{}
+		else if(strcmp(name, "particles") == 0)			grid->particle_count = atoi(rest);
+		else if(strcmp(name, "seconds") == 0)			grid->seconds = atof(rest);
+		else if(strcmp(name, "dt") == 0)				grid->delta_time = atof(rest);
+		else if(strcmp(name, "samples") == 0)			grid->samples = std::max(1, atoi(rest));
+		else if(strcmp(name, "gravity") == 0)			grid->base.gravity = atof(rest);
+		else if(strcmp(name, "near_pressure_multiplier") == 0) grid->base.near_pressure_multiplier = atof(rest);
+		else if(strcmp(name, "pbf_iterations") == 0)	grid->base.pbf.iterations = atoi(rest);
+		else if(strcmp(name, "mode") == 0)				grid->base.mode = strstr(rest, "pbf") ? solver_mode_pbf : solver_mode_wcsph;
+		else ok = false;
+
+		if(!ok) fprintf(stderr, "%s:%u: can't parse '%s'\n", path, line_number, name);
+	}
+	fclose(file);
+
+	// NOTE(DH): Axes that are not swept keep the base value
+	f32 *base_values[sweep_axis_count] = {
+		&grid->base.smoothing_radius, &grid->base.target_density, &grid->base.pressure_multiplier,
+		&grid->base.viscosity_strength, &grid->base.collision_damping,
+	};
+	for(u32 a = 0; a < sweep_axis_count; ++a) {
+		if(grid->axes[a].count == 0) grid->axes[a] = {.count = 1, .values = {*base_values[a]}};
+	}
+
+	return ok;
+}
+
+static func config_count(sweep_grid *grid) -> u32 {
+	u32 result = 1;
+	for(u32 a = 0; a < sweep_axis_count; ++a) result *= grid->axes[a].count;
+	return result;
+}
+
+// NOTE(DH): Config index -> one value per axis, last axis changes fastest
+static func config_params(sweep_grid *grid, u32 config, f32 *values) -> sph_params<2> {
+	sph_params<2> params = grid->base;
+	for(i32 a = sweep_axis_count - 1; a >= 0; --a) {
+		values[a] = grid->axes[a].values[config % grid->axes[a].count];
+		config /= grid->axes[a].count;
+	}
+	params.smoothing_radius		= values[0];
+	params.target_density		= values[1];
+	params.pressure_multiplier	= values[2];
+	params.viscosity_strength	= values[3];
+	params.collision_damping	= values[4];
+	return params;
+}
+
+static func max_speed(memory_arena *arena, sph_state<2> *s) -> f32 {
+	auto velocities = arena->get_array(s->velocities);
+	f32 result = 0;
+	for(u32 i = 0; i < s->velocities.count; ++i) result = fmax(result, Inner(velocities[i], velocities[i]));
+	return SquareRoot(result);
+}
+
+// NOTE(DH): The walls keep positions (and so energy) finite, a blow up mostly shows as speed: nothing in a box
+// of height H can go faster than free fall over H, twice that means the solver is pumping energy in. Same test
+// as junk/sim_benchmarks/pbf_vs_wcsph.cpp, non-finite values are only the backstop
+static func blew_up(sph_params<2> *params, f32 speed, f32 energy) -> bool {
+	f32 free_fall_speed = SquareRoot(2.0f * fabsf(params->gravity) * params->bounds_size.y);
+	return !(speed <= 2.0f * free_fall_speed) || !std::isfinite(energy);
+}
+
+static func run_config(sweep_grid *grid, u32 config) -> sweep_result {
+	sweep_result result = {};
+	sph_params<2> params = config_params(grid, config, result.values);
+
+	memory_arena arena = initialize_arena(Megabytes(1) + (usize)grid->particle_count * 128);
+	sph_state<2> s = sph_create<2>(&arena, grid->particle_count, params);
+	sph_spawn_grid(&arena, &s, params.particle_size * 2 + 0.03f);
+
+	u32 steps = std::max(1u, (u32)(grid->seconds / grid->delta_time));
+	u32 sample_every = std::max(1u, steps / grid->samples);
+	u32 sample_count = 0;
+	u32 steps_run = 0;
+	f64 step_seconds = 0;
+
+	for(u32 step = 0; step < steps; ++step) {
+		auto start = std::chrono::high_resolution_clock::now();
+		sph_step(&arena, &s, grid->delta_time);
+		auto end = std::chrono::high_resolution_clock::now();
+
+		f64 seconds = std::chrono::duration<f64>(end - start).count();
+		step_seconds += seconds;
+		++steps_run;
+		result.step_ms_max = std::max(result.step_ms_max, seconds * 1000.0);
+
+		if((step + 1) % sample_every == 0) {
+			f32 energy = sph_kinetic_energy(&arena, &s);
+			f32 speed = max_speed(&arena, &s);
+			result.max_speed = std::max(result.max_speed, speed);
+			// NOTE(DH): A blown up run is not worth finishing
+			if(blew_up(&params, speed, energy)) { result.exploded = true; break; }
+			result.kinetic_energy_mean += energy;
+			++sample_count;
+		}
+	}
+
+	result.step_ms_mean = step_seconds * 1000.0 / steps_run;	// NOTE(DH): Fewer than steps if it blew up
+	result.kinetic_energy_mean /= std::max(1u, sample_count);
+	result.kinetic_energy_final = sph_kinetic_energy(&arena, &s);
+	result.density_error = sph_density_error(&arena, &s);
+	f32 final_speed = max_speed(&arena, &s);
+	result.max_speed = std::max(result.max_speed, final_speed);
+	result.exploded = result.exploded || blew_up(&params, final_speed, result.kinetic_energy_final) || !std::isfinite(result.density_error);
+
+	free(arena.base);
+	return result;
+}
+
+int main(int argc, char** argv) {
+	if(argc < 3) {
+		fprintf(stderr, "usage: %s grid.txt results.csv [threads]\n", argv[0]);
+		return 1;
+	}
+
+	sweep_grid grid;
+	if(!load_grid(argv[1], &grid)) { fprintf(stderr, "can't load grid %s\n", argv[1]); return 1; }
+
+	FILE *csv = fopen(argv[2], "wb");
+	if(!csv) { fprintf(stderr, "can't open %s\n", argv[2]); return 1; }
+
+	u32 thread_count = argc > 3 ? atoi(argv[3]) : 0;
+	if(thread_count == 0) thread_count = std::max(1u, std::thread::hardware_concurrency());
+
+	u32 total = config_count(&grid);
+	thread_count = std::min(thread_count, total);
+
+	printf("%u configurations, %u particles, %.2f simulated s each, %s, %u threads\n", total, grid.particle_count, grid.seconds,
+		grid.base.mode == solver_mode_pbf ? "pbf" : "wcsph", thread_count);
+
+	fprintf(csv, "config");
+	for(u32 a = 0; a < sweep_axis_count; ++a) fprintf(csv, ",%s", sweep_axis_names[a]);
+	fprintf(csv, ",density_error,kinetic_energy_final,kinetic_energy_mean,step_ms_mean,step_ms_max,max_speed,exploded\n");
+	fflush(csv);
+
+	std::atomic<u32> next_config = 0;
+	std::atomic<u32> finished = 0;
+	std::mutex csv_lock;
+	auto start = std::chrono::high_resolution_clock::now();
+
+	auto worker = [&]() {
+		for(u32 config = next_config.fetch_add(1); config < total; config = next_config.fetch_add(1)) {
+			sweep_result r = run_config(&grid, config);
+
+			std::lock_guard<std::mutex> guard(csv_lock);
+			fprintf(csv, "%u", config);
+			for(u32 a = 0; a < sweep_axis_count; ++a) fprintf(csv, ",%g", r.values[a]);
+			fprintf(csv, ",%g,%g,%g,%.4f,%.4f,%g,%u\n", r.density_error, r.kinetic_energy_final, r.kinetic_energy_mean, r.step_ms_mean, r.step_ms_max, r.max_speed, r.exploded ? 1 : 0);
+			fflush(csv);
+
+			u32 done = ++finished;
+			f64 elapsed = std::chrono::duration<f64>(std::chrono::high_resolution_clock::now() - start).count();
+			printf("\r%u / %u done, %.1f s elapsed, ~%.0f s left   ", done, total, elapsed, elapsed / done * (total - done));
+			fflush(stdout);
+		}
+	};
+
+	std::thread threads[256];
+	thread_count = std::min(thread_count, 256u);
+	for(u32 i = 1; i < thread_count; ++i) threads[i] = std::thread(worker);
+	worker();
+	for(u32 i = 1; i < thread_count; ++i) threads[i].join();
+
+	printf("\nresults written to %s\n", argv[2]);
+	fclose(csv);
+	return 0;
+}
@@ -56,18 +56,6 @@ static inline func spiky_pow_2_scaling_factor(f32 smoothing_radius) -> f32 {
 	return 6.0f / (std::numbers::pi * pow(smoothing_radius, 4.0f));
 }
 
-static inline func spiky_pow_3_scaling_factor(f32 smoothing_radius) -> f32 {
-	return 10.0f / (std::numbers::pi * pow(smoothing_radius, 5.0f));
-}
-
-static inline func spiky_pow_2_derivative_scaling_factor(f32 smoothing_radius) -> f32 {
-	return 12.0f / (std::numbers::pi * pow(smoothing_radius, 4.0f));
-}
-
-static inline func spiky_pow_3_derivative_scaling_factor(f32 smoothing_radius) -> f32 {
-	return 30.0f / (std::numbers::pi * pow(smoothing_radius, 5.0f));
-}
-
 static inline func smoothing_kernel(f32 dst, f32 radius) -> f32 {
 	if(dst < radius) {
 		f32 v = radius - dst;
@@ -76,288 +64,54 @@ static inline func smoothing_kernel(f32 dst, f32 radius) -> f32 {
 	return 0;
 }
 
-static inline func smoothing_kernel_near(f32 dst, f32 radius) -> f32 {
-	if(dst >= radius) return 0;
-	f32 volume = (std::numbers::pi * pow(radius, 6.0f)) / 8.0f;
-	return(radius - dst) * (radius - dst) / volume;
-}
-
-static inline func viscosity_smoothing_kernel(f32 dst, f32 radius) -> f32 {
-	if(dst >= radius) return 0;
-	f32 volume = (std::numbers::pi * pow(radius, 4.0f)) / 6.0f;
-	return(radius - dst) * (radius - dst) / volume;
-}
-
-static inline func smoothing_kernel_derivative(f32 dst, f32 radius) -> f32 {
-	if(dst <= radius) {
-		f32 v = radius - dst;
-		return -v * spiky_pow_2_derivative_scaling_factor(radius);
-	}
-	return 0;
-}
-
-static inline func smoothing_kernel_derivative_near(f32 dst, f32 radius) -> f32 {
-	if(dst <= radius) {
-		f32 v = radius - dst;
-		return -v * spiky_pow_3_derivative_scaling_factor(radius);
-	}
-	return 0;
-}
-
-static inline func get_random_dir() -> v2 {
-	// NOTE(DH): Randomly create particles
-	printf("Get random dir is called !\n");
-	std::random_device rd;
-	std::mt19937 gen(rd());
-	std::uniform_real_distribution<f32> distrib(0.0f, 2.0f * std::numbers::pi);
-
-	f32 angle = distrib(gen);
-
-	f32 x = cos(angle);
-	f32 y = sin(angle);
-
-	return V2(x, y);
-}
-
-// NOTE(DH): Convert position to the coordinate of the cell it is within
-static inline func position_to_cell_coord (v2 point, f32 radius) -> v2i {
-	i32 cell_x = i32(point.x / radius);
-	i32 cell_y = i32(point.y / radius);
-	return V2i(cell_x, cell_y);
-}
-
-// NOTE(DH): Convert a cell coordinate into a single number
-// Hash collisions (different cells -> same value) are unavoidable, but we want to
-// at least try to minimize collisions for nearby cells. Mabe better ways is exist, but
-// this is my approach, so it works for now :)
-static inline func hash_cell(i32 cell_x, i32 cell_y) -> u32 {
-	u32 a = (u32)cell_x * 15823;
-	u32 b = (u32)cell_y * 9737333;
-	return a + b;
-}
-
-// NOTE(DH): Wrap the hash value around the length of the array (so it can be used as an index)
-static inline func get_key_from_hash(u32 hash, u32 array_count) -> u32 {
-	return hash % array_count;
-}
-
-inline func particle_simulation::foreach_point_within_radius(f32 dt, v2 sample_point, u8* data, void(*lambda)(particle_simulation *sim, u32 particle_idx, f32 dt, f32 gravity, u8* data)) -> void {
-	auto indices 		= arena.get_array(this->start_indices);
-	auto spatial_lookup = arena.get_array(this->spatial_lookup);
-	auto points			= arena.get_array(this->positions);
-
-	u32 num_of_iters = 0;
-
-	v2i centre = position_to_cell_coord(sample_point, this->info_for_cshader.smoothing_radius);
-	f32 sqr_radius = this->info_for_cshader.smoothing_radius * this->info_for_cshader.smoothing_radius;
-
-	auto cell_offsets = arena.get_array(this->cell_offsets);
-
-	for(u32 i = 0; i < this->cell_offsets.count; ++i) {
-		u32 key = get_key_from_hash(hash_cell(centre.x + cell_offsets[i].x, centre.y + cell_offsets[i].y), this->spatial_lookup.count);
-		i32 cell_start_index = indices[key];
-
-		for(i32 j = cell_start_index; j < this->spatial_lookup.count; ++j) {
-			if(spatial_lookup[j].cell_key != key) break;
-
-			u32 particle_index  = spatial_lookup[j].particle_index;
-			f32 sqr_dst = Length(points[particle_index] - sample_point);
-
-			// NOTE(DH): Test if the point is inside the radius
-			if(sqr_dst <= sqr_radius) {
-				lambda(this, particle_index, dt, this->info_for_cshader.gravity, data);
-				++num_of_iters;
-			}
-		}
-	}
-
-	// printf("num of iters: %u\n", num_of_iters);
-}
+// NOTE(DH): visit(particle_idx, offset, sqr_dst) for every particle within `radius` of `sample_point`. The lookup is
+// built from predicted positions, which are at most a step ahead of the current ones.
+template<typename F>
+inline func particle_simulation::foreach_point_within_radius(v2 sample_point, f32 radius, F visit) -> void {
+	sph_state<2> state = cpu_state();
+	auto query = sph_make_query(&arena, &state, arena.get_array(this->positions), state.params.smoothing_radius);
+	query.radius(sample_point, radius, visit);
+}
+
+// NOTE(DH): View of this simulation as the shared solver state, arrays still live in this->arena
+inline func particle_simulation::cpu_state() -> sph_state<2> {
+	sph_state<2> result = {};
+
+	result.params.mode						= this->mode;
+	result.params.pbf						= this->pbf;
+	result.params.smoothing_radius			= this->info_for_cshader.smoothing_radius;
+	result.params.target_density			= this->info_for_cshader.target_density;
+	result.params.pressure_multiplier		= this->info_for_cshader.pressure_multiplier;
+	result.params.near_pressure_multiplier	= this->info_for_cshader.near_pressure_multiplier;
+	result.params.viscosity_strength		= this->info_for_cshader.viscosity_strength;
+	result.params.gravity					= this->info_for_cshader.gravity;
+	result.params.collision_damping			= this->info_for_cshader.collision_damping;
+	result.params.particle_size				= this->particle_size;
+	result.params.prediction_factor			= 1.0f / 120.0f;
+	result.params.bounds_size				= this->info_for_cshader.bounds_size;
+	result.params.pull_push_radius			= this->info_for_cshader.pull_push_radius;
+	result.params.pull_push_strength		= this->info_for_cshader.pull_push_strength;
+
+	result.positions			= this->positions;
+	result.predicted_positions	= this->predicted_positions;
+	result.velocities			= this->velocities;
+	result.densities			= this->densities;
+	result.start_indices		= this->start_indices;
+	result.spatial_lookup		= this->spatial_lookup;
+	result.pbf_lambdas			= this->pbf_lambdas;
+	result.pbf_deltas			= this->pbf_deltas;
+	result.cell_starts			= this->cell_starts;
+	result.grid					= this->grid;
 
-inline func particle_simulation::update_spatial_lookup(f32 radius) -> void {
-	auto indices = arena.get_array(this->start_indices);
-	auto lookup = arena.get_array(this->spatial_lookup);
-	auto points	= arena.get_array(this->predicted_positions);
-
-	for(u32 i = 0 ; i < this->positions.count; ++i) {
-		v2i cell = position_to_cell_coord(points[i], radius);
-		u32 cell_key = get_key_from_hash(hash_cell(cell.x, cell.y), this->positions.count);
-		lookup[i] = {.particle_index = i, .cell_key = cell_key};
-		indices[i] = INT_MAX;
-	}
-
-	auto sort_func = [](spatial_data a, spatial_data b) {
-		return a.cell_key < b.cell_key;
-	};
-
-	std::sort(lookup, lookup + this->spatial_lookup.count, sort_func);
-
-	for(u32 i = 0; i < this->positions.count; ++i) {
-		u32 key = lookup[i].cell_key;
-		u32 key_prev = (i == 0) ? UINT_MAX : lookup[i - 1].cell_key;
-		if(key != key_prev) {
-			indices[key] = i;
-		}
-	}
-}
-
-inline func particle_simulation::calculate_shared_pressure(f32 density_a, f32 density_b, f32 near_density_a, f32 near_density_b) -> v2 {
-	v2 pressure_A = convert_density_to_pressure(density_a, near_density_a);
-	v2 pressure_B = convert_density_to_pressure(density_b, near_density_b);
-	v2 result = V2((pressure_A.x + pressure_B.x) / 2, (pressure_A.y + pressure_B.y) / 2);
 	return result;
 }
 
-inline func particle_simulation::calculate_pressure_force(u32 particle_idx, f32 smoothing_radius) -> v2 {
-	auto densities = arena.get_array(this->densities);
-
-	v2 pressure_force = {};
-
-	auto indices 		= arena.get_array(this->start_indices);
-	auto spatial_lookup = arena.get_array(this->spatial_lookup);
-	auto points			= arena.get_array(this->predicted_positions); // NOTE(DH): We need to use here predicted positions!!!
-
-	v2i centre = position_to_cell_coord(points[particle_idx], smoothing_radius);
-	f32 sqr_radius = smoothing_radius * smoothing_radius;
-
-	auto cell_offsets = arena.get_array(this->cell_offsets);
-
-	for(u32 i = 0; i < this->cell_offsets.count; ++i) {
-		u32 key = get_key_from_hash(hash_cell(centre.x + cell_offsets[i].x, centre.y + cell_offsets[i].y), this->spatial_lookup.count);
-		i32 cell_start_index = indices[key];
-
-		for(i32 j = cell_start_index; j < this->spatial_lookup.count; ++j) {
-			if(spatial_lookup[j].cell_key != key) break;
-
-			u32 particle_index  = spatial_lookup[j].particle_index;
-
-			if(particle_idx == particle_index) continue;
-
-			v2 offset_to_neighbour = points[particle_index] - points[particle_idx];
-			f32 sqr_dst = Inner(offset_to_neighbour, offset_to_neighbour);
-
-			// NOTE(DH): Test if the point is inside the radius
-			if(sqr_dst > sqr_radius) continue;
-
-			f32 dst = sqrt(sqr_dst);
-			v2 dir = (dst > 0.0f) ?  offset_to_neighbour / dst : get_random_dir();
-
-			f32 density = densities[particle_idx].x;
-			f32 near_density = densities[particle_idx].y;
-			v2 shared_pressure = calculate_shared_pressure(density, densities[particle_idx].x, near_density, densities[particle_idx].y);
-			pressure_force += shared_pressure.x * dir * smoothing_kernel_derivative(dst, smoothing_radius) / density;
-			pressure_force += shared_pressure.y * dir * smoothing_kernel_derivative_near(dst, smoothing_radius) / near_density;
-		}
-	}
-
-	return pressure_force;
-}
-
-inline func particle_simulation::calculate_density(v2 sample_point, f32 smoothing_radius) -> f32 {
-	auto positions 		= arena.get_array(this->predicted_positions);
-	auto indices 		= arena.get_array(this->start_indices);
-	auto spatial_lookup = arena.get_array(this->spatial_lookup);
-
-	f32 density = 0;
-
-	auto cell_offsets = arena.get_array(this->cell_offsets);
-	v2i centre = position_to_cell_coord(sample_point, smoothing_radius);
-	f32 sqr_radius = Square(smoothing_radius);
-
-	for(u32 i = 0; i < this->cell_offsets.count; ++i) {
-		u32 key = get_key_from_hash(hash_cell(centre.x + cell_offsets[i].x, centre.y + cell_offsets[i].y), this->spatial_lookup.count);
-		i32 cell_start_index = indices[key];
-
-		for(i32 j = cell_start_index; j < this->spatial_lookup.count; ++j) {
-			if(spatial_lookup[j].cell_key != key) break;
-
-			u32 particle_index  = spatial_lookup[j].particle_index;
-
-			v2 offset_to_neighbour = positions[particle_index] - sample_point;
-			f32 sqr_dst = Inner(offset_to_neighbour, offset_to_neighbour);
-
-			// NOTE(DH): Test if the point is inside the radius
-			if(sqr_dst <= sqr_radius) {
-				f32 dst = sqrt(sqr_dst);
-				f32 influence = smoothing_kernel(dst, smoothing_radius);
-				density += influence;
-			}
-		}
-	}
-
-	return density;
-}
-
-inline func particle_simulation::calculate_near_density(v2 sample_point, f32 smoothing_radius) -> f32 {
-	auto positions 		= arena.get_array(this->predicted_positions);
-	auto indices 		= arena.get_array(this->start_indices);
-	auto spatial_lookup = arena.get_array(this->spatial_lookup);
-
-	f32 density = 0;
-
-	auto cell_offsets = arena.get_array(this->cell_offsets);
-	v2i centre = position_to_cell_coord(sample_point, smoothing_radius);
-	f32 sqr_radius = Square(smoothing_radius);
-
-	for(u32 i = 0; i < this->cell_offsets.count; ++i) {
-		u32 key = get_key_from_hash(hash_cell(centre.x + cell_offsets[i].x, centre.y + cell_offsets[i].y), this->spatial_lookup.count);
-		i32 cell_start_index = indices[key];
-
-		for(i32 j = cell_start_index; j < this->spatial_lookup.count; ++j) {
-			if(spatial_lookup[j].cell_key != key) break;
-
-			u32 particle_index  = spatial_lookup[j].particle_index;
-			v2 offset_to_neighbour = positions[particle_index] - sample_point;
-			f32 sqr_dst = Inner(offset_to_neighbour, offset_to_neighbour);
-
-			// NOTE(DH): Test if the point is inside the radius
-			if(sqr_dst <= sqr_radius) {
-				f32 dst = sqrt(sqr_dst);
-				f32 influence = smoothing_kernel_near(dst, smoothing_radius);
-				density += influence;
-			}
-		}
-	}
-
-	return density;
-}
-
-inline func particle_simulation::calculate_viscosity(u32 particle_index) -> v2 {
-	auto positions 		= arena.get_array(this->positions);
-	auto indices 		= arena.get_array(this->start_indices);
-	auto spatial_lookup = arena.get_array(this->spatial_lookup);
-	auto velocities 	= arena.get_array(this->velocities);
-
-	v2 viscosity_force = {};
-	v2 position = positions[particle_index];
-
-	f32 density = 0;
-
-	auto cell_offsets = arena.get_array(this->cell_offsets);
-	v2i centre = position_to_cell_coord(position, this->info_for_cshader.smoothing_radius);
-	f32 sqr_radius = Square(this->info_for_cshader.smoothing_radius);
-
-	for(u32 i = 0; i < this->cell_offsets.count; ++i) {
-		u32 key = get_key_from_hash(hash_cell(centre.x + cell_offsets[i].x, centre.y + cell_offsets[i].y), this->spatial_lookup.count);
-		i32 cell_start_index = indices[key];
-
-		for(i32 j = cell_start_index; j < this->spatial_lookup.count; ++j) {
-			if(spatial_lookup[j].cell_key != key) break;
-
-			u32 other_index  = spatial_lookup[j].particle_index;
-			v2 offset_to_neighbour = positions[other_index] - position;
-			f32 sqr_dst = Inner(offset_to_neighbour, offset_to_neighbour);
-
-			// NOTE(DH): Test if the point is inside the radius
-			if(sqr_dst <= sqr_radius) {
-				f32 dst = sqrt(sqr_dst);
-				f32 influence = viscosity_smoothing_kernel(dst, this->info_for_cshader.smoothing_radius);
-				viscosity_force += (velocities[other_index] - velocities[particle_index]) * influence;
-			}
-		}
-	}
-
-	return viscosity_force * this->info_for_cshader.viscosity_strength;
+inline func particle_simulation::update_spatial_lookup(f32 radius) -> void {
+	sph_state<2> state = cpu_state();
+	state.params.smoothing_radius = radius;
+	sph_update_spatial_lookup(&arena, &state);
+	this->cell_starts	= state.cell_starts;
+	this->grid			= state.grid;
 }
 
 inline func particle_simulation::calculate_property(v2 sample_point, f32 smoothing_radius) -> f32 {
@@ -378,31 +132,6 @@ inline func particle_simulation::calculate_property(v2 sample_point, f32 smoothi
 	return property;
 }
 
-inline func particle_simulation::convert_density_to_pressure(f32 density, f32 near_density) -> v2 {
-	f32 density_error = density - info_for_cshader.target_density;
-	f32 pressure = density_error * info_for_cshader.pressure_multiplier;
-	f32 near_pressure = near_density * this->info_for_cshader.near_pressure_multiplier;
-	return V2(pressure, near_pressure);
-}
-
-func sign(f32 val) -> f32 {
-	if(val > 0) return 1;
-	else if(val < 0) return -1.0f;
-	return 0;
-}
-
-func particle_simulation::resolve_collisions(v2* position, v2* velocity, f32 particle_size) -> void {
-	v2 half_bound_size = this->info_for_cshader.bounds_size * 0.5f - V2(particle_size, particle_size);
-
-	if(abs(position->x) > half_bound_size.x) {
-		position->x = half_bound_size.x * sign(position->x);
-		velocity->x *= -1 * info_for_cshader.collision_damping;
-	}
-	if(abs(position->y) > half_bound_size.y) {
-		position->y = half_bound_size.y * sign(position->y);
-		velocity->y *= -1 * info_for_cshader.collision_damping;
-	}
-}
 
 ID3D12GraphicsCommandList* generate_compute_command_buffer(dx_context *ctx, memory_arena arena, arena_array<resource_and_view> r_n_v, ID3D12GraphicsCommandList *cmd_list, descriptor_heap heap, rendering_stage rndr_stage, u32 width, u32 height)
 {
@@ -546,13 +275,8 @@ inline func particle_simulation::simulation_step(dx_context *ctx, f32 delta_time
 	this->sim_data_counter++;
 	this->info_for_cshader.delta_time = delta_time;
 
-	auto dnsties	= arena.get_array(this->densities);
-	auto near_dnsties	= arena.get_array(this->near_densities);
 	auto positions = arena.get_array(this->positions);
-	auto velocities = arena.get_array(this->velocities);
-	auto predicted_positions = arena.get_array(this->predicted_positions);
 
-	f32 prediction_factor = 1.0f / 120.0f;
 	f32 aspect = (f32)width / (f32)height;
 	f32 scale = 5.0f;
 	v2 mouse_centered = V2((-mouse_pos.x + (width / 2)), mouse_pos.y - (height / 2));
@@ -561,99 +285,24 @@ inline func particle_simulation::simulation_step(dx_context *ctx, f32 delta_time
 	// ndc_mouse_pos = camera * ndc_mouse_pos;
 	// mat4 view = (translation_matrix(V3(mouse_pos, 1.0f)) * camera);
 
-	for(u32 i = 0 ; i < this->positions.count; ++i) {
-		velocities[i] += V2(0.0, 1.0f) * info_for_cshader.gravity * delta_time;
-
-		if(is_left_mouse)
-			velocities[i] += interaction_force(ndc_mouse_pos.xy, this->info_for_cshader.pull_push_radius, this->info_for_cshader.pull_push_strength, i);
-		else if (is_right_mouse)
-			velocities[i] += interaction_force(ndc_mouse_pos.xy, this->info_for_cshader.pull_push_radius, -this->info_for_cshader.pull_push_strength, i);
-
-		predicted_positions[i] = positions[i] + velocities[i] * prediction_factor;
-	}
-
-	update_spatial_lookup(this->info_for_cshader.smoothing_radius);
-	
-	// u32 i = 0;
-	// std::for_each(std::execution::par, velocities, velocities + this->velocities.count, [this, &i, delta_time, positions, predicted_positions, dnsties](v2& elem){
-	// 	elem += V2(0.0, 1.0f) * gravity * delta_time;
-	// 	predicted_positions[i] = positions[i] + elem * delta_time;
-	// 	dnsties[i] = calculate_density(predicted_positions[i], this->info_for_cshader.smoothing_radius);
-	// 	++i;
-	// });
-
-
-	// auto offsets = arena.get_array(this->cell_offsets);
-
-	// auto start = std::chrono::high_resolution_clock::now();
-	// i = 0;
-	// std::for_each(std::execution::seq, dnsties, dnsties + this->densities.count, [this, &i, delta_time, predicted_positions](f32& elem){
-	// 	elem = calculate_density(predicted_positions[i], this->info_for_cshader.smoothing_radius);
-	// 	++i;
-	// });
-	// auto end = std::chrono::high_resolution_clock::now();
-	// std::chrono::duration<f32>	duration = end - start;
-	// printf("duration of calc density: %f\n", (f32)std::chrono::duration_cast<std::chrono::milliseconds>(duration).count());
-
-	for(u32 i = 0 ; i < this->positions.count; ++i) {
-		dnsties[i].x = calculate_density(predicted_positions[i], this->info_for_cshader.smoothing_radius);
-	}
+	sph_state<2> state = cpu_state();
+	state.params.pull_push_active		= is_left_mouse || is_right_mouse;
+	state.params.pull_push_input_point	= ndc_mouse_pos.xy;
+	if(is_right_mouse && !is_left_mouse) state.params.pull_push_strength = -state.params.pull_push_strength;
 
-	for(u32 i = 0 ; i < this->positions.count; ++i) {
-		dnsties[i].y = calculate_near_density(predicted_positions[i], this->info_for_cshader.smoothing_radius);
-	}
+	sph_step(&arena, &state, delta_time);
 
-	for(u32 i = 0 ; i < this->positions.count; ++i) {
-		v2 pressure_force = calculate_pressure_force(i, this->info_for_cshader.smoothing_radius);
-		v2 pressure_acceleration = pressure_force /  dnsties[i].x;
-		velocities[i] += pressure_acceleration * delta_time;
-	}
+	// NOTE(DH): Keep the lookup for queries between steps (and the interaction query of the next step)
+	this->cell_starts	= state.cell_starts;
+	this->grid			= state.grid;
 
 	for(u32 i = 0 ; i < this->positions.count; ++i) {
-		velocities[i] += calculate_viscosity(i) * delta_time;
-	}
-
-	// start = std::chrono::high_resolution_clock::now();
-	// i = 0;
-	// std::for_each(std::execution::par, velocities, velocities + this->velocities.count, [this, &i, delta_time, dnsties](v2& elem){
-	// 	v2 pressure_force = calculate_pressure_force(i, this->info_for_cshader.smoothing_radius);
-	// 	v2 pressure_acceleration = pressure_force * (1.0f /  dnsties[i]);
-	// 	elem += pressure_acceleration * delta_time;
-
-	// 	if(Length(elem) > this->max_velocity) {
-	// 		elem = normalize(elem) * this->max_velocity;
-	// 	}
-	// 	++i;
-	// });
-	// end = std::chrono::high_resolution_clock::now();
-	// duration = end - start;
-	// printf("duration of calc pressure force: %f\n", (f32)std::chrono::duration_cast<std::chrono::milliseconds>(duration).count());
-
-	for(u32 i = 0 ; i < this->positions.count; ++i) {
-		positions[i] += velocities[i] * delta_time;
-		resolve_collisions(&positions[i], &velocities[i], particle_size);
 		arena.get_array(matrices)[i] = translation_matrix(V3(positions[i], 0.0f));
 	}
 }
 
-inline func particle_simulation::interaction_force(v2 input_pos, f32 radius, f32 strength, u32 particle_idx) -> v2 {
-	auto pos_array = arena.get_array(predicted_positions);
-	auto vel_array = arena.get_array(velocities);
-	v2 interaction_force = {};
-	v2 offset = input_pos - pos_array[particle_idx];
-	f32 sqr_dst = Inner(offset, offset);
-
-	if(sqr_dst < (radius * radius)) {
-		f32 dst = sqrt(sqr_dst);
-		v2 dir_to_input_point = (dst <= FLT_EPSILON) ? V2(0.0f) : offset / dst;
-		f32 centre_t = 1.0f - dst / radius;
-		interaction_force = (dir_to_input_point * strength - vel_array[particle_idx]) * centre_t;
-	}
-
-	return interaction_force;
-}
-
-inline func initialize_simulation(dx_context *ctx, u32 particle_count, f32 gravity, f32 collision_damping) -> particle_simulation {
+// NOTE(DH): CPU side of the simulation only, no device objects are touched here (used by headless benchmarks too)
+inline func initialize_simulation_state(u32 particle_count, f32 gravity, f32 collision_damping, solver_mode mode) -> particle_simulation {
 	particle_simulation result = {};
 	result.arena				= initialize_arena(Megabytes(64));
 
@@ -686,9 +335,11 @@ inline func initialize_simulation(dx_context *ctx, u32 particle_count, f32 gravi
 	result.start_indices		= result.arena.alloc_array<i32>(particle_count);
 	result.start_indices.count	= particle_count;
 
-	result.info_for_cshader.gravity 				= gravity;
-	result.info_for_cshader.collision_damping 	= collision_damping;
-	result.info_for_cshader.bounds_size			= V2(18.0f, 10.0f);
+	result.pbf_lambdas			= result.arena.alloc_array<f32>(particle_count);
+	result.pbf_lambdas.count	= particle_count;
+
+	result.pbf_deltas			= result.arena.alloc_array<v2>(particle_count);
+	result.pbf_deltas.count		= particle_count;
 
 	result.info_for_cshader		= {};
 	result.info_for_cshader.particle_count = particle_count;
@@ -696,33 +347,29 @@ inline func initialize_simulation(dx_context *ctx, u32 particle_count, f32 gravi
 	result.info_for_cshader.max_velocity = 1.0f;
 	result.info_for_cshader.target_density = 1.5f;
 	result.info_for_cshader.pressure_multiplier = 0.0f;
+	result.info_for_cshader.gravity 			= gravity;
+	result.info_for_cshader.collision_damping 	= collision_damping;
+	result.info_for_cshader.bounds_size			= V2(18.0f, 10.0f);
 
-	result.cmd_list 			= create_command_list<ID3D12GraphicsCommandList>(ctx, D3D12_COMMAND_LIST_TYPE_DIRECT, nullptr, true);
-	result.simulation_desc_heap = allocate_descriptor_heap(ctx->g_device, D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV, D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE, 32);
-
-	for(u32 i = 0; i < g_NumFrames; ++i) {
-		result.command_allocators[i] = create_command_allocator(ctx->g_device, D3D12_COMMAND_LIST_TYPE_DIRECT);
-	}
+	// NOTE(DH): Can also be switched at runtime, simulation_step reads it every step
+	result.mode						= mode;
+	result.pbf.iterations			= 4;
+	result.pbf.relaxation			= 100.0f;
+	result.pbf.s_corr_strength		= 0.001f;
+	result.pbf.s_corr_delta_q		= 0.2f;
+	result.pbf.s_corr_power			= 4.0f;
+	result.pbf.xsph_viscosity		= 0.01f;
 
 	result.particle_size = 0.04f;
 
+	// NOTE(DH): Row span cell table of the CPU solver, sized for the starting radius and bounds
+	result.cell_starts				= result.arena.alloc_array<u32>(sph_grid_cell_capacity(result.cpu_state().params, particle_count));
+
 	u32 particles_row = (i32)sqrt(particle_count);
 	u32 particle_per_col  = (particle_count - 1) / particles_row + 1;
 	float spacing = result.particle_size * 2 + 0.03f;
 
 	auto p_n_vs		= result.arena.get_array(result.positions);
-	auto prprtes	= result.arena.get_array(result.particle_properties);
-	auto final_grad	= result.arena.get_array(result.final_gradient);
-	auto densities	= result.arena.get_array(result.densities);
-	auto velocities = result.arena.get_array(result.velocities);
-	auto predicted_positions = result.arena.get_array(result.predicted_positions);
-
-	// NOTE(DH): Randomly create particles
-	std::random_device rd;
-	std::mt19937 gen(rd());
-	std::uniform_real_distribution<> distrib(0, 1.0f);
-
-	auto cell_offsets = result.arena.get_array(result.cell_offsets);
 
 	for(u32 i = 0; i < result.positions.count; ++i) {
 		// float x = (distrib(gen) - 0.5f) * result.bounds_size.x;
@@ -733,11 +380,10 @@ inline func initialize_simulation(dx_context *ctx, u32 particle_count, f32 gravi
 		
 		p_n_vs[i].x = x;
 		p_n_vs[i].y = y;
-
-		// velocities[i] += V2(0.0, 1.0f) * gravity * result.delta_time;
-		// predicted_positions[i] = p_n_vs[i] + velocities[i] * (1.0f / 120.0f);
 	}
 
+	auto cell_offsets = result.arena.get_array(result.cell_offsets);
+
 	// NOTE(DH): Initialize cells for gather
 	cell_offsets[0] = V2i(-1, 1);
 	cell_offsets[1] = V2i(0, 1);
@@ -749,11 +395,22 @@ inline func initialize_simulation(dx_context *ctx, u32 particle_count, f32 gravi
 	cell_offsets[7] = V2i(0, -1);
 	cell_offsets[8] = V2i(1, -1);
 
-	// result.update_spatial_lookup(result.info_for_cshader.smoothing_radius);
+	return result;
+}
+
+inline func initialize_simulation(dx_context *ctx, u32 particle_count, f32 gravity, f32 collision_damping, solver_mode mode) -> particle_simulation {
+	particle_simulation result = initialize_simulation_state(particle_count, gravity, collision_damping, mode);
 
-	// for(u32 i = 0 ; i < particle_count; ++i) {
-	// 	densities[i] = result.calculate_density(predicted_positions[i], result.info_for_cshader.smoothing_radius);
-	// }
+	result.cmd_list 			= create_command_list<ID3D12GraphicsCommandList>(ctx, D3D12_COMMAND_LIST_TYPE_DIRECT, nullptr, true);
+	result.simulation_desc_heap = allocate_descriptor_heap(ctx->g_device, D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV, D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE, 32);
+
+	for(u32 i = 0; i < g_NumFrames; ++i) {
+		result.command_allocators[i] = create_command_allocator(ctx->g_device, D3D12_COMMAND_LIST_TYPE_DIRECT);
+	}
+
+	auto p_n_vs		= result.arena.get_array(result.positions);
+	auto prprtes	= result.arena.get_array(result.particle_properties);
+	auto densities	= result.arena.get_array(result.densities);
 
 	WCHAR shader_path[] = L"shaders.hlsl";
 	ID3DBlob* vertex_shader = compile_shader(ctx->g_device, shader_path, "VSMain", "vs_5_0");
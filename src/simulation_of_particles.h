@@ -1,6 +1,7 @@
 #pragma once
 #include "dmath.h"
 #include "util/memory_management.h"
+#include "simulation_of_particles_core.h"
 #include "dx_backend.h"
 
 struct pos_and_vel {
@@ -8,12 +9,6 @@ struct pos_and_vel {
 	v2 velocity;
 };
 
-struct spatial_data {
-	u32 particle_index;
-	u32 hash;
-	u32 cell_key;
-};
-
 struct particles_info {
 	u32 particle_count;
 	f32 smoothing_radius;
@@ -59,6 +54,9 @@ struct particle_simulation {
 	particles_info info_for_cshader;
 	sorting_info info_for_sorting;
 
+	solver_mode mode;	// NOTE(DH): CPU solver used by simulation_step
+	pbf_settings pbf;
+
 	memory_arena 					arena;
 	arena_array<sorting_info>		sorting_infos;
 	arena_array<v2>					positions;
@@ -73,6 +71,10 @@ struct particle_simulation {
 	arena_array<v2i>				cell_offsets;
 	arena_array<i32>				start_indices;
 	arena_array<spatial_data>		spatial_lookup;
+	arena_array<f32>				pbf_lambdas;
+	arena_array<v2>					pbf_deltas;
+	arena_array<u32>				cell_starts;
+	sph_grid<2>						grid;
 	ID3D12CommandAllocator* 		command_allocators[g_NumFrames];
 
 	ID3D12GraphicsCommandList *cmd_list;
@@ -82,23 +84,16 @@ struct particle_simulation {
 
 	rendering_stage rndr_stage;
 
-	inline func update_particles(f32 delta_time) -> void;
-	inline func resolve_collisions(v2* position, v2* velocity,f32 particle_size) -> void;
-	inline func calculate_density(v2 sample_point, f32 smoothing_radius) -> f32;
-	inline func calculate_near_density(v2 sample_point, f32 smoothing_radius) -> f32;
-	inline func calculate_viscosity(u32 particle_index) -> v2;
 	inline func calculate_property(v2 sample_point, f32 smoothing_radius) -> f32;
-	inline func calculate_pressure_force(u32 particle_idx, f32 smoothing_radius) -> v2;
-	inline func calculate_shared_pressure(f32 density_a, f32 density_b, f32 near_density_a, f32 near_density_b) -> v2;
 	inline func simulation_step(dx_context* ctx, f32 delta_time, u32 width, u32 height, v2 mouse_pos, bool is_left_mouse, bool is_right_mouse) -> void;
 	inline func update_spatial_lookup(f32 radius) -> void;
-	inline func interaction_force(v2 input_pos, f32 radius, f32 strength, u32 particle_idx) -> v2;
-	inline func foreach_point_within_radius(f32 dt, v2 sample_point, u8* data, void(*lambda)(particle_simulation *sim, u32 particle_idx, f32 dt, f32 gravity, u8* data)) -> void;
-	inline func convert_density_to_pressure(f32 density, f32 near_density) -> v2;
+	inline func cpu_state() -> sph_state<2>;
+	template<typename F> inline func foreach_point_within_radius(v2 sample_point, f32 radius, F visit) -> void;
 	inline func particle_sim_start_frame(u32 frame_idx, ID3D12GraphicsCommandList *cmd_list, ID3D12CommandAllocator **cmd_allocator, ID3D12PipelineState *pipeline_state) -> void;
 };
 
-static inline func initialize_simulation(dx_context *ctx, u32 particle_count, f32 gravity, f32 collision_damping) -> particle_simulation;
+static inline func initialize_simulation_state(u32 particle_count, f32 gravity, f32 collision_damping, solver_mode mode = solver_mode_wcsph) -> particle_simulation;
+static inline func initialize_simulation(dx_context *ctx, u32 particle_count, f32 gravity, f32 collision_damping, solver_mode mode = solver_mode_wcsph) -> particle_simulation;
 inline func update_settings(particle_simulation* sim, f32 delta_time, v2 mouse_pos, u32 width, u32 height, bool is_left_mouse, bool is_right_mouse) -> void;
 func generate_command_buffer(dx_context *context, memory_arena arena, ID3D12GraphicsCommandList *cmd_list, ID3D12CommandAllocator **cmd_allocators, descriptor_heap heap, rendering_stage rndr_stage) -> ID3D12GraphicsCommandList*;
 func generate_compute_command_buffer(dx_context *ctx, memory_arena arena, arena_array<resource_and_view> r_n_v, ID3D12GraphicsCommandList *cmd_list, descriptor_heap heap, rendering_stage rndr_stage, u32 width, u32 height) -> ID3D12GraphicsCommandList*;
@@ -0,0 +1,183 @@
+#pragma once
+#include <atomic>
+#include <immintrin.h>
+#include <type_traits>
+#include "simulation_of_particles_core.h"
+
+// NOTE(DH): Per step statistics of the CPU solver. Everything comes out of one fused pass over positions,
+// velocities and densities right after the step, while they are still in cache (AVX for the f32 2D layout, the
+// layout views otherwise). Density error uses the densities the step itself computed, so no neighbour search
+// is done for it (sph_density_error is the exact, expensive one).
+// Stats are published into a ring buffer that other threads read without ever blocking the solver.
+
+template<u32 dim>
+struct sph_step_stats {
+	using vec = typename sph_dim<dim>::vec;
+
+	u64 step;
+	f32 time;
+	u32 particle_count;
+
+	f32 kinetic_energy;			// NOTE(DH): Unit mass per particle
+	f32 max_speed;
+	f32 mean_density_error;		// NOTE(DH): |density - target_density| / target_density
+	f32 max_density_error;
+	vec bounds_min;
+	vec bounds_max;
+};
+
+template<u32 dim>
+static inline func sph_stats_accumulate(sph_step_stats<dim> *stats, typename sph_dim<dim>::vec p, typename sph_dim<dim>::vec v, f32 density, f32 target, f32 *sum_error, f32 *max_sqr_speed) -> void {
+	for(u32 k = 0; k < dim; ++k) {
+		stats->bounds_min.E[k] = std::min(stats->bounds_min.E[k], p.E[k]);
+		stats->bounds_max.E[k] = std::max(stats->bounds_max.E[k], p.E[k]);
+	}
+	f32 sqr_speed = Inner(v, v);
+	stats->kinetic_energy += 0.5f * sqr_speed;
+	*max_sqr_speed = std::max(*max_sqr_speed, sqr_speed);
+
+	f32 error = fabsf(density - target);
+	*sum_error += error;
+	stats->max_density_error = std::max(stats->max_density_error, error);
+}
+
+template<u32 dim, typename L>
+inline func sph_compute_step_stats(memory_arena *arena, sph_state<dim, L> *s) -> sph_step_stats<dim> {
+	sph_step_stats<dim> result = {};
+	u32 count = s->positions.count;
+	result.particle_count = count;
+	if(count == 0) return result;
+
+	for(u32 k = 0; k < dim; ++k) {
+		result.bounds_min.E[k] = FLT_MAX;
+		result.bounds_max.E[k] = -FLT_MAX;
+	}
+
+	f32 target = s->params.target_density;
+	f32 sum_error = 0;
+	f32 max_sqr_speed = 0;
+	u32 i = 0;
+
+#if defined(__AVX__)
+	if constexpr (dim == 2 && std::is_same_v<L, sph_layout_full>) {
+		// NOTE(DH): 4 particles per iteration, v2 arrays are read as 8 interleaved floats (even lanes x, odd lanes y)
+		const f32 *positions = (const f32*)arena->get_array(s->positions);
+		const f32 *velocities = (const f32*)arena->get_array(s->velocities);
+		const f32 *densities = (const f32*)arena->get_array(s->densities);
+
+		__m256 lo = _mm256_set1_ps(FLT_MAX), hi = _mm256_set1_ps(-FLT_MAX);
+		__m256 energy = _mm256_setzero_ps(), speed = _mm256_setzero_ps();
+		__m256 error_sum = _mm256_setzero_ps(), error_max = _mm256_setzero_ps();
+		__m256 targets = _mm256_set1_ps(target);
+		__m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+		__m256 density_lanes = _mm256_castsi256_ps(_mm256_setr_epi32(-1, 0, -1, 0, -1, 0, -1, 0));
+
+		for(; i + 4 <= count; i += 4) {
+			__m256 p = _mm256_loadu_ps(positions + i * 2);
+			lo = _mm256_min_ps(lo, p);
+			hi = _mm256_max_ps(hi, p);
+
+			__m256 v = _mm256_loadu_ps(velocities + i * 2);
+			__m256 sqr = _mm256_mul_ps(v, v);
+			energy = _mm256_add_ps(energy, sqr);
+			speed = _mm256_max_ps(speed, _mm256_hadd_ps(sqr, sqr));
+
+			__m256 d = _mm256_loadu_ps(densities + i * 2);
+			__m256 error = _mm256_and_ps(_mm256_and_ps(_mm256_sub_ps(d, targets), abs_mask), density_lanes);
+			error_sum = _mm256_add_ps(error_sum, error);
+			error_max = _mm256_max_ps(error_max, error);
+		}
+
+		alignas(32) f32 lanes[6][8];
+		_mm256_store_ps(lanes[0], lo);
+		_mm256_store_ps(lanes[1], hi);
+		_mm256_store_ps(lanes[2], energy);
+		_mm256_store_ps(lanes[3], speed);
+		_mm256_store_ps(lanes[4], error_sum);
+		_mm256_store_ps(lanes[5], error_max);
+		for(u32 l = 0; l < 8; ++l) {
+			result.bounds_min.E[l & 1] = std::min(result.bounds_min.E[l & 1], lanes[0][l]);
+			result.bounds_max.E[l & 1] = std::max(result.bounds_max.E[l & 1], lanes[1][l]);
+			result.kinetic_energy += 0.5f * lanes[2][l];
+			max_sqr_speed = std::max(max_sqr_speed, lanes[3][l]);
+			sum_error += lanes[4][l];
+			result.max_density_error = std::max(result.max_density_error, lanes[5][l]);
+		}
+	}
+#endif
+
+	auto positions = sph_positions(arena, s, s->positions);
+	auto velocities = sph_velocities(arena, s);
+	auto densities = sph_densities(arena, s);
+	for(; i < count; ++i) {
+		v2 density = densities[i];
+		sph_stats_accumulate<dim>(&result, positions[i], velocities[i], density.x, target, &sum_error, &max_sqr_speed);
+	}
+
+	result.max_speed = sqrtf(max_sqr_speed);
+	result.mean_density_error = sum_error / (count * target);
+	result.max_density_error /= target;
+	return result;
+}
+
+// NOTE(DH): Single writer (the solver thread), any number of readers. Every slot is a seqlock: the writer makes
+// the sequence odd, writes, makes it even again; a reader that saw the same even sequence before and after its
+// copy has a whole entry, otherwise it was overwritten under it and the read fails. The writer never waits.
+template<u32 dim, u32 capacity = 256>
+struct sph_stats_ring {
+	static_assert((capacity & (capacity - 1)) == 0, "capacity has to be a power of two");
+
+	struct alignas(64) slot {
+		std::atomic<u64> sequence;
+		sph_step_stats<dim> stats;
+	};
+
+	alignas(64) std::atomic<u64> published;	// NOTE(DH): Entries written so far, entry n lives in slots[n % capacity]
+	slot slots[capacity];
+
+	inline func publish(const sph_step_stats<dim> &stats) -> void {
+		u64 n = published.load(std::memory_order_relaxed);
+		slot *at = &slots[n & (capacity - 1)];
+
+		u64 sequence = at->sequence.load(std::memory_order_relaxed);
+		at->sequence.store(sequence + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		at->stats = stats;
+		at->sequence.store(sequence + 2, std::memory_order_release);
+
+		published.store(n + 1, std::memory_order_release);
+	}
+
+	// NOTE(DH): Entry n, false when it isn't published yet or was already overwritten
+	inline func read(u64 n, sph_step_stats<dim> *out) const -> bool {
+		if(n >= published.load(std::memory_order_acquire)) return false;
+
+		const slot *at = &slots[n & (capacity - 1)];
+		u64 before = at->sequence.load(std::memory_order_acquire);
+		if(before & 1) return false;
+		*out = at->stats;
+		std::atomic_thread_fence(std::memory_order_acquire);
+		u64 after = at->sequence.load(std::memory_order_relaxed);
+
+		// NOTE(DH): Every lap around the ring adds 2 to the slot's sequence, so the lap has to match too
+		return before == after && before == (n / capacity + 1) * 2;
+	}
+
+	inline func latest(sph_step_stats<dim> *out) const -> bool {
+		for(u32 attempt = 0; attempt < 4; ++attempt) {
+			u64 n = published.load(std::memory_order_acquire);
+			if(n == 0) return false;
+			if(read(n - 1, out)) return true;
+		}
+		return false;
+	}
+};
+
+// NOTE(DH): Computes and publishes the stats of the step that just finished
+template<u32 dim, typename L, u32 capacity>
+inline func sph_record_step(memory_arena *arena, sph_state<dim, L> *s, sph_stats_ring<dim, capacity> *ring, u64 step, f32 time) -> void {
+	sph_step_stats<dim> stats = sph_compute_step_stats(arena, s);
+	stats.step = step;
+	stats.time = time;
+	ring->publish(stats);
+}
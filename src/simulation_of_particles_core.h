@@ -0,0 +1,1216 @@
+#pragma once
+#include <algorithm>
+#include <bit>
+#include <cfloat>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <immintrin.h>
+#include <numbers>
+#include "dmath.h"
+#include "util/memory_management.h"
+
+// NOTE(DH): Dimension independent core of the CPU particle solver. Spatial hashing, sorting and every phase
+// loop are written once against sph_dim<dim>, so the 2D simulation and 3D/headless runs share the same hot path.
+// Nothing in here touches the device, so it can be used from tools and benchmarks on any platform.
+
+struct spatial_data {
+	u32 particle_index;
+	u32 hash;
+	u32 cell_key;
+};
+
+enum solver_mode : u32 {
+	solver_mode_wcsph = 0,	// NOTE(DH): Explicit weakly-compressible SPH (pressure_multiplier/near_pressure_multiplier), needs tiny dt
+	solver_mode_pbf,		// NOTE(DH): Position based fluids, iterative density constraint projection, stable at 4-8x larger dt
+};
+
+// NOTE(DH): How sph_foreach_neighbour finds candidates
+enum sph_neighbour_search : u32 {
+	sph_search_row_spans = 0,	// NOTE(DH): Dense row-major grid over the bounds, a query is 3 (3D: 9) contiguous spans
+	sph_search_hashed_cells,	// NOTE(DH): Hashed cells sorted by key, a query hashes and scans 9 (3D: 27) cells
+};
+
+struct pbf_settings {
+	u32 iterations;			// NOTE(DH): Constraint projection iterations per step
+	f32 relaxation;			// NOTE(DH): Constraint force mixing (epsilon in the lambda denominator)
+	f32 s_corr_strength;	// NOTE(DH): Artificial pressure (tensile instability) strength, k
+	f32 s_corr_delta_q;		// NOTE(DH): Artificial pressure reference distance as a fraction of smoothing radius
+	f32 s_corr_power;		// NOTE(DH): Artificial pressure exponent, n
+	f32 xsph_viscosity;		// NOTE(DH): XSPH velocity smoothing, c
+};
+
+// NOTE(DH): Kernel scales for the current smoothing radius, computed once per step instead of per neighbour
+struct sph_kernel_factors {
+	f32 density;					// NOTE(DH): (h - r)^2
+	f32 near_density;				// NOTE(DH): (h - r)^2
+	f32 density_derivative;			// NOTE(DH): -(h - r)
+	f32 near_density_derivative;	// NOTE(DH): -(h - r)
+	f32 viscosity;					// NOTE(DH): (h - r)^2
+};
+
+template<u32 dim> struct sph_dim;
+
+template<>
+struct sph_dim<2> {
+	using vec	= v2;
+	using cell	= v2i;
+
+	static constexpr u32 neighbour_cell_count = 9; //3 * 3 cells
+	static constexpr i32 cell_offsets[neighbour_cell_count][2] = {
+		{-1,  1}, {0,  1}, {1,  1},
+		{-1,  0}, {0,  0}, {1,  0},
+		{-1, -1}, {0, -1}, {1, -1},
+	};
+
+	static inline func kernel_factors(f32 h) -> sph_kernel_factors {
+		f32 pi = std::numbers::pi_v<f32>;
+		return {
+			.density 					= 6.0f / (pi * pow(h, 4.0f)),
+			.near_density 				= 8.0f / (pi * pow(h, 6.0f)),
+			.density_derivative 		= 12.0f / (pi * pow(h, 4.0f)),
+			.near_density_derivative 	= 30.0f / (pi * pow(h, 5.0f)),
+			.viscosity 					= 6.0f / (pi * pow(h, 4.0f)),
+		};
+	}
+
+	// NOTE(DH): Convert position to the coordinate of the cell it is within
+	static inline func cell_coord(v2 point, f32 radius) -> v2i {
+		return V2i(i32(point.x / radius), i32(point.y / radius));
+	}
+
+	static inline func neighbour_cell(v2i centre, u32 offset_idx) -> v2i {
+		return V2i(centre.x + cell_offsets[offset_idx][0], centre.y + cell_offsets[offset_idx][1]);
+	}
+
+	// NOTE(DH): Convert a cell coordinate into a single number
+	// Hash collisions (different cells -> same value) are unavoidable, but we want to
+	// at least try to minimize collisions for nearby cells.
+	static inline func hash_cell(v2i cell) -> u32 {
+		u32 a = (u32)cell.x * 15823;
+		u32 b = (u32)cell.y * 9737333;
+		return a + b;
+	}
+
+	static inline func up() -> v2 { return V2(0.0f, 1.0f); }
+};
+
+template<>
+struct sph_dim<3> {
+	using vec	= v3;
+	using cell	= v3i;
+
+	static constexpr u32 neighbour_cell_count = 27; //3 * 3 * 3 cells
+	static constexpr i32 cell_offsets[neighbour_cell_count][3] = {
+		{-1,  1, -1}, {0,  1, -1}, {1,  1, -1},
+		{-1,  0, -1}, {0,  0, -1}, {1,  0, -1},
+		{-1, -1, -1}, {0, -1, -1}, {1, -1, -1},
+		{-1,  1,  0}, {0,  1,  0}, {1,  1,  0},
+		{-1,  0,  0}, {0,  0,  0}, {1,  0,  0},
+		{-1, -1,  0}, {0, -1,  0}, {1, -1,  0},
+		{-1,  1,  1}, {0,  1,  1}, {1,  1,  1},
+		{-1,  0,  1}, {0,  0,  1}, {1,  0,  1},
+		{-1, -1,  1}, {0, -1,  1}, {1, -1,  1},
+	};
+
+	// NOTE(DH): Same kernel shapes as 2D, normalised over a sphere (near density keeps the 2D near/density ratio)
+	static inline func kernel_factors(f32 h) -> sph_kernel_factors {
+		f32 pi = std::numbers::pi_v<f32>;
+		return {
+			.density 					= 15.0f / (2.0f * pi * pow(h, 5.0f)),
+			.near_density 				= 10.0f / (pi * pow(h, 7.0f)),
+			.density_derivative 		= 15.0f / (pi * pow(h, 5.0f)),
+			.near_density_derivative 	= 45.0f / (pi * pow(h, 6.0f)),
+			.viscosity 					= 15.0f / (2.0f * pi * pow(h, 5.0f)),
+		};
+	}
+
+	static inline func cell_coord(v3 point, f32 radius) -> v3i {
+		return V3i(i32(point.x / radius), i32(point.y / radius), i32(point.z / radius));
+	}
+
+	static inline func neighbour_cell(v3i centre, u32 offset_idx) -> v3i {
+		return V3i(centre.x + cell_offsets[offset_idx][0], centre.y + cell_offsets[offset_idx][1], centre.z + cell_offsets[offset_idx][2]);
+	}
+
+	static inline func hash_cell(v3i cell) -> u32 {
+		u32 a = (u32)cell.x * 15823;
+		u32 b = (u32)cell.y * 9737333;
+		u32 c = (u32)cell.z * 440817757;
+		return a + b + c;
+	}
+
+	static inline func up() -> v3 { return V3(0.0f, 1.0f, 0.0f); }
+};
+
+// NOTE(DH): Wrap the hash value around the length of the array (so it can be used as an index)
+static inline func sph_key_from_hash(u32 hash, u32 array_count) -> u32 {
+	return hash % array_count;
+}
+
+template<u32 dim>
+struct sph_params {
+	using vec = typename sph_dim<dim>::vec;
+
+	solver_mode				mode;
+	sph_neighbour_search	neighbour_search;
+	pbf_settings			pbf;
+
+	f32 smoothing_radius;
+	f32 target_density;
+	f32 pressure_multiplier;
+	f32 near_pressure_multiplier;
+	f32 viscosity_strength;
+	f32 gravity;
+	f32 collision_damping;
+	f32 particle_size;
+	f32 prediction_factor; // NOTE(DH): Look-ahead used for the explicit path neighbour search
+	vec bounds_size;
+
+	bool pull_push_active;
+	f32 pull_push_strength;
+	f32 pull_push_radius;
+	vec pull_push_input_point;
+};
+
+// NOTE(DH): Storage layouts of the per particle arrays. Kernels never touch the stored type directly, they go
+// through views whose operator[] decodes into a register vec on read and encodes on write:
+//  - sph_layout_full		- f32 vec/v2, the views are plain pointers (what the solver always used),
+//  - sph_layout_compact	- fixed-point i16 positions relative to the simulation bounds (with a margin for
+//						  predicted positions), fp16 velocities and fp16 density/near density.
+// Compact halves the bytes the neighbour loops stream per particle, at the cost of quantisation error.
+
+static inline func sph_f32_to_f16(f32 value) -> u16 {
+#if defined(__F16C__)
+	return (u16)_cvtss_sh(value, 0);
+#else
+	// NOTE(DH): Round to nearest even, overflow goes to inf, nan stays nan
+	u32 f = std::bit_cast<u32>(value);
+	u32 sign = f & 0x80000000u;
+	f ^= sign;
+
+	u32 result;
+	if(f >= 0x47800000u) {
+		result = f > 0x7f800000u ? 0x7e00u : 0x7c00u;
+	} else if(f < 0x38800000u) {
+		// NOTE(DH): Subnormal, let the float adder do the rounding
+		result = std::bit_cast<u32>(std::bit_cast<f32>(f) + 0.5f) - 0x3f000000u;
+	} else {
+		u32 mantissa_odd = (f >> 13) & 1;
+		f += 0xc8000fffu + mantissa_odd;
+		result = f >> 13;
+	}
+	return (u16)(result | (sign >> 16));
+#endif
+}
+
+static inline func sph_f16_to_f32(u16 value) -> f32 {
+#if defined(__F16C__)
+	return _cvtsh_ss(value);
+#else
+	u32 bits = (u32)(value & 0x7fff) << 13;
+	f32 magnitude = std::bit_cast<f32>(bits) * 0x1p112f;
+	u32 result = std::bit_cast<u32>(magnitude);
+	if(magnitude >= 65536.0f) result |= 0x7f800000u;
+	return std::bit_cast<f32>(result | ((u32)(value & 0x8000) << 16));
+#endif
+}
+
+template<u32 dim> struct sph_fixed_position { i16 E[dim]; };
+template<u32 dim> struct sph_half_vec { u16 E[dim]; };
+struct sph_half_density { u16 density; u16 near_density; };
+
+// NOTE(DH): Fixed-point covers bounds * sph_fixed_margin, predicted positions can be a bit outside the bounds
+static constexpr f32 sph_fixed_margin = 1.25f;
+
+template<u32 dim>
+struct sph_fixed_position_view {
+	using vec = typename sph_dim<dim>::vec;
+
+	sph_fixed_position<dim> *data;
+	vec to_world;
+	vec to_fixed;
+
+	struct ref {
+		sph_fixed_position<dim> *elem;
+		const sph_fixed_position_view *view;
+
+		inline operator vec() const {
+			vec result;
+			for(u32 k = 0; k < dim; ++k) result.E[k] = elem->E[k] * view->to_world.E[k];
+			return result;
+		}
+		inline func operator=(vec value) -> ref& {
+			for(u32 k = 0; k < dim; ++k) {
+				f32 fixed = std::min(32767.0f, std::max(-32767.0f, value.E[k] * view->to_fixed.E[k]));
+				elem->E[k] = (i16)lrintf(fixed);
+			}
+			return *this;
+		}
+		inline func operator=(const ref &other) -> ref& { return *this = (vec)other; }
+		inline func operator+=(vec value) -> ref& { return *this = (vec)*this + value; }
+	};
+
+	inline func operator[](u32 idx) const -> ref { return {data + idx, this}; }
+};
+
+template<u32 dim>
+struct sph_half_vec_view {
+	using vec = typename sph_dim<dim>::vec;
+
+	sph_half_vec<dim> *data;
+
+	struct ref {
+		sph_half_vec<dim> *elem;
+
+		inline operator vec() const {
+			vec result;
+			for(u32 k = 0; k < dim; ++k) result.E[k] = sph_f16_to_f32(elem->E[k]);
+			return result;
+		}
+		inline func operator=(vec value) -> ref& {
+			for(u32 k = 0; k < dim; ++k) elem->E[k] = sph_f32_to_f16(value.E[k]);
+			return *this;
+		}
+		inline func operator=(const ref &other) -> ref& { *elem = *other.elem; return *this; }
+		inline func operator+=(vec value) -> ref& { return *this = (vec)*this + value; }
+	};
+
+	inline func operator[](u32 idx) const -> ref { return {data + idx}; }
+};
+
+struct sph_half_density_view {
+	sph_half_density *data;
+
+	struct ref {
+		sph_half_density *elem;
+
+		inline operator v2() const { return V2(sph_f16_to_f32(elem->density), sph_f16_to_f32(elem->near_density)); }
+		inline func operator=(v2 value) -> ref& {
+			elem->density = sph_f32_to_f16(value.x);
+			elem->near_density = sph_f32_to_f16(value.y);
+			return *this;
+		}
+	};
+
+	inline func operator[](u32 idx) const -> ref { return {data + idx}; }
+};
+
+struct sph_layout_full {
+	template<u32 dim> using position	= typename sph_dim<dim>::vec;
+	template<u32 dim> using velocity	= typename sph_dim<dim>::vec;
+	using density						= v2;
+
+	template<u32 dim> static inline func position_view(position<dim> *data, sph_params<dim> *) -> position<dim>* { return data; }
+	template<u32 dim> static inline func velocity_view(velocity<dim> *data) -> velocity<dim>* { return data; }
+	static inline func density_view(density *data) -> density* { return data; }
+};
+
+struct sph_layout_compact {
+	template<u32 dim> using position	= sph_fixed_position<dim>;
+	template<u32 dim> using velocity	= sph_half_vec<dim>;
+	using density						= sph_half_density;
+
+	template<u32 dim> static inline func position_view(position<dim> *data, sph_params<dim> *params) -> sph_fixed_position_view<dim> {
+		sph_fixed_position_view<dim> result = {.data = data};
+		for(u32 k = 0; k < dim; ++k) {
+			f32 half_extent = params->bounds_size.E[k] * 0.5f * sph_fixed_margin;
+			result.to_world.E[k] = half_extent / 32767.0f;
+			result.to_fixed.E[k] = 32767.0f / half_extent;
+		}
+		return result;
+	}
+	template<u32 dim> static inline func velocity_view(velocity<dim> *data) -> sph_half_vec_view<dim> { return {data}; }
+	static inline func density_view(density *data) -> sph_half_density_view { return {data}; }
+};
+
+// NOTE(DH): Dense grid covering the bounds plus one cell on every side. Cells are row-major (x fastest), so the
+// three cells x-1..x+1 of a row are consecutive and their particles form one span of the sorted lookup.
+// Anything outside is clamped to the border cells, which is still correct as long as cells are >= radius.
+template<u32 dim>
+struct sph_grid {
+	using vec = typename sph_dim<dim>::vec;
+
+	vec origin;
+	f32 inv_cell_size;
+	u32 dims[dim];
+	u32 cell_count;
+};
+
+template<u32 dim, typename L = sph_layout_full>
+struct sph_state {
+	using vec		= typename sph_dim<dim>::vec;
+	using position	= typename L::template position<dim>;
+	using velocity	= typename L::template velocity<dim>;
+	using density	= typename L::density;
+
+	sph_params<dim>				params;
+
+	arena_array<position>		positions;
+	arena_array<position>		predicted_positions;
+	arena_array<velocity>		velocities;
+	arena_array<density>		densities; // NOTE(DH): x - density, y - near density
+	arena_array<i32>			start_indices;
+	arena_array<spatial_data>	spatial_lookup;
+	arena_array<f32>			pbf_lambdas;
+	arena_array<vec>			pbf_deltas;
+
+	sph_grid<dim>				grid;
+	arena_array<u32>			cell_starts; // NOTE(DH): Row spans, cell c owns lookup[cell_starts[c] .. cell_starts[c + 1])
+};
+
+template<u32 dim, typename L>
+static inline func sph_positions(memory_arena *arena, sph_state<dim, L> *s, arena_array<typename L::template position<dim>> array) {
+	return L::template position_view<dim>(arena->get_array(array), &s->params);
+}
+
+template<u32 dim, typename L>
+static inline func sph_velocities(memory_arena *arena, sph_state<dim, L> *s) {
+	return L::template velocity_view<dim>(arena->get_array(s->velocities));
+}
+
+template<u32 dim, typename L>
+static inline func sph_densities(memory_arena *arena, sph_state<dim, L> *s) {
+	return L::density_view(arena->get_array(s->densities));
+}
+
+// NOTE(DH): Bytes of particle state the neighbour loops stream per particle (positions, predicted positions,
+// velocities, densities), used to report what a layout saves
+template<u32 dim, typename L>
+static constexpr func sph_streamed_bytes_per_particle() -> u32 {
+	using S = sph_state<dim, L>;
+	return sizeof(typename S::position) * 2 + sizeof(typename S::velocity) + sizeof(typename S::density);
+}
+
+template<u32 dim>
+inline func sph_default_params() -> sph_params<dim> {
+	sph_params<dim> result = {};
+	result.mode						= solver_mode_wcsph;
+	result.neighbour_search			= sph_search_row_spans;
+	result.pbf.iterations			= 4;
+	result.pbf.relaxation			= 100.0f;
+	result.pbf.s_corr_strength		= 0.001f;
+	result.pbf.s_corr_delta_q		= 0.2f;
+	result.pbf.s_corr_power			= 4.0f;
+	result.pbf.xsph_viscosity		= 0.01f;
+	result.smoothing_radius			= 0.3f;
+	result.target_density			= 1.5f;
+	result.collision_damping		= 0.95f;
+	result.particle_size			= 0.04f;
+	result.prediction_factor		= 1.0f / 120.0f;
+	for(u32 k = 0; k < dim; ++k) result.bounds_size.E[k] = 10.0f;
+	result.bounds_size.x			= 18.0f;
+	return result;
+}
+
+template<u32 dim, typename T>
+static inline func sph_alloc(memory_arena *arena, u32 count) -> arena_array<T> {
+	arena_array<T> result = arena->alloc_array<T>(count, arena_simd_alignment);
+	result.count = count;
+	memset(arena->get_array(result), 0, sizeof(T) * count);
+	return result;
+}
+
+template<u32 dim>
+static inline func sph_grid_fit(sph_params<dim> *params, f32 cell_size) -> sph_grid<dim> {
+	sph_grid<dim> result = {};
+	result.inv_cell_size = 1.0f / cell_size;
+	result.cell_count = 1;
+	for(u32 k = 0; k < dim; ++k) {
+		result.dims[k] = (u32)ceilf(params->bounds_size.E[k] / cell_size) + 2;
+		result.origin.E[k] = -0.5f * result.dims[k] * cell_size;
+		result.cell_count *= result.dims[k];
+	}
+	return result;
+}
+
+// NOTE(DH): Cell table entries to allocate, capped so a tiny radius doesn't take the whole arena. When the radius
+// or the bounds change later the grid just gets coarser cells to fit (see sph_grid_for_capacity).
+template<u32 dim>
+inline func sph_grid_cell_capacity(sph_params<dim> params, u32 particle_count) -> u32 {
+	u32 cells = sph_grid_fit(&params, params.smoothing_radius).cell_count;
+	return std::min(cells, std::max(4096u, particle_count * 8)) + 1;
+}
+
+template<u32 dim>
+static inline func sph_grid_for_capacity(sph_params<dim> *params, u32 capacity) -> sph_grid<dim> {
+	f32 cell_size = params->smoothing_radius;
+	sph_grid<dim> result = sph_grid_fit(params, cell_size);
+	while(result.cell_count + 1 > capacity) {
+		cell_size *= 1.25f;
+		result = sph_grid_fit(params, cell_size);
+	}
+	return result;
+}
+
+template<u32 dim>
+static inline func sph_grid_cell(sph_grid<dim> *grid, typename sph_dim<dim>::vec point, u32 *cell) -> void {
+	for(u32 k = 0; k < dim; ++k) {
+		f32 c = (point.E[k] - grid->origin.E[k]) * grid->inv_cell_size;
+		cell[k] = (u32)std::min(std::max(c, 0.0f), (f32)(grid->dims[k] - 1));
+	}
+}
+
+template<u32 dim>
+static inline func sph_grid_index(sph_grid<dim> *grid, u32 *cell) -> u32 {
+	u32 result = cell[dim - 1];
+	for(i32 k = dim - 2; k >= 0; --k) result = result * grid->dims[k] + cell[k];
+	return result;
+}
+
+template<u32 dim, typename L = sph_layout_full>
+inline func sph_create(memory_arena *arena, u32 particle_count, sph_params<dim> params) -> sph_state<dim, L> {
+	using S = sph_state<dim, L>;
+
+	S result = {};
+	result.params				= params;
+	result.positions			= sph_alloc<dim, typename S::position>(arena, particle_count);
+	result.predicted_positions	= sph_alloc<dim, typename S::position>(arena, particle_count);
+	result.velocities			= sph_alloc<dim, typename S::velocity>(arena, particle_count);
+	result.densities			= sph_alloc<dim, typename S::density>(arena, particle_count);
+	result.start_indices		= sph_alloc<dim, i32>(arena, particle_count);
+	result.spatial_lookup		= sph_alloc<dim, spatial_data>(arena, particle_count);
+	result.pbf_lambdas			= sph_alloc<dim, f32>(arena, particle_count);
+	result.pbf_deltas			= sph_alloc<dim, typename S::vec>(arena, particle_count);
+	result.cell_starts			= sph_alloc<dim, u32>(arena, sph_grid_cell_capacity(params, particle_count));
+	return result;
+}
+
+// NOTE(DH): Position of particle `idx` when `count` particles are laid out in a block centred on the origin,
+// the last axis takes the remainder
+template<u32 dim>
+inline func sph_grid_position(u32 idx, u32 count, f32 spacing) -> typename sph_dim<dim>::vec {
+	typename sph_dim<dim>::vec result = {};
+
+	u32 per_axis[dim];
+	u32 layer = 1;
+	for(u32 k = 0; k + 1 < dim; ++k) {
+		per_axis[k] = (u32)pow((f32)count, 1.0f / dim);
+		layer *= per_axis[k];
+	}
+	per_axis[dim - 1] = (count - 1) / layer + 1;
+
+	u32 rest = idx;
+	for(u32 k = 0; k < dim; ++k) {
+		u32 axis_idx = (k + 1 < dim) ? rest % per_axis[k] : rest;
+		rest = (k + 1 < dim) ? rest / per_axis[k] : 0;
+		result.E[k] = (axis_idx - per_axis[k] / 2.0f + 0.5f) * spacing;
+	}
+
+	return result;
+}
+
+template<u32 dim, typename L>
+inline func sph_spawn_grid(memory_arena *arena, sph_state<dim, L> *s, f32 spacing) -> void {
+	auto positions = sph_positions(arena, s, s->positions);
+	for(u32 i = 0; i < s->positions.count; ++i) {
+		positions[i] = sph_grid_position<dim>(i, s->positions.count, spacing);
+	}
+}
+
+// NOTE(DH): Number of particles the next step works on, arrays are allocated once with the largest capacity
+template<u32 dim, typename L>
+inline func sph_set_count(sph_state<dim, L> *s, u32 count) -> void {
+	assert(count <= s->positions.capacity);
+	s->positions.count				= count;
+	s->predicted_positions.count	= count;
+	s->velocities.count				= count;
+	s->densities.count				= count;
+	s->start_indices.count			= count;
+	s->spatial_lookup.count			= count;
+	s->pbf_lambdas.count			= count;
+	s->pbf_deltas.count				= count;
+	s->cell_starts.count			= 0; // NOTE(DH): Lookup no longer matches the particles, queries scan until it's rebuilt
+}
+
+template<u32 dim, typename L>
+static inline func sph_uses_row_spans(sph_state<dim, L> *s) -> bool {
+	return s->params.neighbour_search == sph_search_row_spans && s->cell_starts.capacity > 0;
+}
+
+template<u32 dim, typename L>
+inline func sph_update_spatial_lookup(memory_arena *arena, sph_state<dim, L> *s) -> void {
+	using traits = sph_dim<dim>;
+
+	auto indices 	= arena->get_array(s->start_indices);
+	auto lookup 	= arena->get_array(s->spatial_lookup);
+	auto points		= sph_positions(arena, s, s->predicted_positions);
+	u32 count		= s->positions.count;
+	f32 radius		= s->params.smoothing_radius;
+
+	if(sph_uses_row_spans(s)) {
+		// NOTE(DH): Counting sort by dense cell, stable and O(n + cells). start_indices is free in this mode
+		// and keeps every particle's cell between the two passes.
+		s->grid = sph_grid_for_capacity(&s->params, s->cell_starts.capacity);
+		u32 cell_count = s->grid.cell_count;
+		s->cell_starts.count = cell_count + 1;
+
+		auto starts = arena->get_array(s->cell_starts);
+		memset(starts, 0, sizeof(u32) * (cell_count + 1));
+
+		for(u32 i = 0 ; i < count; ++i) {
+			u32 cell[dim];
+			sph_grid_cell(&s->grid, points[i], cell);
+			u32 c = sph_grid_index(&s->grid, cell);
+			indices[i] = c;
+			++starts[c + 1];
+		}
+
+		for(u32 c = 1; c <= cell_count; ++c) starts[c] += starts[c - 1];
+
+		// NOTE(DH): Scatter bumps every start to the next cell's start, shift back afterwards
+		for(u32 i = 0 ; i < count; ++i) {
+			u32 c = (u32)indices[i];
+			lookup[starts[c]++] = {.particle_index = i, .hash = c, .cell_key = c};
+		}
+		for(u32 c = cell_count; c > 0; --c) starts[c] = starts[c - 1];
+		starts[0] = 0;
+		return;
+	}
+
+	for(u32 i = 0 ; i < count; ++i) {
+		auto cell = traits::cell_coord(points[i], radius);
+		u32 hash = traits::hash_cell(cell);
+		lookup[i] = {.particle_index = i, .hash = hash, .cell_key = sph_key_from_hash(hash, count)};
+		indices[i] = INT_MAX;
+	}
+
+	auto sort_func = [](spatial_data a, spatial_data b) {
+		return a.cell_key < b.cell_key;
+	};
+
+	std::sort(lookup, lookup + count, sort_func);
+
+	for(u32 i = 0; i < count; ++i) {
+		u32 key = lookup[i].cell_key;
+		u32 key_prev = (i == 0) ? UINT_MAX : lookup[i - 1].cell_key;
+		if(key != key_prev) {
+			indices[key] = i;
+		}
+	}
+}
+
+// NOTE(DH): The one neighbour loop every phase goes through. Visitor gets (particle_index, offset_to_neighbour, sqr_dst)
+// for every particle of `points` within the smoothing radius of `sample_point` (including the particle itself).
+template<u32 dim, typename L, typename P, typename F>
+static inline func sph_foreach_neighbour(memory_arena *arena, sph_state<dim, L> *s, P points, typename sph_dim<dim>::vec sample_point, F visit) -> void {
+	using traits = sph_dim<dim>;
+
+	auto indices 	= arena->get_array(s->start_indices);
+	auto lookup 	= arena->get_array(s->spatial_lookup);
+	u32 count		= s->spatial_lookup.count;
+	f32 radius		= s->params.smoothing_radius;
+	f32 sqr_radius	= radius * radius;
+
+	auto visit_candidate = [&](u32 particle_index) {
+		typename sph_dim<dim>::vec offset_to_neighbour = points[particle_index] - sample_point;
+		f32 sqr_dst = Inner(offset_to_neighbour, offset_to_neighbour);
+
+		// NOTE(DH): Test if the point is inside the radius
+		if(sqr_dst > sqr_radius) return;
+
+		visit(particle_index, offset_to_neighbour, sqr_dst);
+	};
+
+	if(sph_uses_row_spans(s)) {
+		sph_grid<dim> *grid = &s->grid;
+		auto starts = arena->get_array(s->cell_starts);
+
+		u32 centre[dim];
+		sph_grid_cell(grid, sample_point, centre);
+		u32 x_begin = centre[0] > 0 ? centre[0] - 1 : 0;
+		u32 x_end = std::min(centre[0] + 1, grid->dims[0] - 1) + 1;
+
+		// NOTE(DH): 3 rows in 2D, 9 in 3D, each one contiguous span of the lookup
+		constexpr u32 row_count = dim == 2 ? 3 : 9;
+		for(u32 row = 0; row < row_count; ++row) {
+			u32 cell[dim];
+			cell[0] = 0;
+			bool inside = true;
+			u32 rest = row;
+			for(u32 k = 1; k < dim; ++k) {
+				i32 c = (i32)centre[k] + (i32)(rest % 3) - 1;
+				rest /= 3;
+				inside = inside && c >= 0 && c < (i32)grid->dims[k];
+				cell[k] = (u32)c;
+			}
+			if(!inside) continue;
+
+			u32 row_base = sph_grid_index(grid, cell);
+			u32 begin = starts[row_base + x_begin];
+			u32 end = starts[row_base + x_end];
+			for(u32 j = begin; j < end; ++j) visit_candidate(lookup[j].particle_index);
+		}
+		return;
+	}
+
+	auto centre = traits::cell_coord(sample_point, radius);
+
+	for(u32 i = 0; i < traits::neighbour_cell_count; ++i) {
+		u32 key = sph_key_from_hash(traits::hash_cell(traits::neighbour_cell(centre, i)), count);
+
+		for(u32 j = (u32)indices[key]; j < count; ++j) {
+			if(lookup[j].cell_key != key) break;
+			visit_candidate(lookup[j].particle_index);
+		}
+	}
+}
+
+// NOTE(DH): Spatial queries over the sorted cell structure. Candidates come from the row spans of every row the
+// query box touches, the exact test runs on `points`. `points` may lag behind the positions the lookup was built
+// from (e.g. querying positions while the lookup was built from predicted positions) by up to `slack`, every box
+// is grown by that much. Without a row span lookup (hashed search or nothing built yet) queries scan all particles.
+// Visitors are templates, so they are inlined into the span loops.
+template<u32 dim, typename L, typename P>
+struct sph_query {
+	using vec = typename sph_dim<dim>::vec;
+
+	memory_arena		*arena;
+	sph_state<dim, L>	*s;
+	P					points;
+	f32					slack;
+
+	inline func lookup_ready() const -> bool {
+		return sph_uses_row_spans(s) && s->grid.cell_count > 0 && s->cell_starts.count == s->grid.cell_count + 1;
+	}
+
+	inline func cell_size() const -> f32 {
+		return lookup_ready() ? 1.0f / s->grid.inv_cell_size : s->params.smoothing_radius;
+	}
+
+	// NOTE(DH): Every particle whose cell overlaps [lo, hi], each one once
+	template<typename F>
+	inline func foreach_candidate_in_box(vec lo, vec hi, F visit) const -> void {
+		u32 count = s->positions.count;
+		if(!lookup_ready()) {
+			for(u32 i = 0; i < count; ++i) visit(i);
+			return;
+		}
+
+		auto lookup = arena->get_array(s->spatial_lookup);
+		auto starts = arena->get_array(s->cell_starts);
+		sph_grid<dim> *grid = &s->grid;
+
+		u32 cell_lo[dim], cell_hi[dim];
+		sph_grid_cell(grid, lo, cell_lo);
+		sph_grid_cell(grid, hi, cell_hi);
+
+		foreach_row(cell_lo, cell_hi, [&](u32 *cell) {
+			u32 row_base = sph_grid_index(grid, cell);
+			u32 end = starts[row_base + cell_hi[0] + 1];
+			for(u32 j = starts[row_base + cell_lo[0]]; j < end; ++j) visit(lookup[j].particle_index);
+		});
+	}
+
+	// NOTE(DH): Calls row(cell) for every row between the two cells, cell[0] is left at 0
+	template<typename F>
+	inline func foreach_row(u32 *cell_lo, u32 *cell_hi, F row) const -> void {
+		u32 cell[dim] = {};
+		if constexpr (dim == 2) {
+			for(cell[1] = cell_lo[1]; cell[1] <= cell_hi[1]; ++cell[1]) row(cell);
+		} else {
+			for(cell[2] = cell_lo[2]; cell[2] <= cell_hi[2]; ++cell[2])
+				for(cell[1] = cell_lo[1]; cell[1] <= cell_hi[1]; ++cell[1]) row(cell);
+		}
+	}
+
+	// NOTE(DH): visit(particle_index, offset_from_centre, sqr_dst) for every particle within `radius` of `centre`
+	template<typename F>
+	inline func radius(vec centre, f32 radius, F visit) const -> void {
+		vec extent;
+		for(u32 k = 0; k < dim; ++k) extent.E[k] = radius + slack;
+		f32 sqr_radius = radius * radius;
+
+		foreach_candidate_in_box(centre - extent, centre + extent, [&](u32 idx) {
+			vec offset = points[idx] - centre;
+			f32 sqr_dst = Inner(offset, offset);
+			if(sqr_dst <= sqr_radius) visit(idx, offset, sqr_dst);
+		});
+	}
+
+	// NOTE(DH): visit(particle_index, position) for every particle inside the box (inclusive)
+	template<typename F>
+	inline func aabb(vec lo, vec hi, F visit) const -> void {
+		vec extent;
+		for(u32 k = 0; k < dim; ++k) extent.E[k] = slack;
+
+		foreach_candidate_in_box(lo - extent, hi + extent, [&](u32 idx) {
+			vec p = points[idx];
+			for(u32 k = 0; k < dim; ++k) if(p.E[k] < lo.E[k] || p.E[k] > hi.E[k]) return;
+			visit(idx, p);
+		});
+	}
+
+	// NOTE(DH): Up to `k` nearest particles within `max_radius`, nearest first. The search radius starts at one cell
+	// and doubles until k particles are inside it, so only the cells around `centre` are touched. Returns how many
+	// were found.
+	inline func knn(vec centre, u32 k, u32 *indices, f32 *sqr_dsts, f32 max_radius = FLT_MAX) const -> u32 {
+		if(k == 0) return 0;
+
+		f32 max_extent = 0;
+		for(u32 d = 0; d < dim; ++d) max_extent += s->params.bounds_size.E[d] + 2.0f * cell_size() + fabsf(centre.E[d]);
+		max_radius = std::min(max_radius, max_extent);
+
+		f32 search_radius = lookup_ready() ? std::min(cell_size(), max_radius) : max_radius;
+		u32 found = 0;
+		for(;;) {
+			found = 0;
+			radius(centre, search_radius, [&](u32 idx, vec, f32 sqr_dst) {
+				if(found == k && sqr_dst >= sqr_dsts[k - 1]) return;
+
+				// NOTE(DH): Insertion into the sorted k best, k is expected to be small
+				u32 at = found < k ? found++ : k - 1;
+				while(at > 0 && sqr_dsts[at - 1] > sqr_dst) {
+					sqr_dsts[at] = sqr_dsts[at - 1];
+					indices[at] = indices[at - 1];
+					--at;
+				}
+				sqr_dsts[at] = sqr_dst;
+				indices[at] = idx;
+			});
+
+			if(found == k || search_radius >= max_radius) break;
+			search_radius = std::min(search_radius * 2.0f, max_radius);
+		}
+		return found;
+	}
+
+	// NOTE(DH): visit(particle_index, t, sqr_dst) for every particle within `radius` of the segment a-b, t is where
+	// along the segment (0..1) the closest point is. Rows are cut down to the cells the capsule actually crosses.
+	template<typename F>
+	inline func segment(vec a, vec b, f32 radius, F visit) const -> void {
+		vec ab = b - a;
+		f32 ab_sqr = Inner(ab, ab);
+		f32 sqr_radius = radius * radius;
+
+		auto test = [&](u32 idx) {
+			vec p = points[idx];
+			f32 t = ab_sqr > 0.0f ? Clamp01(Inner(p - a, ab) / ab_sqr) : 0.0f;
+			vec offset = p - (a + ab * t);
+			f32 sqr_dst = Inner(offset, offset);
+			if(sqr_dst <= sqr_radius) visit(idx, t, sqr_dst);
+		};
+
+		if(!lookup_ready()) {
+			for(u32 i = 0; i < s->positions.count; ++i) test(i);
+			return;
+		}
+
+		auto lookup = arena->get_array(s->spatial_lookup);
+		auto starts = arena->get_array(s->cell_starts);
+		sph_grid<dim> *grid = &s->grid;
+		f32 size = cell_size();
+		f32 reach = radius + slack;
+
+		vec lo, hi;
+		for(u32 k = 0; k < dim; ++k) {
+			lo.E[k] = std::min(a.E[k], b.E[k]) - reach;
+			hi.E[k] = std::max(a.E[k], b.E[k]) + reach;
+		}
+		u32 cell_lo[dim], cell_hi[dim];
+		sph_grid_cell(grid, lo, cell_lo);
+		sph_grid_cell(grid, hi, cell_hi);
+
+		foreach_row(cell_lo, cell_hi, [&](u32 *cell) {
+			// NOTE(DH): Part of the segment within reach of this row's slab, border rows are open towards outside
+			f32 t0 = 0.0f, t1 = 1.0f;
+			for(u32 k = 1; k < dim; ++k) {
+				f32 slab_lo = cell[k] == 0 ? -FLT_MAX : grid->origin.E[k] + cell[k] * size - reach;
+				f32 slab_hi = cell[k] == grid->dims[k] - 1 ? FLT_MAX : grid->origin.E[k] + (cell[k] + 1) * size + reach;
+				if(ab.E[k] == 0.0f) {
+					if(a.E[k] < slab_lo || a.E[k] > slab_hi) return;
+					continue;
+				}
+				f32 enter = (slab_lo - a.E[k]) / ab.E[k];
+				f32 leave = (slab_hi - a.E[k]) / ab.E[k];
+				if(enter > leave) std::swap(enter, leave);
+				t0 = std::max(t0, enter);
+				t1 = std::min(t1, leave);
+			}
+			if(t0 > t1) return;
+
+			vec x_lo = {}, x_hi = {};
+			x_lo.E[0] = std::min(a.E[0] + ab.E[0] * t0, a.E[0] + ab.E[0] * t1) - reach;
+			x_hi.E[0] = std::max(a.E[0] + ab.E[0] * t0, a.E[0] + ab.E[0] * t1) + reach;
+			u32 span_lo[dim], span_hi[dim];
+			sph_grid_cell(grid, x_lo, span_lo);
+			sph_grid_cell(grid, x_hi, span_hi);
+
+			u32 row_base = sph_grid_index(grid, cell);
+			u32 end = starts[row_base + span_hi[0] + 1];
+			for(u32 j = starts[row_base + span_lo[0]]; j < end; ++j) test(lookup[j].particle_index);
+		});
+	}
+
+	// NOTE(DH): First particle (smallest distance along the ray) within `radius` of the ray, -1 if none. Used for picking.
+	inline func ray_nearest(vec origin, vec direction, f32 max_distance, f32 radius, f32 *hit_distance = nullptr) const -> i32 {
+		i32 result = -1;
+		f32 best_t = FLT_MAX;
+		segment(origin, origin + direction * max_distance, radius, [&](u32 idx, f32 t, f32) {
+			if(t < best_t || (t == best_t && (i32)idx < result)) { best_t = t; result = (i32)idx; }
+		});
+		if(hit_distance && result >= 0) *hit_distance = best_t * max_distance;
+		return result;
+	}
+};
+
+template<u32 dim, typename L, typename P>
+inline func sph_make_query(memory_arena *arena, sph_state<dim, L> *s, P points, f32 slack = 0.0f) -> sph_query<dim, L, P> {
+	return {arena, s, points, slack};
+}
+
+// NOTE(DH): Density and near density in one neighbour pass
+template<u32 dim, typename L>
+static inline func sph_calculate_density(memory_arena *arena, sph_state<dim, L> *s, sph_kernel_factors k, typename sph_dim<dim>::vec sample_point) -> v2 {
+	auto points	= sph_positions(arena, s, s->predicted_positions);
+	f32 h		= s->params.smoothing_radius;
+	v2 density	= {};
+
+	sph_foreach_neighbour(arena, s, points, sample_point, [&](u32, auto, f32 sqr_dst) {
+		f32 v = h - sqrt(sqr_dst);
+		density.x += v * v * k.density;
+		density.y += v * v * k.near_density;
+	});
+
+	return density;
+}
+
+template<u32 dim>
+static inline func sph_density_to_pressure(sph_params<dim> *params, v2 density) -> v2 {
+	f32 density_error = density.x - params->target_density;
+	return V2(density_error * params->pressure_multiplier, density.y * params->near_pressure_multiplier);
+}
+
+template<u32 dim, typename L>
+static inline func sph_calculate_pressure_force(memory_arena *arena, sph_state<dim, L> *s, sph_kernel_factors k, u32 particle_idx) -> typename sph_dim<dim>::vec {
+	using vec = typename sph_dim<dim>::vec;
+
+	auto points		= sph_positions(arena, s, s->predicted_positions);
+	auto densities	= sph_densities(arena, s);
+	f32 h			= s->params.smoothing_radius;
+
+	v2 density		= densities[particle_idx];
+	v2 pressure		= sph_density_to_pressure(&s->params, density);
+	vec pressure_force = {};
+
+	sph_foreach_neighbour(arena, s, points, points[particle_idx], [&](u32 other_idx, vec offset_to_neighbour, f32 sqr_dst) {
+		if(other_idx == particle_idx) return;
+
+		f32 dst = sqrt(sqr_dst);
+		vec dir = (dst > 0.0f) ? offset_to_neighbour / dst : sph_dim<dim>::up();
+
+		v2 other_density = densities[other_idx];
+		v2 other_pressure = sph_density_to_pressure(&s->params, other_density);
+		f32 shared_pressure = (pressure.x + other_pressure.x) * 0.5f;
+		f32 shared_near_pressure = (pressure.y + other_pressure.y) * 0.5f;
+
+		f32 v = h - dst;
+		pressure_force += dir * (shared_pressure * -v * k.density_derivative / other_density.x);
+		pressure_force += dir * (shared_near_pressure * -v * k.near_density_derivative / other_density.y);
+	});
+
+	return pressure_force;
+}
+
+template<u32 dim, typename L>
+static inline func sph_calculate_viscosity(memory_arena *arena, sph_state<dim, L> *s, sph_kernel_factors k, u32 particle_idx) -> typename sph_dim<dim>::vec {
+	using vec = typename sph_dim<dim>::vec;
+
+	auto points		= sph_positions(arena, s, s->positions);
+	auto velocities	= sph_velocities(arena, s);
+	f32 h			= s->params.smoothing_radius;
+	vec velocity	= velocities[particle_idx];
+	vec viscosity_force = {};
+
+	sph_foreach_neighbour(arena, s, points, points[particle_idx], [&](u32 other_idx, vec, f32 sqr_dst) {
+		f32 v = h - sqrt(sqr_dst);
+		viscosity_force += (velocities[other_idx] - velocity) * (v * v * k.viscosity);
+	});
+
+	return viscosity_force * s->params.viscosity_strength;
+}
+
+template<u32 dim>
+static inline func sph_interaction_force(sph_params<dim> *params, typename sph_dim<dim>::vec position, typename sph_dim<dim>::vec velocity) -> typename sph_dim<dim>::vec {
+	using vec = typename sph_dim<dim>::vec;
+
+	vec interaction_force = {};
+	vec offset = params->pull_push_input_point - position;
+	f32 sqr_dst = Inner(offset, offset);
+	f32 radius = params->pull_push_radius;
+
+	if(sqr_dst < (radius * radius)) {
+		f32 dst = sqrt(sqr_dst);
+		vec dir_to_input_point = (dst <= FLT_EPSILON) ? vec{} : offset / dst;
+		f32 centre_t = 1.0f - dst / radius;
+		interaction_force = (dir_to_input_point * params->pull_push_strength - velocity) * centre_t;
+	}
+
+	return interaction_force;
+}
+
+template<u32 dim>
+static inline func sph_resolve_collisions(sph_params<dim> *params, typename sph_dim<dim>::vec *position, typename sph_dim<dim>::vec *velocity) -> void {
+	for(u32 k = 0; k < dim; ++k) {
+		f32 half_bound_size = params->bounds_size.E[k] * 0.5f - params->particle_size;
+		if(fabsf(position->E[k]) > half_bound_size) {
+			position->E[k] = position->E[k] > 0.0f ? half_bound_size : -half_bound_size;
+			velocity->E[k] *= -1 * params->collision_damping;
+		}
+	}
+}
+
+template<u32 dim, typename L>
+inline func sph_apply_external_forces(memory_arena *arena, sph_state<dim, L> *s, f32 delta_time, f32 prediction_factor) -> void {
+	using traits = sph_dim<dim>;
+	using vec = typename sph_dim<dim>::vec;
+
+	auto positions 				= sph_positions(arena, s, s->positions);
+	auto velocities 			= sph_velocities(arena, s);
+	auto predicted_positions 	= sph_positions(arena, s, s->predicted_positions);
+	sph_params<dim> *params		= &s->params;
+
+	for(u32 i = 0 ; i < s->positions.count; ++i) {
+		velocities[i] += traits::up() * params->gravity * delta_time;
+	}
+
+	// NOTE(DH): Only particles around the input point feel it. The lookup is still the one of the previous step,
+	// built from these predicted positions before the solver moved them by less than a cell.
+	if(params->pull_push_active) {
+		auto query = sph_make_query(arena, s, predicted_positions, params->smoothing_radius);
+		query.radius(params->pull_push_input_point, params->pull_push_radius, [&](u32 idx, vec, f32) {
+			velocities[idx] += sph_interaction_force(params, predicted_positions[idx], velocities[idx]);
+		});
+	}
+
+	for(u32 i = 0 ; i < s->positions.count; ++i) {
+		predicted_positions[i] = positions[i] + velocities[i] * prediction_factor;
+	}
+}
+
+template<u32 dim, typename L>
+inline func sph_step_wcsph(memory_arena *arena, sph_state<dim, L> *s, f32 delta_time) -> void {
+	using vec = typename sph_dim<dim>::vec;
+
+	auto densities 		= sph_densities(arena, s);
+	auto positions 		= sph_positions(arena, s, s->positions);
+	auto velocities 	= sph_velocities(arena, s);
+	auto predicted		= sph_positions(arena, s, s->predicted_positions);
+	auto deltas			= arena->get_array(s->pbf_deltas);
+	u32 count			= s->positions.count;
+	sph_kernel_factors k = sph_dim<dim>::kernel_factors(s->params.smoothing_radius);
+
+	sph_apply_external_forces(arena, s, delta_time, s->params.prediction_factor);
+	sph_update_spatial_lookup(arena, s);
+
+	for(u32 i = 0 ; i < count; ++i) {
+		densities[i] = sph_calculate_density(arena, s, k, predicted[i]);
+	}
+
+	for(u32 i = 0 ; i < count; ++i) {
+		vec pressure_force = sph_calculate_pressure_force(arena, s, k, i);
+		v2 density = densities[i];
+		velocities[i] += pressure_force / density.x * delta_time;
+	}
+
+	// NOTE(DH): Viscosity reads neighbour velocities, so it is gathered before any of them changes
+	for(u32 i = 0 ; i < count; ++i) {
+		deltas[i] = sph_calculate_viscosity(arena, s, k, i);
+	}
+
+	for(u32 i = 0 ; i < count; ++i) {
+		vec velocity = velocities[i];
+		velocity += deltas[i] * delta_time;
+		vec position = positions[i];
+		position += velocity * delta_time;
+		sph_resolve_collisions(&s->params, &position, &velocity);
+		positions[i] = position;
+		velocities[i] = velocity;
+	}
+}
+
+// NOTE(DH): Position based fluids (Macklin & Muller 2013). Instead of turning density error into a force,
+// every iteration solves C_i = density_i / rest_density - 1 = 0 directly on predicted positions, so
+// the step stays stable at time steps several times larger than the explicit pressure path allows.
+template<u32 dim, typename L>
+static inline func sph_calculate_pbf_lambda(memory_arena *arena, sph_state<dim, L> *s, sph_kernel_factors k, u32 particle_idx) -> f32 {
+	using vec = typename sph_dim<dim>::vec;
+
+	auto points			= sph_positions(arena, s, s->predicted_positions);
+	auto densities		= sph_densities(arena, s);
+	f32 h				= s->params.smoothing_radius;
+	f32 rest_density	= s->params.target_density;
+
+	f32 density = 0;
+	f32 sum_grad_sqr = 0;
+	vec grad_i = {};
+
+	sph_foreach_neighbour(arena, s, points, points[particle_idx], [&](u32 other_idx, vec offset_to_neighbour, f32 sqr_dst) {
+		f32 dst = sqrt(sqr_dst);
+		f32 v = h - dst;
+		density += v * v * k.density;
+
+		if(other_idx == particle_idx || dst <= FLT_EPSILON) return;
+
+		// NOTE(DH): Gradient of the constraint with respect to the neighbour position
+		vec grad_j = offset_to_neighbour * (-v * k.density_derivative / (dst * rest_density));
+		sum_grad_sqr += Inner(grad_j, grad_j);
+		grad_i -= grad_j;
+	});
+
+	sum_grad_sqr += Inner(grad_i, grad_i);
+	densities[particle_idx] = V2(density, 0.0f);
+
+	f32 constraint = density / rest_density - 1.0f;
+	return -constraint / (sum_grad_sqr + s->params.pbf.relaxation);
+}
+
+template<u32 dim, typename L>
+static inline func sph_calculate_pbf_delta(memory_arena *arena, sph_state<dim, L> *s, sph_kernel_factors k, u32 particle_idx) -> typename sph_dim<dim>::vec {
+	using vec = typename sph_dim<dim>::vec;
+
+	auto points			= sph_positions(arena, s, s->predicted_positions);
+	auto lambdas		= arena->get_array(s->pbf_lambdas);
+	f32 h				= s->params.smoothing_radius;
+	f32 lambda_i		= lambdas[particle_idx];
+	pbf_settings pbf	= s->params.pbf;
+	vec delta			= {};
+
+	// NOTE(DH): Artificial pressure keeps particles from clumping at the free surface
+	f32 s_corr_v = h - pbf.s_corr_delta_q * h;
+	f32 s_corr_reference = s_corr_v * s_corr_v * k.density;
+	f32 inv_s_corr_reference = s_corr_reference > 0.0f ? 1.0f / s_corr_reference : 0.0f;
+
+	sph_foreach_neighbour(arena, s, points, points[particle_idx], [&](u32 other_idx, vec offset_to_neighbour, f32 sqr_dst) {
+		if(other_idx == particle_idx) return;
+
+		f32 dst = sqrt(sqr_dst);
+		vec dir = (dst > FLT_EPSILON) ? offset_to_neighbour / dst : sph_dim<dim>::up();
+		f32 v = h - dst;
+
+		f32 s_corr = -pbf.s_corr_strength * pow(v * v * k.density * inv_s_corr_reference, pbf.s_corr_power);
+		delta += dir * ((lambda_i + lambdas[other_idx] + s_corr) * v * k.density_derivative);
+	});
+
+	return delta / s->params.target_density;
+}
+
+template<u32 dim, typename L>
+static inline func sph_calculate_xsph_viscosity(memory_arena *arena, sph_state<dim, L> *s, sph_kernel_factors k, u32 particle_idx) -> typename sph_dim<dim>::vec {
+	using vec = typename sph_dim<dim>::vec;
+
+	auto points			= sph_positions(arena, s, s->predicted_positions);
+	auto velocities		= sph_velocities(arena, s);
+	f32 h				= s->params.smoothing_radius;
+	f32 scale			= k.density / s->params.target_density;
+	vec velocity		= velocities[particle_idx];
+	vec velocity_correction = {};
+
+	sph_foreach_neighbour(arena, s, points, points[particle_idx], [&](u32 other_idx, vec, f32 sqr_dst) {
+		f32 v = h - sqrt(sqr_dst);
+		velocity_correction += (velocities[other_idx] - velocity) * (v * v * scale);
+	});
+
+	return velocity_correction * s->params.pbf.xsph_viscosity;
+}
+
+template<u32 dim, typename L>
+inline func sph_step_pbf(memory_arena *arena, sph_state<dim, L> *s, f32 delta_time) -> void {
+	using vec = typename sph_dim<dim>::vec;
+
+	auto positions 				= sph_positions(arena, s, s->positions);
+	auto velocities 			= sph_velocities(arena, s);
+	auto predicted_positions 	= sph_positions(arena, s, s->predicted_positions);
+	auto lambdas				= arena->get_array(s->pbf_lambdas);
+	auto deltas					= arena->get_array(s->pbf_deltas);
+	u32 count					= s->positions.count;
+	sph_kernel_factors k		= sph_dim<dim>::kernel_factors(s->params.smoothing_radius);
+
+	// NOTE(DH): Apply external forces and predict where particles would end up
+	sph_apply_external_forces(arena, s, delta_time, delta_time);
+	for(u32 i = 0 ; i < count; ++i) {
+		vec predicted = predicted_positions[i];
+		vec velocity = velocities[i];
+		sph_resolve_collisions(&s->params, &predicted, &velocity);
+		predicted_positions[i] = predicted;
+		velocities[i] = velocity;
+	}
+
+	// NOTE(DH): Neighbours are found once per step, particles move less than a cell during projection
+	sph_update_spatial_lookup(arena, s);
+
+	for(u32 iteration = 0; iteration < s->params.pbf.iterations; ++iteration) {
+		for(u32 i = 0 ; i < count; ++i) {
+			lambdas[i] = sph_calculate_pbf_lambda(arena, s, k, i);
+		}
+
+		for(u32 i = 0 ; i < count; ++i) {
+			deltas[i] = sph_calculate_pbf_delta(arena, s, k, i);
+		}
+
+		for(u32 i = 0 ; i < count; ++i) {
+			vec unused_velocity = {};
+			vec predicted = predicted_positions[i];
+			predicted += deltas[i];
+			sph_resolve_collisions(&s->params, &predicted, &unused_velocity);
+			predicted_positions[i] = predicted;
+		}
+	}
+
+	// NOTE(DH): Velocity is whatever displacement the projection ended up with
+	f32 inv_dt = 1.0f / delta_time;
+	for(u32 i = 0 ; i < count; ++i) {
+		velocities[i] = (predicted_positions[i] - positions[i]) * inv_dt;
+	}
+
+	for(u32 i = 0 ; i < count; ++i) {
+		deltas[i] = sph_calculate_xsph_viscosity(arena, s, k, i);
+	}
+
+	for(u32 i = 0 ; i < count; ++i) {
+		vec velocity = velocities[i];
+		velocity += deltas[i];
+		vec position = predicted_positions[i];
+		sph_resolve_collisions(&s->params, &position, &velocity);
+		positions[i] = position;
+		velocities[i] = velocity;
+	}
+}
+
+template<u32 dim, typename L>
+inline func sph_step(memory_arena *arena, sph_state<dim, L> *s, f32 delta_time) -> void {
+	if(s->params.mode == solver_mode_pbf) 	sph_step_pbf(arena, s, delta_time);
+	else 									sph_step_wcsph(arena, s, delta_time);
+}
+
+// NOTE(DH): Mean relative deviation from target_density, measured on current positions (not the predicted ones
+// the step used), so both solvers are judged the same way. Rebuilds the spatial lookup.
+template<u32 dim, typename L>
+inline func sph_density_error(memory_arena *arena, sph_state<dim, L> *s) -> f32 {
+	auto positions = sph_positions(arena, s, s->positions);
+	auto predicted = sph_positions(arena, s, s->predicted_positions);
+	u32 count = s->positions.count;
+	if(count == 0) return 0.0f;
+
+	for(u32 i = 0; i < count; ++i) predicted[i] = positions[i];
+	sph_update_spatial_lookup(arena, s);
+
+	sph_kernel_factors k = sph_dim<dim>::kernel_factors(s->params.smoothing_radius);
+	f32 error_sum = 0;
+	for(u32 i = 0; i < count; ++i) {
+		f32 density = sph_calculate_density(arena, s, k, positions[i]).x;
+		error_sum += fabsf(density - s->params.target_density) / s->params.target_density;
+	}
+	return error_sum / count;
+}
+
+// NOTE(DH): Unit mass per particle
+template<u32 dim, typename L>
+inline func sph_kinetic_energy(memory_arena *arena, sph_state<dim, L> *s) -> f32 {
+	auto velocities = sph_velocities(arena, s);
+	f32 result = 0;
+	for(u32 i = 0; i < s->velocities.count; ++i) {
+		result += 0.5f * Inner(velocities[i], velocities[i]);
+	}
+	return result;
+}
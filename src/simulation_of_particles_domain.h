@@ -0,0 +1,546 @@
+#pragma once
+#include "simulation_of_particles_core.h"
+#include "util/log.h"
+
+#include <atomic>
+#include <chrono>
+#include <immintrin.h>
+
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// NOTE(DH): Slab domain decomposition of the 2D CPU solver over several processes on one machine.
+// The bounds are cut along x into one slab per worker. Every step a worker
+//  1) steps its owned particles together with the ghosts it received last step,
+//  2) sends particles that left its slab to the neighbour that now owns them (migration),
+//  3) sends copies of particles close to the slab edge to that neighbour (ghosts / halo).
+// All traffic goes through single-producer single-consumer byte rings in one POSIX shared memory object,
+// one ring per direction per pair of neighbouring slabs. Workers only synchronise with their neighbours,
+// the message of step N is what orders them.
+//
+// Nothing is sized for the whole particle count, so memory per process goes down as workers are added: a worker
+// starts with room for its slab share plus headroom and regrows its arena when migrants and ghosts don't fit,
+// and a ring is sized for a typical message (the halo band), with bigger messages streamed through it in pieces.
+
+#define DOMAIN_MAGIC 0x534c4142 // 'SLAB'
+#define DOMAIN_CACHE_LINE 64
+
+static constexpr u32 domain_max_workers = 64;
+
+// NOTE(DH): Ghosts within halo_factor * smoothing_radius of the slab edge are sent, so the ghosts that do
+// touch owned particles (within one radius) have their own full neighbourhood and get a correct density
+static constexpr f32 domain_halo_factor = 2.0f;
+
+// NOTE(DH): Starting capacity of a worker over what it owns at spawn, and how much a regrow adds over what was
+// needed, so a slab that keeps filling up doesn't regrow every step
+static constexpr f32 domain_headroom = 1.5f;
+
+struct domain_particle {
+	v2 position;
+	v2 velocity;
+};
+
+struct domain_message_header {
+	u32 step;
+	u32 migrant_count;
+	u32 ghost_count;
+	u32 reserved;
+};
+// NOTE(DH): Rings only ever move whole 16 byte units, so a partial read or write never splits a particle
+static_assert(sizeof(domain_message_header) == sizeof(domain_particle), "Ring traffic is in particle sized units");
+
+// NOTE(DH): Lives in shared memory, data follows right after the header
+struct shm_ring {
+	alignas(DOMAIN_CACHE_LINE) std::atomic<u64> head; // NOTE(DH): Bytes written, owned by the producer
+	alignas(DOMAIN_CACHE_LINE) std::atomic<u64> tail; // NOTE(DH): Bytes read, owned by the consumer
+	alignas(DOMAIN_CACHE_LINE) u64 capacity;			 // NOTE(DH): Power of two
+};
+static_assert(std::atomic<u64>::is_always_lock_free, "Ring counters are shared between processes and have to be lock free");
+
+struct domain_worker_stats {
+	u32 owned_count;
+	u32 ghost_count;
+	u32 migrated_out;
+	u32 migrated_in;
+	u32 steps_done;
+	u32 max_owned_count;
+	u32 capacity;
+	u32 grow_count;
+	u64 arena_bytes;
+	f32 max_speed;		// NOTE(DH): Of the owned particles at the end, a blown up run shows here first
+	f64 step_seconds;
+	f64 exchange_seconds;
+};
+
+struct domain_control {
+	u32 magic;
+	u32 worker_count;
+	u32 particle_count;
+	u32 step_count;
+	u64 ring_capacity;
+	u64 ring_stride;
+	u64 rings_offset;
+	u64 total_size;
+	f32 delta_time;
+	f32 spacing;
+	bool pin_workers;
+	sph_params<2> params;
+
+	std::atomic<u32> abort; // NOTE(DH): Set when any worker dies, so nobody waits on a ring forever
+	alignas(DOMAIN_CACHE_LINE) domain_worker_stats stats[domain_max_workers];
+};
+
+struct domain_slab {
+	f32 min_x;
+	f32 max_x;
+};
+
+static inline func next_pow_2(u64 value) -> u64 {
+	u64 result = 1;
+	while(result < value) result <<= 1;
+	return result;
+}
+
+static inline func align_up(u64 value, u64 alignment) -> u64 {
+	return (value + alignment - 1) & ~(alignment - 1);
+}
+
+// NOTE(DH): Edge (from -> to) between neighbouring workers, 2 rings per pair
+static inline func domain_ring_index(u32 from, u32 to) -> u32 {
+	return from < to ? from * 2 : to * 2 + 1;
+}
+
+static inline func domain_ring(domain_control *ctrl, u32 from, u32 to) -> shm_ring* {
+	return (shm_ring*)((u8*)ctrl + ctrl->rings_offset + ctrl->ring_stride * domain_ring_index(from, to));
+}
+
+static inline func domain_slab_of(domain_control *ctrl, u32 worker_idx) -> domain_slab {
+	f32 width = ctrl->params.bounds_size.x / ctrl->worker_count;
+	f32 left = -ctrl->params.bounds_size.x * 0.5f;
+	domain_slab result = {};
+	// NOTE(DH): Outer slabs are open, collisions keep particles inside the bounds anyway
+	result.min_x = worker_idx == 0 ? -FLT_MAX : left + width * worker_idx;
+	result.max_x = worker_idx == ctrl->worker_count - 1 ? FLT_MAX : left + width * (worker_idx + 1);
+	return result;
+}
+
+// NOTE(DH): Spin a bit, then give the core away. Returns false if the run was aborted.
+static inline func domain_wait(domain_control *ctrl, u32 *spins) -> bool {
+	if(++(*spins) < 1024) 	_mm_pause();
+	else 					sched_yield();
+	return ctrl->abort.load(std::memory_order_relaxed) == 0;
+}
+
+static inline func shm_ring_data(shm_ring *ring) -> u8* {
+	return (u8*)ring + sizeof(shm_ring);
+}
+
+static inline func shm_ring_copy_in(shm_ring *ring, u64 position, const void *src, u64 size) -> void {
+	u64 mask = ring->capacity - 1;
+	u64 at = position & mask;
+	u64 first = std::min(size, ring->capacity - at);
+	memcpy(shm_ring_data(ring) + at, src, first);
+	memcpy(shm_ring_data(ring), (u8*)src + first, size - first);
+}
+
+static inline func shm_ring_copy_out(shm_ring *ring, u64 position, void *dst, u64 size) -> void {
+	u64 mask = ring->capacity - 1;
+	u64 at = position & mask;
+	u64 first = std::min(size, ring->capacity - at);
+	memcpy(dst, shm_ring_data(ring) + at, first);
+	memcpy((u8*)dst + first, shm_ring_data(ring), size - first);
+}
+
+// NOTE(DH): Writes as much of the message as the ring has room for, from byte `done` on. Returns false when
+// there was no room at all. A message bigger than the ring goes through in pieces while the reader drains it.
+static inline func shm_ring_write_some(shm_ring *ring, domain_message_header *header, domain_particle *particles, u64 *done) -> bool {
+	u64 size = sizeof(*header) + sizeof(domain_particle) * (header->migrant_count + header->ghost_count);
+	u64 head = ring->head.load(std::memory_order_relaxed);
+	u64 space = ring->capacity - (head - ring->tail.load(std::memory_order_acquire));
+	u64 count = std::min(space, size - *done);
+	if(count == 0) return false;
+
+	u64 header_bytes = *done == 0 ? sizeof(*header) : 0;
+	if(header_bytes) shm_ring_copy_in(ring, head, header, sizeof(*header));
+	u64 payload_at = *done + header_bytes - sizeof(*header);
+	shm_ring_copy_in(ring, head + header_bytes, (u8*)particles + payload_at, count - header_bytes);
+	ring->head.store(head + count, std::memory_order_release);
+	*done += count;
+	return true;
+}
+
+static inline func shm_ring_read_header(shm_ring *ring, domain_message_header *header) -> bool {
+	u64 tail = ring->tail.load(std::memory_order_relaxed);
+	if(ring->head.load(std::memory_order_acquire) - tail < sizeof(*header)) return false;
+	shm_ring_copy_out(ring, tail, header, sizeof(*header));
+	ring->tail.store(tail + sizeof(*header), std::memory_order_release);
+	return true;
+}
+
+// NOTE(DH): Up to max_count particles that are already in the ring
+static inline func shm_ring_read_particles(shm_ring *ring, domain_particle *dst, u32 max_count) -> u32 {
+	u64 tail = ring->tail.load(std::memory_order_relaxed);
+	u64 available = (ring->head.load(std::memory_order_acquire) - tail) / sizeof(domain_particle);
+	u32 count = (u32)std::min<u64>(available, max_count);
+	if(count == 0) return 0;
+	shm_ring_copy_out(ring, tail, dst, sizeof(domain_particle) * count);
+	ring->tail.store(tail + sizeof(domain_particle) * count, std::memory_order_release);
+	return count;
+}
+
+// NOTE(DH): Particles spawn as a layer resting on the floor across the whole width, so every slab starts with a
+// share and nothing starts inside a wall. Columns are counted across the width, rows stack up from the floor.
+static inline func domain_spawn_columns(domain_control *ctrl) -> u32 {
+	u32 columns = (u32)(ctrl->params.bounds_size.x * 0.9f / ctrl->spacing);
+	return std::max(1u, std::min(columns, ctrl->particle_count));
+}
+
+static inline func domain_spawn_position(domain_control *ctrl, u32 idx) -> v2 {
+	u32 columns = domain_spawn_columns(ctrl);
+	f32 left = -(f32)columns * ctrl->spacing * 0.5f;
+	f32 floor = -ctrl->params.bounds_size.y * 0.5f + ctrl->params.particle_size;
+	return V2(left + (idx % columns + 0.5f) * ctrl->spacing, floor + (idx / columns + 0.5f) * ctrl->spacing);
+}
+
+// NOTE(DH): Shared memory object holding the control block followed by all rings
+static inline func domain_create_shared(const char *name, u32 worker_count, u32 particle_count, u32 step_count, f32 delta_time, sph_params<2> params) -> domain_control* {
+	if(worker_count == 0 || worker_count > domain_max_workers) panic("Worker count is out of range!");
+
+	// NOTE(DH): Rest spacing (unit mass, kernels integrate to one), a layer spawned denser than that starts with
+	// a pressure blast, which deep layers under PBF don't survive
+	f32 spacing = 1.0f / SquareRoot(params.target_density);
+	u32 columns = (u32)(params.bounds_size.x * 0.9f / spacing);
+	u32 rows = columns ? (particle_count + columns - 1) / columns : 0;
+	if(rows * spacing > params.bounds_size.y * 0.8f) panic("Too many particles for the domain bounds!");
+
+	// NOTE(DH): A typical message is one band of ghosts (halo wide, plus a radius for the migrants) over the whole
+	// height, at spawn spacing. Two of them fit so a neighbour one step ahead doesn't wait, anything bigger streams.
+	f32 band_width = params.smoothing_radius * (domain_halo_factor + 1.0f);
+	u64 band_particles = std::min<u64>(particle_count, (u64)(band_width * params.bounds_size.y / (spacing * spacing)) + 1);
+	u64 typical_message = sizeof(domain_message_header) + sizeof(domain_particle) * band_particles;
+	u64 ring_capacity = next_pow_2(std::max<u64>(typical_message * 2, 4096));
+	u64 ring_stride = align_up(sizeof(shm_ring) + ring_capacity, 4096);
+	u64 rings_offset = align_up(sizeof(domain_control), 4096);
+	u64 ring_count = (worker_count - 1) * 2;
+	u64 total_size = rings_offset + ring_stride * ring_count;
+
+	i32 fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+	if(fd < 0) panic("Can't create shared memory object!");
+	if(ftruncate(fd, total_size) != 0) { close(fd); shm_unlink(name); panic("Can't resize shared memory object!"); }
+
+	void *mapped = mmap(nullptr, total_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(mapped == MAP_FAILED) { shm_unlink(name); panic("Can't map shared memory object!"); }
+
+	// NOTE(DH): Value initialized in place (zeroes the plain fields, constructs the atomics)
+	domain_control *ctrl = new (mapped) domain_control();
+	ctrl->worker_count		= worker_count;
+	ctrl->particle_count	= particle_count;
+	ctrl->step_count		= step_count;
+	ctrl->ring_capacity		= ring_capacity;
+	ctrl->ring_stride		= ring_stride;
+	ctrl->rings_offset		= rings_offset;
+	ctrl->total_size		= total_size;
+	ctrl->delta_time		= delta_time;
+	ctrl->spacing			= spacing;
+	ctrl->params			= params;
+	ctrl->abort.store(0);
+
+	for(u32 i = 0; i < ring_count; ++i) {
+		shm_ring *ring = (shm_ring*)((u8*)ctrl + rings_offset + ring_stride * i);
+		ring->head.store(0);
+		ring->tail.store(0);
+		ring->capacity = ring_capacity;
+	}
+
+	std::atomic_thread_fence(std::memory_order_release);
+	ctrl->magic = DOMAIN_MAGIC;
+	return ctrl;
+}
+
+static inline func domain_open_shared(const char *name) -> domain_control* {
+	i32 fd = shm_open(name, O_RDWR, 0600);
+	if(fd < 0) panic("Can't open shared memory object!");
+
+	domain_control probe = {};
+	if(pread(fd, &probe, sizeof(probe), 0) != sizeof(probe) || probe.magic != DOMAIN_MAGIC) { close(fd); panic("Shared memory object is not a domain!"); }
+
+	void *mapped = mmap(nullptr, probe.total_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(mapped == MAP_FAILED) panic("Can't map shared memory object!");
+	return (domain_control*)mapped;
+}
+
+static inline func domain_close_shared(domain_control *ctrl) -> void {
+	munmap(ctrl, ctrl->total_size);
+}
+
+struct domain_worker {
+	u32 idx;
+	domain_control *ctrl;
+	domain_slab slab;
+	f32 halo;
+
+	memory_arena arena;
+	sph_state<2> state;
+	u32 capacity;
+	u32 owned_count;
+	u32 ghost_count;
+
+	// NOTE(DH): Outgoing messages, index 0 - left neighbour, 1 - right neighbour. A side never gets more than
+	// what is owned, incoming particles go straight from the ring into the state.
+	arena_array<domain_particle> outgoing[2];
+};
+
+static inline func domain_neighbour(domain_worker *w, u32 side) -> i32 {
+	i32 result = side == 0 ? (i32)w->idx - 1 : (i32)w->idx + 1;
+	return (result < 0 || result >= (i32)w->ctrl->worker_count) ? -1 : result;
+}
+
+static inline func domain_worker_arena_size(domain_control *ctrl, u32 capacity) -> usize {
+	usize cells = sph_grid_cell_capacity(ctrl->params, capacity);
+	return Kilobytes(64) + (usize)capacity * (128 + 2 * sizeof(domain_particle)) + cells * sizeof(u32);
+}
+
+// NOTE(DH): Makes room for `needed` particles. A regrow moves the state to a new arena: only the first `keep`
+// positions/velocities and the outgoing messages (which may be half sent) carry over, everything else is
+// rebuilt by the next step anyway.
+static inline func domain_worker_reserve(domain_worker *w, u32 needed, u32 keep, u32 *outgoing_count) -> void {
+	if(needed <= w->capacity) return;
+
+	u32 capacity = std::max((u32)(needed * domain_headroom), 64u);
+	memory_arena arena = initialize_arena(domain_worker_arena_size(w->ctrl, capacity));
+	sph_state<2> state = sph_create<2>(&arena, capacity, w->ctrl->params);
+	memcpy(arena.get_array(state.positions), w->arena.get_array(w->state.positions), sizeof(v2) * keep);
+	memcpy(arena.get_array(state.velocities), w->arena.get_array(w->state.velocities), sizeof(v2) * keep);
+	sph_set_count(&state, keep);
+
+	for(u32 side = 0; side < 2; ++side) {
+		arena_array<domain_particle> outgoing = arena.alloc_array<domain_particle>(capacity);
+		memcpy(arena.get_array(outgoing), w->arena.get_array(w->outgoing[side]), sizeof(domain_particle) * outgoing_count[side]);
+		w->outgoing[side] = outgoing;
+	}
+
+	free(w->arena.base);
+	w->arena	= arena;
+	w->state	= state;
+	w->capacity	= capacity;
+
+	domain_worker_stats *stats = &w->ctrl->stats[w->idx];
+	stats->capacity		= capacity;
+	stats->arena_bytes	= arena.size;
+	stats->grow_count++;
+}
+
+static inline func domain_worker_create(domain_control *ctrl, u32 idx) -> domain_worker {
+	domain_worker result = {};
+	result.idx		= idx;
+	result.ctrl		= ctrl;
+	result.slab		= domain_slab_of(ctrl, idx);
+	result.halo		= ctrl->params.smoothing_radius * domain_halo_factor;
+
+	// NOTE(DH): Every worker lays out the same global layer and keeps what falls into its slab
+	u32 total = ctrl->particle_count;
+	u32 owned = 0;
+	for(u32 i = 0; i < total; ++i) {
+		v2 p = domain_spawn_position(ctrl, i);
+		owned += p.x >= result.slab.min_x && p.x < result.slab.max_x;
+	}
+
+	// NOTE(DH): Room for the slab share and the ghosts of the edges that have a neighbour, more comes when needed
+	u32 fair_share = (total + ctrl->worker_count - 1) / ctrl->worker_count;
+	u32 neighbours = (idx > 0) + (idx + 1 < ctrl->worker_count);
+	u32 rows = (total + domain_spawn_columns(ctrl) - 1) / domain_spawn_columns(ctrl);
+	u32 edge_ghosts = neighbours * (u32)(result.halo / ctrl->spacing) * rows;
+	u32 capacity = (u32)((std::max(owned, fair_share) + edge_ghosts) * domain_headroom) + 64;
+
+	result.capacity	= capacity;
+	result.arena	= initialize_arena(domain_worker_arena_size(ctrl, capacity));
+	result.state	= sph_create<2>(&result.arena, capacity, ctrl->params);
+	for(u32 side = 0; side < 2; ++side) result.outgoing[side] = result.arena.alloc_array<domain_particle>(capacity);
+
+	auto positions = result.arena.get_array(result.state.positions);
+	for(u32 i = 0; i < total; ++i) {
+		v2 p = domain_spawn_position(ctrl, i);
+		if(p.x >= result.slab.min_x && p.x < result.slab.max_x) {
+			positions[result.owned_count++] = p;
+		}
+	}
+	sph_set_count(&result.state, result.owned_count);
+
+	domain_worker_stats *stats = &ctrl->stats[idx];
+	stats->capacity		= capacity;
+	stats->arena_bytes	= result.arena.size;
+
+	return result;
+}
+
+static inline func domain_exchange(domain_worker *w, u32 step) -> bool {
+	auto positions	= w->arena.get_array(w->state.positions);
+	auto velocities	= w->arena.get_array(w->state.velocities);
+	domain_worker_stats *stats = &w->ctrl->stats[w->idx];
+
+	domain_particle* out[2] = { w->arena.get_array(w->outgoing[0]), w->arena.get_array(w->outgoing[1]) };
+	domain_message_header header[2] = {};
+	header[0].step = header[1].step = step;
+
+	// NOTE(DH): Ghosts from the previous step are dropped, they were only there to be neighbours
+	u32 owned = w->owned_count;
+
+	// NOTE(DH): Migration, particles that left the slab go to the neighbour on that side (if it moved further,
+	// the neighbour passes it on next step)
+	for(u32 i = 0; i < owned;) {
+		f32 x = positions[i].x;
+		u32 side = x < w->slab.min_x ? 0 : (x >= w->slab.max_x ? 1 : 2);
+		if(side == 2) { ++i; continue; }
+
+		out[side][header[side].migrant_count++] = {positions[i], velocities[i]};
+		--owned;
+		positions[i] = positions[owned];
+		velocities[i] = velocities[owned];
+		stats->migrated_out++;
+	}
+
+	// NOTE(DH): Halo, copies of particles near the slab edges
+	for(u32 i = 0; i < owned; ++i) {
+		f32 x = positions[i].x;
+		if(x < w->slab.min_x + w->halo) {
+			out[0][header[0].migrant_count + header[0].ghost_count++] = {positions[i], velocities[i]};
+		}
+		if(x >= w->slab.max_x - w->halo) {
+			out[1][header[1].migrant_count + header[1].ghost_count++] = {positions[i], velocities[i]};
+		}
+	}
+
+	// NOTE(DH): Both directions make progress in one loop, so two neighbours streaming big messages at each other
+	// never wait on one another. Incoming particles are only read once both headers are in, that is when it is
+	// known how much room they need: migrants of both sides go right after the owned ones, then the ghosts.
+	shm_ring *send_ring[2] = {};
+	shm_ring *receive_ring[2] = {};
+	for(u32 side = 0; side < 2; ++side) {
+		i32 other = domain_neighbour(w, side);
+		if(other < 0) continue;
+		send_ring[side] = domain_ring(w->ctrl, w->idx, other);
+		receive_ring[side] = domain_ring(w->ctrl, other, w->idx);
+	}
+
+	u64 sent[2] = {};
+	domain_message_header incoming[2] = {};
+	bool have_header[2] = { receive_ring[0] == nullptr, receive_ring[1] == nullptr };
+	bool placed = false;
+	u32 received[2] = {};
+	u32 migrant_at[2] = {};
+	u32 ghost_at[2] = {};
+
+	for(u32 spins = 0;;) {
+		bool progress = false;
+		bool done = placed;
+
+		for(u32 side = 0; side < 2; ++side) {
+			if(send_ring[side] == nullptr) continue;
+			u64 size = sizeof(domain_message_header) + sizeof(domain_particle) * (header[side].migrant_count + header[side].ghost_count);
+			if(sent[side] < size) progress |= shm_ring_write_some(send_ring[side], &header[side], out[side], &sent[side]);
+			done &= sent[side] == size;
+		}
+
+		for(u32 side = 0; side < 2; ++side) {
+			if(have_header[side]) continue;
+			if(!shm_ring_read_header(receive_ring[side], &incoming[side])) continue;
+			if(incoming[side].step != step) panic("Neighbour worker is out of step!");
+			have_header[side] = progress = true;
+		}
+
+		if(!placed && have_header[0] && have_header[1]) {
+			u32 migrants = incoming[0].migrant_count + incoming[1].migrant_count;
+			u32 ghosts = incoming[0].ghost_count + incoming[1].ghost_count;
+			u32 outgoing_count[2] = { header[0].migrant_count + header[0].ghost_count, header[1].migrant_count + header[1].ghost_count };
+			domain_worker_reserve(w, owned + migrants + ghosts, owned, outgoing_count);
+			positions	= w->arena.get_array(w->state.positions);
+			velocities	= w->arena.get_array(w->state.velocities);
+			out[0]		= w->arena.get_array(w->outgoing[0]);
+			out[1]		= w->arena.get_array(w->outgoing[1]);
+
+			migrant_at[0]	= owned;
+			migrant_at[1]	= owned + incoming[0].migrant_count;
+			ghost_at[0]		= owned + migrants;
+			ghost_at[1]		= owned + migrants + incoming[0].ghost_count;
+			placed = progress = true;
+		}
+
+		for(u32 side = 0; placed && side < 2; ++side) {
+			u32 count = incoming[side].migrant_count + incoming[side].ghost_count;
+			while(received[side] < count) {
+				domain_particle batch[64];
+				u32 n = shm_ring_read_particles(receive_ring[side], batch, std::min(count - received[side], 64u));
+				if(n == 0) break;
+				for(u32 i = 0; i < n; ++i, ++received[side]) {
+					u32 k = received[side];
+					u32 at = k < incoming[side].migrant_count ? migrant_at[side] + k : ghost_at[side] + (k - incoming[side].migrant_count);
+					positions[at] = batch[i].position;
+					velocities[at] = batch[i].velocity;
+				}
+				progress = true;
+			}
+			done &= received[side] == count;
+		}
+
+		if(done) break;
+		if(progress) spins = 0;
+		else if(!domain_wait(w->ctrl, &spins)) return false;
+	}
+
+	u32 migrants = incoming[0].migrant_count + incoming[1].migrant_count;
+	stats->migrated_in += migrants;
+
+	w->owned_count = owned + migrants;
+	w->ghost_count = incoming[0].ghost_count + incoming[1].ghost_count;
+	sph_set_count(&w->state, w->owned_count + w->ghost_count);
+	return true;
+}
+
+// NOTE(DH): Entry of a worker process. Returns process exit code.
+static inline func domain_run_worker(const char *shm_name, u32 idx) -> i32 {
+	domain_control *ctrl = domain_open_shared(shm_name);
+	domain_worker_stats *stats = &ctrl->stats[idx];
+
+#if defined(__linux__)
+	// NOTE(DH): Pin before allocating, so the arena is first touched on the node this worker runs on
+	if(ctrl->pin_workers) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(idx % sysconf(_SC_NPROCESSORS_ONLN), &set);
+		sched_setaffinity(0, sizeof(set), &set);
+	}
+#endif
+
+	domain_worker w = domain_worker_create(ctrl, idx);
+
+	// NOTE(DH): Initial halo, so the first step already sees its neighbours
+	bool ok = domain_exchange(&w, 0);
+
+	for(u32 step = 1; ok && step <= ctrl->step_count; ++step) {
+		auto start = std::chrono::high_resolution_clock::now();
+		sph_step(&w.arena, &w.state, ctrl->delta_time);
+		auto mid = std::chrono::high_resolution_clock::now();
+		ok = domain_exchange(&w, step);
+		auto end = std::chrono::high_resolution_clock::now();
+
+		stats->step_seconds += std::chrono::duration<f64>(mid - start).count();
+		stats->exchange_seconds += std::chrono::duration<f64>(end - mid).count();
+		stats->steps_done = step;
+		stats->max_owned_count = std::max(stats->max_owned_count, w.owned_count);
+	}
+
+	stats->owned_count = w.owned_count;
+	stats->ghost_count = w.ghost_count;
+	auto velocities = w.arena.get_array(w.state.velocities);
+	for(u32 i = 0; i < w.owned_count; ++i) stats->max_speed = std::max(stats->max_speed, SquareRoot(Inner(velocities[i], velocities[i])));
+
+	free(w.arena.base);
+	if(!ok) ctrl->abort.store(1);
+	domain_close_shared(ctrl);
+	return ok ? 0 : 1;
+}
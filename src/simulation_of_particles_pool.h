@@ -0,0 +1,232 @@
+#pragma once
+#include "simulation_of_particles_core.h"
+
+// NOTE(DH): Dynamic particle count on top of sph_state. Arrays are allocated once with the largest capacity,
+// particles live densely in [0, alive) so every solver phase only walks live ones. Particles are known to the
+// outside by a stable id:
+//  - spawn 	- O(1), takes an id from the free list and appends at `alive`,
+//  - despawn 	- O(1), the last live particle is moved into the hole and the id goes back to the free list,
+//  - compact 	- every `compact_interval` updates the live range is reordered into lookup (cell) order, so
+//				  particles that are neighbours in space are neighbours in memory too.
+// Emitters and sinks are applied between steps by sph_pool_update.
+
+static constexpr u32 sph_pool_invalid = UINT_MAX;
+
+struct sph_pool {
+	arena_array<u32>	ids;		// NOTE(DH): Dense index -> id
+	arena_array<u32>	slots;		// NOTE(DH): Id -> dense index, sph_pool_invalid when despawned
+	arena_array<u32>	free_ids;	// NOTE(DH): Stack, count is how many ids are free
+	arena_array<u32>	pending;	// NOTE(DH): Ids collected by sinks before they are despawned
+	arena_array<u8>		scratch;	// NOTE(DH): Gather buffer for compaction, capacity * largest particle element,
+									// per particle "already queued" flags while sinks collect
+
+	u32 alive;
+	u32 compact_interval;			// NOTE(DH): Updates between compactions, 0 - never
+	u32 updates_since_compact;
+	u32 random_state;
+
+	u32 spawned;					// NOTE(DH): Totals, for stats
+	u32 despawned;
+	u32 compactions;
+};
+
+template<u32 dim>
+struct sph_emitter {
+	using vec = typename sph_dim<dim>::vec;
+
+	vec position;
+	vec velocity;
+	f32 rate;			// NOTE(DH): Particles per second
+	f32 spread;			// NOTE(DH): Spawn positions are jittered within this distance of `position`
+	f32 accumulator;	// NOTE(DH): Fraction of a particle carried over to the next update
+};
+
+template<u32 dim>
+struct sph_sink {
+	using vec = typename sph_dim<dim>::vec;
+
+	vec lo;
+	vec hi;
+};
+
+template<u32 dim, typename L>
+inline func sph_pool_create(memory_arena *arena, sph_state<dim, L> *s, u32 alive, u32 compact_interval) -> sph_pool {
+	using S = sph_state<dim, L>;
+
+	u32 capacity = s->positions.capacity;
+	assert(alive <= capacity);
+
+	sph_pool result = {};
+	result.ids			= sph_alloc<dim, u32>(arena, capacity);
+	result.slots		= sph_alloc<dim, u32>(arena, capacity);
+	result.free_ids		= sph_alloc<dim, u32>(arena, capacity);
+	result.pending		= sph_alloc<dim, u32>(arena, capacity);
+
+	usize element_size = std::max({sizeof(typename S::position), sizeof(typename S::velocity), sizeof(typename S::density), sizeof(u32)});
+	result.scratch		= sph_alloc<dim, u8>(arena, capacity * element_size);
+
+	result.alive = alive;
+	result.compact_interval = compact_interval;
+	result.random_state = 0x9e3779b9u;
+
+	auto ids = arena->get_array(result.ids);
+	auto slots = arena->get_array(result.slots);
+	auto free_ids = arena->get_array(result.free_ids);
+	for(u32 i = 0; i < capacity; ++i) {
+		ids[i] = i;
+		slots[i] = i < alive ? i : sph_pool_invalid;
+	}
+
+	// NOTE(DH): Pushed in reverse so the lowest free id is handed out first
+	result.free_ids.count = capacity - alive;
+	for(u32 i = 0; i < result.free_ids.count; ++i) free_ids[i] = capacity - 1 - i;
+
+	sph_set_count(s, alive);
+	return result;
+}
+
+template<u32 dim, typename L>
+static inline func sph_pool_move(memory_arena *arena, sph_state<dim, L> *s, u32 to, u32 from) -> void {
+	auto positions = arena->get_array(s->positions);
+	auto predicted = arena->get_array(s->predicted_positions);
+	auto velocities = arena->get_array(s->velocities);
+	auto densities = arena->get_array(s->densities);
+	positions[to] = positions[from];
+	predicted[to] = predicted[from];
+	velocities[to] = velocities[from];
+	densities[to] = densities[from];
+}
+
+// NOTE(DH): Returns the id of the new particle, sph_pool_invalid when the pool is full
+template<u32 dim, typename L>
+inline func sph_pool_spawn(memory_arena *arena, sph_state<dim, L> *s, sph_pool *pool, typename sph_dim<dim>::vec position, typename sph_dim<dim>::vec velocity) -> u32 {
+	if(pool->free_ids.count == 0) return sph_pool_invalid;
+
+	u32 id = arena->get_array(pool->free_ids)[--pool->free_ids.count];
+	u32 idx = pool->alive++;
+	sph_set_count(s, pool->alive);
+
+	arena->get_array(pool->ids)[idx] = id;
+	arena->get_array(pool->slots)[id] = idx;
+
+	sph_positions(arena, s, s->positions)[idx] = position;
+	sph_positions(arena, s, s->predicted_positions)[idx] = position;
+	sph_velocities(arena, s)[idx] = velocity;
+	sph_densities(arena, s)[idx] = V2(s->params.target_density, 0.0f);
+
+	++pool->spawned;
+	return id;
+}
+
+template<u32 dim, typename L>
+inline func sph_pool_despawn(memory_arena *arena, sph_state<dim, L> *s, sph_pool *pool, u32 id) -> void {
+	auto ids = arena->get_array(pool->ids);
+	auto slots = arena->get_array(pool->slots);
+
+	u32 idx = slots[id];
+	if(idx == sph_pool_invalid) return;
+
+	u32 last = --pool->alive;
+	if(idx != last) {
+		sph_pool_move(arena, s, idx, last);
+		ids[idx] = ids[last];
+		slots[ids[idx]] = idx;
+	}
+
+	slots[id] = sph_pool_invalid;
+	ids[last] = id;
+	arena->get_array(pool->free_ids)[pool->free_ids.count++] = id;
+	sph_set_count(s, pool->alive);
+
+	++pool->despawned;
+}
+
+template<typename T>
+static inline func sph_pool_gather(T *data, spatial_data *order, u32 count, u8 *scratch) -> void {
+	T *gathered = (T*)scratch;
+	for(u32 j = 0; j < count; ++j) gathered[j] = data[order[j].particle_index];
+	memcpy(data, gathered, sizeof(T) * count);
+}
+
+// NOTE(DH): Reorders the live range into the order of the current lookup. Afterwards particle j is lookup entry j,
+// so the lookup is rewritten as the identity and stays valid. Does nothing without a row span lookup.
+template<u32 dim, typename L>
+inline func sph_pool_compact(memory_arena *arena, sph_state<dim, L> *s, sph_pool *pool) -> bool {
+	auto query = sph_make_query(arena, s, sph_positions(arena, s, s->positions));
+	if(!query.lookup_ready() || s->spatial_lookup.count != pool->alive) return false;
+
+	auto lookup = arena->get_array(s->spatial_lookup);
+	auto ids = arena->get_array(pool->ids);
+	auto slots = arena->get_array(pool->slots);
+	u8 *scratch = arena->get_array(pool->scratch);
+	u32 count = pool->alive;
+
+	sph_pool_gather(arena->get_array(s->positions), lookup, count, scratch);
+	sph_pool_gather(arena->get_array(s->predicted_positions), lookup, count, scratch);
+	sph_pool_gather(arena->get_array(s->velocities), lookup, count, scratch);
+	sph_pool_gather(arena->get_array(s->densities), lookup, count, scratch);
+	sph_pool_gather(ids, lookup, count, scratch);
+
+	for(u32 j = 0; j < count; ++j) {
+		slots[ids[j]] = j;
+		lookup[j].particle_index = j;
+	}
+
+	++pool->compactions;
+	return true;
+}
+
+static inline func sph_pool_random(sph_pool *pool) -> f32 {
+	// NOTE(DH): xorshift, spawn jitter only needs to be cheap and deterministic
+	u32 x = pool->random_state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	pool->random_state = x;
+	return (x >> 8) * (1.0f / 16777216.0f);
+}
+
+// NOTE(DH): Call between steps: compacts when due (the lookup of the last step is still valid then), drains every
+// particle inside a sink and lets every emitter spawn what it accumulated over `delta_time`.
+template<u32 dim, typename L>
+inline func sph_pool_update(memory_arena *arena, sph_state<dim, L> *s, sph_pool *pool, sph_emitter<dim> *emitters, u32 emitter_count, sph_sink<dim> *sinks, u32 sink_count, f32 delta_time) -> void {
+	using vec = typename sph_dim<dim>::vec;
+
+	if(pool->compact_interval && ++pool->updates_since_compact >= pool->compact_interval) {
+		if(sph_pool_compact(arena, s, pool)) pool->updates_since_compact = 0;
+	}
+
+	if(sink_count) {
+		// NOTE(DH): Ids first, despawning moves particles around under the query. Sinks may overlap, a particle
+		// is queued once, so pending never holds more than the live count
+		auto ids = arena->get_array(pool->ids);
+		auto pending = arena->get_array(pool->pending);
+		u8 *queued = arena->get_array(pool->scratch);
+		memset(queued, 0, pool->alive);
+		pool->pending.count = 0;
+
+		auto query = sph_make_query(arena, s, sph_positions(arena, s, s->positions), s->params.smoothing_radius);
+		for(u32 i = 0; i < sink_count; ++i) {
+			query.aabb(sinks[i].lo, sinks[i].hi, [&](u32 idx, vec) {
+				if(queued[idx]) return;
+				queued[idx] = 1;
+				assert(pool->pending.count < pool->pending.capacity);
+				pending[pool->pending.count++] = ids[idx];
+			});
+		}
+		for(u32 i = 0; i < pool->pending.count; ++i) sph_pool_despawn(arena, s, pool, pending[i]);
+	}
+
+	for(u32 i = 0; i < emitter_count; ++i) {
+		sph_emitter<dim> *e = &emitters[i];
+		e->accumulator += e->rate * delta_time;
+		for(; e->accumulator >= 1.0f; e->accumulator -= 1.0f) {
+			vec jitter;
+			for(u32 k = 0; k < dim; ++k) jitter.E[k] = (sph_pool_random(pool) * 2.0f - 1.0f) * e->spread;
+			if(sph_pool_spawn(arena, s, pool, e->position + jitter, e->velocity) == sph_pool_invalid) {
+				e->accumulator = 0.0f;
+				break;
+			}
+		}
+	}
+}
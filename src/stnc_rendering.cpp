@@ -553,6 +553,12 @@ func imgui_draw_canvas(dx_context *ctx, stnc_rendering *stnc_rndr)
 		ImGui::Text("Angle: %f", angle);
 		ImGui::Text("Zoom: %f", stnc_rndr->zoom_factor);
 		ImGui::Text("This is canvas position: %f, %f", ImGui::GetCursorScreenPos().x, ImGui::GetCursorScreenPos().y);
+#ifdef ALLOC_TRACKING
+		alloc_totals heap = global_alloc_tracker.get_totals();
+		ImGui::Text("Heap: %llu allocs (%llu bytes) last frame, %llu frames without one, %llu bytes live", (unsigned long long)heap.last_frame_allocs,
+			(unsigned long long)heap.last_frame_bytes, (unsigned long long)heap.clean_frames, (unsigned long long)heap.live_bytes);
+		if(ImGui::Button("Print allocation report")) global_alloc_tracker.report(stdout);
+#endif
 		
 
         // Typically you would use a BeginChild()/EndChild() pair to benefit from a clipping region + own scrolling.
@@ -663,14 +669,14 @@ func imgui_draw_canvas(dx_context *ctx, stnc_rendering *stnc_rndr)
 		//NOTE(DH) END
 
 		bool swap = false;
-		u32 swap_node_idx = 0;
+		def_idx_t swap_node_idx = {};
 		let mod = ctx->mem_arena.get_ptr(stnc_rndr->mod);
-		mod->defs.iter_in_order([=, &swap, &swap_node_idx](definition *def, u32 def_idx, u32 ordered_def_idx) -> void {
+		mod->defs.iter_in_order([=, &swap, &swap_node_idx](definition *def, u32 def_order, def_idx_t def_idx) -> void {
 			if(def->tag == definition::node) {
 
 				// NOTE(DH): Swap elements only on next iteration for proper drawing!
 				def->data.node.nodes.iter([=, &swap, &swap_node_idx](node *nd) -> void {
-					if(draw_node(ctx, stnc_rndr, draw_list, io, canvas_p0, canvas_p1, nd, ordered_def_idx) == true) {
+					if(draw_node(ctx, stnc_rndr, draw_list, io, canvas_p0, canvas_p1, nd, def_idx.idx) == true) {
 						swap = true;
 						swap_node_idx = def_idx;
 					}
@@ -683,7 +689,7 @@ func imgui_draw_canvas(dx_context *ctx, stnc_rendering *stnc_rndr)
 		});
 		draw_list->PopClipRect();
 
-		if(swap_node_idx != 0 && swap) mod->defs.swap_to_last(swap_node_idx);
+		if(swap) mod->defs.raise(swap_node_idx);
 
 			// NOTE(DH): Clear all interaction things
 		if(ImGui::IsMouseReleased(ImGuiMouseButton_Left)) {
@@ -216,13 +216,6 @@ func ui_context_compare(ui_context p, ui_context q) {
 //     return el_ptr;
 // }
 
-struct image_buffer {
-    rgba* render_img;
-    u32* component_id_img;
-    u32 width;
-    u32 height;
-};
-
 template <typename a> struct ui_component;
 
 struct ui_back_state {
@@ -237,7 +230,7 @@ struct ui_back_state {
 
     template <typename a>
     inline func replace(ui_component<a>* el, auto new_el) -> ui_component<a>* {
-        this->components_data.free(free_list_buffer::fl_ptr {.offset = (u32)((u8*)el - (u8*)this->components_data.data) - 8});
+        this->components_data.free(this->components_data.ptr_of(el));
         // let el_offset = this->components_data.write(new_el);
         let el_offset = new_el(this);
         return this->components_data.get_ptr<ui_component<a>>(el_offset);
@@ -620,12 +613,12 @@ func my_component(my_params params) {
             // let el = ui_back->components_data.get_ptr<ui_component<ui_block_params>>(el_offset);
             let params = el->params;
             params.bg_color = {.u32 = 0x00};
-            el->update_fn(ui_back, {.offset = (u32)((u8*)el - (u8*)ui_back->components_data.data) - 8}, params);
+            el->update_fn(ui_back, ui_back->components_data.ptr_of(el), params);
             el->user_callbacks.mouse_press = [](ui_back_state* ui_back, ui_component<ui_block_params>* el, ui_point_2d pos) {
                 // let el = ui_back->components_data.get_ptr<ui_component<ui_block_params>>(el_offset);
                 let params = el->params;
                 params.bg_color = {.u32 = 0x8a4515 + (u32)pos.x};
-                el->update_fn(ui_back, {.offset = (u32)((u8*)el - (u8*)ui_back->components_data.data) - 8}, params);
+                el->update_fn(ui_back, ui_back->components_data.ptr_of(el), params);
                 // return el_offset;
             };
             // return el_offset;
@@ -1,32 +1,224 @@
 #pragma once
 
 #include "types.h"
+#include "log.h"
+#include "alloc_tracking.h"
+#include "memory_management.h"
+#include <algorithm>
 #include <cstdlib>
+#include <cstring>
 
+// NOTE(DH): An allocator is a context pointer plus three functions taking it. Containers keep calling
+// alc.alloc(size) / alc.realloc(ptr, size) / alc.free(ptr), what backs them (malloc, an arena, a pool) is
+// decided by whoever creates the container. A null realloc ptr behaves like alloc, like the C one.
+// alloc/realloc take the call site (see alloc_tracking.h) and hand it on to the functions through
+// alloc_current_site, which is what the tracking ones read.
 struct allocator {
-    void*(*alloc)(usize);
-    void*(*realloc)(void*, usize);
-    void(*free)(void*);
+    void* ctx;
+    void*(*alloc_fn)(void* ctx, usize size);
+    void*(*realloc_fn)(void* ctx, void* ptr, usize size);
+    void(*free_fn)(void* ctx, void* ptr);
+
+    inline func alloc(usize size, alloc_site site = alloc_site::current()) const -> void* {
+        alloc_current_site = site;
+        return alloc_fn(ctx, size);
+    }
+    inline func realloc(void* ptr, usize size, alloc_site site = alloc_site::current()) const -> void* {
+        alloc_current_site = site;
+        return realloc_fn(ctx, ptr, size);
+    }
+    inline func free(void* ptr) const -> void { free_fn(ctx, ptr); }
 };
 
 static constexpr allocator default_allocator = {
-    .alloc   = [](usize size) -> void* {
-        let ptr = malloc(size);
-        // printf("alloc %p %llu\n", ptr, size);
-        // system("pause");
-        return ptr;
-        // return malloc(size);
+    .ctx      = nullptr,
+    .alloc_fn = [](void*, usize size) -> void* {
+        return tracked_malloc(size, alloc_current_site);
     },
-    .realloc = [](void* ptr, usize size) -> void* {
-        // printf("realloc %p %llu\n", ptr, size);
-        // system("pause");
-        let nptr = realloc(ptr, size);
-        // printf("realloced %p %llu\n", nptr, size);
-        // system("pause");
-        return nptr;
-        // return realloc(ptr, size);
+    .realloc_fn = [](void*, void* ptr, usize size) -> void* {
+        return tracked_realloc(ptr, size, alloc_current_site);
     },
-    .free    = [](void* ptr) -> void {return free(ptr);},
+    .free_fn  = [](void*, void* ptr) -> void {return tracked_free(ptr);},
+};
+
+// NOTE(DH): Arena backed allocator, ctx is the memory_arena (so the arena must not move while it is in use).
+// Every block gets a small header with its size. Growing or freeing the block at the top of the arena happens
+// in place, so a list that is the last thing pushed grows without copying; freeing anything else is a no-op
+// and the memory comes back when the arena (or its temporary memory) is reset.
+struct arena_block_header {
+    usize size;
+    usize reserved;
 };
 
-// static constexpr allocator mem_arena_with_free_list = {};
\ No newline at end of file
+static constexpr usize arena_allocator_alignment = 16;
+
+inline func arena_block_of(void* ptr) -> arena_block_header* {
+    return (arena_block_header*)((u8*)ptr - sizeof(arena_block_header));
+}
+
+inline func arena_block_is_top(memory_arena* arena, void* ptr) -> bool {
+    return (u8*)ptr + arena_block_of(ptr)->size == arena->base + arena->used;
+}
+
+inline func arena_allocator_alloc(void* ctx, usize size) -> void* {
+    let arena = (memory_arena*)ctx;
+    usize start = (usize)arena->base + arena->used + sizeof(arena_block_header);
+    usize aligned = (start + arena_allocator_alignment - 1) & ~(arena_allocator_alignment - 1);
+    usize used = aligned - (usize)arena->base + size;
+    assert(used <= arena->size);
+
+    arena->used = used;
+    arena_block_of((void*)aligned)->size = size;
+    track_arena_push(size, alloc_current_site);
+    return (void*)aligned;
+}
+
+inline func arena_allocator_realloc(void* ctx, void* ptr, usize size) -> void* {
+    let arena = (memory_arena*)ctx;
+    if (ptr == nullptr) return arena_allocator_alloc(ctx, size);
+
+    let header = arena_block_of(ptr);
+    if (arena_block_is_top(arena, ptr)) {
+        usize used = (usize)((u8*)ptr - arena->base) + size;
+        assert(used <= arena->size);
+        arena->used = used;
+        header->size = size;
+        return ptr;
+    }
+
+    if (size <= header->size) { header->size = size; return ptr; }
+
+    let result = arena_allocator_alloc(ctx, size);
+    memcpy(result, ptr, header->size);
+    return result;
+}
+
+inline func arena_allocator_free(void* ctx, void* ptr) -> void {
+    let arena = (memory_arena*)ctx;
+    if (ptr == nullptr) return;
+    if (arena_block_is_top(arena, ptr)) {
+        arena->used = (usize)((u8*)arena_block_of(ptr) - arena->base);
+    }
+}
+
+inline func arena_allocator(memory_arena* arena) -> allocator {
+    return {
+        .ctx        = arena,
+        .alloc_fn   = arena_allocator_alloc,
+        .realloc_fn = arena_allocator_realloc,
+        .free_fn    = arena_allocator_free,
+    };
+}
+
+// NOTE(DH): Fixed size block pool, every alloc is one block no matter the size asked for (it has to fit). Blocks
+// come from the backing allocator once, freed blocks go on an intrusive free list. Realloc within a block is
+// free, realloc past it is a bug.
+struct block_pool {
+    allocator backing;
+    usize     block_size;
+    u32       block_count;
+    u32       used;
+    u8*       memory;
+    void*     free_list;
+
+    static inline func create(allocator backing, usize block_size, u32 block_count) -> block_pool {
+        block_size = (std::max(block_size, sizeof(void*)) + arena_allocator_alignment - 1) & ~(arena_allocator_alignment - 1);
+        block_pool result = {
+            .backing     = backing,
+            .block_size  = block_size,
+            .block_count = block_count,
+            .used        = 0,
+            .memory      = (u8*)backing.alloc(block_size * block_count),
+            .free_list   = nullptr,
+        };
+
+        for (u32 i = block_count; i-- > 0;) {
+            let block = result.memory + i * block_size;
+            *(void**)block = result.free_list;
+            result.free_list = block;
+        }
+        return result;
+    }
+
+    inline func destroy() -> void {
+        backing.free(memory);
+        memory = nullptr;
+        free_list = nullptr;
+    }
+
+    inline func as_allocator() -> allocator {
+        return {
+            .ctx        = this,
+            .alloc_fn   = [](void* ctx, usize size) -> void* {
+                let pool = (block_pool*)ctx;
+                if (size > pool->block_size) panic("block_pool: allocation bigger than a block");
+                if (pool->free_list == nullptr) return nullptr;
+
+                let block = pool->free_list;
+                pool->free_list = *(void**)block;
+                pool->used += 1;
+                return block;
+            },
+            .realloc_fn = [](void* ctx, void* ptr, usize size) -> void* {
+                let pool = (block_pool*)ctx;
+                if (size > pool->block_size) panic("block_pool: realloc bigger than a block");
+                return ptr != nullptr ? ptr : pool->as_allocator().alloc(size);
+            },
+            .free_fn    = [](void* ctx, void* ptr) -> void {
+                let pool = (block_pool*)ctx;
+                if (ptr == nullptr) return;
+                *(void**)ptr = pool->free_list;
+                pool->free_list = ptr;
+                pool->used -= 1;
+            },
+        };
+    }
+};
+
+// NOTE(DH): Reports everything that goes through the backing allocator to a tracker (kind alloc_kind_wrapped),
+// with or without ALLOC_TRACKING, so one arena or pool can be watched on its own (give it its own tracker, the
+// global one counts wrapped blocks in its totals). Each block gets an
+// alloc_header in front. Like block_pool, ctx is this struct, it must not move while the allocator is in use.
+struct tracking_allocator {
+    allocator      backing;
+    alloc_tracker* tracker;
+
+    static inline func create(allocator backing, alloc_tracker* tracker = &global_alloc_tracker) -> tracking_allocator {
+        return {.backing = backing, .tracker = tracker};
+    }
+
+    inline func as_allocator() -> allocator {
+        return {
+            .ctx        = this,
+            .alloc_fn   = [](void* ctx, usize size) -> void* {
+                let self = (tracking_allocator*)ctx;
+                alloc_site site = alloc_current_site;
+                let block = self->backing.alloc(sizeof(alloc_header) + size, site);
+                if (block == nullptr) return nullptr;
+                return alloc_header_write(block, size, self->tracker->record_alloc(site, alloc_kind_wrapped, size));
+            },
+            .realloc_fn = [](void* ctx, void* ptr, usize size) -> void* {
+                let self = (tracking_allocator*)ctx;
+                alloc_site site = alloc_current_site;
+                if (ptr == nullptr) return self->as_allocator().alloc(size, site);
+
+                let header = alloc_header_of(ptr);
+                assert(header->magic == alloc_header_magic);
+                let old_size = header->size;
+                let old_site = header->site;
+                let block = self->backing.realloc(header, sizeof(alloc_header) + size, site);
+                if (block == nullptr) return nullptr;
+                return alloc_header_write(block, size, self->tracker->record_realloc(old_site, old_size, site, alloc_kind_wrapped, size));
+            },
+            .free_fn    = [](void* ctx, void* ptr) -> void {
+                let self = (tracking_allocator*)ctx;
+                if (ptr == nullptr) return;
+                let header = alloc_header_of(ptr);
+                assert(header->magic == alloc_header_magic);
+                header->magic = 0;
+                self->tracker->record_free(header->site, header->size);
+                self->backing.free(header);
+            },
+        };
+    }
+};
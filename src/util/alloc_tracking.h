@@ -0,0 +1,327 @@
+#pragma once
+
+#include "types.h"
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <source_location>
+
+// NOTE(DH): Heap allocation tracking. With ALLOC_TRACKING defined (DEBUG builds turn it on) every heap block
+// that goes through tracked_malloc/tracked_realloc/tracked_free gets a 16 byte header with its size and the call
+// site that made it, and global_alloc_tracker counts it: totals, live bytes and their high water mark, a size
+// histogram per call site and allocations per frame. Without it the helpers are plain malloc/realloc/free and the
+// call site parameters are never looked at.
+//
+// Call sites are std::source_location default arguments: list::push, buffer_write, slab_array::push,
+// free_list_buffer::alloc_s, memory_arena::push_array and friends take one, so what gets recorded is the line
+// that pushed, not the line inside the container that called realloc. Arena pushes are counted per site as well
+// (kind alloc_kind_arena), but they aren't heap allocations and don't count towards the per frame number.
+//
+// tracking_allocator wraps any allocator (an arena, a pool) and reports what goes through it the same way.
+
+#if defined(DEBUG) && !defined(ALLOC_TRACKING)
+#define ALLOC_TRACKING
+#endif
+
+using alloc_site = std::source_location;
+
+enum alloc_kind : u32 {
+    alloc_kind_heap = 0,
+    alloc_kind_arena,
+    alloc_kind_wrapped,    // NOTE(DH): Through a tracking_allocator
+};
+
+static constexpr u32 alloc_histogram_buckets = 32;  // NOTE(DH): Bucket i holds sizes in [2^i, 2^(i+1))
+static constexpr u32 alloc_max_sites = 1024;        // NOTE(DH): Power of two, open addressing
+
+struct alloc_site_stats {
+    const char* file;
+    const char* function;
+    u32 line;
+    u32 column;
+    alloc_kind kind;
+
+    u64 allocs;
+    u64 reallocs;
+    u64 frees;
+    u64 bytes;              // NOTE(DH): Requested in total, reallocs count their new size
+    u64 live_bytes;
+    u64 peak_live_bytes;
+    u64 frame_allocs;
+    u32 histogram[alloc_histogram_buckets];
+};
+
+struct alloc_totals {
+    u64 allocs;
+    u64 reallocs;
+    u64 frees;
+    u64 bytes;
+    u64 live_bytes;
+    u64 peak_live_bytes;
+    u64 live_blocks;
+
+    u64 frame;
+    u64 frame_allocs;       // NOTE(DH): Heap allocs + reallocs so far this frame
+    u64 last_frame_allocs;
+    u64 last_frame_bytes;
+    u64 frame_bytes;
+    u64 clean_frames;       // NOTE(DH): Frames in a row without a single heap allocation
+};
+
+struct alloc_tracker {
+    std::mutex lock;
+    alloc_totals totals;
+    u32 site_count;
+    alloc_site_stats sites[alloc_max_sites + 1];   // NOTE(DH): The one past the table takes whatever doesn't fit
+
+    inline func find_site(alloc_site loc, alloc_kind kind) -> u32;
+    inline func record_alloc(alloc_site loc, alloc_kind kind, usize size) -> u32;
+    inline func record_realloc(u32 old_site, usize old_size, alloc_site loc, alloc_kind kind, usize size) -> u32;
+    inline func record_free(u32 site, usize size) -> void;
+
+    inline func next_frame() -> void;
+    inline func get_totals() -> alloc_totals;
+    inline func report(FILE* out, u32 top_sites = 20) -> void;
+    inline func reset() -> void;
+};
+
+inline alloc_tracker global_alloc_tracker;
+
+struct alloc_header {
+    u64 size;
+    u32 site;
+    u32 magic;
+};
+
+static constexpr u32 alloc_header_magic = 0xA110CA7E;
+
+inline func alloc_size_bucket(usize size) -> u32 {
+    u32 bucket = 0;
+    while (bucket + 1 < alloc_histogram_buckets && (usize(2) << bucket) <= size) ++bucket;
+    return bucket;
+}
+
+inline func alloc_tracker::find_site(alloc_site loc, alloc_kind kind) -> u32 {
+    // NOTE(DH): Hashes line and column only, hashing the file name costs more than the rest of the lookup. A header
+    // included from many translation units hands out a file_name pointer per unit, the pointer compare is only
+    // the fast path
+    u32 hash = (loc.line() * 2654435761u) ^ (loc.column() * 40503u) ^ (u32)kind;
+
+    for (u32 probe = 0; probe < alloc_max_sites; ++probe) {
+        u32 i = (hash + probe) & (alloc_max_sites - 1);
+        alloc_site_stats* site = &this->sites[i];
+        if (site->file == nullptr) {
+            // NOTE(DH): One slot always stays empty, so a lookup that misses stops
+            if (this->site_count == alloc_max_sites - 1) break;
+            site->file = loc.file_name();
+            site->function = loc.function_name();
+            site->line = loc.line();
+            site->column = loc.column();
+            site->kind = kind;
+            this->site_count += 1;
+            return i;
+        }
+        if (site->line == loc.line() && site->column == loc.column() && site->kind == kind && (site->file == loc.file_name() || strcmp(site->file, loc.file_name()) == 0)) {
+            return i;
+        }
+    }
+
+    this->sites[alloc_max_sites].file = "<too many call sites>";
+    this->sites[alloc_max_sites].function = "";
+    return alloc_max_sites;
+}
+
+inline func alloc_tracker::record_alloc(alloc_site loc, alloc_kind kind, usize size) -> u32 {
+    std::lock_guard<std::mutex> guard(this->lock);
+    u32 i = this->find_site(loc, kind);
+    alloc_site_stats* site = &this->sites[i];
+    site->allocs += 1;
+    site->bytes += size;
+    site->histogram[alloc_size_bucket(size)] += 1;
+    if (kind == alloc_kind_arena) return i;
+
+    site->live_bytes += size;
+    site->peak_live_bytes = std::max(site->peak_live_bytes, site->live_bytes);
+    site->frame_allocs += 1;
+
+    this->totals.allocs += 1;
+    this->totals.bytes += size;
+    this->totals.live_bytes += size;
+    this->totals.live_blocks += 1;
+    this->totals.peak_live_bytes = std::max(this->totals.peak_live_bytes, this->totals.live_bytes);
+    this->totals.frame_allocs += 1;
+    this->totals.frame_bytes += size;
+    return i;
+}
+
+// NOTE(DH): The block moves over to the site that grew it, that is the one that decides how big it got
+inline func alloc_tracker::record_realloc(u32 old_site, usize old_size, alloc_site loc, alloc_kind kind, usize size) -> u32 {
+    std::lock_guard<std::mutex> guard(this->lock);
+    this->sites[old_site].live_bytes -= old_size;
+
+    u32 i = this->find_site(loc, kind);
+    alloc_site_stats* site = &this->sites[i];
+    site->reallocs += 1;
+    site->bytes += size;
+    site->histogram[alloc_size_bucket(size)] += 1;
+    site->live_bytes += size;
+    site->peak_live_bytes = std::max(site->peak_live_bytes, site->live_bytes);
+    site->frame_allocs += 1;
+
+    this->totals.reallocs += 1;
+    this->totals.bytes += size;
+    this->totals.live_bytes += size - old_size;
+    this->totals.peak_live_bytes = std::max(this->totals.peak_live_bytes, this->totals.live_bytes);
+    this->totals.frame_allocs += 1;
+    this->totals.frame_bytes += size;
+    return i;
+}
+
+inline func alloc_tracker::record_free(u32 site, usize size) -> void {
+    std::lock_guard<std::mutex> guard(this->lock);
+    this->sites[site].frees += 1;
+    this->sites[site].live_bytes -= size;
+    this->totals.frees += 1;
+    this->totals.live_bytes -= size;
+    this->totals.live_blocks -= 1;
+}
+
+inline func alloc_tracker::next_frame() -> void {
+    std::lock_guard<std::mutex> guard(this->lock);
+    this->totals.clean_frames = this->totals.frame_allocs == 0 ? this->totals.clean_frames + 1 : 0;
+    this->totals.last_frame_allocs = this->totals.frame_allocs;
+    this->totals.last_frame_bytes = this->totals.frame_bytes;
+    this->totals.frame_allocs = 0;
+    this->totals.frame_bytes = 0;
+    this->totals.frame += 1;
+    for (u32 i = 0; i <= alloc_max_sites; ++i) this->sites[i].frame_allocs = 0;
+}
+
+inline func alloc_tracker::get_totals() -> alloc_totals {
+    std::lock_guard<std::mutex> guard(this->lock);
+    return this->totals;
+}
+
+// NOTE(DH): Totals, then the busiest sites by allocation count with the sizes they asked for
+inline func alloc_tracker::report(FILE* out, u32 top_sites) -> void {
+    std::lock_guard<std::mutex> guard(this->lock);
+    alloc_totals t = this->totals;
+    fprintf(out, "allocations: %llu allocs, %llu reallocs, %llu frees, %llu bytes requested\n",
+        (unsigned long long)t.allocs, (unsigned long long)t.reallocs, (unsigned long long)t.frees, (unsigned long long)t.bytes);
+    fprintf(out, "live: %llu bytes in %llu blocks, peak %llu bytes\n",
+        (unsigned long long)t.live_bytes, (unsigned long long)t.live_blocks, (unsigned long long)t.peak_live_bytes);
+    fprintf(out, "frame %llu: %llu allocs (%llu bytes) last frame, %llu frames without one\n",
+        (unsigned long long)t.frame, (unsigned long long)t.last_frame_allocs, (unsigned long long)t.last_frame_bytes, (unsigned long long)t.clean_frames);
+
+    u32 order[alloc_max_sites + 1];
+    u32 count = 0;
+    for (u32 i = 0; i <= alloc_max_sites; ++i) if (this->sites[i].file != nullptr) order[count++] = i;
+    std::sort(order, order + count, [&](u32 a, u32 b) {
+        return this->sites[a].allocs + this->sites[a].reallocs > this->sites[b].allocs + this->sites[b].reallocs;
+    });
+
+    static const char* kind_names[] = {"heap", "arena", "wrapped"};
+    for (u32 n = 0; n < std::min(count, top_sites); ++n) {
+        alloc_site_stats* s = &this->sites[order[n]];
+        fprintf(out, "  %-7s %s:%u (%s)\n", kind_names[s->kind], s->file, s->line, s->function);
+        fprintf(out, "          %llu allocs, %llu reallocs, %llu frees, %llu bytes, live %llu, peak live %llu\n",
+            (unsigned long long)s->allocs, (unsigned long long)s->reallocs, (unsigned long long)s->frees,
+            (unsigned long long)s->bytes, (unsigned long long)s->live_bytes, (unsigned long long)s->peak_live_bytes);
+        fprintf(out, "          sizes:");
+        for (u32 b = 0; b < alloc_histogram_buckets; ++b) {
+            if (s->histogram[b]) fprintf(out, " %llu+:%u", (unsigned long long)1 << b, s->histogram[b]);
+        }
+        fprintf(out, "\n");
+    }
+}
+
+inline func alloc_tracker::reset() -> void {
+    std::lock_guard<std::mutex> guard(this->lock);
+    u64 live_bytes = this->totals.live_bytes;
+    u64 live_blocks = this->totals.live_blocks;
+    u64 frame = this->totals.frame;
+    this->totals = {};
+    this->totals.live_bytes = live_bytes;
+    this->totals.live_blocks = live_blocks;
+    this->totals.peak_live_bytes = live_bytes;
+    this->totals.frame = frame;
+    for (u32 i = 0; i <= alloc_max_sites; ++i) {
+        alloc_site_stats* s = &this->sites[i];
+        s->allocs = s->reallocs = s->frees = s->bytes = s->frame_allocs = 0;
+        s->peak_live_bytes = s->live_bytes;
+        memset(s->histogram, 0, sizeof(s->histogram));
+    }
+}
+
+// NOTE(DH): Header helpers shared by the heap functions and tracking_allocator
+inline func alloc_header_of(void* ptr) -> alloc_header* {
+    return (alloc_header*)((u8*)ptr - sizeof(alloc_header));
+}
+
+inline func alloc_header_write(void* block, usize size, u32 site) -> void* {
+    alloc_header* header = (alloc_header*)block;
+    header->size = size;
+    header->site = site;
+    header->magic = alloc_header_magic;
+    return header + 1;
+}
+
+inline func tracked_malloc(usize size, [[maybe_unused]] alloc_site loc = alloc_site::current()) -> void* {
+#ifdef ALLOC_TRACKING
+    void* block = malloc(sizeof(alloc_header) + size);
+    if (block == nullptr) return nullptr;
+    return alloc_header_write(block, size, global_alloc_tracker.record_alloc(loc, alloc_kind_heap, size));
+#else
+    return malloc(size);
+#endif
+}
+
+inline func tracked_calloc(usize count, usize size, [[maybe_unused]] alloc_site loc = alloc_site::current()) -> void* {
+#ifdef ALLOC_TRACKING
+    void* result = tracked_malloc(count * size, loc);
+    if (result != nullptr) memset(result, 0, count * size);
+    return result;
+#else
+    return calloc(count, size);
+#endif
+}
+
+inline func tracked_realloc(void* ptr, usize size, [[maybe_unused]] alloc_site loc = alloc_site::current()) -> void* {
+#ifdef ALLOC_TRACKING
+    if (ptr == nullptr) return tracked_malloc(size, loc);
+    alloc_header* header = alloc_header_of(ptr);
+    assert(header->magic == alloc_header_magic && "tracked_realloc on a block tracked_malloc didn't make");
+    usize old_size = header->size;
+    u32 old_site = header->site;
+    void* block = realloc(header, sizeof(alloc_header) + size);
+    if (block == nullptr) return nullptr;
+    return alloc_header_write(block, size, global_alloc_tracker.record_realloc(old_site, old_size, loc, alloc_kind_heap, size));
+#else
+    return realloc(ptr, size);
+#endif
+}
+
+inline func tracked_free(void* ptr) -> void {
+#ifdef ALLOC_TRACKING
+    if (ptr == nullptr) return;
+    alloc_header* header = alloc_header_of(ptr);
+    assert(header->magic == alloc_header_magic && "tracked_free on a block tracked_malloc didn't make");
+    header->magic = 0;
+    global_alloc_tracker.record_free(header->site, header->size);
+    free(header);
+#else
+    free(ptr);
+#endif
+}
+
+inline func track_arena_push([[maybe_unused]] usize size, [[maybe_unused]] alloc_site loc) -> void {
+#ifdef ALLOC_TRACKING
+    global_alloc_tracker.record_alloc(loc, alloc_kind_arena, size);
+#endif
+}
+
+// NOTE(DH): Set by allocator::alloc/realloc for the allocator functions, which don't take a call site
+inline thread_local alloc_site alloc_current_site;
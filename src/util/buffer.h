@@ -3,6 +3,8 @@
 #include "types.h"
 #include "alloc.h"
 
+// NOTE(DH): One block, grown by doubling (a realloc copy of everything written so far). Command streams that get
+// big go to chunked_buffer (chunked_buffer.h), which never moves what it has written.
 struct buffer {
     u32       size;
     u32       capacity;
@@ -10,34 +12,34 @@ struct buffer {
     allocator alc;
 };
 
-inline func buffer_create(allocator alc, u32 capacity /* bytes */) -> buffer {
+inline func buffer_create(allocator alc, u32 capacity /* bytes */, alloc_site site = alloc_site::current()) -> buffer {
     capacity = capacity == 0 ? 64 : capacity;
     return {
         .size     = 0,
         .capacity = capacity,
-        .data     = alc.alloc(capacity),
+        .data     = alc.alloc(capacity, site),
         .alc      = alc
     };
 }
 
-inline func buffer_resize(buffer buf, u32 size_needed) -> buffer {
+inline func buffer_resize(buffer buf, u32 size_needed, alloc_site site = alloc_site::current()) -> buffer {
     buf.capacity = inline_code(var sc = buf.capacity; while(sc < size_needed) {sc = sc * 2;}; return sc;);
-    let data     = buf.alc.realloc(buf.data, buf.capacity);
+    let data     = buf.alc.realloc(buf.data, buf.capacity, site);
     buf.data = data;
     return buf;
 }
 
-inline func buffer_write_bytes(buffer buf, u32 size, u8* data) -> buffer {
-    if (buf.size + size > buf.capacity) { buf = buffer_resize(buf, buf.size + size); }
+inline func buffer_write_bytes(buffer buf, u32 size, u8* data, alloc_site site = alloc_site::current()) -> buffer {
+    if (buf.size + size > buf.capacity) { buf = buffer_resize(buf, buf.size + size, site); }
     memcpy(((u8*)buf.data)+buf.size, data, size);
     buf.size += size;
     return buf;
 }
 
 template <typename T>
-inline func buffer_write(buffer buf, T val) -> buffer {
+inline func buffer_write(buffer buf, T val, alloc_site site = alloc_site::current()) -> buffer {
     let size = sizeof (T);
-    if (buf.size + size > buf.capacity) { buf = buffer_resize(buf, buf.size + size); }
+    if (buf.size + size > buf.capacity) { buf = buffer_resize(buf, buf.size + size, site); }
     *(T*)((u8*)buf.data + buf.size) = val;
     buf.size += size;
     return buf;
@@ -0,0 +1,193 @@
+#pragma once
+
+#include "types.h"
+#include "alloc.h"
+
+// NOTE(DH): A byte stream kept as a list of chunks instead of one block. Appending never moves what was written:
+// a write that doesn't fit the last chunk starts a new one, so there is no realloc copy of the whole stream and
+// a pointer into it stays good until reset/destroy. Every write is contiguous (it never straddles two chunks),
+// which is what lets a reader hand out pointers to whole commands in place. A write bigger than chunk_size gets a
+// chunk of its own.
+//
+// reset() keeps the chunks for the next round, so a stream rebuilt every frame stops allocating once it has
+// reached its size. The struct is used through a pointer, unlike buffer.
+//
+// The *_bytes calls and reserve/commit pack bytes with no alignment. write<T>/read<T> pad the stream up to
+// alignof(T) first, so the T* they hand out can be dereferenced; the padding is part of size (and of copy_to),
+// and a stream has to be read back with the same mix of typed and byte calls it was written with.
+struct buffer_chunk {
+    buffer_chunk* next;
+    u32           size;       // NOTE(DH): Committed bytes
+    u32           capacity;
+    u8            data[];
+};
+
+struct chunked_buffer_cursor;
+
+// NOTE(DH): Bytes from p up to the next multiple of align (a power of two)
+static inline func chunked_buffer_padding(const u8* p, u32 align) -> u32 {
+    return (u32)(-(usize)p & (usize)(align - 1));
+}
+
+struct chunked_buffer {
+    allocator     alc;
+    u32           chunk_size;
+    u32           chunk_count;
+    u64           size;       // NOTE(DH): Committed bytes over all chunks
+    buffer_chunk* first;
+    buffer_chunk* last;
+    buffer_chunk* spare;      // NOTE(DH): Chunks reset() took back, reused before allocating
+
+    static inline func create(allocator alc, u32 chunk_size /* bytes */, alloc_site site = alloc_site::current()) -> chunked_buffer {
+        chunked_buffer result = {
+            .alc         = alc,
+            .chunk_size  = chunk_size == 0 ? 4096 : chunk_size,
+            .chunk_count = 0,
+            .size        = 0,
+            .first       = nullptr,
+            .last        = nullptr,
+            .spare       = nullptr,
+        };
+        result.append_chunk(result.chunk_size, site);
+        return result;
+    }
+
+    // NOTE(DH): Contiguous space for size bytes at the end of the stream, nothing is written until commit
+    inline func reserve(u32 size, alloc_site site = alloc_site::current()) -> u8* {
+        if (this->last->capacity - this->last->size < size) this->append_chunk(size, site);
+        return this->last->data + this->last->size;
+    }
+
+    // NOTE(DH): Makes size bytes of the last reserve part of the stream, may be less than was reserved
+    inline func commit(u32 size) -> void {
+        assert(this->last->size + size <= this->last->capacity);
+        this->last->size += size;
+        this->size += size;
+    }
+
+    inline func write_bytes(u32 size, const void* data, alloc_site site = alloc_site::current()) -> u8* {
+        u8* dst = this->reserve(size, site);
+        memcpy(dst, data, size);
+        this->commit(size);
+        return dst;
+    }
+
+    template <typename T>
+    inline func write(T val, alloc_site site = alloc_site::current()) -> T* {
+        u8* dst = this->reserve_aligned(sizeof(T), alignof(T), site);
+        memcpy(dst, &val, sizeof(T));
+        this->commit(sizeof(T));
+        return (T*)dst;
+    }
+
+    inline func begin_read() -> chunked_buffer_cursor;
+
+    // NOTE(DH): Flattens the stream into dst (size bytes), e.g. for an upload that wants one block
+    inline func copy_to(u8* dst) -> void {
+        for (buffer_chunk* c = this->first; c != nullptr; c = c->next) {
+            memcpy(dst, c->data, c->size);
+            dst += c->size;
+        }
+    }
+
+    inline func reset() -> void {
+        // NOTE(DH): Keep the first chunk in place, the rest goes to spare for the following writes
+        if (this->first->next != nullptr) {
+            this->last->next = this->spare;
+            this->spare = this->first->next;
+            this->first->next = nullptr;
+        }
+        for (buffer_chunk* c = this->spare; c != nullptr; c = c->next) c->size = 0;
+        this->first->size = 0;
+        this->last = this->first;
+        this->chunk_count = 1;
+        this->size = 0;
+    }
+
+    inline func destroy() -> void {
+        for (buffer_chunk* c = this->first; c != nullptr;) { buffer_chunk* next = c->next; this->alc.free(c); c = next; }
+        for (buffer_chunk* c = this->spare; c != nullptr;) { buffer_chunk* next = c->next; this->alc.free(c); c = next; }
+        this->first = this->last = this->spare = nullptr;
+        this->chunk_count = 0;
+        this->size = 0;
+    }
+
+private:
+    // NOTE(DH): Like reserve, but first commits padding so the result is aligned. When the padding and size don't
+    // both fit, nothing is padded in the old chunk and the reader skips its end like for any other write
+    inline func reserve_aligned(u32 size, u32 align, alloc_site site) -> u8* {
+        u32 pad = chunked_buffer_padding(this->last->data + this->last->size, align);
+        if (this->last->capacity - this->last->size < pad + size) {
+            this->append_chunk(size + align - 1, site);
+            pad = chunked_buffer_padding(this->last->data, align);
+        }
+        this->commit(pad);
+        return this->last->data + this->last->size;
+    }
+
+    inline func append_chunk(u32 size_needed, alloc_site site) -> void {
+        buffer_chunk* chunk = nullptr;
+        for (buffer_chunk** s = &this->spare; *s != nullptr; s = &(*s)->next) {
+            if ((*s)->capacity >= size_needed) { chunk = *s; *s = chunk->next; break; }
+        }
+        if (chunk == nullptr) {
+            u32 capacity = size_needed > this->chunk_size ? size_needed : this->chunk_size;
+            chunk = (buffer_chunk*)this->alc.alloc(sizeof(buffer_chunk) + capacity, site);
+            chunk->capacity = capacity;
+        }
+        chunk->next = nullptr;
+        chunk->size = 0;
+
+        if (this->last != nullptr) this->last->next = chunk;
+        else this->first = chunk;
+        this->last = chunk;
+        this->chunk_count += 1;
+    }
+};
+
+// NOTE(DH): Sequential reader. Reads hand out pointers into the chunks, nothing is copied; a read has to ask for
+// the same sizes the writes wrote (the command tag says how big the rest is), since the end of a chunk that a
+// write didn't fit in is skipped.
+struct chunked_buffer_cursor {
+    buffer_chunk* chunk;
+    u32           offset;
+
+    inline func at_end() -> bool {
+        this->skip_finished_chunks();
+        return this->chunk == nullptr;
+    }
+
+    inline func peek(u32 size) -> u8* {
+        this->skip_finished_chunks();
+        if (this->chunk == nullptr) return nullptr;
+        assert(this->offset + size <= this->chunk->size);
+        return this->chunk->data + this->offset;
+    }
+
+    inline func read_bytes(u32 size) -> u8* {
+        u8* result = this->peek(size);
+        if (result != nullptr) this->offset += size;
+        return result;
+    }
+
+    // NOTE(DH): Skips the padding write<T> put in front of the value
+    template <typename T>
+    inline func read() -> T* {
+        this->skip_finished_chunks();
+        if (this->chunk == nullptr) return nullptr;
+        this->offset += chunked_buffer_padding(this->chunk->data + this->offset, alignof(T));
+        return (T*)this->read_bytes(sizeof(T));
+    }
+
+private:
+    inline func skip_finished_chunks() -> void {
+        while (this->chunk != nullptr && this->offset == this->chunk->size) {
+            this->chunk = this->chunk->next;
+            this->offset = 0;
+        }
+    }
+};
+
+inline func chunked_buffer::begin_read() -> chunked_buffer_cursor {
+    return {.chunk = this->first, .offset = 0};
+}
@@ -2,151 +2,486 @@
 
 #include "types.h"
 #include "log.h"
+#include "alloc_tracking.h"
+#include <chrono>
 #include <cstdlib>
+#include <cstring>
 
-struct free_list_node {
-    u32 start;
-    u32 end;
-    free_list_node* next;
+// NOTE(DH): Two level segregated fit (TLSF) allocator over one growable byte buffer.
+// Free blocks sit in one list per size class: the first level is the power of two, the second level splits each
+// power of two into 16 linear steps. Two bitmaps say which lists are non empty, so finding a fitting block and
+// freeing one (coalescing with both physical neighbours right away) are a handful of bit scans, no list walks
+// and no heap allocated nodes.
+//
+// Every block starts with two u32s: the block size (a multiple of 8, header included) with two flags in the
+// low bits, and the handle of the block; the data follows at +8 (up to 8 byte aligned types). Free blocks keep
+// their list links after the size and their size again in their last u32, which the next block reads to find
+// the start of a free block in front of it. The last 8 bytes of the buffer are an always used, empty sentinel
+// block, so the last real block has a neighbour to keep its flags in.
+//
+// fl_ptr is a handle, an index into a table of block offsets (0 is never handed out). That is what lets
+// compact() slide live blocks down over the holes between them a few at a time and give the buffer tail back
+// once usage drops: only the table changes, every fl_ptr stays valid. Raw pointers from get_ptr don't survive
+// compact() (nor an alloc that grows the buffer).
+
+struct free_list_stats {
+    u32 capacity;
+    u32 used;               // NOTE(DH): Bytes in used blocks, headers included
+    u32 free_bytes;
+    u32 largest_free;
+    f32 fragmentation;      // NOTE(DH): 1 - largest_free / free_bytes, 0 when all free space is one block
+
+    u64 bytes_moved;
+    u64 blocks_moved;
+    u32 passes;             // NOTE(DH): Compaction passes that reached the end of the buffer
+    u32 shrinks;
+    f64 last_compact_ms;
+    f64 total_compact_ms;
 };
 
 struct free_list_buffer {
     u32 capacity;
-    u32 size;
+    u32 size;   // NOTE(DH): Bytes in used blocks, headers included
     u8* data;
 
-    free_list_node* free_list;
+    u32* handles;           // NOTE(DH): handle -> block offset, free handles chain through as (next << 1) | 1
+    u32  handle_capacity;
+    u32  free_handle;
+
+    u32  initial_capacity;
+    u32  compact_cursor;    // NOTE(DH): Block offset the running compaction pass continues from
+    bool shrink_pending;    // NOTE(DH): A pass finished, the next compact() call gives the tail back
+    f64  copy_ns_per_byte;  // NOTE(DH): Measured cost of moving a byte, what moves and shrinks are budgeted with
+    free_list_stats stats;
+
+    static constexpr u32 sl_log2       = 4;
+    static constexpr u32 sl_count      = 1 << sl_log2;
+    static constexpr u32 small_limit   = sl_count * 8;    // NOTE(DH): Below this the classes are 8 bytes apart
+    static constexpr u32 fl_shift      = 7;               // NOTE(DH): log2(small_limit)
+    static constexpr u32 fl_count      = 32 - fl_shift + 1;
+    static constexpr u32 min_block     = 16;
+    static constexpr u32 sentinel_size = 8;
+    static constexpr u32 invalid       = 0xFFFFFFFF;
+
+    static constexpr u32 block_free      = 1;
+    static constexpr u32 block_prev_free = 2;
+    static constexpr u32 block_flags     = 7;
+
+    u32 fl_bitmap;
+    u32 sl_bitmap[fl_count];
+    u32 heads[fl_count][sl_count];
 
 private:
     template <typename a>
     struct stored_elem {
         u32 size;
+        u32 handle;
         a data;
     };
 
+    struct free_links {
+        u32 header;
+        u32 next;
+        u32 prev;
+    };
+
 public:
     struct fl_ptr {
         u32 offset;
     };
 
-    static inline func create(u32 capacity) -> free_list_buffer {
-        capacity = capacity == 0 ? 64 : capacity;
+    static inline func create(u32 capacity, alloc_site site = alloc_site::current()) -> free_list_buffer {
+        capacity = capacity < 64 ? 64 : (capacity + 7) & ~7u;
 
-        free_list_node* free_list = new free_list_node {.start = 0, .end = capacity, .next = nullptr};
-        // free_list_node* free_list = (free_list_node*)malloc(sizeof(free_list_node));
-        // *free_list = free_list_node {.start = 0, .end = capacity};
+        free_list_buffer result = {};
+        result.capacity = capacity;
+        result.size = 0;
+        result.data = (u8*)tracked_malloc(capacity, site);
+        result.handle_capacity = 64;
+        result.handles = (u32*)tracked_malloc(sizeof(u32) * result.handle_capacity, site);
+        result.free_handle = 0;
+        for (u32 h = result.handle_capacity - 1; h > 0; --h) {
+            result.handles[h] = (result.free_handle << 1) | 1;
+            result.free_handle = h;
+        }
+        result.initial_capacity = capacity;
+        result.compact_cursor = 0;
+        result.shrink_pending = false;
+        result.copy_ns_per_byte = 0.1;    // NOTE(DH): Until the first moves are measured
+        result.stats = {};
+        result.fl_bitmap = 0;
+        for (u32 f = 0; f < fl_count; ++f) {
+            result.sl_bitmap[f] = 0;
+            for (u32 s = 0; s < sl_count; ++s) result.heads[f][s] = invalid;
+        }
 
-        return free_list_buffer {
-            .capacity = capacity,
-            .size = 0,
-            .data = (u8*)malloc(capacity),
-            .free_list = free_list
-        };
+        result.header(capacity - sentinel_size) = 0;
+        result.make_free(0, capacity - sentinel_size);
+        return result;
     }
 
-    inline func alloc_s(u32 size) -> fl_ptr {
-        for (var fl = this->free_list, fl_prev = fl;;) {
-            let fl_size = fl->end - fl->start;
-            let block_size_needed = size + 8;
-            // let block_size_needed = size + sizeof(stored_elem<empty_t>);
-
-            if (fl_size >= block_size_needed) {
-                let offset = fl->start;
-
-                fl->start = fl->start + block_size_needed;
+    inline func destroy() -> void {
+        tracked_free(this->data);
+        tracked_free(this->handles);
+        this->data = nullptr;
+        this->handles = nullptr;
+    }
 
-                if (fl->start == fl->end) {
-                    fl_prev->next = fl->next;
-                }
+    // NOTE(DH): Bytes for the data, the handle comes back as fl_ptr
+    inline func alloc_s(u32 size, alloc_site site = alloc_site::current()) -> fl_ptr {
+        let block_size_needed = block_size_for(size);
 
-                *(stored_elem<empty_t>*)(this->data + offset) = stored_elem<empty_t> {.size = size};
+        var offset = this->find_free(block_size_needed);
+        if (offset == invalid) {
+            this->grow(block_size_needed, site);
+            offset = this->find_free(block_size_needed);
+        }
 
-                return debug_ptr_check_init(fl_ptr {.offset = offset});
-            } else if (fl->next == nullptr) {
-                let offset = fl->start;
+        this->remove_free(offset);
+        let block_size = size_of(offset);
 
-                fl->end = fl->end + this->capacity;
-                this->capacity = this->capacity * 2;
-                this->data = (u8*)realloc(this->data, this->capacity);
+        // NOTE(DH): Split off the tail if it is big enough to be a block on its own
+        if (block_size - block_size_needed >= min_block) {
+            this->header(offset) = block_size_needed | (this->header(offset) & block_prev_free);
+            this->make_free(offset + block_size_needed, block_size - block_size_needed);
+        } else {
+            this->header(offset) &= ~block_free;
+            this->header(offset + block_size) &= ~block_prev_free;
+        }
 
-                fl->start = fl->start + block_size_needed;
+        this->size += size_of(offset);
 
-                if (fl->start == fl->end) {
-                    fl_prev->next = fl->next;
-                }
+        let handle = this->alloc_handle(site);
+        this->handles[handle] = offset;
+        this->header(offset + 4) = handle;
+        return debug_ptr_check_init(fl_ptr {.offset = handle});
+    }
 
-                *(stored_elem<empty_t>*)(this->data + offset) = stored_elem<empty_t> {.size = size};
+    // NOTE(DH): Frees the block at offset start, size is its header (stored_elem size)
+    inline func free_s(u32 start, u32 size) -> void {
+        var offset = start;
+        var block_size = size & ~block_flags;
+        this->size -= block_size;
 
-                return debug_ptr_check_init(fl_ptr {.offset = offset});
-            } else {
-                fl_prev = fl;
-                fl = fl->next;
-                continue;
-            }
+        let next = offset + block_size;
+        if (this->header(next) & block_free) {
+            this->remove_free(next);
+            block_size += size_of(next);
         }
-    }
 
-    inline func free_s(u32 start, u32 size) -> void {
-        let block_size = size + 8;
-        for (free_list_node* fl = this->free_list, *fl_prev = nullptr;;) {
-            if (fl->next != nullptr && fl->end == start && fl->next->start == start + block_size) {
-                fl->end = fl->next->end;
-                fl->next = fl->next->next;
-                delete fl->next;
-            } else if (fl->end == start) {
-                fl->end = fl->end + block_size;
-            } else if (start + block_size == fl->start) {
-                fl->start = start;
-            } else if (fl_prev && start < fl->start) {
-                fl_prev->next = new free_list_node {.start = start, .end = start + block_size, .next = fl};
-            } else if (start < fl->start) {
-                this->free_list = new free_list_node {.start = start, .end = start + block_size, .next = fl};
-                break;
-            } else if (fl_prev && fl->next == nullptr) {
-                fl_prev->next = new free_list_node {.start = start, .end = start + block_size, .next = fl};
-            } else if (fl->next == nullptr) {
-                this->free_list = new free_list_node {.start = start, .end = start + block_size, .next = fl};
-            } else {
-                fl_prev = fl;
-                fl = fl->next;
-            }
+        if (this->header(offset) & block_prev_free) {
+            let prev = offset - this->header(offset - 4);
+            this->remove_free(prev);
+            block_size += size_of(prev);
+            offset = prev;
         }
+
+        this->keep_cursor_on_block(offset, block_size);
+        this->make_free(offset, block_size);
     }
 
     // template <typename a>
     inline func free(fl_ptr offset_ptr) -> void {
-        offset_ptr = debug_ptr_check_elim(offset_ptr);
-        let fl_el = (stored_elem<empty_t>*)(this->data + offset_ptr.offset);
-        this->free_s(offset_ptr.offset, fl_el->size);
+        let handle = debug_ptr_check_elim(offset_ptr).offset;
+        let offset = this->handles[handle];
+        let fl_el = (stored_elem<empty_t>*)(this->data + offset);
+        this->free_s(offset, fl_el->size);
+        this->free_handle_slot(handle);
+    }
+
+    // NOTE(DH): Handle of the element whose data is at ptr (a pointer from get_ptr)
+    inline func ptr_of(void* ptr) -> fl_ptr {
+        return debug_ptr_check_init(fl_ptr {.offset = *(u32*)((u8*)ptr - 4)});
     }
 
     template <typename a>
     inline func write(a val) -> fl_ptr {
         let fl_el = this->alloc_s(sizeof(val));
-        let ptr = (stored_elem<a>*)(this->data + debug_ptr_check_elim(fl_el).offset);
+        let ptr = this->elem<a>(fl_el);
         ptr->data = val;
         return fl_el;
     }
 
     template <typename a>
     inline func load(fl_ptr offset_ptr) -> a {
-        let fl_el = (stored_elem<a>*)(this->data + debug_ptr_check_elim(offset_ptr).offset);
+        let fl_el = this->elem<a>(offset_ptr);
         return fl_el->data;
     }
 
+    // NOTE(DH): Points at the whole payload, not just stored_elem::data: computed from the block start so the
+    // compiler doesn't take sizeof(a) as the bounds of what's behind it (get_ptr<u8> of a 100 byte block)
     template <typename a>
     inline func get_ptr(fl_ptr offset_ptr) -> a* {
-        let fl_el = (stored_elem<a>*)(this->data + debug_ptr_check_elim(offset_ptr).offset);
-        return &fl_el->data;
+        constexpr usize data_offset = (2 * sizeof(u32) + alignof(a) - 1) & ~(usize)(alignof(a) - 1);   // NOTE(DH): offsetof(stored_elem<a>, data)
+        u8* block = (u8*)this->elem<a>(offset_ptr);
+        return (a*)(block + data_offset);
     }
 
     template <typename a>
     inline func update(fl_ptr offset_ptr, auto upd_fn) {
-        let fl_el = (stored_elem<a>*)(this->data + debug_ptr_check_elim(offset_ptr).offset);
+        let fl_el = this->elem<a>(offset_ptr);
         return upd_fn(&fl_el->data);
     }
 
+    // NOTE(DH): Walks every block, for debugging and stats only
+    inline func largest_free_block() -> u32 {
+        u32 largest = 0;
+        for (u32 offset = 0; offset < this->capacity - sentinel_size; offset += size_of(offset)) {
+            if ((this->header(offset) & block_free) && size_of(offset) > largest) largest = size_of(offset);
+        }
+        return largest;
+    }
+
+    inline func get_stats() -> free_list_stats {
+        free_list_stats result = this->stats;
+        result.capacity = this->capacity;
+        result.used = this->size;
+        result.free_bytes = this->capacity - sentinel_size - this->size;
+        result.largest_free = this->largest_free_block();
+        result.fragmentation = result.free_bytes ? 1.0f - (f32)result.largest_free / result.free_bytes : 0.0f;
+        return result;
+    }
+
+    // NOTE(DH): Incremental compaction, call it between frames (no get_ptr pointers held). Each call continues
+    // the running pass: the free block at the cursor swaps places with the used block after it, so holes bubble
+    // up to the end of the buffer and merge there. Before every move the time so far plus what the move is
+    // expected to cost (its size at the measured ns/byte) is checked against budget_ms, only the first block of a
+    // call goes ahead regardless so a block bigger than the budget can't stall the pass. The call after a finished
+    // pass does nothing but shrink(budget_ms), so the tail copy never lands on top of moves.
+    // Returns true when a pass finished (all free space was in one block at the end at that point).
+    inline func compact(f64 budget_ms, alloc_site site = alloc_site::current()) -> bool {
+        let start = std::chrono::high_resolution_clock::now();
+        let budget_ns = budget_ms * 1e6;
+        let end = this->capacity - sentinel_size;
+        bool done = false;
+
+        // NOTE(DH): Also when all free space already is the tail, don't start another pass for nothing
+        if (this->shrink_pending || (this->compact_cursor == 0 && this->tail_free() == end - this->size)) {
+            this->shrink_pending = false;
+            this->shrink(budget_ms, site);
+            done = true;
+        }
+
+        // NOTE(DH): Walking over used blocks is budgeted too, on a big buffer every header can be a cache miss
+        u64 bytes_moved = 0;
+        for (u32 step = 0; !done; ++step) {
+            let cursor = this->compact_cursor;
+            if (cursor >= end) { done = true; break; }
+
+            let elapsed_ns = std::chrono::duration<f64, std::nano>(std::chrono::high_resolution_clock::now() - start).count();
+            if ((this->header(cursor) & block_free) == 0) {
+                if (step > 0 && elapsed_ns > budget_ns) break;
+                this->compact_cursor += size_of(cursor);
+                continue;
+            }
+
+            let hole = size_of(cursor);
+            let next = cursor + hole;
+            if (next >= end) { done = true; break; }
+
+            // NOTE(DH): The block after a free block is always used, free neighbours are merged on free
+            let moved = size_of(next);
+            if (step > 0 && elapsed_ns + moved * this->copy_ns_per_byte > budget_ns) break;
+
+            this->remove_free(cursor);
+            memmove(this->data + cursor, this->data + next, moved);
+            this->header(cursor) &= ~block_prev_free;
+            this->handles[this->header(cursor + 4)] = cursor;
+
+            var free_offset = cursor + moved;
+            var free_size = hole;
+            let after = free_offset + free_size;
+            if (this->header(after) & block_free) {
+                this->remove_free(after);
+                free_size += size_of(after);
+            }
+            this->make_free(free_offset, free_size);
+
+            this->compact_cursor = free_offset;
+            bytes_moved += moved;
+            this->stats.bytes_moved += moved;
+            this->stats.blocks_moved += 1;
+        }
+
+        if (done && this->compact_cursor != 0) {
+            this->compact_cursor = 0;
+            this->stats.passes += 1;
+            this->shrink_pending = true;
+        }
+
+        // NOTE(DH): Everything the loop did counts, clock reads included, so the estimate errs on the slow side
+        let elapsed_ns = std::chrono::duration<f64, std::nano>(std::chrono::high_resolution_clock::now() - start).count();
+        if (bytes_moved >= 4096) this->copy_ns_per_byte = this->copy_ns_per_byte * 0.75 + (elapsed_ns / bytes_moved) * 0.25;
+
+        let ms = elapsed_ns * 1e-6;
+        this->stats.last_compact_ms = ms;
+        this->stats.total_compact_ms += ms;
+        return done;
+    }
+
+    // NOTE(DH): Gives back the free tail when it is more than half the buffer, keeping a quarter of slack. The
+    // realloc may copy everything in front of the tail, when that is expected to take longer than budget_ms the
+    // buffer keeps its size (a loading screen can pass a bigger budget). Returns true when it shrank.
+    inline func shrink(f64 budget_ms, alloc_site site = alloc_site::current()) -> bool {
+        let end = this->capacity - sentinel_size;
+        if ((this->header(end) & block_prev_free) == 0) return false;
+
+        let tail = end - this->header(end - 4);
+        u32 new_capacity = this->capacity;
+        while (new_capacity / 2 >= this->initial_capacity && new_capacity / 2 >= tail + tail / 4 + min_block + sentinel_size) new_capacity /= 2;
+        if (new_capacity == this->capacity) return false;
+        if (tail * this->copy_ns_per_byte > budget_ms * 1e6) return false;
+
+        this->remove_free(tail);
+        this->header(new_capacity - sentinel_size) = 0;
+        this->make_free(tail, new_capacity - sentinel_size - tail);
+        this->data = (u8*)tracked_realloc(this->data, new_capacity, site);
+        this->capacity = new_capacity;
+        this->stats.shrinks += 1;
+        return true;
+    }
+
 private:
+    inline func header(u32 offset) -> u32& { return *(u32*)(this->data + offset); }
+
+    template <typename a>
+    inline func elem(fl_ptr ptr) -> stored_elem<a>* {
+        return (stored_elem<a>*)(this->data + this->handles[debug_ptr_check_elim(ptr).offset]);
+    }
+
+    inline func alloc_handle(alloc_site site) -> u32 {
+        if (this->free_handle == 0) {
+            let old_capacity = this->handle_capacity;
+            this->handle_capacity *= 2;
+            this->handles = (u32*)tracked_realloc(this->handles, sizeof(u32) * this->handle_capacity, site);
+            for (u32 h = this->handle_capacity - 1; h >= old_capacity; --h) {
+                this->handles[h] = (this->free_handle << 1) | 1;
+                this->free_handle = h;
+            }
+        }
+        let handle = this->free_handle;
+        this->free_handle = this->handles[handle] >> 1;
+        return handle;
+    }
+
+    inline func free_handle_slot(u32 handle) -> void {
+        this->handles[handle] = (this->free_handle << 1) | 1;
+        this->free_handle = handle;
+    }
+
+    // NOTE(DH): A merge that swallows the block the compaction cursor sits on moves the cursor to its start
+    inline func keep_cursor_on_block(u32 offset, u32 block_size) -> void {
+        if (this->compact_cursor > offset && this->compact_cursor < offset + block_size) this->compact_cursor = offset;
+    }
+
+    inline func tail_free() -> u32 {
+        let end = this->capacity - sentinel_size;
+        return this->header(end) & block_prev_free ? this->header(end - 4) : 0;
+    }
+
+    inline func links(u32 offset) -> free_links* { return (free_links*)(this->data + offset); }
+    inline func size_of(u32 offset) -> u32 { return this->header(offset) & ~block_flags; }
+
+    static inline func block_size_for(u32 size) -> u32 {
+        // NOTE(DH): 8 byte header in front of the data (4 for the size, up to 4 of alignment padding)
+        u32 block_size = (size + 8 + 7) & ~7u;
+        return block_size < min_block ? min_block : block_size;
+    }
+
+    static inline func mapping(u32 size, u32* fl, u32* sl) -> void {
+        if (size < small_limit) {
+            *fl = 0;
+            *sl = size / 8;
+        } else {
+            u32 log2 = 31 - __builtin_clz(size);
+            *fl = log2 - fl_shift + 1;
+            *sl = (size >> (log2 - sl_log2)) ^ sl_count;
+        }
+    }
+
+    // NOTE(DH): Rounds up to the next class first, so every block in the class that comes out fits
+    inline func find_free(u32 size) -> u32 {
+        if (size >= small_limit) {
+            u32 log2 = 31 - __builtin_clz(size);
+            size += (1u << (log2 - sl_log2)) - 1;
+        }
+        u32 fl, sl;
+        mapping(size, &fl, &sl);
+        if (fl >= fl_count) return invalid;
+
+        u32 sl_map = this->sl_bitmap[fl] & (~0u << sl);
+        if (sl_map == 0) {
+            u32 fl_map = fl + 1 < 32 ? this->fl_bitmap & (~0u << (fl + 1)) : 0;
+            if (fl_map == 0) return invalid;
+            fl = __builtin_ctz(fl_map);
+            sl_map = this->sl_bitmap[fl];
+        }
+        return this->heads[fl][__builtin_ctz(sl_map)];
+    }
+
+    inline func insert_free(u32 offset) -> void {
+        u32 fl, sl;
+        mapping(size_of(offset), &fl, &sl);
+
+        let head = this->heads[fl][sl];
+        links(offset)->next = head;
+        links(offset)->prev = invalid;
+        if (head != invalid) links(head)->prev = offset;
+        this->heads[fl][sl] = offset;
+
+        this->fl_bitmap |= 1u << fl;
+        this->sl_bitmap[fl] |= 1u << sl;
+    }
+
+    inline func remove_free(u32 offset) -> void {
+        u32 fl, sl;
+        mapping(size_of(offset), &fl, &sl);
+
+        let next = links(offset)->next;
+        let prev = links(offset)->prev;
+        if (next != invalid) links(next)->prev = prev;
+        if (prev != invalid) links(prev)->next = next;
+        else                 this->heads[fl][sl] = next;
+
+        if (this->heads[fl][sl] == invalid) {
+            this->sl_bitmap[fl] &= ~(1u << sl);
+            if (this->sl_bitmap[fl] == 0) this->fl_bitmap &= ~(1u << fl);
+        }
+    }
+
+    // NOTE(DH): The block in front is never free here (it would have been coalesced), the one after gets told
+    inline func make_free(u32 offset, u32 block_size) -> void {
+        this->header(offset) = block_size | block_free;
+        this->header(offset + block_size - 4) = block_size;
+        this->header(offset + block_size) |= block_prev_free;
+        this->insert_free(offset);
+    }
+
+    // NOTE(DH): Doubles the buffer (at least enough for the request), the new space joins the last block if free
+    inline func grow(u32 block_size_needed, alloc_site site) -> void {
+        let old_capacity = this->capacity;
+        var new_capacity = old_capacity * 2;
+        while (new_capacity - old_capacity < block_size_needed + min_block) new_capacity *= 2;
+        if (new_capacity <= old_capacity) panic("free_list_buffer: out of 32 bit offsets");
+
+        this->data = (u8*)tracked_realloc(this->data, new_capacity, site);
+        this->capacity = new_capacity;
+
+        var offset = old_capacity - sentinel_size;
+        var block_size = new_capacity - old_capacity;
+        let last_was_free = this->header(offset) & block_prev_free;
+        this->header(new_capacity - sentinel_size) = 0;
+
+        if (last_was_free) {
+            let prev = offset - this->header(offset - 4);
+            this->remove_free(prev);
+            block_size += size_of(prev);
+            offset = prev;
+        }
+        this->keep_cursor_on_block(offset, block_size);
+        this->make_free(offset, block_size);
+    }
+
     constexpr func debug_ptr_check_init(fl_ptr ptr) -> fl_ptr {
         return ptr;
         // #if DEBUG
@@ -172,4 +507,4 @@ using fl_offset = free_list_buffer::fl_ptr;
 
 using fl_offseta = free_list_buffer::fl_ptr;
 
-// TODO: make offset 0 to be reserved for nullptr
\ No newline at end of file
+// TODO: make offset 0 to be reserved for nullptr
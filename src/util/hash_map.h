@@ -0,0 +1,312 @@
+#pragma once
+
+#include "types.h"
+#include "alloc.h"
+#include <bit>
+#include <cassert>
+#include <cstring>
+#include <type_traits>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define HASH_MAP_SSE2 1
+#endif
+
+// NOTE(DH): Flat open addressing hash map, Swiss table style. The table is one control byte per slot: empty,
+// deleted, or the top 7 bits of the key's hash. A lookup loads 16 control bytes at once and compares them all
+// with the hash bits (SSE2), so only slots whose 7 bits match get their key compared, and a group with an empty
+// byte in it ends the search. Groups are probed triangularly (stride 16, 32, 48 ...), which visits every group.
+//
+// Entries (key, value) don't live in the table but in a dense array in insertion order, the table slot holds
+// the index. That makes iteration a linear walk that always comes out in insertion order, no matter how the
+// table was grown or what got erased in between (deterministic for caches and for anything that ends up in a
+// file). An erase leaves a tombstone in the table and a hole in the entries, both go away at the next rebuild:
+// the table is rebuilt (same size when it was mostly tombstones, double otherwise) when it runs out of empty slots, and the
+// entries are compacted keeping their order. The full hash is kept per entry, so a rebuild never rehashes keys.
+//
+// Keys and values are moved with memcpy on a rebuild (like list<T> does on realloc) and pointers returned by
+// find/insert are good until the next insert. All memory comes from the allocator given to create, an arena
+// allocator works (erase never frees anything, the arena gets it back at once).
+//
+// Lookups are heterogeneous: find/erase/contains take any Q that the hasher and the equality accept next to K,
+// e.g. a map keyed by str_key found with a plain const char* without building a key first. A Q has to hash the
+// same as the K it is equal to.
+
+static constexpr u32 hash_map_group_size    = 16;
+static constexpr u32 hash_map_min_capacity  = 16;
+
+static constexpr i8 hash_map_ctrl_empty     = (i8)0x80;
+static constexpr i8 hash_map_ctrl_deleted   = (i8)0xFE;
+
+static constexpr u64 hash_map_dead          = ~0ull;  // NOTE(DH): Hash of an erased entry, no key hashes to it
+
+static inline func hash_mix(u64 x) -> u64 {
+    // NOTE(DH): splitmix64 finalizer, every input bit reaches both the low (position) and top (control) bits
+    x ^= x >> 30; x *= 0xBF58476D1CE4E5B9ull;
+    x ^= x >> 27; x *= 0x94D049BB133111EBull;
+    x ^= x >> 31;
+    return x;
+}
+
+static inline func hash_bytes(const void* data, usize size) -> u64 {
+    const u8* p = (const u8*)data;
+    u64 h = 0x9E3779B97F4A7C15ull ^ size;
+    for (; size >= 8; p += 8, size -= 8) {
+        u64 w; memcpy(&w, p, 8);
+        h = hash_mix(h ^ w);
+    }
+    if (size > 0) {
+        u64 w = 0; memcpy(&w, p, size);
+        h = hash_mix(h ^ w ^ 0xFF51AFD7ED558CCDull);
+    }
+    return h;
+}
+
+// NOTE(DH): Non owning string key, the bytes have to outlive the map (interned, in an arena, a literal)
+struct str_key {
+    const char* data;
+    u32 size;
+
+    static inline func from(const char* c_str) -> str_key { return {c_str, (u32)strlen(c_str)}; }
+};
+
+struct hash_map_hash {
+    // NOTE(DH): Integers, enums, pointers and plain structs without padding (v2i cells) hash their bytes
+    template <typename T>
+    inline func operator()(const T& key) const -> u64 {
+        static_assert(std::has_unique_object_representations_v<T>, "no default hash for this type (padding or floats), pass a hasher");
+        if constexpr (sizeof(T) <= 8) {
+            u64 w = 0; memcpy(&w, &key, sizeof(T));
+            return hash_mix(w);
+        } else {
+            return hash_bytes(&key, sizeof(T));
+        }
+    }
+    inline func operator()(str_key key) const -> u64 { return hash_bytes(key.data, key.size); }
+    inline func operator()(const char* c_str) const -> u64 { return hash_bytes(c_str, strlen(c_str)); }
+};
+
+struct hash_map_eq {
+    template <typename A, typename B>
+    inline func operator()(const A& a, const B& b) const -> bool {
+        if constexpr (std::is_same_v<A, B> && std::has_unique_object_representations_v<A> && !std::is_scalar_v<A>) return memcmp(&a, &b, sizeof(A)) == 0;
+        else return a == b;
+    }
+    inline func operator()(str_key a, str_key b) const -> bool { return a.size == b.size && memcmp(a.data, b.data, a.size) == 0; }
+    inline func operator()(str_key a, const char* b) const -> bool { return strncmp(a.data, b, a.size) == 0 && b[a.size] == 0; }
+};
+
+// NOTE(DH): 16 control bytes, the match functions return one bit per byte
+struct hash_map_group {
+#if HASH_MAP_SSE2
+    __m128i ctrl;
+
+    static inline func load(const i8* p) -> hash_map_group { return {_mm_loadu_si128((const __m128i*)p)}; }
+    inline func match(i8 h2) const -> u32 { return (u32)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(h2), this->ctrl)); }
+    inline func match_empty() const -> u32 { return this->match(hash_map_ctrl_empty); }
+#else
+    i8 ctrl[hash_map_group_size];
+
+    static inline func load(const i8* p) -> hash_map_group { hash_map_group g; memcpy(g.ctrl, p, hash_map_group_size); return g; }
+    inline func match(i8 h2) const -> u32 {
+        u32 result = 0;
+        for (u32 i = 0; i < hash_map_group_size; ++i) result |= (u32)(this->ctrl[i] == h2) << i;
+        return result;
+    }
+    inline func match_empty() const -> u32 { return this->match(hash_map_ctrl_empty); }
+#endif
+};
+
+template <typename K, typename V, typename H = hash_map_hash, typename E = hash_map_eq>
+struct hash_map {
+    struct entry {
+        K key;
+        V value;
+    };
+
+    allocator alc;
+    i8*    ctrl;            // NOTE(DH): capacity + 16 bytes, the last 16 mirror the first 16 so a group load never wraps
+    u32*   slots;           // NOTE(DH): Entry index per table slot
+    entry* entries;
+    u64*   hashes;          // NOTE(DH): Per entry, hash_map_dead for holes
+    u32    capacity;        // NOTE(DH): Table slots, a power of two
+    u32    count;           // NOTE(DH): Live entries
+    u32    entry_count;     // NOTE(DH): Entries including holes
+    u32    growth_left;     // NOTE(DH): Empty slots that may still be filled before the table is rebuilt
+
+    static inline func create(allocator alc, u32 expected_count = 0, alloc_site site = alloc_site::current()) -> hash_map {
+        hash_map result = {};
+        result.alc = alc;
+        result.rebuild(hash_map::capacity_for(expected_count), site);
+        return result;
+    }
+
+    inline func destroy() -> void {
+        this->alc.free(this->ctrl);
+        this->alc.free(this->slots);
+        this->alc.free(this->entries);
+        this->alc.free(this->hashes);
+        *this = {};
+    }
+
+    inline func clear() -> void {
+        memset(this->ctrl, (u8)hash_map_ctrl_empty, this->capacity + hash_map_group_size);
+        this->count = 0;
+        this->entry_count = 0;
+        this->growth_left = hash_map::max_load(this->capacity);
+    }
+
+    inline func reserve(u32 expected_count, alloc_site site = alloc_site::current()) -> void {
+        u32 needed = hash_map::capacity_for(expected_count);
+        if (needed > this->capacity) this->rebuild(needed, site);
+    }
+
+    template <typename Q>
+    inline func find(const Q& key) -> V* {
+        u32 slot = this->find_slot(key, this->hash_of(key));
+        return slot == ~0u ? nullptr : &this->entries[this->slots[slot]].value;
+    }
+
+    template <typename Q>
+    inline func contains(const Q& key) -> bool { return this->find(key) != nullptr; }
+
+    // NOTE(DH): Inserts, or returns the existing value untouched (inserted says which)
+    inline func find_or_insert(K key, V value, bool* inserted = nullptr, alloc_site site = alloc_site::current()) -> V* {
+        u64 hash = this->hash_of(key);
+        u32 slot = this->find_slot(key, hash);
+        if (inserted != nullptr) *inserted = slot == ~0u;
+        if (slot != ~0u) return &this->entries[this->slots[slot]].value;
+
+        if (this->growth_left == 0) {
+            // NOTE(DH): Same size while the live entries fit in 25/32 of it (the rest of max_load is tombstones),
+            // so erase + insert churn at a steady count doesn't keep doubling the table
+            bool fits = (u64)this->count * 32 <= (u64)this->capacity * 25;
+            this->rebuild(fits ? this->capacity : this->capacity * 2, site);
+        }
+
+        u32 index = this->entry_count++;
+        this->entries[index] = entry {key, value};
+        this->hashes[index] = hash;
+        this->place(index, hash);
+        this->count += 1;
+        return &this->entries[index].value;
+    }
+
+    // NOTE(DH): Inserts or overwrites
+    inline func insert(K key, V value, alloc_site site = alloc_site::current()) -> V* {
+        bool inserted;
+        V* result = this->find_or_insert(key, value, &inserted, site);
+        if (!inserted) *result = value;
+        return result;
+    }
+
+    template <typename Q>
+    inline func erase(const Q& key) -> bool {
+        u32 slot = this->find_slot(key, this->hash_of(key));
+        if (slot == ~0u) return false;
+        this->hashes[this->slots[slot]] = hash_map_dead;
+        this->set_ctrl(slot, hash_map_ctrl_deleted);
+        this->count -= 1;
+        return true;
+    }
+
+    // NOTE(DH): f(K* key, V* value) for every entry, in insertion order
+    template <typename F>
+    inline func iter(F f) -> void {
+        for (u32 i = 0; i < this->entry_count; ++i) {
+            if (this->hashes[i] != hash_map_dead) f(&this->entries[i].key, &this->entries[i].value);
+        }
+    }
+
+    template <typename ACC, typename F>
+    inline func fold(ACC acc, F f) -> ACC {
+        this->iter([&](K* key, V* value) { acc = f(acc, key, value); });
+        return acc;
+    }
+
+private:
+    static inline func max_load(u32 capacity) -> u32 { return capacity - capacity / 8; }
+
+    static inline func capacity_for(u32 expected_count) -> u32 {
+        u32 result = hash_map_min_capacity;
+        while (hash_map::max_load(result) < expected_count) result *= 2;
+        return result;
+    }
+
+    template <typename Q>
+    inline func hash_of(const Q& key) const -> u64 {
+        u64 hash = H{}(key);
+        return hash == hash_map_dead ? 0 : hash;
+    }
+
+    static inline func h2_of(u64 hash) -> i8 { return (i8)(hash >> 57); }
+
+    inline func set_ctrl(u32 slot, i8 value) -> void {
+        this->ctrl[slot] = value;
+        this->ctrl[((slot - hash_map_group_size) & (this->capacity - 1)) + hash_map_group_size] = value;
+    }
+
+    template <typename Q>
+    inline func find_slot(const Q& key, u64 hash) const -> u32 {
+        u32 mask = this->capacity - 1;
+        u32 pos = (u32)hash & mask;
+        i8 h2 = hash_map::h2_of(hash);
+        for (u32 stride = hash_map_group_size;; stride += hash_map_group_size) {
+            hash_map_group group = hash_map_group::load(this->ctrl + pos);
+            for (u32 bits = group.match(h2); bits != 0; bits &= bits - 1) {
+                u32 slot = (pos + std::countr_zero(bits)) & mask;
+                if (E{}(this->entries[this->slots[slot]].key, key)) return slot;
+            }
+            if (group.match_empty() != 0) return ~0u;
+            pos = (pos + stride) & mask;
+        }
+    }
+
+    // NOTE(DH): New entries only ever take empty slots, so table slots in use == entry_count and one counter
+    // (growth_left) covers both the tombstones and the holes
+    inline func place(u32 index, u64 hash) -> void {
+        u32 mask = this->capacity - 1;
+        u32 pos = (u32)hash & mask;
+        for (u32 stride = hash_map_group_size;; stride += hash_map_group_size) {
+            u32 empty = hash_map_group::load(this->ctrl + pos).match_empty();
+            if (empty != 0) {
+                u32 slot = (pos + std::countr_zero(empty)) & mask;
+                this->set_ctrl(slot, hash_map::h2_of(hash));
+                this->slots[slot] = index;
+                this->growth_left -= 1;
+                return;
+            }
+            pos = (pos + stride) & mask;
+        }
+    }
+
+    inline func rebuild(u32 new_capacity, alloc_site site) -> void {
+        // NOTE(DH): Squeeze the holes out of the entries, keeping the order
+        u32 live = 0;
+        for (u32 i = 0; i < this->entry_count; ++i) {
+            if (this->hashes[i] == hash_map_dead) continue;
+            if (live != i) {
+                memcpy((void*)&this->entries[live], (void*)&this->entries[i], sizeof(entry));
+                this->hashes[live] = this->hashes[i];
+            }
+            live += 1;
+        }
+        assert(live == this->count);
+
+        if (new_capacity != this->capacity) {
+            u32 entry_capacity = hash_map::max_load(new_capacity);
+            this->alc.free(this->ctrl);
+            this->alc.free(this->slots);
+            this->ctrl = (i8*)this->alc.alloc(new_capacity + hash_map_group_size, site);
+            this->slots = (u32*)this->alc.alloc(sizeof(u32) * new_capacity, site);
+            this->entries = (entry*)this->alc.realloc(this->entries, sizeof(entry) * entry_capacity, site);
+            this->hashes = (u64*)this->alc.realloc(this->hashes, sizeof(u64) * entry_capacity, site);
+            this->capacity = new_capacity;
+        }
+
+        memset(this->ctrl, (u8)hash_map_ctrl_empty, this->capacity + hash_map_group_size);
+        this->entry_count = live;
+        this->growth_left = hash_map::max_load(this->capacity);
+        for (u32 i = 0; i < live; ++i) this->place(i, this->hashes[i]);
+    }
+};
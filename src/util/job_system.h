@@ -0,0 +1,345 @@
+#pragma once
+
+#include "types.h"
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstring>
+#include <new>
+#include <thread>
+
+// NOTE(DH): Work stealing job system. The thread that creates it is worker 0, worker_count - 1 more threads are
+// started. Every worker has a Chase-Lev deque: it pushes and pops its own jobs at the bottom (LIFO, what it just
+// spawned is still in cache), idle workers steal from the top of someone else's (FIFO, the oldest and usually the
+// biggest piece of work). Workers that found nothing for a while sleep on an atomic wait until something is pushed.
+//
+// A job is a function, a 64 byte payload and two counters:
+// - unfinished: 1 for itself plus 1 per child created with it as parent. wait(job) returns once it reaches 0, so a
+//   parent is the handle for a whole tree of work (parallel_for is built that way).
+// - pending: dependencies that haven't finished, plus 1 that run() takes away. A job is pushed when it reaches 0,
+//   so add_dependency(before, after) wired up before both are run makes after start only once before is done
+//   (sim phases, graph evaluation).
+//
+// wait() doesn't block, the waiting thread runs jobs (its own, or stolen) until the one it waits for is done, so
+// the main thread helps instead of sitting idle.
+//
+// Jobs come from a ring of job_pool_size per worker and are reused in order (skipping the unfinished ones), so a
+// handle to a finished job is only good until its worker has created about job_pool_size more. Jobs can only be created and run from the worker threads (the main
+// thread included), not from threads of their own.
+
+static constexpr u32 job_deque_size       = 4096;
+static constexpr u32 job_pool_size        = 4096;
+static constexpr u32 job_max_dependents   = 6;
+static constexpr u32 job_payload_size     = 64;
+static constexpr u32 job_max_workers      = 64;
+
+struct job_system;
+struct job;
+
+using job_fn = void(*)(job_system* js, job* j, void* payload);
+
+struct alignas(64) job {
+    job_fn fn;
+    job* parent;
+    std::atomic<i32> unfinished;
+    std::atomic<i32> pending;
+    std::atomic<u32> dependent_count;
+    job* dependents[job_max_dependents];
+    alignas(16) u8 payload[job_payload_size];
+};
+
+// NOTE(DH): Chase-Lev, the fixed size variant with the C11 orderings of Le, Pop, Cohen and Zappa Nardelli.
+// push and pop only from the owner, steal from anyone.
+struct job_deque {
+    alignas(64) std::atomic<i64> top;
+    alignas(64) std::atomic<i64> bottom;
+    alignas(64) std::atomic<job*> items[job_deque_size];
+
+    inline func push(job* j) -> bool {
+        i64 b = this->bottom.load(std::memory_order_relaxed);
+        i64 t = this->top.load(std::memory_order_acquire);
+        if (b - t >= (i64)job_deque_size) return false;
+        // NOTE(DH): Release on the slot and on bottom instead of the paper's fence, same code on x86 and the
+        // thread sanitizer can see it
+        this->items[b & (job_deque_size - 1)].store(j, std::memory_order_release);
+        this->bottom.store(b + 1, std::memory_order_release);
+        return true;
+    }
+
+    inline func pop() -> job* {
+        i64 b = this->bottom.load(std::memory_order_relaxed) - 1;
+        this->bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        i64 t = this->top.load(std::memory_order_relaxed);
+
+        if (t > b) {
+            this->bottom.store(b + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        job* result = this->items[b & (job_deque_size - 1)].load(std::memory_order_relaxed);
+        if (t == b) {
+            // NOTE(DH): Last one, race the thieves for it
+            if (!this->top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) result = nullptr;
+            this->bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return result;
+    }
+
+    inline func steal() -> job* {
+        i64 t = this->top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        i64 b = this->bottom.load(std::memory_order_acquire);
+        if (t >= b) return nullptr;
+
+        job* result = this->items[t & (job_deque_size - 1)].load(std::memory_order_acquire);
+        if (!this->top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) return nullptr;
+        return result;
+    }
+};
+
+struct job_worker {
+    job_deque deque;
+    job* pool;
+    u32 pool_next;
+    u64 random_state;
+    std::thread thread;
+
+    // NOTE(DH): Only the owning worker writes these, so a relaxed load + store is enough and there is no locked
+    // add; atomic so get_stats() can read them from another thread while the workers run
+    std::atomic<u64> executed;
+    std::atomic<u64> stolen;
+};
+
+struct job_system_stats {
+    u64 executed;
+    u64 stolen;
+    u64 inline_runs;        // NOTE(DH): Jobs run right away because a deque was full
+};
+
+inline thread_local i32 job_worker_index = -1;
+
+struct job_system {
+    u32 worker_count;
+    job_worker* workers;
+    std::atomic<bool> running;
+    std::atomic<u32> work_epoch;
+    std::atomic<u32> sleepers;
+    std::atomic<u64> inline_runs;
+
+    static inline func create(u32 worker_count = 0) -> job_system*;
+    inline func destroy() -> void;
+
+    inline func create_job(job_fn fn, job* parent = nullptr) -> job*;
+    inline func add_dependency(job* before, job* after) -> void;
+    inline func run(job* j) -> void;
+    inline func wait(job* j) -> void;
+    inline func is_done(job* j) -> bool { return j->unfinished.load(std::memory_order_acquire) == 0; }
+
+    // NOTE(DH): 0 .. worker_count - 1 inside a job, for per worker scratch (like fluid_surface's per thread one)
+    static inline func current_worker() -> u32 { return (u32)job_worker_index; }
+
+    // NOTE(DH): A job running f() (copied into the payload, so it has to fit and be trivially copyable)
+    template <typename F>
+    inline func create_lambda_job(F f, job* parent = nullptr) -> job*;
+
+    inline func get_stats() -> job_system_stats;
+
+    // NOTE(DH): Internals, public for the worker threads and parallel_for
+    inline func push(job* j) -> void;
+    inline func find_job() -> job*;
+    inline func execute(job* j) -> void;
+    inline func finish(job* j) -> void;
+    inline func worker_loop(u32 index) -> void;
+};
+
+inline func job_system::create(u32 worker_count) -> job_system* {
+    if (worker_count == 0) worker_count = std::max(1u, std::thread::hardware_concurrency());
+    worker_count = std::min(worker_count, job_max_workers);
+
+    job_system* js = new job_system {};
+    js->worker_count = worker_count;
+    js->workers = new job_worker[worker_count] {};
+    js->running.store(true);
+    for (u32 i = 0; i < worker_count; ++i) {
+        js->workers[i].pool = new job[job_pool_size] {};
+        js->workers[i].random_state = 0x9E3779B97F4A7C15ull * (i + 1);
+    }
+
+    assert(job_worker_index == -1 && "this thread already belongs to a job_system");
+    job_worker_index = 0;
+    for (u32 i = 1; i < worker_count; ++i) js->workers[i].thread = std::thread([js, i]() { js->worker_loop(i); });
+    return js;
+}
+
+inline func job_system::destroy() -> void {
+    this->running.store(false);
+    this->work_epoch.fetch_add(1);
+    this->work_epoch.notify_all();
+    for (u32 i = 1; i < this->worker_count; ++i) this->workers[i].thread.join();
+    for (u32 i = 0; i < this->worker_count; ++i) delete[] this->workers[i].pool;
+    delete[] this->workers;
+    job_worker_index = -1;
+    delete this;
+}
+
+inline func job_system::create_job(job_fn fn, job* parent) -> job* {
+    assert(job_worker_index >= 0 && "jobs are created from worker threads (the main thread is worker 0)");
+    job_worker* worker = &this->workers[job_worker_index];
+    // NOTE(DH): Skip the slots still in use (a parallel_for root outlives thousands of its children)
+    job* j = &worker->pool[worker->pool_next++ & (job_pool_size - 1)];
+    for (u32 tries = 1; j->unfinished.load(std::memory_order_acquire) != 0; ++tries) {
+        assert(tries < job_pool_size && "job pool is full of unfinished jobs");
+        j = &worker->pool[worker->pool_next++ & (job_pool_size - 1)];
+    }
+
+    j->fn = fn;
+    j->parent = parent;
+    j->unfinished.store(1, std::memory_order_relaxed);
+    j->pending.store(1, std::memory_order_relaxed);
+    j->dependent_count.store(0, std::memory_order_relaxed);
+    if (parent != nullptr) parent->unfinished.fetch_add(1, std::memory_order_relaxed);
+    return j;
+}
+
+template <typename F>
+inline func job_system::create_lambda_job(F f, job* parent) -> job* {
+    static_assert(sizeof(F) <= job_payload_size, "job lambda captures too much, capture a pointer instead");
+    static_assert(std::is_trivially_copyable_v<F>, "job lambda has to be trivially copyable");
+    job* j = this->create_job([](job_system*, job*, void* payload) { (*(F*)payload)(); }, parent);
+    new (j->payload) F(f);
+    return j;
+}
+
+inline func job_system::add_dependency(job* before, job* after) -> void {
+    u32 slot = before->dependent_count.fetch_add(1, std::memory_order_relaxed);
+    assert(slot < job_max_dependents && "too many dependents, chain them through an empty job");
+    before->dependents[slot] = after;
+    after->pending.fetch_add(1, std::memory_order_relaxed);
+}
+
+inline func job_system::run(job* j) -> void {
+    if (j->pending.fetch_sub(1, std::memory_order_acq_rel) == 1) this->push(j);
+}
+
+inline func job_system::push(job* j) -> void {
+    if (!this->workers[job_worker_index].deque.push(j)) {
+        this->inline_runs.fetch_add(1, std::memory_order_relaxed);
+        this->execute(j);
+        return;
+    }
+    this->work_epoch.fetch_add(1, std::memory_order_seq_cst);
+    if (this->sleepers.load(std::memory_order_seq_cst) != 0) this->work_epoch.notify_one();
+}
+
+inline func job_system::find_job() -> job* {
+    job_worker* self = &this->workers[job_worker_index];
+    job* j = self->deque.pop();
+    if (j != nullptr) return j;
+
+    // NOTE(DH): Start at a random victim so the thieves spread out
+    u64 r = self->random_state;
+    r ^= r << 13; r ^= r >> 7; r ^= r << 17;
+    self->random_state = r;
+    for (u32 n = 0; n < this->worker_count; ++n) {
+        u32 victim = (u32)((r + n) % this->worker_count);
+        if (victim == (u32)job_worker_index) continue;
+        j = this->workers[victim].deque.steal();
+        if (j != nullptr) { self->stolen.store(self->stolen.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed); return j; }
+    }
+    return nullptr;
+}
+
+inline func job_system::execute(job* j) -> void {
+    j->fn(this, j, j->payload);
+    std::atomic<u64>* executed = &this->workers[job_worker_index].executed;
+    executed->store(executed->load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    this->finish(j);
+}
+
+inline func job_system::finish(job* j) -> void {
+    // NOTE(DH): Read everything out first, once a waiter sees unfinished == 0 the job may be reused
+    job* parent = j->parent;
+    u32 dependent_count = j->dependent_count.load(std::memory_order_relaxed);
+    job* dependents[job_max_dependents];
+    memcpy(dependents, j->dependents, sizeof(job*) * dependent_count);
+    if (j->unfinished.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+
+    for (u32 i = 0; i < dependent_count; ++i) this->run(dependents[i]);
+    if (parent != nullptr) this->finish(parent);
+}
+
+inline func job_system::wait(job* j) -> void {
+    while (!this->is_done(j)) {
+        job* next = this->find_job();
+        if (next != nullptr) this->execute(next);
+        else std::this_thread::yield();
+    }
+}
+
+inline func job_system::worker_loop(u32 index) -> void {
+    job_worker_index = (i32)index;
+    u32 misses = 0;
+    while (this->running.load(std::memory_order_relaxed)) {
+        job* j = this->find_job();
+        if (j != nullptr) { this->execute(j); misses = 0; continue; }
+
+        if (++misses < 64) { std::this_thread::yield(); continue; }
+
+        // NOTE(DH): Announce the sleep, look once more, then wait for the next push
+        this->sleepers.fetch_add(1, std::memory_order_seq_cst);
+        u32 epoch = this->work_epoch.load(std::memory_order_seq_cst);
+        j = this->find_job();
+        if (j == nullptr && this->running.load()) this->work_epoch.wait(epoch);
+        this->sleepers.fetch_sub(1, std::memory_order_seq_cst);
+        if (j != nullptr) this->execute(j);
+        misses = 0;
+    }
+    job_worker_index = -1;
+}
+
+inline func job_system::get_stats() -> job_system_stats {
+    job_system_stats result = {.executed = 0, .stolen = 0, .inline_runs = this->inline_runs.load()};
+    for (u32 i = 0; i < this->worker_count; ++i) {
+        result.executed += this->workers[i].executed.load(std::memory_order_relaxed);
+        result.stolen += this->workers[i].stolen.load(std::memory_order_relaxed);
+    }
+    return result;
+}
+
+// NOTE(DH): Runs f(begin, end) over [begin, end) in ranges of at most grain and waits for all of them (helping).
+// Each job keeps halving its range, handing the upper half to the deque, so idle workers steal big pieces
+// first and the spawning is spread over the workers instead of one thread creating count / grain jobs.
+template <typename F>
+inline func parallel_for(job_system* js, u32 begin, u32 end, u32 grain, F f) -> void {
+    if (begin >= end) return;
+    grain = std::max(grain, 1u);
+    if (end - begin <= grain) { f(begin, end); return; }
+
+    struct range {
+        F* f;
+        job* root;
+        u32 begin;
+        u32 end;
+        u32 grain;
+    };
+    static_assert(sizeof(range) <= job_payload_size);
+
+    job_fn split = [](job_system* js, job* self, void* payload) {
+        range r = *(range*)payload;
+        while (r.end - r.begin > r.grain) {
+            u32 mid = r.begin + (r.end - r.begin) / 2;
+            job* upper = js->create_job(self->fn, r.root);
+            *(range*)upper->payload = range {r.f, r.root, mid, r.end, r.grain};
+            js->run(upper);
+            r.end = mid;
+        }
+        (*r.f)(r.begin, r.end);
+    };
+
+    job* root = js->create_job([](job_system*, job*, void*) {});
+    job* first = js->create_job(split, root);
+    *(range*)first->payload = range {&f, root, begin, end, grain};
+    js->run(first);
+    js->run(root);
+    js->wait(root);
+}
@@ -12,17 +12,17 @@ struct list {
     T* items;
     usize size, capacity;
 
-    static auto create(allocator allocator, usize capacity) -> list<T> {
+    static auto create(allocator allocator, usize capacity, alloc_site site = alloc_site::current()) -> list<T> {
         list<T> n;
-        n.init(allocator, capacity);
+        n.init(allocator, capacity, site);
         return n;
     }
 
-    void init(allocator allocator, usize capacity) {
+    void init(allocator allocator, usize capacity, alloc_site site = alloc_site::current()) {
         this->m_allocator = allocator;
         this->size = 0;
         this->capacity = capacity;
-        this->items = (T*)allocator.alloc(capacity);
+        this->items = (T*)allocator.alloc(sizeof(T) * capacity, site);
     }
 
     //auto at(usize i) const -> const T& {
@@ -30,10 +30,10 @@ struct list {
     //    return this->start_ptr[i];
     //}
 
-    void push(T item) {
+    void push(T item, alloc_site site = alloc_site::current()) {
         if (this->size == this->capacity) {
-            auto new_capacity = this->size*2;
-            this->items = (T*)this->m_allocator.realloc(this->items, new_capacity);
+            auto new_capacity = this->size == 0 ? 4 : this->size*2;
+            this->items = (T*)this->m_allocator.realloc(this->items, sizeof(T) * new_capacity, site);
             // TODO: check error
             this->capacity = new_capacity;
         }
@@ -51,18 +51,18 @@ struct list {
         }
     }
 
-    void resize(usize new_size) {
+    void resize(usize new_size, alloc_site site = alloc_site::current()) {
         if (new_size > this->capacity) {
-            this->items = this->m_allocator.realloc(this->items, new_size);
+            this->items = (T*)this->m_allocator.realloc(this->items, sizeof(T) * new_size, site);
             // TODO: check error
             this->capacity = new_size;
         }
         this->size = new_size;
     }
 
-    void reserve(usize new_size) {
+    void reserve(usize new_size, alloc_site site = alloc_site::current()) {
         if (new_size > this->capacity) {
-            this->items = this->m_allocator.realloc(this->items, new_size);
+            this->items = (T*)this->m_allocator.realloc(this->items, sizeof(T) * new_size, site);
             // TODO: check error
             this->capacity = new_size;
         }
@@ -74,6 +74,7 @@ struct list {
 };
 
 
+// NOTE(DH): Superseded by hash_map (util/hash_map.h), keyed by str_key
 //template<typename T>
 //struct dict {
 //    list<str_view>  keys;
@@ -1,8 +1,11 @@
 #pragma once
 #include "types.h"
+#include "alloc_tracking.h"
 #include <cassert>
 #include <cstddef>
 #include <cstdlib>
+#include <cstring>
+#include <numeric>
 
 #define Kilobytes(Value) ((Value)*1024LL)
 #define Megabytes(Value) (Kilobytes(Value)*1024LL)
@@ -12,6 +15,11 @@
 void* allocate_memory(void* base, size_t size);
 inline usize default_arena_alignment(void);
 
+struct memory_arena;
+inline usize get_alignment_offset(memory_arena *arena, usize alignment);
+inline usize get_data_alignment_offset(memory_arena *arena, usize data_offset, usize alignment);
+inline usize get_effective_size_for(memory_arena *arena, usize size_init, usize alignment);
+
 struct uni_p {
 	
 };
@@ -35,44 +43,64 @@ struct stored_elem {
 	T data;
 };
 
+static constexpr usize arena_simd_alignment = 32;		// NOTE(DH): One AVX register
+static constexpr usize arena_cache_line_alignment = 64;
+
+// NOTE(DH): Structure of arrays in the arena. Every component array starts on the alignment and has the same
+// capacity, rounded up so capacity * sizeof(component) is a whole number of alignment sized blocks for all of
+// them. A SIMD loop can always run in full registers up to the padded capacity without a scalar tail.
+template<typename... T>
+struct arena_soa {
+	u32 capacity;
+	u32 count;
+	tuple<arena_array<T>...> components;
+};
+
+template<typename... T>
+constexpr func arena_soa_padded_count(usize count, usize alignment) -> usize {
+	usize step = 1;
+	((step = std::lcm(step, alignment / std::gcd(alignment, sizeof(T)))), ...);
+	return (count + step - 1) / step * step;
+}
+
 struct memory_arena
 {
     usize size;
     u8 *base;
     usize used;
     u32 temp_count;
+    usize high_water; // NOTE(DH): Largest used seen when temporary memory or a frame rolled back
 
 private:
+	// NOTE(DH): The u32 header sits in front of the data, so it is the data (not the header) that gets aligned.
+	// The header is what stays at ptr.offset, so get_array/load_by_idx don't care about the alignment at all.
 	template<typename T>
-	inline func mem_alloc_aligned(memory_arena *arena) -> arena_ptr<T>
+	inline func mem_alloc_aligned(memory_arena *arena, usize count, usize alignment, alloc_site site) -> arena_ptr<T>
 	{ 
-		usize size = get_effective_size_for(arena, sizeof(stored_elem<T>), default_arena_alignment());
+		alignment = alignment < alignof(T) ? alignof(T) : alignment;
+		usize data_offset = offsetof(stored_elem<T>, data);
+		usize memory_size = data_offset + sizeof(T) * count;
+		usize alignment_offset = get_data_alignment_offset(arena, data_offset, alignment);
+		usize size = memory_size + alignment_offset;
 		
 		assert((arena->used + size) <= arena->size);
+		track_arena_push(size, site);
 		
-		usize alignment_offset = get_alignment_offset(arena, default_arena_alignment());
-
 		arena_ptr<T> result = {.offset = (u32)(arena->used + alignment_offset)}; // TODO(DH): Get rid of this ugly convertion, please!!!
 		arena->used += size;
-		
-		assert(size >= sizeof(T));
 		return result;
 	}
 
 	template<typename T>
-	inline func mem_alloc_aligned(memory_arena *arena, usize count) -> arena_ptr<T>
+	inline func mem_alloc_aligned(memory_arena *arena, alloc_site site) -> arena_ptr<T>
 	{ 
-		usize memory_size = (sizeof(T) * count) + sizeof(stored_elem<T>::reserved);
-		usize size = get_effective_size_for(arena, memory_size, default_arena_alignment());
-		
-		assert((arena->used + size) <= arena->size);
-		
-		usize alignment_offset = get_alignment_offset(arena, default_arena_alignment());
-		arena_ptr<T> result = {.offset = (u32)(arena->used + alignment_offset)}; // TODO(DH): Get rid of this ugly convertion, please!!!
-		arena->used += size;
-		
-		assert(size >= memory_size);
-		return result;
+		return mem_alloc_aligned<T>(arena, 1, default_arena_alignment(), site);
+	}
+
+	template<typename T>
+	inline func mem_alloc_aligned(memory_arena *arena, usize count, alloc_site site) -> arena_ptr<T>
+	{ 
+		return mem_alloc_aligned<T>(arena, count, default_arena_alignment(), site);
 	}
 
 public:
@@ -83,32 +111,44 @@ public:
 	}
 
 	template<typename T>
-	inline func push_array(T* data_to_copy, usize count) -> arena_array<T> {
-		arena_array array = {.capacity = (u32)count, .count = count, .ptr = mem_alloc_aligned<T>(this, count)};
+	inline func push_array(T* data_to_copy, usize count, usize alignment = default_arena_alignment(), alloc_site site = alloc_site::current()) -> arena_array<T> {
+		arena_array array = {.capacity = (u32)count, .count = (u32)count, .ptr = mem_alloc_aligned<T>(this, count, alignment, site)};
 		stored_elem<T> *elem = (stored_elem<T>*)(this->base + array.ptr.offset);
 		memcpy((T*)&elem->data, data_to_copy, sizeof(T) * count);
 		return array;
 	}
 
 	template<typename T>
-	inline func write(T data_to_copy) -> arena_ptr<T> {
-		arena_ptr ptr = mem_alloc_aligned<T>(this);
+	inline func write(T data_to_copy, alloc_site site = alloc_site::current()) -> arena_ptr<T> {
+		arena_ptr ptr = mem_alloc_aligned<T>(this, site);
 		stored_elem<T> *elem = (stored_elem<T>*)(this->base + ptr.offset);
 		elem->data = data_to_copy;
 		return ptr;
 	}
 
 	template<typename T>
-	inline func push_data(T data) -> arena_ptr<T> {
-		arena_ptr ptr = mem_alloc_aligned<T>(this);
+	inline func push_data(T data, alloc_site site = alloc_site::current()) -> arena_ptr<T> {
+		arena_ptr ptr = mem_alloc_aligned<T>(this, site);
 		stored_elem<T> *elem = (stored_elem<T>*)(this->base + ptr.offset);
 		elem->data = data;
 		return ptr;
 	}
 
 	template<typename T>
-	inline func alloc_array(usize count) -> arena_array<T> {
-		return {.capacity = (u32)count, .count = 0, .ptr = mem_alloc_aligned<T>(this, count)};
+	inline func alloc_array(usize count, usize alignment = default_arena_alignment(), alloc_site site = alloc_site::current()) -> arena_array<T> {
+		return {.capacity = (u32)count, .count = 0, .ptr = mem_alloc_aligned<T>(this, count, alignment, site)};
+	}
+
+	// NOTE(DH): One array per component, each aligned and padded (see arena_soa)
+	template<typename... T>
+	inline func alloc_soa(usize count, usize alignment = arena_simd_alignment, alloc_site site = alloc_site::current()) -> arena_soa<T...> {
+		u32 capacity = (u32)arena_soa_padded_count<T...>(count, alignment);
+		return {.capacity = capacity, .count = 0, .components = {alloc_array<T>(capacity, alignment, site)...}};
+	}
+
+	template<u32 component, typename... T>
+	inline func get_soa(arena_soa<T...> soa) {
+		return get_array(std::get<component>(soa.components));
 	}
 
 	template<typename T>
@@ -159,6 +199,57 @@ struct temporary_memory
     usize used;
 };
 
+inline temporary_memory
+begin_temporary_memory(memory_arena *arena)
+{
+	temporary_memory result = {.arena = arena, .used = arena->used};
+	++arena->temp_count;
+	return(result);
+}
+
+inline void
+end_temporary_memory(temporary_memory temp)
+{
+	memory_arena *arena = temp.arena;
+	assert(arena->used >= temp.used);
+	assert(arena->temp_count > 0);
+	arena->high_water = arena->used > arena->high_water ? arena->used : arena->high_water;
+	arena->used = temp.used;
+	--arena->temp_count;
+}
+
+// NOTE(DH): Everything allocated from the arena while this is alive is gone when it goes out of scope.
+// Scopes nest, they have to end in reverse order (which C++ scoping gives for free).
+struct temporary_memory_scope
+{
+	temporary_memory temp;
+
+	temporary_memory_scope(memory_arena *arena) : temp(begin_temporary_memory(arena)) {}
+	~temporary_memory_scope() { end_temporary_memory(temp); }
+
+	temporary_memory_scope(const temporary_memory_scope&) = delete;
+	temporary_memory_scope& operator=(const temporary_memory_scope&) = delete;
+};
+
+struct frame_arena_stats
+{
+	u64 frame;
+	usize last_frame_peak;	// NOTE(DH): Peak of the frame that just ended, temporary scopes included
+	usize peak;				// NOTE(DH): Peak over all frames so far
+	u64 peak_frame;
+};
+
+// NOTE(DH): Scratch memory that only lives until the end of the frame. Nothing in it may be kept across
+// move_to_next_frame, which resets it; everything that has to survive goes to the persistent arena.
+struct frame_arena
+{
+	memory_arena arena;
+	frame_arena_stats stats;
+
+	static inline func create(usize size, alloc_site site = alloc_site::current()) -> frame_arena;
+	inline func next_frame() -> void;
+};
+
 inline usize
 default_arena_alignment(void)
 {
@@ -167,17 +258,39 @@ default_arena_alignment(void)
 }
 
 inline memory_arena
-initialize_arena(usize size)
+initialize_arena(usize size, [[maybe_unused]] alloc_site site = alloc_site::current())
 {
 	memory_arena result = {};
     result.size = size;
     result.base = (u8 *)allocate_memory(0, size);
+#ifdef ALLOC_TRACKING
+	global_alloc_tracker.record_alloc(site, alloc_kind_heap, size); // NOTE(DH): Arenas live until exit, never freed
+#endif
     result.used = 0;
     result.temp_count = 0;
+    result.high_water = 0;
+
+	return result;
+}
 
+inline func frame_arena::create(usize size, alloc_site site) -> frame_arena {
+	frame_arena result = {};
+	result.arena = initialize_arena(size, site);
 	return result;
 }
 
+inline func frame_arena::next_frame() -> void {
+	assert(arena.temp_count == 0); // NOTE(DH): A temporary scope is still open across the frame boundary
+
+	usize frame_peak = arena.used > arena.high_water ? arena.used : arena.high_water;
+	stats.last_frame_peak = frame_peak;
+	if(frame_peak > stats.peak) { stats.peak = frame_peak; stats.peak_frame = stats.frame; }
+	++stats.frame;
+
+	arena.used = 0;
+	arena.high_water = 0;
+}
+
 inline usize
 get_alignment_offset(memory_arena *arena,  usize alignment)
 {
@@ -191,6 +304,20 @@ get_alignment_offset(memory_arena *arena,  usize alignment)
 	return(alignment_offset);
 }
 
+// NOTE(DH): Padding to put in front of a block so that the byte data_offset into it lands on the alignment
+inline usize
+get_data_alignment_offset(memory_arena *arena, usize data_offset, usize alignment)
+{
+	usize alignment_offset = 0;
+	usize data_pointer = (usize)arena->base + arena->used + data_offset;
+	usize alignment_mask = alignment - 1;
+	if(data_pointer & alignment_mask)
+	{
+		alignment_offset = alignment - (data_pointer & alignment_mask);
+	}
+	return(alignment_offset);
+}
+
 inline usize
 get_arena_size_remaining(memory_arena *arena, usize alignment)
 {
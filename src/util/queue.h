@@ -0,0 +1,267 @@
+#pragma once
+
+#include "types.h"
+#include "alloc.h"
+#include <atomic>
+#include <new>
+#include <thread>
+#include <type_traits>
+
+// NOTE(DH): Bounded lock-free ring queues for handing things between threads (sim -> render, capture -> writer,
+// log producers -> log consumer). Capacity is rounded up to a power of two and never grows, a full queue refuses
+// the push. Items are copied in and out, so they have to be trivially copyable (push an index or a pointer for
+// anything bigger).
+//
+// spsc_queue: one producer thread, one consumer thread. Each side keeps a copy of the other side's index on its
+// own cache line and only reloads the shared one when the copy says full/empty, so in the steady state a push or
+// pop touches no line the other thread writes.
+//
+// mpsc_queue: any number of producers, one consumer. Producers claim slots with a CAS on head, then publish each
+// slot through its sequence number, so a slow producer only holds up the consumer at its own slot.
+//
+// Both have push_n/pop_n that move as many items as fit with one index update, and push_wait/pop_wait that
+// sleep on std::atomic wait (a futex on linux, WaitOnAddress on windows) when the queue is full/empty. Waking
+// costs the other side a fence and a load per push/pop, so it is only paid for when the queue was created with
+// blocking = true; pop_wait/push_wait on a non blocking queue spin and yield instead.
+
+static constexpr u32 queue_cache_line = 64;
+static constexpr u32 queue_spin_count = 64;       // NOTE(DH): Tries before a *_wait goes to sleep
+
+static inline func queue_round_capacity(u32 capacity) -> u32 {
+    u32 result = 2;
+    while (result < capacity) result <<= 1;
+    return result;
+}
+
+// NOTE(DH): Retries try_once() until it succeeds, sleeping on index (which the other side bumps) once spinning didn't help
+template <typename F>
+static inline func queue_wait_until(bool blocking, std::atomic<u32>* waiting, std::atomic<u32>* index, F try_once) -> void {
+    for (u32 spin = 0;; ++spin) {
+        if (try_once()) return;
+        if (!blocking || spin < queue_spin_count) { std::this_thread::yield(); continue; }
+
+        u32 seen = index->load(std::memory_order_relaxed);
+        waiting->fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        bool done = try_once();
+        if (!done) index->wait(seen, std::memory_order_acquire);
+        waiting->fetch_sub(1, std::memory_order_relaxed);
+        if (done) return;
+    }
+}
+
+template <typename T>
+struct spsc_queue {
+    static_assert(std::is_trivially_copyable_v<T>, "queue items are copied with memcpy semantics");
+
+    // NOTE(DH): Producer line. The waiting flags sit with the side that checks them on every push/pop, the
+    // side that sets them only does so before it sleeps
+    alignas(queue_cache_line) std::atomic<u32> head;
+    u32 cached_tail;
+    std::atomic<u32> consumer_waiting;
+
+    // NOTE(DH): Consumer line
+    alignas(queue_cache_line) std::atomic<u32> tail;
+    u32 cached_head;
+    std::atomic<u32> producer_waiting;
+
+    // NOTE(DH): Read only after create
+    alignas(queue_cache_line) u32 mask;
+    bool blocking;
+    T* items;
+    allocator alc;
+
+    static inline func create(allocator alc, u32 capacity, bool blocking = false, alloc_site site = alloc_site::current()) -> spsc_queue* {
+        spsc_queue* q = new (alc.alloc(sizeof(spsc_queue), site)) spsc_queue {};
+        q->mask = queue_round_capacity(capacity) - 1;
+        q->blocking = blocking;
+        q->items = (T*)alc.alloc(sizeof(T) * (q->mask + 1), site);
+        q->alc = alc;
+        return q;
+    }
+
+    inline func destroy() -> void {
+        allocator a = this->alc;
+        a.free(this->items);
+        this->~spsc_queue();
+        a.free(this);
+    }
+
+    inline func capacity() -> u32 { return this->mask + 1; }
+
+    // NOTE(DH): Exact only from one of the two threads while the other one is idle, a hint otherwise
+    inline func size() -> u32 {
+        return this->head.load(std::memory_order_acquire) - this->tail.load(std::memory_order_acquire);
+    }
+
+    // NOTE(DH): Producer side
+    inline func push(T item) -> bool {
+        return this->push_n(&item, 1) == 1;
+    }
+
+    inline func push_n(const T* src, u32 count) -> u32 {
+        u32 h = this->head.load(std::memory_order_relaxed);
+        u32 space = this->capacity() - (h - this->cached_tail);
+        if (space < count) {
+            this->cached_tail = this->tail.load(std::memory_order_acquire);
+            space = this->capacity() - (h - this->cached_tail);
+        }
+        count = count < space ? count : space;
+        if (count == 0) return 0;
+
+        for (u32 i = 0; i < count; ++i) this->items[(h + i) & this->mask] = src[i];
+        this->head.store(h + count, std::memory_order_release);
+        if (this->blocking) this->wake(&this->consumer_waiting, &this->head);
+        return count;
+    }
+
+    inline func push_wait(T item) -> void {
+        queue_wait_until(this->blocking, &this->producer_waiting, &this->tail, [&]() { return this->push(item); });
+    }
+
+    // NOTE(DH): Consumer side
+    inline func pop(T* item) -> bool {
+        return this->pop_n(item, 1) == 1;
+    }
+
+    inline func pop_n(T* dst, u32 max_count) -> u32 {
+        u32 t = this->tail.load(std::memory_order_relaxed);
+        u32 available = this->cached_head - t;
+        if (available < max_count) {
+            this->cached_head = this->head.load(std::memory_order_acquire);
+            available = this->cached_head - t;
+        }
+        u32 count = max_count < available ? max_count : available;
+        if (count == 0) return 0;
+
+        for (u32 i = 0; i < count; ++i) dst[i] = this->items[(t + i) & this->mask];
+        this->tail.store(t + count, std::memory_order_release);
+        if (this->blocking) this->wake(&this->producer_waiting, &this->tail);
+        return count;
+    }
+
+    inline func pop_wait(T* item) -> void {
+        queue_wait_until(this->blocking, &this->consumer_waiting, &this->head, [&]() { return this->pop(item); });
+    }
+
+private:
+    // NOTE(DH): The fence pairs with the one in queue_wait_until: either the waiter sees our index change or
+    // we see its flag
+    static inline func wake(std::atomic<u32>* waiting, std::atomic<u32>* index) -> void {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiting->load(std::memory_order_relaxed) != 0) index->notify_all();
+    }
+};
+
+template <typename T>
+struct mpsc_queue {
+    static_assert(std::is_trivially_copyable_v<T>, "queue items are copied with memcpy semantics");
+
+    // NOTE(DH): Slot i holds position p when sequence == p + 1, anything else means not written yet
+    struct cell {
+        std::atomic<u32> sequence;
+        T value;
+    };
+
+    // NOTE(DH): Producers line (waiting flags placed like in spsc_queue)
+    alignas(queue_cache_line) std::atomic<u32> head;
+    std::atomic<u32> consumer_waiting;
+
+    // NOTE(DH): Consumer line
+    alignas(queue_cache_line) std::atomic<u32> tail;
+    std::atomic<u32> producers_waiting;
+
+    alignas(queue_cache_line) u32 mask;
+    bool blocking;
+    cell* cells;
+    allocator alc;
+
+    static inline func create(allocator alc, u32 capacity, bool blocking = false, alloc_site site = alloc_site::current()) -> mpsc_queue* {
+        mpsc_queue* q = new (alc.alloc(sizeof(mpsc_queue), site)) mpsc_queue {};
+        q->mask = queue_round_capacity(capacity) - 1;
+        q->blocking = blocking;
+        q->cells = (cell*)alc.alloc(sizeof(cell) * (q->mask + 1), site);
+        for (u32 i = 0; i <= q->mask; ++i) new (&q->cells[i].sequence) std::atomic<u32>(0);
+        q->alc = alc;
+        return q;
+    }
+
+    inline func destroy() -> void {
+        allocator a = this->alc;
+        a.free(this->cells);
+        this->~mpsc_queue();
+        a.free(this);
+    }
+
+    inline func capacity() -> u32 { return this->mask + 1; }
+
+    inline func size() -> u32 {
+        return this->head.load(std::memory_order_acquire) - this->tail.load(std::memory_order_acquire);
+    }
+
+    // NOTE(DH): Producer side, from any thread
+    inline func push(T item) -> bool {
+        return this->push_n(&item, 1) == 1;
+    }
+
+    // NOTE(DH): Claims a run of slots with one CAS, so a batch comes out in order and not interleaved with
+    // other producers' items
+    inline func push_n(const T* src, u32 count) -> u32 {
+        u32 h = this->head.load(std::memory_order_relaxed);
+        u32 claimed;
+        do {
+            u32 space = this->capacity() - (h - this->tail.load(std::memory_order_acquire));
+            claimed = count < space ? count : space;
+            if (claimed == 0) return 0;
+        } while (!this->head.compare_exchange_weak(h, h + claimed, std::memory_order_relaxed, std::memory_order_relaxed));
+
+        for (u32 i = 0; i < claimed; ++i) {
+            cell* c = &this->cells[(h + i) & this->mask];
+            c->value = src[i];
+            c->sequence.store(h + i + 1, std::memory_order_release);
+        }
+        if (this->blocking) {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            // NOTE(DH): The consumer sleeps on whichever slot is next for it, that may be any one of ours
+            if (this->consumer_waiting.load(std::memory_order_relaxed) != 0) {
+                for (u32 i = 0; i < claimed; ++i) this->cells[(h + i) & this->mask].sequence.notify_all();
+            }
+        }
+        return claimed;
+    }
+
+    inline func push_wait(T item) -> void {
+        queue_wait_until(this->blocking, &this->producers_waiting, &this->tail, [&]() { return this->push(item); });
+    }
+
+    // NOTE(DH): Consumer side
+    inline func pop(T* item) -> bool {
+        return this->pop_n(item, 1) == 1;
+    }
+
+    // NOTE(DH): Stops at the first slot that isn't published yet, even if later ones are
+    inline func pop_n(T* dst, u32 max_count) -> u32 {
+        u32 t = this->tail.load(std::memory_order_relaxed);
+        u32 count = 0;
+        while (count < max_count) {
+            cell* c = &this->cells[(t + count) & this->mask];
+            if (c->sequence.load(std::memory_order_acquire) != t + count + 1) break;
+            dst[count] = c->value;
+            count += 1;
+        }
+        if (count == 0) return 0;
+
+        this->tail.store(t + count, std::memory_order_release);
+        if (this->blocking) {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (this->producers_waiting.load(std::memory_order_relaxed) != 0) this->tail.notify_all();
+        }
+        return count;
+    }
+
+    // NOTE(DH): Sleeps on the sequence of the next slot, that is what the producer that fills it bumps
+    inline func pop_wait(T* item) -> void {
+        std::atomic<u32>* next = &this->cells[this->tail.load(std::memory_order_relaxed) & this->mask].sequence;
+        queue_wait_until(this->blocking, &this->consumer_waiting, next, [&]() { return this->pop(item); });
+    }
+};
@@ -1,172 +1,334 @@
 #pragma once
 #include "types.h"
+#include "alloc_tracking.h"
 #include <algorithm>
+#include <bit>
+#include <cassert>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 
 template <typename A, typename B>
 using fn1 = B(*)(A);
 template <typename A, typename B, typename C>
 using fn2 = C(*)(A, B);
 
-template <typename A>
+// NOTE(DH): slab_sparse keeps every value in its slot, so pointers stay put until the value is removed.
+// slab_dense packs the live values into one array (remove moves the last value into the hole), iteration is a
+// plain loop over values()/count that vectorizes; the handles stay stable, the pointers don't.
+enum slab_layout {
+    slab_sparse = 0,
+    slab_dense,
+};
+
+// NOTE(DH): Which slots are live is a bitset (one bit per slot) plus a summary bitset (one bit per non empty
+// word of it). Iteration jumps between live slots with countr_zero, so it costs the live count plus
+// high water / 4096 words, not a test per slot up to the high water mark.
+//
+// Handles carry the generation of their slot, remove bumps it, so a handle kept past a remove never reaches
+// whatever reuses the slot (get_ptr asserts, try_get_ptr returns nullptr). Generation 0 is never live, a zeroed
+// ptr {} is a null handle.
+//
+// Draw order is a doubly linked list through z_prev/z_next (bottom to top): push puts the value on top, raise and
+// remove unlink in O(1), iter_in_order walks it bottom to top touching only live slots.
+template <typename A, slab_layout layout = slab_sparse>
 struct slab_array {
+    static constexpr u32 invalid = 0xFFFFFFFF;
+
     u32 capacity;
-    u32 first_free_slot_idx;
-    u32 max_used_slot_idx; // TODO
-    void* data;
+    u32 first_free_slot_idx;    // NOTE(DH): Head of the chain of removed slots, invalid when empty
+    u32 max_used_slot_idx;      // NOTE(DH): Slots above it were never used
+    u32 count;
+    void* data;                 // NOTE(DH): slot_t[capacity] when sparse, A[capacity] packed when dense
+
+    u64* occupancy;
+    u64* summary;
+
+    u32* slot_to_dense;         // NOTE(DH): Dense only. For free slots it holds the next free slot instead
+    u32* dense_to_slot;
+
+    u32* generations;
 
 	// NOTE(DH): Its needed for rendering selected nodes/connections on top
-	u32 *iter_order;
+    u32  z_bottom;
+    u32  z_top;
+    u32* z_prev;
+    u32* z_next;
 
-    struct ptr {u32 idx;};
+    struct ptr {u32 idx; u32 gen;};
 
-    struct slot_t {
-        union {
-            A val;
-            u32 next_free_slot_idx;
-        } data;
-        bool in_use;
+    union slot_t {
+        A val;
+        u32 next_free_slot_idx;
     };
 
-    static func create(u32 slot_count) -> slab_array<A> {
+    static func create(u32 slot_count, alloc_site site = alloc_site::current()) -> slab_array<A, layout> {
         // static_assert(sizeof(A) >= sizeof(u32));
-        return slab_array<A> {.capacity = slot_count, .first_free_slot_idx = 0, .max_used_slot_idx = 0, .data = calloc(sizeof(slot_t), slot_count), .iter_order = (u32*)calloc(sizeof(u32), slot_count)};
+        slot_count = std::max(slot_count, 1u);
+        slab_array<A, layout> result = {
+            .capacity = slot_count,
+            .first_free_slot_idx = invalid,
+            .max_used_slot_idx = 0,
+            .count = 0,
+            .data = tracked_calloc(layout == slab_dense ? sizeof(A) : sizeof(slot_t), slot_count, site),
+            .occupancy = (u64*)tracked_calloc(sizeof(u64), occupancy_words(slot_count), site),
+            .summary = (u64*)tracked_calloc(sizeof(u64), summary_words(slot_count), site),
+            .slot_to_dense = nullptr,
+            .dense_to_slot = nullptr,
+            .generations = (u32*)tracked_calloc(sizeof(u32), slot_count, site),
+            .z_bottom = invalid,
+            .z_top = invalid,
+            .z_prev = (u32*)tracked_calloc(sizeof(u32), slot_count, site),
+            .z_next = (u32*)tracked_calloc(sizeof(u32), slot_count, site),
+        };
+        if constexpr (layout == slab_dense) {
+            result.slot_to_dense = (u32*)tracked_calloc(sizeof(u32), slot_count, site);
+            result.dense_to_slot = (u32*)tracked_calloc(sizeof(u32), slot_count, site);
+        }
+        return result;
     }
 
     func dealloc() -> void {
-        free(this->data);
-		free(this->iter_order);
+        tracked_free(this->data);
+        tracked_free(this->occupancy);
+        tracked_free(this->summary);
+        tracked_free(this->slot_to_dense);
+        tracked_free(this->dense_to_slot);
+        tracked_free(this->generations);
+        tracked_free(this->z_prev);
+        tracked_free(this->z_next);
     }
 
-    func resize(u32 new_capacity) -> void {
+    func resize(u32 new_capacity, alloc_site site = alloc_site::current()) -> void {
         let old_capacity = this->capacity;
-        let new_data = realloc(this->data, sizeof(slot_t) * new_capacity);
-		let new_iter_order = realloc(this->iter_order, sizeof(u32) * new_capacity);
-        memset((slot_t*)new_data + old_capacity, 0, new_capacity - old_capacity);
-        this->data = new_data;
-		this->iter_order = (u32*)new_iter_order;
+        let element_size = layout == slab_dense ? sizeof(A) : sizeof(slot_t);
+        this->data = tracked_realloc(this->data, element_size * new_capacity, site);
+        memset((u8*)this->data + element_size * old_capacity, 0, element_size * (new_capacity - old_capacity));
+
+        this->occupancy = grow_zeroed(this->occupancy, occupancy_words(old_capacity), occupancy_words(new_capacity), site);
+        this->summary = grow_zeroed(this->summary, summary_words(old_capacity), summary_words(new_capacity), site);
+        this->generations = (u32*)tracked_realloc(this->generations, sizeof(u32) * new_capacity, site);
+        memset(this->generations + old_capacity, 0, sizeof(u32) * (new_capacity - old_capacity));
+        this->z_prev = (u32*)tracked_realloc(this->z_prev, sizeof(u32) * new_capacity, site);
+        this->z_next = (u32*)tracked_realloc(this->z_next, sizeof(u32) * new_capacity, site);
+        if constexpr (layout == slab_dense) {
+            this->slot_to_dense = (u32*)tracked_realloc(this->slot_to_dense, sizeof(u32) * new_capacity, site);
+            this->dense_to_slot = (u32*)tracked_realloc(this->dense_to_slot, sizeof(u32) * new_capacity, site);
+        }
         this->capacity = new_capacity;
     }
 
-    func push(A val) -> ptr {
-        let data = (slot_t*)this->data;
-        if (this->first_free_slot_idx == this->capacity) {
-            this->resize(this->capacity * 2);
-            this->push(val);
+    func push(A val, alloc_site site = alloc_site::current()) -> ptr {
+        u32 slot_idx;
+        if (this->first_free_slot_idx != invalid) {
+            slot_idx = this->first_free_slot_idx;
+            this->first_free_slot_idx = this->next_free(slot_idx);
         } else {
-            let slot_idx = this->first_free_slot_idx;
-            if (data[this->first_free_slot_idx].data.next_free_slot_idx == 0) {
-                this->first_free_slot_idx += 1;
-            } else {
-                this->first_free_slot_idx = data[this->first_free_slot_idx].data.next_free_slot_idx;
-            }
-            data[slot_idx] = slot_t {.data = {.val = val}, .in_use = true};
-			iter_order[slot_idx] = slot_idx;
-            this->max_used_slot_idx = std::max(this->max_used_slot_idx, slot_idx);
-            return ptr {slot_idx};
+            slot_idx = this->count == 0 && this->max_used_slot_idx == 0 && !this->is_used(0) ? 0 : this->max_used_slot_idx + 1;
+            if (slot_idx == this->capacity) this->resize(this->capacity * 2, site);
+        }
+
+        if constexpr (layout == slab_dense) {
+            ((A*)this->data)[this->count] = val;
+            this->slot_to_dense[slot_idx] = this->count;
+            this->dense_to_slot[this->count] = slot_idx;
+        } else {
+            ((slot_t*)this->data)[slot_idx].val = val;
         }
+
+        this->occupancy[slot_idx / 64] |= 1ull << (slot_idx % 64);
+        this->summary[slot_idx / 4096] |= 1ull << ((slot_idx / 64) % 64);
+        this->count += 1;
+        this->max_used_slot_idx = std::max(this->max_used_slot_idx, slot_idx);
+        if (this->generations[slot_idx] == 0) this->generations[slot_idx] = 1;
+        this->z_link_top(slot_idx);
+        return ptr {slot_idx, this->generations[slot_idx]};
     }
 
     func remove(ptr _idx) {
         let idx = _idx.idx;
-        let data = (slot_t*)this->data;
-        data[idx] = slot_t {.data = {.next_free_slot_idx = this->first_free_slot_idx}, .in_use = false};
-		iter_order[idx] = 0; // TODO(DH): Maybe move bottom elements to top?...
+        if (!this->is_valid(_idx)) return;
+
+        if constexpr (layout == slab_dense) {
+            let values = (A*)this->data;
+            let hole = this->slot_to_dense[idx];
+            let last = this->count - 1;
+            values[hole] = values[last];
+            this->dense_to_slot[hole] = this->dense_to_slot[last];
+            this->slot_to_dense[this->dense_to_slot[hole]] = hole;
+        }
+
+        let word = idx / 64;
+        this->occupancy[word] &= ~(1ull << (idx % 64));
+        if (this->occupancy[word] == 0) this->summary[word / 64] &= ~(1ull << (word % 64));
+        this->count -= 1;
+
+        this->z_unlink(idx);
+        this->generations[idx] += 1;
+        if (this->generations[idx] == 0) this->generations[idx] = 1;
+
+        this->set_next_free(idx, this->first_free_slot_idx);
         this->first_free_slot_idx = idx;
     }
 
-    template <typename B>
-    func map(fn1<A, B> f) -> slab_array<B> {
-        let result = slab_array<B>::create(this->capacity);
-        for (var i = 0; i <= this->max_used_slot_idx; i++) {
-            let el = ((slot_t*)this->data)[i];
-            if (el.in_use) {
-                result.push(f(el.data.val));
+    func is_used(u32 idx) -> bool {
+        return idx < this->capacity && (this->occupancy[idx / 64] >> (idx % 64)) & 1;
+    }
+
+    func is_valid(ptr i) -> bool {
+        return this->is_used(i.idx) && this->generations[i.idx] == i.gen;
+    }
+
+    // NOTE(DH): Handle of a live slot, e.g. one handed out by iter_slots
+    func handle_of(u32 idx) -> ptr {
+        return ptr {idx, this->generations[idx]};
+    }
+
+    // NOTE(DH): Live values by slot, for whatever needs them in slot order (dense layout too)
+    template <typename F>
+    func iter_slots(F f) -> void {
+        let summary_count = summary_words(this->max_used_slot_idx + 1);
+        for (u32 s = 0; s < summary_count; ++s) {
+            for (u64 words = this->summary[s]; words != 0; words &= words - 1) {
+                let word = s * 64 + std::countr_zero(words);
+                for (u64 bits = this->occupancy[word]; bits != 0; bits &= bits - 1) {
+                    f(word * 64 + std::countr_zero(bits));
+                }
             }
         }
+    }
+
+    // NOTE(DH): Number of live slots below idx, i.e. the position of idx among the live ones in slot order
+    func rank(u32 idx) -> u32 {
+        u32 result = 0;
+        for (u32 w = 0; w < idx / 64; ++w) result += std::popcount(this->occupancy[w]);
+        if (idx % 64) result += std::popcount(this->occupancy[idx / 64] & ((1ull << (idx % 64)) - 1));
+        return result;
+    }
+
+    // NOTE(DH): Dense layout: the packed values, count of them
+    func values() -> A* {
+        static_assert(layout == slab_dense, "values() is only packed for slab_dense");
+        return (A*)this->data;
+    }
+
+    template <typename B>
+    func map(fn1<A, B> f, alloc_site site = alloc_site::current()) -> slab_array<B> {
+        var result = slab_array<B>::create(this->capacity, site);
+        this->iter([&](A* el) { result.push(f(*el), site); });
         return result;
     }
 
     template <typename F>
     func iter(F f) -> void {
-        for (var i = 0; i <= this->max_used_slot_idx; i++) {
-            let el = ((slot_t*)this->data + i);
-            if (el->in_use) {
-                f(&el->data.val);
-            }
+        if constexpr (layout == slab_dense) {
+            let values = (A*)this->data;
+            for (u32 i = 0; i < this->count; ++i) f(&values[i]);
+        } else {
+            let slots = (slot_t*)this->data;
+            this->iter_slots([&](u32 idx) { f(&slots[idx].val); });
         }
         return;
     }
 
+    // NOTE(DH): f(value, position from the bottom, handle), bottom to top
 	template <typename F>
     func iter_in_order(F f) -> void {
-        for (var i = 0; i <= this->max_used_slot_idx; i++) {
-            let el = ((slot_t*)this->data + this->iter_order[i]);
-            if (el->in_use) {
-                f(&el->data.val, i, this->iter_order[i]);
-            }
+        u32 i = 0;
+        for (u32 idx = this->z_bottom; idx != invalid; idx = this->z_next[idx], ++i) {
+            f(this->get_ptr_unchecked(idx), i, this->handle_of(idx));
         }
         return;
     }
 
-	func swap_to_last(u32 new_idx) -> void {
-		if(new_idx == 0xFFFF) return;
-		u32 tmp = this->iter_order[new_idx];
-		for(u32 i = new_idx; i < this->max_used_slot_idx; ++i) {
-			this->iter_order[i] = this->iter_order[i+1];
-		}
-		this->iter_order[this->max_used_slot_idx] = tmp;
-	}
-
-	// NOTE(DH): This is n = 1 operation!
-	// TODO(DH): Leave this version if we do not care about order
-	// func swap_to_last(u32 new_idx) -> void {
-	// 	if(new_idx == 0xFFFF) return;
-	// 	u32 tmp = this->iter_order[this->max_used_slot_idx];
-	// 	this->iter_order[this->max_used_slot_idx] = this->iter_order[new_idx];
-	// 	this->iter_order[new_idx] = tmp;
-	// }
-
-    template <typename ACC>
-    func fold(ACC acc, fn2<A, ACC, ACC> f) -> ACC {
-        for (var i = 0; i <= this->max_used_slot_idx; i++) {
-            let el = ((slot_t*)this->data)[i];
-            if (el.in_use) {
-                acc = f(el.data.val, acc);
-            }
-        }
+    // NOTE(DH): Moves the value on top of the draw order, O(1). Stale handles are ignored
+    func raise(ptr i) -> void {
+        if (!this->is_valid(i) || this->z_top == i.idx) return;
+        this->z_unlink(i.idx);
+        this->z_link_top(i.idx);
+    }
+
+    func lower(ptr i) -> void {
+        if (!this->is_valid(i) || this->z_bottom == i.idx) return;
+        this->z_unlink(i.idx);
+        this->z_prev[i.idx] = invalid;
+        this->z_next[i.idx] = this->z_bottom;
+        this->z_prev[this->z_bottom] = i.idx;
+        this->z_bottom = i.idx;
+    }
+
+    // NOTE(DH): acc = f(value, acc) over the live values, nothing but the value gets copied
+    template <typename ACC, typename F>
+    func fold(ACC acc, F f) -> ACC {
+        this->iter([&](A* el) { acc = f(*el, acc); });
         return acc;
     }
 
-    template <typename ACC>
-    func fold_ptr(ACC acc, fn2<A*, ACC, ACC> f) -> ACC {
-        for (var i = 0; i <= this->max_used_slot_idx; i++) {
-            let el = ((slot_t*)this->data)[i];
-            if (el.in_use) {
-                acc = f(&el.data.val, acc);
-            }
-        }
+    template <typename ACC, typename F>
+    func fold_ptr(ACC acc, F f) -> ACC {
+        this->iter([&](A* el) { acc = f(el, acc); });
         return acc;
     }
 
-    template <typename ACC>
-    func iter_with_acc(ACC acc, fn2<A*, ACC, void> f) -> void {
-        for (var i = 0; i <= this->max_used_slot_idx; i++) {
-            let el = ((slot_t*)this->data)[i];
-            if (el.in_use) {
-                f(&el.data.val, acc);
-            }
-        }
+    // NOTE(DH): f(value, acc) with the accumulator by pointer, so it is updated in place
+    template <typename ACC, typename F>
+    func iter_with_acc(ACC* acc, F f) -> void {
+        this->iter([&](A* el) { f(el, acc); });
     }
 
     func get(ptr i) -> A {
-        let data = (slot_t*)this->data;
-        return data[i.idx].data.val;
+        return *this->get_ptr(i);
     }
 
     func get_ptr(ptr i) -> A* {
-        let data = (slot_t*)this->data;
-        return data[i.idx].data.val;
+        assert(this->is_valid(i) && "stale or null slab_array handle");
+        return this->get_ptr_unchecked(i.idx);
+    }
+
+    func try_get_ptr(ptr i) -> A* {
+        return this->is_valid(i) ? this->get_ptr_unchecked(i.idx) : nullptr;
+    }
+
+private:
+    func get_ptr_unchecked(u32 idx) -> A* {
+        if constexpr (layout == slab_dense) {
+            return &((A*)this->data)[this->slot_to_dense[idx]];
+        } else {
+            return &((slot_t*)this->data)[idx].val;
+        }
+    }
+
+    func z_link_top(u32 idx) -> void {
+        this->z_prev[idx] = this->z_top;
+        this->z_next[idx] = invalid;
+        if (this->z_top != invalid) this->z_next[this->z_top] = idx;
+        else this->z_bottom = idx;
+        this->z_top = idx;
+    }
+
+    func z_unlink(u32 idx) -> void {
+        let prev = this->z_prev[idx];
+        let next = this->z_next[idx];
+        if (prev != invalid) this->z_next[prev] = next; else this->z_bottom = next;
+        if (next != invalid) this->z_prev[next] = prev; else this->z_top = prev;
+    }
+
+    static func occupancy_words(u32 slots) -> u32 { return (slots + 63) / 64; }
+    static func summary_words(u32 slots) -> u32 { return (occupancy_words(slots) + 63) / 64; }
+
+    static func grow_zeroed(u64* words, u32 old_count, u32 new_count, alloc_site site) -> u64* {
+        words = (u64*)tracked_realloc(words, sizeof(u64) * new_count, site);
+        memset(words + old_count, 0, sizeof(u64) * (new_count - old_count));
+        return words;
+    }
+
+    func next_free(u32 idx) -> u32 {
+        if constexpr (layout == slab_dense) return this->slot_to_dense[idx];
+        else return ((slot_t*)this->data)[idx].next_free_slot_idx;
+    }
+
+    func set_next_free(u32 idx, u32 next) -> void {
+        if constexpr (layout == slab_dense) this->slot_to_dense[idx] = next;
+        else ((slot_t*)this->data)[idx].next_free_slot_idx = next;
     }
-};
\ No newline at end of file
+};
@@ -0,0 +1,267 @@
+#pragma once
+
+#include "types.h"
+#include "alloc.h"
+#include <atomic>
+#include <mutex>
+#include <new>
+
+// NOTE(DH): Per thread memory, so worker code doesn't meet on malloc's locks or on a memory_arena (which has no
+// synchronization at all).
+//
+// thread_scratch() is a memory_arena owned by the calling thread, for temporaries under a
+// temporary_memory_scope, same as dx_context::scratch but one per thread.
+//
+// thread_allocator() is an allocator over a heap owned by the calling thread: blocks up to thread_heap_max_small
+// come from per size class free lists, carved out of 64 KB chunks, with no atomics and no locks on the owning
+// thread. Bigger blocks go to tracked_malloc. Every block remembers its heap, so it can be freed from any thread:
+// a free from another thread is pushed onto the owner's deferred list (one CAS) and the owner takes the whole
+// list back the next time its free lists run dry (or in thread_heap_collect).
+//
+// When a thread exits its heap and scratch arena go away with it. A heap that still has blocks out (freed later
+// by other threads) is parked on an orphan list instead, and whichever thread next creates a heap or calls
+// thread_heap_collect frees it once the last of its blocks came back.
+
+static constexpr u32 thread_heap_class_count = 9;       // NOTE(DH): 16, 32, ... 4096 bytes
+static constexpr u32 thread_heap_max_small   = 16u << (thread_heap_class_count - 1);
+static constexpr u32 thread_heap_chunk_size  = 64 * 1024;
+static constexpr usize thread_scratch_size   = Megabytes(4);
+
+struct thread_heap;
+
+struct thread_block_header {
+    thread_heap* owner;     // NOTE(DH): nullptr for big blocks, they are plain tracked_malloc ones
+    u32 size_class;
+    u32 size;               // NOTE(DH): Requested size (big blocks), or the class size
+};
+
+struct thread_free_block {
+    thread_free_block* next;
+};
+
+struct thread_heap_chunk {
+    thread_heap_chunk* next;
+    u32 used;
+    u32 pad;
+};
+
+struct thread_heap {
+    thread_free_block* free_lists[thread_heap_class_count];
+    thread_heap_chunk* chunks;
+    std::atomic<thread_block_header*> deferred;     // NOTE(DH): Freed by other threads, chained through the data
+    i64 live_blocks;        // NOTE(DH): Only the owner touches it (the collector, once orphaned)
+
+    u64 allocs;
+    u64 local_frees;
+    u64 remote_frees;
+    thread_heap* next_orphan;
+};
+
+struct thread_heap_stats {
+    u64 allocs;
+    u64 local_frees;
+    u64 remote_frees;
+    i64 live_blocks;
+    u32 chunks;
+};
+
+inline std::mutex thread_heap_orphans_lock;
+inline thread_heap* thread_heap_orphans = nullptr;
+
+inline func thread_heap_class_of(usize size) -> u32 {
+    u32 size_class = 0;
+    while ((16u << size_class) < size) ++size_class;
+    return size_class;
+}
+
+inline func thread_heap_block_data(thread_block_header* header) -> void* { return header + 1; }
+inline func thread_heap_block_of(void* ptr) -> thread_block_header* { return (thread_block_header*)ptr - 1; }
+
+// NOTE(DH): Takes back everything other threads freed, returns how many blocks
+inline func thread_heap_drain(thread_heap* heap) -> u32 {
+    thread_block_header* block = heap->deferred.exchange(nullptr, std::memory_order_acquire);
+    u32 count = 0;
+    while (block != nullptr) {
+        thread_block_header* next = *(thread_block_header**)thread_heap_block_data(block);
+        thread_free_block* free_block = (thread_free_block*)thread_heap_block_data(block);
+        free_block->next = heap->free_lists[block->size_class];
+        heap->free_lists[block->size_class] = free_block;
+        heap->live_blocks -= 1;
+        count += 1;
+        block = next;
+    }
+    heap->remote_frees += count;
+    return count;
+}
+
+inline func thread_heap_destroy(thread_heap* heap) -> void {
+    for (thread_heap_chunk* c = heap->chunks; c != nullptr;) { thread_heap_chunk* next = c->next; tracked_free(c); c = next; }
+    heap->~thread_heap();
+    tracked_free(heap);
+}
+
+// NOTE(DH): Frees the orphaned heaps that got all their blocks back
+inline func thread_heap_collect_orphans() -> void {
+    std::lock_guard<std::mutex> guard(thread_heap_orphans_lock);
+    for (thread_heap** o = &thread_heap_orphans; *o != nullptr;) {
+        thread_heap* heap = *o;
+        thread_heap_drain(heap);
+        if (heap->live_blocks == 0) { *o = heap->next_orphan; thread_heap_destroy(heap); }
+        else o = &heap->next_orphan;
+    }
+}
+
+// NOTE(DH): Owns the thread's heap and scratch arena, its destructor is the thread exit cleanup
+struct thread_memory {
+    thread_heap* heap;
+    memory_arena scratch;
+
+    ~thread_memory() {
+        if (this->scratch.base != nullptr) {
+            assert(this->scratch.temp_count == 0); // NOTE(DH): A temporary scope outlived the thread
+            tracked_free(this->scratch.base);
+        }
+        if (this->heap == nullptr) return;
+
+        thread_heap_drain(this->heap);
+        if (this->heap->live_blocks == 0) {
+            thread_heap_destroy(this->heap);
+        } else {
+            std::lock_guard<std::mutex> guard(thread_heap_orphans_lock);
+            this->heap->next_orphan = thread_heap_orphans;
+            thread_heap_orphans = this->heap;
+        }
+        this->heap = nullptr;
+    }
+};
+
+inline thread_local thread_memory thread_memory_instance;
+
+inline func thread_heap_get() -> thread_heap* {
+    thread_heap* heap = thread_memory_instance.heap;
+    if (heap != nullptr) return heap;
+
+    thread_heap_collect_orphans();
+    heap = new (tracked_malloc(sizeof(thread_heap))) thread_heap {};
+    thread_memory_instance.heap = heap;
+    return heap;
+}
+
+inline func thread_scratch(alloc_site site = alloc_site::current()) -> memory_arena* {
+    memory_arena* arena = &thread_memory_instance.scratch;
+    if (arena->base == nullptr) {
+        arena->size = thread_scratch_size;
+        arena->base = (u8*)tracked_malloc(thread_scratch_size, site);
+        arena->used = 0;
+        arena->temp_count = 0;
+        arena->high_water = 0;
+    }
+    return arena;
+}
+
+inline func thread_heap_alloc(usize size, alloc_site site) -> void* {
+    if (size > thread_heap_max_small) {
+        thread_block_header* header = (thread_block_header*)tracked_malloc(sizeof(thread_block_header) + size, site);
+        header->owner = nullptr;
+        header->size_class = thread_heap_class_count;
+        header->size = (u32)size;
+        return thread_heap_block_data(header);
+    }
+
+    thread_heap* heap = thread_heap_get();
+    u32 size_class = thread_heap_class_of(size);
+    heap->allocs += 1;
+    heap->live_blocks += 1;
+
+    if (heap->free_lists[size_class] == nullptr) thread_heap_drain(heap);
+    if (heap->free_lists[size_class] != nullptr) {
+        thread_free_block* block = heap->free_lists[size_class];
+        heap->free_lists[size_class] = block->next;
+        return block;
+    }
+
+    u32 block_size = sizeof(thread_block_header) + (16u << size_class);
+    thread_heap_chunk* chunk = heap->chunks;
+    if (chunk == nullptr || chunk->used + block_size > thread_heap_chunk_size) {
+        chunk = (thread_heap_chunk*)tracked_malloc(thread_heap_chunk_size, site);
+        chunk->next = heap->chunks;
+        chunk->used = sizeof(thread_heap_chunk);
+        heap->chunks = chunk;
+    }
+    thread_block_header* header = (thread_block_header*)((u8*)chunk + chunk->used);
+    chunk->used += block_size;
+    header->owner = heap;
+    header->size_class = size_class;
+    header->size = 16u << size_class;
+    return thread_heap_block_data(header);
+}
+
+inline func thread_heap_free(void* ptr) -> void {
+    if (ptr == nullptr) return;
+    thread_block_header* header = thread_heap_block_of(ptr);
+    thread_heap* owner = header->owner;
+    if (owner == nullptr) { tracked_free(header); return; }
+
+    if (owner == thread_memory_instance.heap) {
+        thread_free_block* block = (thread_free_block*)ptr;
+        block->next = owner->free_lists[header->size_class];
+        owner->free_lists[header->size_class] = block;
+        owner->live_blocks -= 1;
+        owner->local_frees += 1;
+        return;
+    }
+
+    // NOTE(DH): Someone else's block, hand it back through the owner's deferred list
+    thread_block_header* head = owner->deferred.load(std::memory_order_relaxed);
+    do {
+        *(thread_block_header**)ptr = head;
+    } while (!owner->deferred.compare_exchange_weak(head, header, std::memory_order_release, std::memory_order_relaxed));
+}
+
+inline func thread_heap_realloc(void* ptr, usize size, alloc_site site) -> void* {
+    if (ptr == nullptr) return thread_heap_alloc(size, site);
+    thread_block_header* header = thread_heap_block_of(ptr);
+    if (header->owner != nullptr && size <= header->size) return ptr;
+    if (header->owner == nullptr && size > thread_heap_max_small) {
+        header = (thread_block_header*)tracked_realloc(header, sizeof(thread_block_header) + size, site);
+        header->size = (u32)size;
+        return thread_heap_block_data(header);
+    }
+
+    void* result = thread_heap_alloc(size, site);
+    memcpy(result, ptr, std::min<usize>(size, header->size));
+    thread_heap_free(ptr);
+    return result;
+}
+
+// NOTE(DH): Works from any thread, each allocation goes to the heap of the thread that makes it
+static constexpr allocator thread_allocator_instance = {
+    .ctx        = nullptr,
+    .alloc_fn   = [](void*, usize size) -> void* { return thread_heap_alloc(size, alloc_current_site); },
+    .realloc_fn = [](void*, void* ptr, usize size) -> void* { return thread_heap_realloc(ptr, size, alloc_current_site); },
+    .free_fn    = [](void*, void* ptr) -> void { thread_heap_free(ptr); },
+};
+
+inline func thread_allocator() -> allocator {
+    return thread_allocator_instance;
+}
+
+// NOTE(DH): For a long running thread that gets a lot of blocks back from others and wants them before it runs dry
+inline func thread_heap_collect() -> void {
+    if (thread_memory_instance.heap != nullptr) thread_heap_drain(thread_memory_instance.heap);
+    thread_heap_collect_orphans();
+}
+
+inline func thread_heap_get_stats() -> thread_heap_stats {
+    thread_heap* heap = thread_memory_instance.heap;
+    if (heap == nullptr) return {};
+    thread_heap_stats result = {
+        .allocs = heap->allocs,
+        .local_frees = heap->local_frees,
+        .remote_frees = heap->remote_frees,
+        .live_blocks = heap->live_blocks,
+        .chunks = 0,
+    };
+    for (thread_heap_chunk* c = heap->chunks; c != nullptr; c = c->next) result.chunks += 1;
+    return result;
+}
@@ -58,6 +58,13 @@ union rgba {
     u8                               arr[4];
 };
 
+struct image_buffer {
+    rgba* render_img;
+    u32* component_id_img;
+    u32 width;
+    u32 height;
+};
+
 #define inline_code(expr) ([=]() {expr})()
 #define inline_codex(ty, expr) ([=]() -> ty {expr})()
 